@@ -0,0 +1,621 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, mkdtemp
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internal/cgbe.h"
+#include "internal/movie.h"
+#include "internal/rewind.h"
+#include "internal/sm83/sm83_block.h"
+#include "internal/sm83/sm83_jit.h"
+#include "internal/sm83/sm83_lanes.h"
+
+// Micro-benchmarks of the cpu engines, the bus, dma, cartridge loading, the ppu, the apu, movie
+// replay and rewind, plus whole rom runs of any roms given on the command line. Every result is
+// one tab separated line on stdout:
+//
+//     name  metric  mean  stddev  min
+//
+// over REPS timed repetitions, so runs from two commits can be diffed directly.
+
+#define REPS 7
+#define CPU_CYCLES (1 << 22)
+#define LOCKSTEP_CYCLES (1 << 18)
+#define BUS_ACCESSES (1 << 22)
+#define DMA_TRANSFERS (1 << 16)
+#define LOADS 2000
+#define FRAMES 60
+
+static char tmp_dir[] = "/tmp/cgbe-bench-XXXXXX";
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, const char *metric, const double *samples) {
+    double sum = 0, min = samples[0];
+    for (size_t i = 0; i < REPS; i++) {
+        sum += samples[i];
+        min = samples[i] < min ? samples[i] : min;
+    }
+    double mean = sum / REPS, var = 0;
+    for (size_t i = 0; i < REPS; i++) {
+        var += (samples[i] - mean) * (samples[i] - mean);
+    }
+
+    printf("%s\t%s\t%.3f\t%.3f\t%.3f\n", name, metric, mean, sqrt(var / (REPS - 1)), min);
+    fflush(stdout);
+}
+
+// Synthetic roms, each jumps from the entry point into a loop at 0x0150.
+
+struct program {
+    const char *name;
+    uint8_t type; // cartridge type
+    size_t banks;
+    const uint8_t *code;
+    size_t size;
+    const uint8_t *banked; // copied to 0x4000 of every switchable bank, if set
+    size_t banked_size;
+};
+
+static const uint8_t alu_code[] = {
+    0x3C,       // loop: inc a
+    0x80,       // add a, b
+    0x91,       // sub c
+    0xA2,       // and d
+    0xAB,       // xor e
+    0xB4,       // or h
+    0xBD,       // cp l
+    0x88,       // adc a, b
+    0x99,       // sbc a, c
+    0xC6, 0x05, // add a, 5
+    0x05,       // dec b
+    0x4F,       // ld c, a
+    0x18, 0xF0, // jr loop
+};
+
+static const uint8_t load_code[] = {
+    0x21, 0x00, 0xC0, // ld hl, 0xC000
+    0x77,             // loop: ld (hl), a
+    0x7E,             // ld a, (hl)
+    0x46,             // ld b, (hl)
+    0x22,             // ld (hl+), a
+    0x3A,             // ld a, (hl-)
+    0xEA, 0x00, 0xC1, // ld (0xC100), a
+    0xFA, 0x00, 0xC1, // ld a, (0xC100)
+    0xE0, 0x80,       // ldh (0x80), a
+    0xF0, 0x80,       // ldh a, (0x80)
+    0x3C,             // inc a
+    0x18, 0xEE,       // jr loop
+};
+
+static const uint8_t cb_code[] = {
+    0x21, 0x00, 0xC0, // ld hl, 0xC000
+    0xCB, 0x00,       // loop: rlc b
+    0xCB, 0x19,       // rr c
+    0xCB, 0x22,       // sla d
+    0xCB, 0x33,       // swap e
+    0xCB, 0x5F,       // bit 3, a
+    0xCB, 0xC7,       // set 0, a
+    0xCB, 0x87,       // res 0, a
+    0xCB, 0x3D,       // srl l
+    0xCB, 0x16,       // rl (hl)
+    0x2E, 0x00,       // ld l, 0
+    0x18, 0xEA,       // jr loop
+};
+
+static const uint8_t branch_code[] = {
+    0x05,             // loop: dec b
+    0x20, 0x01,       // jr nz, skip
+    0x0C,             // inc c
+    0xCD, 0x5D, 0x01, // skip: call sub
+    0xCA, 0x50, 0x01, // jp z, loop
+    0xC3, 0x50, 0x01, // jp loop
+    0xC9,             // sub: ret
+};
+
+static const uint8_t bank_code[] = {
+    0x3E, 0x01,       // loop: ld a, 1
+    0xEA, 0x00, 0x20, // ld (0x2000), a
+    0xCD, 0x00, 0x40, // call 0x4000
+    0x3E, 0x02,       // ld a, 2
+    0xEA, 0x00, 0x20, // ld (0x2000), a
+    0xCD, 0x00, 0x40, // call 0x4000
+    0x18, 0xEE,       // jr loop
+};
+
+static const uint8_t bank_sub[] = {
+    0x3C, 0x80, 0x91, 0xA2, 0xAB, 0xB4, 0x05, 0x4F, // alu ops, as in alu_code
+    0xC9,                                           // ret
+};
+
+// Plays a square wave and noise while looping over alu ops.
+static const uint8_t sound_code[] = {
+    0x3E, 0x80, 0xE0, 0x11, // ld a, 0x80; ldh (NR11), a: 50% duty
+    0x3E, 0xF0, 0xE0, 0x12, // ld a, 0xF0; ldh (NR12), a: full volume
+    0x3E, 0xD6, 0xE0, 0x13, // ld a, 0xD6; ldh (NR13), a
+    0x3E, 0x86, 0xE0, 0x14, // ld a, 0x86; ldh (NR14), a: trigger at 440Hz
+    0x3E, 0xF0, 0xE0, 0x21, // ld a, 0xF0; ldh (NR42), a
+    0x3E, 0x55, 0xE0, 0x22, // ld a, 0x55; ldh (NR43), a
+    0x3E, 0x80, 0xE0, 0x23, // ld a, 0x80; ldh (NR44), a: trigger noise
+    0x3C,                   // loop: inc a
+    0x80,                   // add a, b
+    0x91,                   // sub c
+    0x18, 0xFB,             // jr loop
+};
+
+static const struct program sound_program = {
+    "sound", 0x00, 2, sound_code, sizeof(sound_code), NULL, 0,
+};
+
+static const struct program programs[] = {
+    {"alu", 0x00, 2, alu_code, sizeof(alu_code), NULL, 0},
+    {"load", 0x00, 2, load_code, sizeof(load_code), NULL, 0},
+    {"cb", 0x00, 2, cb_code, sizeof(cb_code), NULL, 0},
+    {"branch", 0x00, 2, branch_code, sizeof(branch_code), NULL, 0},
+    {"bank", 0x01, 4, bank_code, sizeof(bank_code), bank_sub, sizeof(bank_sub)},
+};
+
+// Writes the program to a rom file in tmp_dir and returns its path.
+static const char *write_rom(const struct program *prog, uint8_t ram_size, char *path, size_t n) {
+    size_t size = prog->banks * CARTRIDGE_ROM_BANK_SIZE;
+    uint8_t *rom = calloc(size, 1);
+    assert(rom != NULL);
+
+    rom[0x0100] = 0xC3; // jp 0x0150
+    rom[0x0101] = 0x50;
+    rom[0x0102] = 0x01;
+    rom[0x0147] = prog->type;
+    rom[0x0149] = ram_size;
+    memcpy(&rom[0x0150], prog->code, prog->size);
+    for (size_t bank = 1; prog->banked != NULL && bank < prog->banks; bank++) {
+        memcpy(&rom[bank * CARTRIDGE_ROM_BANK_SIZE], prog->banked, prog->banked_size);
+    }
+
+    snprintf(path, n, "%s/%s.gb", tmp_dir, prog->name);
+    FILE *f = fopen(path, "wb");
+    assert(f != NULL);
+    size_t written = fwrite(rom, 1, size, f);
+    assert(written == size);
+    fclose(f);
+    free(rom);
+
+    return path;
+}
+
+// Instructions the machine runs in its next cycles m-cycles, which have to end between two
+// instructions. Engines overshoot cgbe_run's target by different amounts (blocks and the jit run to
+// the end of a block), so each one's count comes from the cycles it actually ran.
+static size_t count_insns(struct cgbe *gb, size_t cycles) {
+    struct cgbe *fork = cgbe_fork(gb);
+    size_t insns = 0, done = 0;
+
+    for (; done < cycles; insns++) {
+        done += sm83_step(fork->cpu);
+    }
+    assert(done == cycles);
+    cgbe_delete(fork);
+
+    return insns;
+}
+
+enum engine { ENGINE_INTERP, ENGINE_BLOCKS, ENGINE_JIT, ENGINE_LOCKSTEP, ENGINE_COUNT };
+
+static const char *const engine_names[ENGINE_COUNT] = {"interp", "blocks", "jit", "lockstep"};
+
+// Times the machine running from its current state on every engine.
+static void bench_cpu(const char *name, struct cgbe *gb, size_t cycles) {
+    for (enum engine e = 0; e < ENGINE_COUNT; e++) {
+        struct sm83_block_cache *blocks = e == ENGINE_BLOCKS ? sm83_block_cache_new() : NULL;
+        struct sm83_jit *jit = e == ENGINE_JIT ? sm83_jit_new() : NULL;
+        double ns[REPS], mhz[REPS];
+        size_t insns = 0; // over all forks, every rep runs the same ones
+
+        if (e == ENGINE_JIT && jit == NULL) {
+            continue; // host not supported
+        }
+
+        // The first round only warms the caches up.
+        for (int rep = -1; rep < REPS; rep++) {
+            struct cgbe *forks[SM83_LANES];
+            size_t count = e == ENGINE_LOCKSTEP ? SM83_LANES : 1;
+            size_t done;
+
+            for (size_t i = 0; i < count; i++) {
+                forks[i] = cgbe_fork(gb);
+                forks[i]->cpu->blocks = blocks;
+                forks[i]->cpu->jit = jit;
+            }
+
+            double start = now();
+            if (e == ENGINE_LOCKSTEP) {
+                done = cgbe_run_lockstep(forks, count, LOCKSTEP_CYCLES);
+            } else {
+                done = cgbe_run(forks[0], cycles);
+            }
+            double elapsed = now() - start;
+
+            if (rep < 0) {
+                for (size_t i = 0; i < count; i++) {
+                    insns += count_insns(gb, forks[i]->bus->clock - gb->bus->clock);
+                }
+            } else {
+                ns[rep] = elapsed * 1e9 / insns;
+                mhz[rep] = done * 4 / elapsed / 1e6; // 4 clocks per m-cycle
+            }
+            for (size_t i = 0; i < count; i++) {
+                cgbe_delete(forks[i]);
+            }
+        }
+
+        char full[256];
+        snprintf(full, sizeof(full), "cpu/%s/%s", name, engine_names[e]);
+        report(full, "ns_per_insn", ns);
+        report(full, "emulated_mhz", mhz);
+
+        if (jit != NULL) {
+            sm83_jit_delete(jit);
+        }
+        if (blocks != NULL) {
+            sm83_block_cache_delete(blocks);
+        }
+    }
+}
+
+static void bench_programs(void) {
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        char path[256];
+        struct cgbe *gb = cgbe_new(write_rom(&programs[i], 0x00, path, sizeof(path)));
+
+        bench_cpu(programs[i].name, gb, CPU_CYCLES);
+        cgbe_delete(gb);
+        unlink(path);
+    }
+}
+
+struct region {
+    const char *name;
+    uint16_t base;
+    uint16_t mask; // addresses used are base + (i & mask)
+    bool writable;
+};
+
+static const struct region regions[] = {
+    {"rom0", 0x0000, 0x3FFF, false}, {"romx", 0x4000, 0x3FFF, false},
+    {"cart_ram", 0xA000, 0x1FFF, true}, {"wram", 0xC000, 0x1FFF, true},
+    {"echo", 0xE000, 0x0FFF, true},     {"io", 0xFF00, 0x003F, true},
+    {"hram", 0xFF80, 0x003F, true},
+};
+
+static void bench_bus(void) {
+    static const struct program ram_cart = {"bus", 0x03, 4, alu_code, sizeof(alu_code), NULL, 0};
+    char path[256];
+    struct cgbe *gb = cgbe_new(write_rom(&ram_cart, 0x03, path, sizeof(path)));
+    struct bus *bus = gb->bus;
+
+    bus_write(bus, 0x0000, 0x0A); // enable cart ram
+
+    for (size_t r = 0; r < sizeof(regions) / sizeof(regions[0]); r++) {
+        const struct region *reg = &regions[r];
+        double reads[REPS], writes[REPS];
+        volatile uint8_t sink = 0;
+
+        for (size_t rep = 0; rep < REPS; rep++) {
+            uint8_t sum = 0;
+            double start = now();
+            for (size_t i = 0; i < BUS_ACCESSES; i++) {
+                sum += bus_read(bus, reg->base + (i & reg->mask));
+            }
+            reads[rep] = (now() - start) * 1e9 / BUS_ACCESSES;
+            sink += sum;
+
+            if (reg->writable) {
+                start = now();
+                for (size_t i = 0; i < BUS_ACCESSES; i++) {
+                    bus_write(bus, reg->base + (i & reg->mask), i);
+                }
+                writes[rep] = (now() - start) * 1e9 / BUS_ACCESSES;
+            }
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "bus/%s", reg->name);
+        report(name, "ns_per_read", reads);
+        if (reg->writable) {
+            report(name, "ns_per_write", writes);
+        }
+    }
+
+    cgbe_delete(gb);
+    unlink(path);
+}
+
+struct dma {
+    const char *name;
+    uint16_t source;
+    uint16_t reg; // written to start a transfer
+    uint8_t val;
+};
+
+static const struct dma dmas[] = {
+    {"oam", 0xC000, 0xFF46, 0xC0},     // 160 bytes from wram
+    {"gdma", 0x4000, 0xFF55, 0x7F},    // 2048 bytes from the rom
+    {"gdma_io", 0xFF00, 0xFF55, 0x0F}, // 256 bytes through the io handlers
+};
+
+// Transfers started by register writes, as the cpu would, one after the other.
+static void bench_dma(void) {
+    char path[256];
+    struct cgbe *gb = cgbe_new(write_rom(&programs[0], 0x00, path, sizeof(path)));
+
+    for (size_t d = 0; d < sizeof(dmas) / sizeof(dmas[0]); d++) {
+        const struct dma *dma = &dmas[d];
+        double transfers[REPS];
+
+        for (size_t rep = 0; rep < REPS; rep++) {
+            struct cgbe *fork = cgbe_fork(gb);
+            struct bus *bus = fork->bus;
+
+            double start = now();
+            for (size_t i = 0; i < DMA_TRANSFERS; i++) {
+                bus_write(bus, 0xFF51, dma->source >> 8);
+                bus_write(bus, 0xFF52, dma->source);
+                bus_write(bus, 0xFF53, 0x00);
+                bus_write(bus, 0xFF54, 0x00);
+                bus_write(bus, dma->reg, dma->val);
+            }
+            transfers[rep] = (now() - start) * 1e9 / DMA_TRANSFERS;
+
+            cgbe_delete(fork);
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "dma/%s", dma->name);
+        report(name, "ns_per_transfer", transfers);
+    }
+
+    cgbe_delete(gb);
+    unlink(path);
+}
+
+static void bench_cartridge(void) {
+    char path[256];
+    write_rom(&programs[0], 0x03, path, sizeof(path));
+    double cold[REPS], shared[REPS];
+
+    // Cold maps the file every time, shared finds it already mapped by another cartridge.
+    for (size_t rep = 0; rep < REPS; rep++) {
+        double start = now();
+        for (size_t i = 0; i < LOADS; i++) {
+            cartridge_delete(cartridge_new(path));
+        }
+        cold[rep] = (now() - start) * 1e6 / LOADS;
+
+        struct cartridge *keep = cartridge_new(path);
+        start = now();
+        for (size_t i = 0; i < LOADS; i++) {
+            cartridge_delete(cartridge_new(path));
+        }
+        shared[rep] = (now() - start) * 1e6 / LOADS;
+        cartridge_delete(keep);
+    }
+
+    report("cartridge/new/cold", "us_per_load", cold);
+    report("cartridge/new/shared", "us_per_load", shared);
+    unlink(path);
+}
+
+struct video {
+    const char *name;
+    bool framebuffer;
+    size_t draw_every;
+};
+
+static const struct video videos[] = {
+    {"headless", false, 1},
+    {"every_4th", true, 4},
+    {"every_frame", true, 1},
+};
+
+// Frames per second emulated with the lcd on, headless and drawing some or all of them.
+static void bench_ppu(void) {
+    char path[256];
+    struct cgbe *gb = cgbe_new(write_rom(&programs[0], 0x00, path, sizeof(path)));
+    uint32_t *framebuffer = calloc(PPU_WIDTH * PPU_HEIGHT, sizeof(uint32_t));
+    assert(framebuffer != NULL);
+
+    for (size_t v = 0; v < sizeof(videos) / sizeof(videos[0]); v++) {
+        double fps[REPS];
+
+        for (size_t rep = 0; rep < REPS; rep++) {
+            struct cgbe *fork = cgbe_fork(gb);
+            fork->ppu->framebuffer = videos[v].framebuffer ? framebuffer : NULL;
+            fork->ppu->draw_every = videos[v].draw_every;
+
+            double start = now();
+            cgbe_run(fork, FRAMES * PPU_FRAME_CYCLES);
+            fps[rep] = FRAMES / (now() - start);
+
+            cgbe_delete(fork);
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "ppu/%s", videos[v].name);
+        report(name, "frames_per_sec", fps);
+    }
+
+    free(framebuffer);
+    cgbe_delete(gb);
+    unlink(path);
+}
+
+struct audio {
+    const char *name;
+    size_t rate; // 0 for headless
+};
+
+static const struct audio audios[] = {
+    {"headless", 0},
+    {"48khz", 48000},
+};
+
+// Frames per second emulated while the apu plays, headless and producing samples, which are read
+// out after every frame.
+static void bench_apu(void) {
+    char path[256];
+    struct cgbe *gb = cgbe_new(write_rom(&sound_program, 0x00, path, sizeof(path)));
+    int16_t samples[2 * 1024];
+
+    for (size_t a = 0; a < sizeof(audios) / sizeof(audios[0]); a++) {
+        double fps[REPS];
+
+        for (size_t rep = 0; rep < REPS; rep++) {
+            struct cgbe *fork = cgbe_fork(gb);
+            apu_set_rate(fork->apu, audios[a].rate);
+
+            double start = now();
+            for (size_t frame = 0; frame < FRAMES; frame++) {
+                cgbe_run(fork, PPU_FRAME_CYCLES);
+                while (apu_read_samples(fork->apu, samples, sizeof(samples) / 4) != 0) {
+                }
+            }
+            fps[rep] = FRAMES / (now() - start);
+
+            cgbe_delete(fork);
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "apu/%s", audios[a].name);
+        report(name, "frames_per_sec", fps);
+    }
+
+    cgbe_delete(gb);
+    unlink(path);
+}
+
+// A movie of FRAMES frames that presses or releases a button every few of them.
+static const char *write_movie(char *path, size_t n) {
+    snprintf(path, n, "%s/bench.cgbm", tmp_dir);
+    FILE *f = fopen(path, "wb");
+    assert(f != NULL);
+
+    fwrite(MOVIE_MAGIC, 1, 4, f);
+    fputc(MOVIE_VERSION, f);
+    size_t frame = 0;
+    for (; frame + 4 < FRAMES; frame += 4) {
+        fputc(4, f);                         // frames since the last change, a 1 byte varint
+        fputc(JOYPAD_A << frame / 4 % 4, f); // toggles A, B, select and start in turn
+    }
+    fputc(FRAMES - frame, f);
+    fputc(0, f); // end
+    fclose(f);
+
+    return path;
+}
+
+// Frames per second replayed from a movie, state hash after every frame included.
+static void bench_movie(void) {
+    char path[256], movie_path[256];
+    struct cgbe *gb = cgbe_new(write_rom(&programs[0], 0x00, path, sizeof(path)));
+    struct movie *movie = movie_open(write_movie(movie_path, sizeof(movie_path)));
+    assert(movie != NULL && movie->frames == FRAMES);
+    uint64_t hashes[FRAMES];
+    double fps[REPS];
+
+    for (size_t rep = 0; rep < REPS; rep++) {
+        struct cgbe *fork = cgbe_fork(gb);
+
+        double start = now();
+        movie_play(movie, fork, hashes);
+        fps[rep] = FRAMES / (now() - start);
+
+        cgbe_delete(fork);
+    }
+    report("movie/replay", "frames_per_sec", fps);
+
+    movie_close(movie);
+    cgbe_delete(gb);
+    unlink(movie_path);
+    unlink(path);
+}
+
+// Microseconds per frame pushed into a rewind ring with the lcd on and per restore of the frame
+// furthest from its keyframe, plus the bytes each frame takes up in the ring.
+static void bench_rewind(void) {
+    char path[256];
+    struct cgbe *gb = cgbe_new(write_rom(&programs[0], 0x00, path, sizeof(path)));
+    double push[REPS], restore[REPS], bytes[REPS];
+
+    for (size_t rep = 0; rep < REPS; rep++) {
+        struct cgbe *fork = cgbe_fork(gb);
+        struct rewind *rw = rewind_new(fork, REWIND_KEYFRAME_INTERVAL, 64 << 20);
+        double elapsed = 0;
+
+        for (size_t frame = 0; frame < REWIND_KEYFRAME_INTERVAL; frame++) {
+            cgbe_run(fork, PPU_FRAME_CYCLES);
+            double start = now();
+            rewind_push(rw, fork);
+            elapsed += now() - start;
+        }
+        push[rep] = elapsed * 1e6 / REWIND_KEYFRAME_INTERVAL;
+
+        size_t used = 0;
+        for (size_t i = 0; i < rw->count; i++) {
+            used += rw->frames[i].size;
+        }
+        bytes[rep] = (double)used / rw->count;
+
+        double start = now();
+        rewind_restore(rw, fork, 1);
+        restore[rep] = (now() - start) * 1e6;
+
+        rewind_delete(rw);
+        cgbe_delete(fork);
+    }
+    report("rewind/push", "us_per_frame", push);
+    report("rewind/push", "bytes_per_frame", bytes);
+    report("rewind/restore", "us_per_restore", restore);
+
+    cgbe_delete(gb);
+    unlink(path);
+}
+
+// Roms given on the command line run from the state the boot rom leaves them in.
+static void bench_roms(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        struct cgbe *gb = cgbe_new(argv[i]);
+        char name[256];
+
+        snprintf(name, sizeof(name), "rom/%s", argv[i]);
+        bench_cpu(name, gb, CPU_CYCLES);
+        cgbe_delete(gb);
+    }
+}
+
+// Usage: bench [rom ...]
+int main(int argc, char **argv) {
+    char *dir = mkdtemp(tmp_dir);
+    assert(dir != NULL);
+
+    printf("# name\tmetric\tmean\tstddev\tmin\n");
+    bench_programs();
+    bench_bus();
+    bench_dma();
+    bench_cartridge();
+    bench_ppu();
+    bench_apu();
+    bench_movie();
+    bench_rewind();
+    bench_roms(argc, argv);
+
+    rmdir(tmp_dir);
+    return 0;
+}
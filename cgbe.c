@@ -1 +1,191 @@
-int main(void) { return 0; }
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal/cgbe.h"
+#include "internal/movie.h"
+#include "internal/sm83/sm83_profile.h"
+#include "internal/trace.h"
+
+// Hottest instruction addresses listed in a profile report.
+#define PROFILE_SITES 100
+
+// Sample rate of -a recordings, and the m-cycles run between draining the apu.
+#define AUDIO_RATE 48000
+#define AUDIO_CHUNK PPU_FRAME_CYCLES
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-p out] [-t trace] [-a audio.wav] rom m-cycles\n", name);
+    fprintf(stderr, "       %s [-p out] [-t trace] -m movie rom\n", name);
+    exit(1);
+}
+
+static size_t parse_size(const char *name, const char *arg) {
+    char *end;
+    unsigned long long val = strtoull(arg, &end, 0);
+
+    if (*arg == '\0' || *end != '\0') {
+        usage(name);
+    }
+    return val;
+}
+
+static FILE *open_output(const char *prefix, const char *suffix) {
+    char fname[4096];
+    snprintf(fname, sizeof(fname), "%s%s", prefix, suffix);
+
+    FILE *out = fopen(fname, "w");
+    if (out == NULL) {
+        perror(fname);
+        exit(1);
+    }
+    return out;
+}
+
+static void put_le(FILE *out, uint32_t val, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        fputc(val >> (8 * i), out);
+    }
+}
+
+// 16 bit stereo pcm.
+static void write_wav_header(FILE *out, size_t samples) {
+    uint32_t data = samples * 4;
+
+    fwrite("RIFF", 1, 4, out);
+    put_le(out, 36 + data, 4);
+    fwrite("WAVEfmt ", 1, 8, out);
+    put_le(out, 16, 4);
+    put_le(out, 1, 2); // pcm
+    put_le(out, 2, 2); // channels
+    put_le(out, AUDIO_RATE, 4);
+    put_le(out, AUDIO_RATE * 4, 4);
+    put_le(out, 4, 2);
+    put_le(out, 16, 2);
+    fwrite("data", 1, 4, out);
+    put_le(out, data, 4);
+}
+
+// Runs the machine, writing what the apu plays to out as it goes. Returns the samples written.
+static size_t record_audio(struct cgbe *gb, size_t cycles, FILE *out) {
+    int16_t samples[2 * AUDIO_RATE / 50];
+    size_t written = 0;
+
+    apu_set_rate(gb->apu, AUDIO_RATE);
+    for (size_t done = 0; done < cycles;) {
+        done += cgbe_run(gb, cycles - done < AUDIO_CHUNK ? cycles - done : AUDIO_CHUNK);
+
+        size_t n;
+        while ((n = apu_read_samples(gb->apu, samples, sizeof(samples) / 4)) != 0) {
+            for (size_t i = 0; i < 2 * n; i++) {
+                put_le(out, (uint16_t)samples[i], 2);
+            }
+            written += n;
+        }
+    }
+    return written;
+}
+
+// Plays a movie, then prints the state hash after every frame, one per line.
+static void replay(struct cgbe *gb, const char *name, const char *fname) {
+    struct movie *movie = movie_open(fname);
+    if (movie == NULL) {
+        fprintf(stderr, "%s: %s isn't a readable movie\n", name, fname);
+        exit(1);
+    }
+
+    uint64_t *hashes = calloc(movie->frames, sizeof(uint64_t));
+    assert(hashes != NULL || movie->frames == 0);
+
+    movie_play(movie, gb, hashes);
+    for (size_t i = 0; i < movie->frames; i++) {
+        printf("%016llx\n", (unsigned long long)hashes[i]);
+    }
+
+    free(hashes);
+    movie_close(movie);
+}
+
+// Runs a rom for a number of m-cycles, or for as long as a movie given with -m lasts, printing the
+// state hash after each of its frames so runs can be diffed. With -p out the run is profiled, the
+// sorted report ends up in out.txt and the call stacks in out.folded (flamegraph.pl out.folded >
+// out.svg). With -t the run is traced, cgbe_trace prints the trace. With -a the apu's output is
+// recorded to a wav file, runs are headless otherwise.
+int main(int argc, char **argv) {
+    const char *profile_out = NULL;
+    const char *trace_out = NULL;
+    const char *audio_out = NULL;
+    const char *movie_in = NULL;
+    int arg = 1;
+
+    while (arg + 1 < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-p") == 0) {
+            profile_out = argv[arg + 1];
+        } else if (strcmp(argv[arg], "-t") == 0) {
+            trace_out = argv[arg + 1];
+        } else if (strcmp(argv[arg], "-a") == 0) {
+            audio_out = argv[arg + 1];
+        } else if (strcmp(argv[arg], "-m") == 0) {
+            movie_in = argv[arg + 1];
+        } else {
+            usage(argv[0]);
+        }
+        arg += 2;
+    }
+    if (argc - arg != (movie_in != NULL ? 1 : 2) || (movie_in != NULL && audio_out != NULL)) {
+        usage(argv[0]);
+    }
+
+    size_t cycles = movie_in != NULL ? 0 : parse_size(argv[0], argv[arg + 1]);
+    struct cgbe *gb = cgbe_new(argv[arg]);
+    struct sm83_profile *profile = NULL;
+
+    if (profile_out != NULL) {
+        if (!SM83_PROFILE_ENABLED) {
+            fprintf(stderr, "%s: built without the profiler, rebuild with make PROFILE=1\n",
+                    argv[0]);
+            exit(1);
+        }
+        profile = sm83_profile_new();
+        gb->cpu->profile = profile;
+    }
+
+    if (trace_out != NULL) {
+        if (!CGBE_TRACE_ENABLED) {
+            fprintf(stderr, "%s: built without tracing, rebuild with make TRACE=1\n", argv[0]);
+            exit(1);
+        }
+        gb->bus->trace = trace_new(trace_out);
+    }
+
+    if (movie_in != NULL) {
+        replay(gb, argv[0], movie_in);
+    } else if (audio_out != NULL) {
+        FILE *out = open_output(audio_out, "");
+        write_wav_header(out, 0);
+        size_t samples = record_audio(gb, cycles, out);
+        rewind(out);
+        write_wav_header(out, samples);
+        fclose(out);
+    } else {
+        cgbe_run(gb, cycles);
+    }
+
+    trace_delete(gb->bus->trace);
+
+    if (profile != NULL) {
+        FILE *out = open_output(profile_out, ".txt");
+        sm83_profile_report(profile, out, PROFILE_SITES);
+        fclose(out);
+
+        out = open_output(profile_out, ".folded");
+        sm83_profile_collapsed(profile, out);
+        fclose(out);
+
+        sm83_profile_delete(profile);
+    }
+
+    cgbe_delete(gb);
+    return 0;
+}
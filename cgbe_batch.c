@@ -0,0 +1,58 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal/batch.h"
+#include "internal/cgbe.h"
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j threads] rom m-cycles [rom m-cycles ...]\n", name);
+    exit(1);
+}
+
+static size_t parse_size(const char *name, const char *arg) {
+    char *end;
+    unsigned long long val = strtoull(arg, &end, 0);
+
+    if (*arg == '\0' || *end != '\0') {
+        usage(name);
+    }
+    return val;
+}
+
+// Runs one machine per (rom, m-cycles) pair on every core and reports the aggregate speed.
+int main(int argc, char **argv) {
+    size_t threads = 0;
+    int arg = 1;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "-j") == 0) {
+        threads = parse_size(argv[0], argv[arg + 1]);
+        arg += 2;
+    }
+    if (arg == argc || (argc - arg) % 2 != 0) {
+        usage(argv[0]);
+    }
+
+    size_t count = (argc - arg) / 2;
+    struct batch_job *jobs = malloc(count * sizeof(struct batch_job));
+    assert(jobs != NULL);
+
+    for (size_t i = 0; i < count; i++) {
+        jobs[i] = (struct batch_job){
+            .rom = argv[arg + 2 * i],
+            .cycles = parse_size(argv[0], argv[arg + 2 * i + 1]),
+            .done = 0,
+        };
+    }
+
+    struct batch_stats stats = batch_run(jobs, count, threads);
+    double rate = stats.seconds > 0 ? stats.cycles / stats.seconds : 0;
+
+    printf("%zu machines on %zu threads: %zu m-cycles in %.3f s\n", count, stats.threads,
+           stats.cycles, stats.seconds);
+    printf("%.0f m-cycles/s, %.1fx realtime\n", rate, rate / CGBE_SECOND);
+
+    free(jobs);
+    return 0;
+}
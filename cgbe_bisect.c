@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal/cgbe.h"
+#include "internal/movie.h"
+#include "internal/sm83/sm83_block.h"
+#include "internal/sm83/sm83_jit.h"
+
+// Differing addresses listed once the runs diverge.
+#define SHOWN_ADDRESSES 16
+
+// Runs align takes to bring both sides to the same clock before giving up on them.
+#define ALIGN_RUNS 64
+
+// One of the two runs being compared.
+struct side {
+    const char *engine;
+    struct cgbe *gb;
+    struct sm83_block_cache *blocks;
+    struct sm83_jit *jit;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s rom m-cycles engine engine\n", name);
+    fprintf(stderr, "       %s -m movie rom engine engine\n", name);
+    fprintf(stderr, "engines: interp, blocks, jit\n");
+    exit(1);
+}
+
+static size_t parse_size(const char *name, const char *arg) {
+    char *end;
+    unsigned long long val = strtoull(arg, &end, 0);
+
+    if (*arg == '\0' || *end != '\0') {
+        usage(name);
+    }
+    return val;
+}
+
+static void side_init(struct side *side, const char *name, const char *rom, const char *engine) {
+    side->engine = engine;
+    side->gb = cgbe_new(rom);
+    side->blocks = NULL;
+    side->jit = NULL;
+
+    if (strcmp(engine, "blocks") == 0) {
+        side->blocks = sm83_block_cache_new();
+    } else if (strcmp(engine, "jit") == 0) {
+        side->jit = sm83_jit_new();
+        if (side->jit == NULL) {
+            fprintf(stderr, "%s: the jit isn't supported on this host\n", name);
+            exit(1);
+        }
+    } else if (strcmp(engine, "interp") != 0) {
+        usage(name);
+    }
+
+    side->gb->cpu->blocks = side->blocks;
+    side->gb->cpu->jit = side->jit;
+}
+
+// Runs gb until its clock reaches at least clock.
+static void run_until(struct cgbe *gb, uint64_t clock) {
+    if (gb->bus->clock < clock) {
+        cgbe_run(gb, clock - gb->bus->clock);
+    }
+}
+
+// Engines stop at different instruction boundaries, blocks and the jit only stop between whole
+// blocks. Runs whichever side is behind up to the other until both stop at the same clock, false
+// if they don't within ALIGN_RUNS runs, which only happens once they took different paths.
+static bool align(struct cgbe *a, struct cgbe *b) {
+    for (size_t i = 0; i < ALIGN_RUNS && a->bus->clock != b->bus->clock; i++) {
+        run_until(a->bus->clock < b->bus->clock ? a : b, a->bus->clock < b->bus->clock
+                                                             ? b->bus->clock
+                                                             : a->bus->clock);
+    }
+    return a->bus->clock == b->bus->clock;
+}
+
+static bool same(struct cgbe *a, struct cgbe *b) {
+    return align(a, b) && cgbe_state_hash(a) == cgbe_state_hash(b);
+}
+
+// Forks gb to run on the side's engine, forks don't inherit one.
+static struct cgbe *fork_side(const struct side *side, struct cgbe *gb) {
+    struct cgbe *fork = cgbe_fork(gb);
+
+    fork->cpu->blocks = side->blocks;
+    fork->cpu->jit = side->jit;
+    return fork;
+}
+
+// Runs forks of a and b for cycles m-cycles with buttons held, returns whether they agree after.
+static bool agree(const struct side *sides, struct cgbe *from_a, struct cgbe *from_b,
+                  uint8_t buttons, size_t cycles, struct cgbe **a, struct cgbe **b) {
+    *a = fork_side(&sides[0], from_a);
+    *b = fork_side(&sides[1], from_b);
+    joypad_set((*a)->joypad, buttons);
+    joypad_set((*b)->joypad, buttons);
+    run_until(*a, from_a->bus->clock + cycles);
+    run_until(*b, from_b->bus->clock + cycles);
+    return same(*a, *b);
+}
+
+static void print_cpu(const struct side *side, const struct cgbe *gb) {
+    const struct sm83_register_file *r = &gb->cpu->regs;
+
+    printf("  %-6s clock=%llu pc=%04X sp=%04X af=%04X bc=%04X de=%04X hl=%04X digest=%016llx\n",
+           side->engine, (unsigned long long)gb->bus->clock, r->pc, r->sp, r->af, r->bc, r->de,
+           r->hl, (unsigned long long)sm83_register_digest(r));
+}
+
+// Memory the cpu can see without touching a device's registers.
+static void print_memory(struct cgbe *a, struct cgbe *b) {
+    static const uint16_t ranges[][2] = {{0x8000, 0xE000}, {0xFE00, 0xFEA0}, {0xFF80, 0xFFFF}};
+    size_t shown = 0;
+
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        for (uint32_t address = ranges[i][0]; address < ranges[i][1]; address++) {
+            uint8_t x = bus_read(a->bus, address), y = bus_read(b->bus, address);
+
+            if (x != y && shown++ < SHOWN_ADDRESSES) {
+                printf("  %04X: %02X %02X\n", address, x, y);
+            }
+        }
+    }
+    if (shown > SHOWN_ADDRESSES) {
+        printf("  and %zu more addresses\n", shown - SHOWN_ADDRESSES);
+    }
+}
+
+// Both sides agree at from_a and from_b and disagree after cycles more m-cycles. Narrows that
+// down to the first point both can stop at where they disagree, rerunning forks of the agreeing
+// pair.
+static void bisect(const struct side *sides, struct cgbe *from_a, struct cgbe *from_b,
+                   uint8_t buttons, size_t cycles) {
+    size_t lo = 0, hi = cycles;
+    struct cgbe *a, *b;
+
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (agree(sides, from_a, from_b, buttons, mid, &a, &b)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+        cgbe_delete(a);
+        cgbe_delete(b);
+    }
+
+    agree(sides, from_a, from_b, buttons, lo, &a, &b);
+    printf("last agreeing state:\n");
+    print_cpu(&sides[0], a);
+    print_cpu(&sides[1], b);
+    cgbe_delete(a);
+    cgbe_delete(b);
+
+    agree(sides, from_a, from_b, buttons, hi, &a, &b);
+    printf("first diverging state:\n");
+    print_cpu(&sides[0], a);
+    print_cpu(&sides[1], b);
+    print_memory(a, b);
+    cgbe_delete(a);
+    cgbe_delete(b);
+}
+
+// Runs a rom on two engines side by side, a frame at a time, comparing state hashes after every
+// frame. Once they differ, the frame is rerun from the last agreeing pair of states to bisect down
+// to the first instruction the engines disagree on, which gets printed along with both cpus and
+// the memory that differs. With -m the input comes from a movie, which also sets the length of
+// the run. Exits with 1 if the runs diverge.
+int main(int argc, char **argv) {
+    const char *movie_in = NULL;
+    int arg = 1;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "-m") == 0) {
+        movie_in = argv[arg + 1];
+        arg += 2;
+    }
+    if (argc - arg != (movie_in != NULL ? 3 : 4)) {
+        usage(argv[0]);
+    }
+
+    const char *rom = argv[arg++];
+    struct movie *movie = NULL;
+    struct movie_cursor cursor;
+    size_t cycles;
+
+    if (movie_in != NULL) {
+        movie = movie_open(movie_in);
+        if (movie == NULL) {
+            fprintf(stderr, "%s: %s isn't a readable movie\n", argv[0], movie_in);
+            exit(1);
+        }
+        movie_start(movie, &cursor);
+        cycles = movie->frames * (size_t)PPU_FRAME_CYCLES;
+    } else {
+        cycles = parse_size(argv[0], argv[arg++]);
+    }
+
+    struct side sides[2];
+    side_init(&sides[0], argv[0], rom, argv[arg]);
+    side_init(&sides[1], argv[0], rom, argv[arg + 1]);
+    struct cgbe *a = sides[0].gb, *b = sides[1].gb;
+    uint64_t start = a->bus->clock;
+    bool diverged = false;
+
+    for (size_t frame = 0; a->bus->clock - start < cycles && !diverged; frame++) {
+        uint8_t buttons = movie != NULL ? movie_buttons(movie, &cursor, frame) : 0;
+        size_t target = (frame + 1) * (size_t)PPU_FRAME_CYCLES;
+        target = target < cycles ? target : cycles;
+
+        struct cgbe *from_a = cgbe_fork(a), *from_b = cgbe_fork(b);
+        joypad_set(a->joypad, buttons);
+        joypad_set(b->joypad, buttons);
+        run_until(a, start + target);
+        run_until(b, start + target);
+
+        if (!same(a, b)) {
+            printf("diverged in frame %zu, after m-cycle %llu\n", frame,
+                   (unsigned long long)(from_a->bus->clock - start));
+            bisect(sides, from_a, from_b, buttons, a->bus->clock - from_a->bus->clock);
+            diverged = true;
+        }
+        cgbe_delete(from_a);
+        cgbe_delete(from_b);
+    }
+
+    if (!diverged) {
+        printf("no divergence in %llu m-cycles\n", (unsigned long long)(a->bus->clock - start));
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        cgbe_delete(sides[i].gb);
+        sm83_block_cache_delete(sides[i].blocks);
+        if (sides[i].jit != NULL) {
+            sm83_jit_delete(sides[i].jit);
+        }
+    }
+    movie_close(movie);
+    return diverged ? 1 : 0;
+}
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "internal/trace.h"
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s trace\n", name);
+    exit(1);
+}
+
+// Prints a trace written by cgbe -t as text, one instruction per line:
+// bank:pc opcode registers accesses, e.g. "01:4000 EA af=0280 ... rC000=12 w2000=02".
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        usage(argv[0]);
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+    if (!trace_read_header(in)) {
+        fprintf(stderr, "%s: not a trace, or from another version\n", argv[1]);
+        exit(1);
+    }
+
+    struct trace_record record = {0};
+
+    while (trace_read(in, &record)) {
+        printf("%02X:%04X %02X af=%04X bc=%04X de=%04X hl=%04X sp=%04X", record.bank, record.pc,
+               record.opcode, record.af, record.bc, record.de, record.hl, record.sp);
+
+        for (size_t i = 0; i < record.accesses && i < TRACE_MAX_ACCESSES; i++) {
+            const struct trace_access *a = &record.access[i];
+
+            printf(" %c%04X=%02X", a->flags & TRACE_ACCESS_WRITE ? 'w' : 'r', a->address, a->val);
+        }
+        if (record.accesses > TRACE_MAX_ACCESSES) {
+            printf(" +%d", record.accesses - TRACE_MAX_ACCESSES);
+        }
+        putchar('\n');
+    }
+
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef APU_H
+#define APU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal/apu/blip.h"
+#include "internal/memory/bus.h"
+
+// Registers, 0xFF10-0xFF3F, wave ram is the last 16 bytes.
+#define APU_REGS 0x30
+#define APU_WAVE_RAM 0x20
+
+// Output samples buffered per side, older ones are dropped if nobody reads them in time.
+#define APU_BUFFER_SAMPLES 8192
+
+enum apu_channel_id { APU_SQUARE1, APU_SQUARE2, APU_WAVE, APU_NOISE, APU_CHANNELS };
+
+struct apu_channel {
+    bool on;          // as reported in NR52
+    bool dac;         // off means silent, and the channel can't be triggered on
+    uint32_t timer;   // t-cycles until the next waveform step
+    uint8_t position; // duty step or wave sample
+    uint16_t length;  // steps left until the channel turns itself off, if length is enabled
+    uint8_t volume;   // envelope's current volume
+    uint8_t envelope; // sequencer steps until the next envelope change
+    int32_t amp[2];   // last level handed to each side's buffer
+};
+
+// Audio processing unit. Nothing runs per cycle: like the timer the apu catches up on register
+// accesses, and with an output attached the channels only do work on their waveforms' edges,
+// which go into a band-limited buffer per side as level changes. Without an output the apu runs
+// headless, only lengths, envelopes and the sweep are kept up (the cpu can see those through
+// NR52), at a few hundred steps per second. The frame sequencer runs off the apu's own clock
+// rather than DIV.
+struct apu {
+    struct bus *bus;
+    uint64_t synced; // bus clock the apu was last brought up to
+
+    uint8_t regs[APU_REGS]; // as written, reads mask the write only bits
+    struct apu_channel channels[APU_CHANNELS];
+
+    uint16_t shadow; // square 1's sweep frequency
+    uint8_t sweep;   // sequencer steps until the next sweep
+    bool sweeping;   // whether the sweep changes the frequency at all
+    uint16_t lfsr;   // noise
+
+    uint16_t sequencer; // t-cycles into the frame sequencer's current step
+    uint8_t step;       // frame sequencer step, 0-7
+
+    // Optional, left and right. Without them the apu runs headless.
+    struct blip *output[2];
+};
+
+// Constructs an apu, headless, and maps its registers into the bus.
+struct apu *apu_new(struct bus *bus);
+
+// Constructs a copy of an apu for a forked bus. The copy runs headless.
+struct apu *apu_fork(const struct apu *apu, struct bus *bus);
+
+// Deallocates the apu and its output, bus isn't deleted.
+void apu_delete(struct apu *apu);
+
+// Starts producing rate samples per second, or stops and goes headless with rate 0.
+void apu_set_rate(struct apu *apu, size_t rate);
+
+// Brings the apu up to the bus clock.
+void apu_sync(struct apu *apu);
+
+// Reads up to count stereo samples, left then right, returns how many were read. Only the time
+// the apu was synced to is covered, cgbe_run syncs it before returning.
+size_t apu_read_samples(struct apu *apu, int16_t *out, size_t count);
+
+// Brings the output in line with the registers after they were changed directly, e.g. when
+// loading a state.
+void apu_refresh(struct apu *apu);
+
+#endif
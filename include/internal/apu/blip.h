@@ -0,0 +1,50 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sub-sample positions a step can start at, and samples each step is spread over.
+#define BLIP_PHASES 32
+#define BLIP_TAPS 16
+
+// Fractional bits of sample positions.
+#define BLIP_FRAC 32
+
+// Band-limited step buffer. A waveform is described by the times it changes level at, each
+// change is added as a step pre-filtered down to the output rate (a windowed sinc, so there's no
+// aliasing), and samples are produced by summing the steps up when they're read. Generating a
+// square wave costs one step per edge instead of work on every clock, and nothing at all while
+// the level holds.
+struct blip {
+    uint64_t factor; // output samples per input clock, with BLIP_FRAC fractional bits
+    uint64_t offset; // where the current frame starts in buf, with BLIP_FRAC fractional bits
+    int32_t sum;     // running sum of the steps read so far
+    size_t size;     // samples buf holds
+    int32_t *buf;    // steps, BLIP_TAPS samples of room past size for the last ones' tails
+    int16_t kernel[BLIP_PHASES][BLIP_TAPS]; // each phase sums to 1 << 15
+};
+
+// Allocates a buffer of size samples at rate samples per second, for input clocked at clock_rate.
+struct blip *blip_new(size_t clock_rate, size_t rate, size_t size);
+
+void blip_delete(struct blip *blip);
+
+// Adds a step of delta at clock time t, counted from the start of the current frame. It has to
+// land within the buffer, see blip_room.
+void blip_add_delta(struct blip *blip, uint64_t t, int32_t delta);
+
+// Ends the current frame clocks clocks after its start, making the samples before that readable.
+void blip_end_frame(struct blip *blip, uint64_t clocks);
+
+// Samples that can be read.
+size_t blip_available(const struct blip *blip);
+
+// Clocks the current frame can still run for before the buffer is full.
+uint64_t blip_room(const struct blip *blip);
+
+// Reads up to count samples into out, every stride-th int16_t, or drops them when out is NULL.
+// Returns the number of samples read.
+size_t blip_read(struct blip *blip, int16_t *out, size_t count, size_t stride);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+// A machine to run in a batch.
+struct batch_job {
+    const char *rom;
+    size_t cycles; // m-cycles to run for
+    size_t done;   // m-cycles actually run, set by batch_run
+};
+
+struct batch_stats {
+    size_t threads;
+    size_t cycles;  // m-cycles run by all machines together
+    double seconds; // wall clock
+};
+
+// Runs every job on a machine of its own, spread over threads threads (0 for one per core). Each
+// thread starts with an even share of the jobs and steals unstarted ones from the others once
+// it's done with its own. Machines share nothing mutable across threads.
+struct batch_stats batch_run(struct batch_job *jobs, size_t count, size_t threads);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef CGBE_H
+#define CGBE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal/apu/apu.h"
+#include "internal/joypad/joypad.h"
+#include "internal/memory/bus.h"
+#include "internal/memory/cartridge.h"
+#include "internal/ppu/ppu.h"
+#include "internal/scheduler.h"
+#include "internal/sm83/sm83.h"
+#include "internal/timer/tima.h"
+
+// M-cycles per emulated second at single speed.
+#define CGBE_SECOND (1 << 20)
+
+// Bumped whenever the layout of saved states changes, older states are rejected.
+#define CGBE_STATE_VERSION 6
+
+// A whole machine.
+struct cgbe {
+    struct cartridge *cart;
+    struct bus *bus;
+    struct sm83 *cpu;
+    struct ppu *ppu;
+    struct tima *timer;
+    struct apu *apu;
+    struct joypad *joypad;
+    struct scheduler *scheduler;
+};
+
+// Builds a machine around a rom file, in the state the boot rom leaves it in.
+struct cgbe *cgbe_new(const char *fname);
+
+// Clones a machine in its current state. The clone shares rom and every ram page with the
+// original until one of them writes to it, so forking costs a few allocations and each fork
+// only pays for the pages it dirties. Both can be deleted in any order. The clone's cpu
+// interprets, see sm83_fork.
+struct cgbe *cgbe_fork(struct cgbe *gb);
+
+// Deallocates the machine and everything in it.
+void cgbe_delete(struct cgbe *gb);
+
+// Runs for at least `cycles` m-cycles, returns how many actually ran. The cpu runs freely up to
+// the scheduler's next event at a time, devices catch up whenever it touches their registers and
+// all of them are caught up on return.
+size_t cgbe_run(struct cgbe *gb, size_t cycles);
+
+// Runs every machine for at least `cycles` m-cycles, SM83_LANES at a time in lockstep (see
+// sm83_lanes.h). Worth it when the machines mostly run the same rom code, e.g. forks of one state
+// fed different inputs. The devices' events only fire once the cpus are done, so this suits code
+// that doesn't wait on interrupts. Returns the m-cycles run by all of them together.
+size_t cgbe_run_lockstep(struct cgbe **gbs, size_t count, size_t cycles);
+
+// Size in bytes of a saved state of this machine, it only depends on the cartridge.
+size_t cgbe_state_size(const struct cgbe *gb);
+
+// Saves the whole machine into buf, which has to hold at least cgbe_state_size bytes. Returns
+// the number of bytes written.
+size_t cgbe_state_save(const struct cgbe *gb, uint8_t *buf, size_t size);
+
+// Restores a state saved by cgbe_state_save. Returns false and leaves the machine untouched if
+// the state is from another version or another cartridge.
+bool cgbe_state_load(struct cgbe *gb, const uint8_t *buf, size_t size);
+
+// Fingerprint of the state cgbe_state_save would write, two machines in the same state hash the
+// same. Memory is hashed a page at a time and only the pages written since the last call are
+// hashed again (see ram_hash), so calling it every frame costs about as much as the pages the
+// frame dirtied plus the few kilobytes of the rest of the state.
+uint64_t cgbe_state_hash(struct cgbe *gb);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HASH_PRIME UINT64_C(0x9E3779B97F4A7C15)
+
+// 64 bit hash of size bytes, mixed in 8 at a time with a final mix that spreads the last words
+// over every bit. Meant to tell states apart, not to stand up to anyone crafting collisions.
+static inline uint64_t hash_bytes(const void *data, size_t size) {
+    const uint8_t *p = data;
+    uint64_t h = size * HASH_PRIME;
+
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = ((h << 5 | h >> 59) ^ word) * HASH_PRIME;
+    }
+    for (; size > 0; p++, size--) {
+        h = ((h << 5 | h >> 59) ^ *p) * HASH_PRIME;
+    }
+
+    h ^= h >> 31;
+    h *= UINT64_C(0xBF58476D1CE4E5B9);
+    h ^= h >> 29;
+    return h;
+}
+
+#endif
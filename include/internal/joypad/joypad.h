@@ -0,0 +1,43 @@
+#ifndef JOYPAD_H
+#define JOYPAD_H
+
+#include <stdint.h>
+
+#include "internal/memory/bus.h"
+
+// Buttons, as passed to joypad_set. The low nibble is the direction keys' row of P1, the high one
+// the action buttons'.
+#define JOYPAD_RIGHT (1 << 0)
+#define JOYPAD_LEFT (1 << 1)
+#define JOYPAD_UP (1 << 2)
+#define JOYPAD_DOWN (1 << 3)
+#define JOYPAD_A (1 << 4)
+#define JOYPAD_B (1 << 5)
+#define JOYPAD_SELECT (1 << 6)
+#define JOYPAD_START (1 << 7)
+
+// In P1, clear to read that row.
+#define JOYPAD_SELECT_DIRECTIONS (1 << 4)
+#define JOYPAD_SELECT_ACTIONS (1 << 5)
+
+// P1. Buttons only change between runs, from whatever feeds the machine input, so nothing here
+// needs syncing.
+struct joypad {
+    struct bus *bus;
+    uint8_t select;  // P1 bits 4 and 5 as written
+    uint8_t buttons; // held down, JOYPAD_*
+};
+
+// Constructs a joypad with nothing held and maps P1 into the bus.
+struct joypad *joypad_new(struct bus *bus);
+
+// Constructs a copy of a joypad for a forked bus.
+struct joypad *joypad_fork(const struct joypad *joypad, struct bus *bus);
+
+// Deallocates the joypad, bus isn't deleted.
+void joypad_delete(struct joypad *joypad);
+
+// Sets the buttons held down. Pressing one in a selected row requests the joypad interrupt.
+void joypad_set(struct joypad *joypad, uint8_t buttons);
+
+#endif
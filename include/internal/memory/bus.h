@@ -2,21 +2,153 @@
 #define BUS_H
 
 #include "internal/memory/cartridge.h"
+#include "internal/trace.h"
+
+#define BUS_PAGE_SIZE 256
+#define BUS_PAGE_COUNT 256
+
+// Io registers, 0xFF00-0xFF7F.
+#define BUS_IO_COUNT 0x80
+#define BUS_IO_IF 0x0F // pending interrupts
+
+enum bus_interrupt {
+    BUS_INTERRUPT_VBLANK = 1 << 0,
+    BUS_INTERRUPT_STAT = 1 << 1,
+    BUS_INTERRUPT_TIMER = 1 << 2,
+    BUS_INTERRUPT_SERIAL = 1 << 3,
+    BUS_INTERRUPT_JOYPAD = 1 << 4,
+};
+
+// Callbacks for memory mapped devices, ctx is passed back as is.
+struct bus_handler {
+    uint8_t (*read)(void *ctx, uint16_t address);
+    void (*write)(void *ctx, uint16_t address, uint8_t val);
+    void *ctx;
+};
 
 struct bus {
     struct cartridge *cart;
+
+    // Bumped whenever the memory map may have changed (e.g. a write to the mapper registers), so
+    // anything caching what's mapped where knows to look again.
+    size_t generation;
+
+    // M-cycles the cpu has run, as of the access being made. Every cpu engine keeps it up to date,
+    // so devices can tell when they're accessed and catch up to that point (see scheduler.h).
+    uint64_t clock;
+
+    // M-cycles the cpu is halted for by a transfer that just ran (general purpose and hblank dma).
+    // The engines count them as run at the next instruction boundary, see bus_take_stall.
+    size_t stall;
+
+    // Host memory backing each page, NULL when accesses to it go through the page's handler. Only
+    // touched when something gets (re)mapped, e.g. on a bank switch.
+    const uint8_t *read_pages[BUS_PAGE_COUNT];
+    uint8_t *write_pages[BUS_PAGE_COUNT];
+    struct bus_handler handlers[BUS_PAGE_COUNT];
+
+    // Devices' registers, io ones without a handler are plain memory in io.
+    struct bus_handler io_handlers[BUS_IO_COUNT];
+
+    // Optional, records every access in builds with CGBE_TRACE defined (see trace.h). Not owned by
+    // the bus and never inherited by forks.
+    struct trace *trace;
+
+    struct ram *wram; // copy-on-write, shared with forks
+    uint8_t hram[0x7F];
+    uint8_t io[BUS_IO_COUNT]; // registers no device has claimed yet
+    uint8_t ie;
 };
 
 // Constructs a new bus.
 struct bus *bus_new(struct cartridge *cart);
 
+// Constructs a bus for a forked cartridge, sharing wram with the original until either of them
+// writes to it. The original's pages are remapped so that it copies shared pages too.
+struct bus *bus_fork(struct bus *bus, struct cartridge *cart);
+
 // Deallocates a bus, doesn't touch the connected devices (cartridge, etc).
 void bus_delete(struct bus *bus);
 
+// Maps size bytes of host memory at address, both have to be page aligned. Writes are ignored by
+// the fast path unless writable, they go to the pages' handlers instead.
+void bus_map_memory(struct bus *bus, uint16_t address, size_t size, uint8_t *mem, bool writable);
+
+// Routes every access to size bytes at address through the handler, both have to be page aligned.
+void bus_map_handler(struct bus *bus, uint16_t address, size_t size, struct bus_handler handler);
+
+// Maps size bytes of ram, starting at offset, at address. Shared pages, and every page unless
+// writable, are only mapped for reading, writes to them go to the pages' handlers.
+void bus_map_ram(struct bus *bus, uint16_t address, size_t size, const struct ram *ram,
+                 size_t offset, bool writable);
+
+// Routes accesses to count io registers starting at 0xFF00 + reg through the handler.
+void bus_map_io(struct bus *bus, uint8_t reg, size_t count, struct bus_handler handler);
+
+// Points the rom and external ram pages at whatever banks the cartridge has mapped now, shared
+// ram pages are only mapped for reading.
+void bus_map_cartridge(struct bus *bus);
+
+// Points the wram pages at wram's current pages, shared ones are only mapped for reading.
+void bus_map_wram(struct bus *bus);
+
+// Flags an interrupt as pending.
+static inline void bus_request_interrupt(struct bus *bus, enum bus_interrupt interrupt) {
+    bus->io[BUS_IO_IF] |= interrupt;
+}
+
+// Halts the cpu for cycles m-cycles once the current instruction is done.
+static inline void bus_stall(struct bus *bus, size_t cycles) {
+    bus->stall += cycles;
+}
+
+// Returns the m-cycles the cpu has to spend halted and clears them, meant for the cpu engines.
+static inline size_t bus_take_stall(struct bus *bus) {
+    size_t stall = bus->stall;
+
+    if (stall != 0) {
+        bus->stall = 0;
+    }
+    return stall;
+}
+
+// Copies size bytes starting at src out of the bus, for dma. Source pages backed by memory are
+// copied whole, only the rest (e.g. io) is read byte by byte through their handlers. Not traced,
+// the cpu isn't the one reading.
+void bus_dma_read(struct bus *bus, uint16_t src, uint8_t *dst, size_t size);
+
+// Slow paths of bus_read/bus_write.
+uint8_t bus_handler_read(struct bus *bus, uint16_t address);
+void bus_handler_write(struct bus *bus, uint16_t address, uint8_t val);
+
 // Reads data.
-uint8_t bus_read(struct bus *bus, uint16_t address);
+static inline uint8_t bus_read(struct bus *bus, uint16_t address) {
+    const uint8_t *page = bus->read_pages[address / BUS_PAGE_SIZE];
+    uint8_t val = page != NULL ? page[address % BUS_PAGE_SIZE] : bus_handler_read(bus, address);
+
+#ifdef CGBE_TRACE
+    if (bus->trace != NULL) {
+        trace_access(bus->trace, address, val, 0);
+    }
+#endif
+    return val;
+}
 
 // Writes data.
-void bus_write(struct bus *bus, uint16_t address, uint8_t val);
+static inline void bus_write(struct bus *bus, uint16_t address, uint8_t val) {
+    uint8_t *page = bus->write_pages[address / BUS_PAGE_SIZE];
+
+#ifdef CGBE_TRACE
+    if (bus->trace != NULL) {
+        trace_access(bus->trace, address, val, TRACE_ACCESS_WRITE);
+    }
+#endif
+
+    if (page != NULL) {
+        page[address % BUS_PAGE_SIZE] = val;
+        return;
+    }
+    bus_handler_write(bus, address, val);
+}
 
 #endif
@@ -5,6 +5,9 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "internal/memory/ram.h"
+#include "internal/memory/rom.h"
+
 struct cartridge_header {
     uint8_t entry[4];
     uint8_t logo[48];
@@ -28,20 +31,71 @@ struct cartridge_header {
     uint16_t global_checksum;
 };
 
-enum cartridge_mapper_type { CMT_ROM_ONLY, CMT_UNSUPPORTED = -1 };
+enum cartridge_mapper_type {
+    CMT_ROM_ONLY,
+    CMT_MBC1,
+    CMT_MBC2,
+    CMT_MBC3,
+    CMT_MBC5,
+    CMT_UNSUPPORTED = -1,
+};
 
 #define CARTRIDGE_ROM_BANK_SIZE 16384
+#define CARTRIDGE_RAM_BANK_SIZE 8192
+
+// 2^20 m-cycles make a second.
+#define CARTRIDGE_RTC_SECOND (1 << 20)
+
+enum cartridge_rtc_reg { RTC_S, RTC_M, RTC_H, RTC_DL, RTC_DH, RTC_REG_COUNT };
+
+// MBC3 real time clock, it counts emulated rather than host time. Nothing runs per cycle: like the
+// timer it catches up on the time passed whenever the game talks to the cartridge.
+struct cartridge_rtc {
+    uint8_t regs[RTC_REG_COUNT];
+    uint8_t latched[RTC_REG_COUNT]; // what reads see
+    uint8_t latch;                  // last value written to the latch register
+    size_t cycles;                  // m-cycles into the current second
+    uint64_t synced;                // bus clock the clock was last brought up to
+};
+
+// Mapper registers, as written by the game.
+struct cartridge_mbc {
+    uint16_t rom_bank;
+    uint8_t ram_bank; // on MBC3 0x08-0x0C select a clock register instead
+    uint8_t mode;     // MBC1 banking mode
+    bool ram_enabled;
+};
 
 struct cartridge {
     enum cartridge_mapper_type mapper;
-    struct cartridge_header *header;
-    uint8_t bank_00[CARTRIDGE_ROM_BANK_SIZE];
-    uint8_t bank_01_nn[CARTRIDGE_ROM_BANK_SIZE];
+    const struct cartridge_header *header;
+
+    // Shared with every other cartridge made from the same file, banks point into it.
+    struct rom *rom;
+    size_t rom_banks;
+
+    struct ram *ram; // copy-on-write, shared with forks
+    size_t ram_size;
+    bool has_rtc;
+
+    struct cartridge_mbc mbc;
+    struct cartridge_rtc rtc;
+
+    // What's currently mapped, only recomputed when a mapper register is written.
+    const uint8_t *bank_00;
+    const uint8_t *bank_01_nn;
+    uint16_t bank_00_num;
+    uint16_t bank_01_nn_num;
+    bool ram_mapped;   // false when ram accesses need cartridge_ram_read/cartridge_ram_write
+    size_t ram_offset; // where the mapped ram bank starts
 };
 
-// Constructs cartridge rom data from a file.
+// Constructs a cartridge from a rom file, the rom itself is mapped rather than copied.
 struct cartridge *cartridge_new(const char *fname);
 
+// Constructs a copy of a cartridge sharing its rom, and its ram until either of them writes to it.
+struct cartridge *cartridge_fork(const struct cartridge *cart);
+
 // Deallocates cartridge and all the memory associated with it.
 void cartridge_delete(struct cartridge *cart);
 
@@ -51,7 +105,35 @@ void cartridge_header_print_info(const struct cartridge_header *cart, FILE *out)
 // Reads data from rom of a cartridge.
 uint8_t cartridge_rom_read(struct cartridge *cart, uint16_t address);
 
-// Writes data to a rom of a cartridge.
-void cartridge_rom_write(struct cartridge *cart, uint16_t address, uint8_t val);
+// Writes data to a rom of a cartridge, which sets the mapper registers. Returns whether that
+// changed which rom banks or which ram is mapped.
+bool cartridge_rom_write(struct cartridge *cart, uint16_t address, uint8_t val);
+
+// Reads external ram (0xA000-0xBFFF), or the clock on MBC3.
+uint8_t cartridge_ram_read(struct cartridge *cart, uint16_t address);
+
+// Writes external ram (0xA000-0xBFFF), or the clock on MBC3.
+void cartridge_ram_write(struct cartridge *cart, uint16_t address, uint8_t val);
+
+// Returns the external ram currently mapped at the (page aligned) address, or NULL if accesses
+// there can't be plain memory accesses right now (ram disabled, clock selected, MBC2 nibbles).
+const uint8_t *cartridge_ram_page(const struct cartridge *cart, uint16_t address);
+
+// Same as cartridge_ram_page but for writes, also NULL while the page is shared with a fork.
+uint8_t *cartridge_ram_page_writable(const struct cartridge *cart, uint16_t address);
+
+// Recomputes what's mapped from the mapper registers, every access after that is just a pointer
+// dereference. Only needed when cart->mbc is changed directly, e.g. when loading a state.
+void cartridge_map_banks(struct cartridge *cart);
+
+// Brings the cartridge clock, if there is one, up to the bus clock. Time passed while the clock is
+// halted is dropped.
+void cartridge_sync(struct cartridge *cart, uint64_t clock);
+
+// Returns the rom data currently mapped at the (page aligned) address.
+const uint8_t *cartridge_rom_page(const struct cartridge *cart, uint16_t address);
+
+// Returns the number of the rom bank currently mapped at the address.
+uint16_t cartridge_rom_bank(const struct cartridge *cart, uint16_t address);
 
 #endif
@@ -0,0 +1,69 @@
+#ifndef RAM_H
+#define RAM_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAM_PAGE_SIZE 256
+
+// Shared by every fork that hasn't written to it since forking.
+struct ram_page {
+    atomic_size_t refs;
+    uint8_t data[RAM_PAGE_SIZE];
+};
+
+// Memory made of copy-on-write pages, so a fork only costs the pages it goes on to write.
+struct ram {
+    size_t size;
+    struct ram_page **pages;
+
+    // Every page as of the last ram_hash, each with a reference held so it can't change, and its
+    // hash. NULL until ram_hash is first called, forks start without them.
+    struct ram_page **hashed;
+    uint64_t *hashes;
+};
+
+// Allocates size bytes of zeroed ram, size has to be a multiple of the page size.
+struct ram *ram_new(size_t size);
+
+// Returns ram sharing every page with the original.
+struct ram *ram_fork(const struct ram *ram);
+
+// Drops the ram's references to its pages, freeing those no fork uses anymore.
+void ram_delete(struct ram *ram);
+
+// Writes a byte, copying its page first if it's shared.
+void ram_write(struct ram *ram, size_t offset, uint8_t val);
+
+// Copies the whole ram to dst.
+void ram_save(const struct ram *ram, uint8_t *dst);
+
+// Copies the whole ram from src. Pages that already hold the same data stay shared.
+void ram_load(struct ram *ram, const uint8_t *src);
+
+// Brings hashes up to date with one hash per page. Hashing a page takes a reference to it, the way
+// forking does, so anything writing to it afterwards gets a copy and the next call only hashes the
+// pages written since. Returns how many pages were hashed. Pages that were mapped writable aren't
+// anymore if that's not 0, the ram has to be mapped again.
+size_t ram_hash(struct ram *ram);
+
+// Reads a byte.
+static inline uint8_t ram_read(const struct ram *ram, size_t offset) {
+    return ram->pages[offset / RAM_PAGE_SIZE]->data[offset % RAM_PAGE_SIZE];
+}
+
+// Returns the page at the (page aligned) offset for reading.
+static inline const uint8_t *ram_page(const struct ram *ram, size_t offset) {
+    return ram->pages[offset / RAM_PAGE_SIZE]->data;
+}
+
+// Returns the page at the (page aligned) offset if it can be written in place, NULL while it's
+// shared and writes have to go through ram_write.
+static inline uint8_t *ram_page_writable(const struct ram *ram, size_t offset) {
+    struct ram_page *page = ram->pages[offset / RAM_PAGE_SIZE];
+
+    return atomic_load_explicit(&page->refs, memory_order_acquire) == 1 ? page->data : NULL;
+}
+
+#endif
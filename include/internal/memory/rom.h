@@ -0,0 +1,23 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A rom file mapped read-only. Opening the same file again hands out the same mapping, and the
+// pages come straight from the page cache, so every instance in every process shares them.
+struct rom {
+    const uint8_t *data;
+    size_t size;
+};
+
+// Maps a rom file, or takes another reference to it if it's already mapped.
+struct rom *rom_open(const char *fname);
+
+// Takes another reference to an open rom.
+struct rom *rom_ref(struct rom *rom);
+
+// Drops a reference, the file is unmapped once the last one is gone.
+void rom_close(struct rom *rom);
+
+#endif
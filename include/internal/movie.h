@@ -0,0 +1,54 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal/cgbe.h"
+
+// Input movies: what the joypad held over a run, frame by frame, a frame being PPU_FRAME_CYCLES
+// m-cycles. On disk a movie is MOVIE_MAGIC and a version byte followed by one record per change
+// of the buttons:
+//
+//     frames   varint, frames since the previous record (or the start of the movie)
+//     changed  byte, the JOYPAD_* buttons that went down or up
+//
+// so a button costs nothing for as long as it's held. A record that changes nothing ends the
+// movie at its frame. Varints are LEB128, 7 bits per byte starting with the lowest, every byte
+// but the last with its top bit set.
+
+#define MOVIE_MAGIC "CGBM"
+#define MOVIE_VERSION 1
+
+struct movie {
+    const uint8_t *data; // the whole file, mapped
+    size_t size;
+    size_t frames; // length
+};
+
+// Where playback of a movie is at.
+struct movie_cursor {
+    const uint8_t *next; // first record not applied yet
+    uint64_t change;     // frame it applies at
+    uint8_t buttons;     // held as of the last frame asked for
+};
+
+// Maps a movie file and checks it's well formed, returns NULL if it can't be read or isn't one.
+struct movie *movie_open(const char *fname);
+
+// Unmaps the movie.
+void movie_close(struct movie *movie);
+
+// Points cursor at the start of the movie, with nothing held.
+void movie_start(const struct movie *movie, struct movie_cursor *cursor);
+
+// Returns the buttons held during frame, which has to be past the last frame asked for (or 0 after
+// movie_start) and within the movie. Records are decoded straight out of the mapping.
+uint8_t movie_buttons(const struct movie *movie, struct movie_cursor *cursor, size_t frame);
+
+// Plays the movie on a machine from whatever state it's in, the buttons are set at the start of
+// every frame. hashes gets the machine's state hash (see cgbe_state_hash) after every frame, it
+// has to hold movie->frames of them. Nothing is read from disk while it plays.
+void movie_play(const struct movie *movie, struct cgbe *gb, uint64_t *hashes);
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal/memory/bus.h"
+#include "internal/memory/ram.h"
+#include "internal/scheduler.h"
+
+#define PPU_WIDTH 160
+#define PPU_HEIGHT 144
+#define PPU_LINES 154 // including vblank
+
+// M-cycles per line, spent in mode 2 (oam scan), mode 3 (drawing) and mode 0 (hblank) in turn.
+#define PPU_LINE_CYCLES 114
+#define PPU_OAM_SCAN_CYCLES 20
+#define PPU_DRAWING_CYCLES 43
+#define PPU_FRAME_CYCLES (PPU_LINES * PPU_LINE_CYCLES)
+
+#define PPU_BANK_TILES 384 // in each vram bank
+#define PPU_TILES (2 * PPU_BANK_TILES)
+
+// Oam dma copies this many bytes to 0xFE00. Hdma copies 16 byte blocks, halting the cpu for
+// PPU_HDMA_BLOCK_CYCLES per block.
+#define PPU_OAM_DMA_SIZE 160
+#define PPU_HDMA_BLOCK 16
+#define PPU_HDMA_BLOCK_CYCLES 8
+#define PPU_HDMA_INACTIVE (1 << 7) // in HDMA5, set while no hblank transfer is running
+
+#define PPU_LCDC_BG_ON (1 << 0) // in CGB mode: when clear, sprites are always on top instead
+#define PPU_LCDC_OBJ_ON (1 << 1)
+#define PPU_LCDC_OBJ_TALL (1 << 2)
+#define PPU_LCDC_BG_MAP (1 << 3)
+#define PPU_LCDC_TILES (1 << 4) // tile data at 0x8000 with unsigned numbers, else 0x8800 signed
+#define PPU_LCDC_WINDOW_ON (1 << 5)
+#define PPU_LCDC_WINDOW_MAP (1 << 6)
+#define PPU_LCDC_ON (1 << 7)
+
+enum ppu_mode { PPU_HBLANK, PPU_VBLANK, PPU_OAM_SCAN, PPU_DRAWING };
+
+// Color (CGB mode) picture processing unit. Lines are drawn all at once when their mode 3 ends,
+// mid-line register writes only show up from the next line on. VRAM and OAM are never blocked.
+struct ppu {
+    struct bus *bus;
+    struct scheduler *scheduler; // the ppu's event is its next mode change
+
+    struct ram *vram;           // 2 banks of 0x2000, copy-on-write, shared with forks
+    uint8_t oam[BUS_PAGE_SIZE]; // only 0xFE00-0xFE9F exists, the whole page is mapped as memory
+
+    // Background then sprite palette ram, 8 palettes of 4 RGB555 colors each, and the same
+    // colors as 0x00RRGGBB.
+    uint8_t palettes[2][64];
+    uint32_t colors[2][32];
+
+    uint8_t lcdc;
+    uint8_t stat; // only the interrupt enable bits, the rest is computed on reads
+    uint8_t scy;
+    uint8_t scx;
+    uint8_t ly;
+    uint8_t lyc;
+    uint8_t wy;
+    uint8_t wx;
+    uint8_t vbk;  // vram bank mapped at 0x8000
+    uint8_t bcps; // background palette index, bit 7 for auto increment
+    uint8_t ocps; // sprite palette index, bit 7 for auto increment
+
+    // Dma registers. OAM dma (DMA) copies all 160 bytes at once on the write, without modelling
+    // oam being blocked for the 160 m-cycles it takes on hardware. General purpose dma copies
+    // everything at once too and halts the cpu for as long as it takes, hblank dma copies a block
+    // as each visible line's hblank starts.
+    uint8_t dma;       // source of the last oam dma, upper byte
+    uint16_t hdma_src; // where the next hdma block comes from
+    uint16_t hdma_dst; // and goes to, as an offset into the current vram bank
+    uint8_t hdma5;     // blocks left minus one, PPU_HDMA_INACTIVE unless an hblank dma runs
+
+    // Decoded tile cache, 8 rows of 8 color numbers (leftmost pixel in the lowest byte) for every
+    // tile of both banks. Only allocated once a line is drawn, from then on tile data writes mark
+    // their tile dirty and it's decoded again when next drawn.
+    uint64_t (*tiles)[8];
+    uint64_t tiles_dirty[PPU_TILES / 64];
+
+    uint8_t window_line; // window lines drawn this frame
+    bool stat_line;      // the ored stat interrupt conditions, interrupts fire on its rising edge
+    size_t cycle;        // m-cycles into the current line
+    size_t frames;       // vblanks entered so far
+
+    // Optional, PPU_WIDTH * PPU_HEIGHT pixels as 0x00RRGGBB. Without it the ppu runs headless:
+    // timing, STAT, LY and interrupts are the same, but no pixel is ever composed.
+    uint32_t *framebuffer;
+
+    // Only frames numbered a multiple of this are drawn, the framebuffer keeps the last drawn
+    // one in between. 1 draws every frame, 0 isn't allowed.
+    size_t draw_every;
+};
+
+// Constructs a ppu and maps vram, oam and its registers into the bus.
+struct ppu *ppu_new(struct bus *bus, struct scheduler *scheduler);
+
+// Constructs a copy of a ppu for a forked bus, sharing vram until either of them writes to it.
+// The copy has no framebuffer. The original's pages are remapped so that it copies shared pages
+// too.
+struct ppu *ppu_fork(struct ppu *ppu, struct bus *bus, struct scheduler *scheduler);
+
+// Deallocates the ppu, bus isn't deleted.
+void ppu_delete(struct ppu *ppu);
+
+// Advances the ppu by m-cycles, drawing the lines that finish on the way, then schedules the next
+// point it has to be advanced to on its own (a mode change while drawing lines or with STAT
+// interrupts enabled, else the next vblank). Meant to be called when SCHEDULER_PPU fires.
+void ppu_tick(struct ppu *ppu, size_t cycles);
+
+// Brings the ppu up to the bus clock. Its registers do this on every access, so whatever the cpu
+// reads is exact however lazily the ppu is ticked otherwise.
+void ppu_sync(struct ppu *ppu);
+
+// M-cycles until the ppu next changes mode, SIZE_MAX while the lcd is off. Running the cpu no
+// further than that between ticks keeps every mode change, and so every interrupt and LY value,
+// where the cpu expects it.
+size_t ppu_next_event(const struct ppu *ppu);
+
+// Recomputes the vram mapping, colors and next event from the registers and palette ram, only
+// needed when they're changed directly, e.g. when loading a state.
+void ppu_refresh(struct ppu *ppu);
+
+// Maps vram into the bus again after its pages were shared behind the ppu's back, e.g. by hashing
+// them (see ram_hash).
+void ppu_map_vram(struct ppu *ppu);
+
+// Current mode, as reported in STAT.
+enum ppu_mode ppu_mode(const struct ppu *ppu);
+
+#endif
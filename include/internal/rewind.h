@@ -0,0 +1,56 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal/cgbe.h"
+
+// Frames between keyframes.
+#define REWIND_KEYFRAME_INTERVAL 60
+
+// One snapshot in the ring.
+struct rewind_frame {
+    size_t offset; // into buf
+    size_t size;
+    bool key;
+};
+
+// The last few seconds of a machine's states, one per frame, for rewinding and run-ahead. Every
+// REWIND_KEYFRAME_INTERVAL frames a whole state (see cgbe_state_save) is stored, in between only
+// what changed since the frame before: the XOR of the two states, run-length encoded so that the
+// pages a frame didn't dirty cost a few bytes. Restoring a frame decodes its keyframe and at most
+// an interval's worth of deltas. Frames go into a fixed size byte ring, once it's full (or holds
+// as many frames as it may) the oldest keyframe and its deltas make room.
+struct rewind {
+    size_t state_size;
+    uint8_t *last;    // newest frame's state, whole
+    uint8_t *scratch; // state being saved
+    uint8_t *encoded; // frame being encoded, before it goes into buf
+    uint8_t *zeros;   // what keyframes are XORed with
+
+    uint8_t *buf;
+    size_t capacity;
+    size_t head; // where the newest frame ends
+    size_t wrap; // frames before the first one that went back to the start of buf, 0 if none did
+
+    struct rewind_frame *frames; // ring, oldest first
+    size_t max_frames;
+    size_t first;
+    size_t count;
+};
+
+// Allocates a rewind buffer for a machine that keeps up to frames frames in at most bytes bytes of
+// snapshots, plus a few states' worth of buffers.
+struct rewind *rewind_new(const struct cgbe *gb, size_t frames, size_t bytes);
+
+void rewind_delete(struct rewind *rw);
+
+// Stores the machine's current state as the newest frame.
+void rewind_push(struct rewind *rw, const struct cgbe *gb);
+
+// Restores the machine to the frame back frames before the newest (0 for the newest), forgetting
+// the frames after it so pushing goes on from there. back has to be less than rw->count.
+void rewind_restore(struct rewind *rw, struct cgbe *gb, size_t back);
+
+#endif
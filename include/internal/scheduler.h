@@ -0,0 +1,74 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest the cpu runs between two looks at the scheduler, even with nothing scheduled. An event
+// that a register write moves closer can fire this late, though anything reading the device in
+// between still sees it caught up.
+#define SCHEDULER_MAX_SLICE 1024
+
+#define SCHEDULER_NEVER UINT64_MAX
+
+// Devices with timed events, each has at most one pending.
+enum scheduler_event {
+    SCHEDULER_PPU,
+    SCHEDULER_TIMER,
+    SCHEDULER_EVENT_COUNT,
+};
+
+struct scheduler_entry {
+    uint64_t deadline; // SCHEDULER_NEVER while the device is idle
+    uint64_t synced;   // when the device was last brought up to date
+};
+
+// Timestamp ordered device events. Devices are advanced lazily: only when the cpu touches their
+// registers (they sync themselves to the clock then) or when something the cpu can't poll for,
+// like an interrupt, is due. The machine runs the cpu freely up to the earliest such event and
+// only then hands the device the time it has to catch up on. Idle devices have nothing scheduled
+// and cost nothing.
+struct scheduler {
+    const uint64_t *clock; // the bus clock, see struct bus
+    uint64_t next;         // earliest deadline, kept up to date on every change
+    struct scheduler_entry events[SCHEDULER_EVENT_COUNT];
+};
+
+// Allocates a scheduler with nothing scheduled, running on clock.
+struct scheduler *scheduler_new(const uint64_t *clock);
+
+// Allocates a copy of a scheduler for a forked machine, running on that machine's clock.
+struct scheduler *scheduler_fork(const struct scheduler *sched, const uint64_t *clock);
+
+void scheduler_delete(struct scheduler *sched);
+
+// Schedules the event cycles m-cycles after its device was last synced, replacing whatever was
+// scheduled for it. SIZE_MAX unschedules it.
+void scheduler_schedule(struct scheduler *sched, enum scheduler_event event, size_t cycles);
+
+// Marks the device as synced now and makes its event due right away, for when its state changed
+// under it (e.g. a loaded state).
+void scheduler_wake(struct scheduler *sched, enum scheduler_event event);
+
+// Marks the device as synced now, returns the m-cycles since it last was, which the device is
+// expected to catch up on.
+size_t scheduler_sync(struct scheduler *sched, enum scheduler_event event);
+
+// Takes the earliest event due by now out of the queue, syncing its device to the deadline.
+// Returns false if none is due. *elapsed gets the m-cycles from the previous sync to the deadline,
+// which the device is expected to catch up on, then schedule itself again.
+bool scheduler_pop(struct scheduler *sched, enum scheduler_event *event, size_t *elapsed);
+
+static inline uint64_t scheduler_now(const struct scheduler *sched) {
+    return *sched->clock;
+}
+
+// M-cycles the cpu can run for before the earliest event, at most SCHEDULER_MAX_SLICE. Only
+// meaningful once every due event has been popped.
+static inline size_t scheduler_slice(const struct scheduler *sched) {
+    uint64_t until = sched->next - scheduler_now(sched);
+
+    return until < SCHEDULER_MAX_SLICE ? until : SCHEDULER_MAX_SLICE;
+}
+
+#endif
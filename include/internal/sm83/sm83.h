@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 
+#include "internal/hash.h"
 #include "internal/memory/bus.h"
 #include "util.h"
 
@@ -42,11 +43,46 @@ struct sm83_register_file {
     uint16_t sp;
 };
 
+// ALU ops whose flags haven't been written to regs.f yet.
+enum sm83_lazy_op {
+    SM83_LAZY_NONE,
+    SM83_LAZY_ADD,
+    SM83_LAZY_SUB,
+    SM83_LAZY_INC,
+    SM83_LAZY_DEC,
+    SM83_LAZY_SHIFT,
+};
+
+// Enough of the last ALU op to compute its flags once something reads them.
+struct sm83_lazy_flags {
+    enum sm83_lazy_op op;
+    uint8_t x;     // first operand, or the result for inc/dec/shifts
+    uint8_t y;     // second operand
+    uint8_t carry; // carry in for add/sub, carry out for shifts, the untouched C for inc/dec
+};
+
+struct sm83_block_cache;
+struct sm83_jit;
+struct sm83_profile;
+
 struct sm83 {
     struct sm83_register_file regs;
 
     struct bus *bus;
 
+    // Optional, when set sm83_run executes rom code out of it. Not owned by the core.
+    struct sm83_block_cache *blocks;
+
+    // Optional, takes precedence over blocks. Not owned by the core.
+    struct sm83_jit *jit;
+
+    // Optional, only used by builds with SM83_PROFILE defined (see sm83_profile.h). Not owned by
+    // the core and never inherited by forks.
+    struct sm83_profile *profile;
+
+    // regs.f is stale while lazy.op isn't SM83_LAZY_NONE.
+    struct sm83_lazy_flags lazy;
+
     uint8_t opcode;
     SM83_REGISTER_PAIR(hi, lo) tmp;
     size_t m_cycle;
@@ -55,10 +91,50 @@ struct sm83 {
 // Allocates and initializes a new SM83 core.
 struct sm83 *sm83_new(struct bus *bus);
 
+// Allocates a copy of a core attached to another bus. The copy interprets until it's given a block
+// cache or jit of its own, neither may be used by two threads at once.
+struct sm83 *sm83_fork(const struct sm83 *cpu, struct bus *bus);
+
 // Deallocates the core, bus isn't deleted.
 void sm83_delete(struct sm83 *cpu);
 
-// Executes one machine cycle.
+// Executes one machine cycle. Flags may be left lazy, see sm83_sync_flags.
 void sm83_m_cycle(struct sm83 *cpu);
 
+// Writes any lazily kept flags to regs.f. sm83_step and sm83_run do this on their own, only
+// callers reading regs.f after driving sm83_m_cycle directly need it.
+void sm83_sync_flags(struct sm83 *cpu);
+
+// Executes one whole instruction, or finishes the current one if called in the middle of it.
+// Returns the number of machine cycles it took.
+size_t sm83_step(struct sm83 *cpu);
+
+// Executes whole instructions until at least `cycles` machine cycles have passed. Doesn't keep
+// bus timing within an instruction. Returns the number of machine cycles actually executed.
+size_t sm83_run(struct sm83 *cpu, size_t cycles);
+
+// Digest of the register file, for telling at a glance whether two cores agree. Flags have to be
+// synced, as they are after sm83_step and sm83_run.
+static inline uint64_t sm83_register_digest(const struct sm83_register_file *regs) {
+    return hash_bytes(regs, sizeof(struct sm83_register_file));
+}
+
+// Whether something hooked into sm83_m_cycle is attached (a profile or a trace), in which case
+// every instruction has to run through it rather than through a faster engine. Always false in
+// builds with neither SM83_PROFILE nor CGBE_TRACE defined.
+static inline bool sm83_hooked(const struct sm83 *cpu) {
+#ifdef SM83_PROFILE
+    if (cpu->profile != NULL) {
+        return true;
+    }
+#endif
+#ifdef CGBE_TRACE
+    if (cpu->bus->trace != NULL) {
+        return true;
+    }
+#endif
+    (void)cpu;
+    return false;
+}
+
 #endif
@@ -0,0 +1,32 @@
+#ifndef SM83_BLOCK_H
+#define SM83_BLOCK_H
+
+#include <stddef.h>
+
+#include "internal/sm83/sm83.h"
+#include "internal/sm83/sm83_exec.h"
+
+#define SM83_BLOCK_MAX_INSNS 32
+
+// Cache of straight-line runs of rom code, decoded once and keyed by (rom bank, pc). Only rom is
+// cached, so the cached code can only go stale through a bank switch, which changes the key.
+struct sm83_block_cache;
+
+// Allocates an empty block cache.
+struct sm83_block_cache *sm83_block_cache_new(void);
+
+// Deallocates the cache.
+void sm83_block_cache_delete(struct sm83_block_cache *cache);
+
+// Drops every cached block.
+void sm83_block_cache_flush(struct sm83_block_cache *cache);
+
+// Decodes the straight-line run of rom code starting at pc into insns, which must have room for
+// SM83_BLOCK_MAX_INSNS. The run never crosses into another rom bank and ends after anything that
+// may jump. Returns the number of instructions, 0 if not even the first one fits.
+size_t sm83_block_decode(struct bus *bus, uint16_t pc, struct sm83_insn *insns);
+
+// Same as sm83_run, but rom code is executed out of the cache.
+size_t sm83_block_run(struct sm83 *cpu, struct sm83_block_cache *cache, size_t cycles);
+
+#endif
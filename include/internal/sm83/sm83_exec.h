@@ -0,0 +1,535 @@
+#ifndef SM83_EXEC_H
+#define SM83_EXEC_H
+
+#include <stdlib.h>
+
+#include "internal/memory/bus.h"
+#include "internal/sm83/sm83.h"
+#include "internal/sm83/sm83_operands.h"
+
+// Instruction granular execution shared by sm83_step/sm83_run and the block cache. Instructions
+// are decoded up front into a struct sm83_insn and then executed in one go on a register file the
+// caller keeps in locals.
+
+struct sm83_insn {
+    uint8_t opcode;
+    uint8_t length; // in bytes, opcode included
+    uint16_t imm;   // imm8, imm16 or the CB prefixed opcode
+};
+
+// Instruction lengths in bytes.
+static const uint8_t sm83_op_length[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x00
+    1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x10
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x20
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xB0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // 0xC0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // 0xD0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // 0xE0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // 0xF0
+};
+
+// Reads the operands of an instruction, pc points right after the opcode.
+static inline struct sm83_insn sm83_decode(struct bus *bus, uint8_t opcode, uint16_t pc) {
+    struct sm83_insn insn = {.opcode = opcode, .length = sm83_op_length[opcode], .imm = 0};
+
+    if (insn.length > 1) {
+        insn.imm = bus_read(bus, pc);
+    }
+    if (insn.length > 2) {
+        insn.imm |= bus_read(bus, pc + 1) << 8;
+    }
+
+    return insn;
+}
+
+static inline void push16(struct sm83_register_file *r, struct bus *bus, uint16_t val) {
+    bus_write(bus, --r->sp, val / 256);
+    bus_write(bus, --r->sp, val % 256);
+}
+
+static inline uint16_t pop16(struct sm83_register_file *r, struct bus *bus) {
+    uint16_t lo = bus_read(bus, r->sp++);
+    return lo | (bus_read(bus, r->sp++) << 8);
+}
+
+static inline uint8_t get_r8(struct sm83_register_file *r, struct bus *bus, enum r8 reg) {
+    switch (reg) {
+    case r8_b: return r->b;
+    case r8_c: return r->c;
+    case r8_d: return r->d;
+    case r8_e: return r->e;
+    case r8_h: return r->h;
+    case r8_l: return r->l;
+    case r8_hl: return bus_read(bus, r->hl);
+    case r8_a: return r->a;
+    }
+    return 0;
+}
+
+static inline void set_r8(struct sm83_register_file *r, struct bus *bus, enum r8 reg, uint8_t val) {
+    switch (reg) {
+    case r8_b: r->b = val; break;
+    case r8_c: r->c = val; break;
+    case r8_d: r->d = val; break;
+    case r8_e: r->e = val; break;
+    case r8_h: r->h = val; break;
+    case r8_l: r->l = val; break;
+    case r8_hl: bus_write(bus, r->hl, val); break;
+    case r8_a: r->a = val; break;
+    }
+}
+
+static inline uint16_t *r16(struct sm83_register_file *r, enum r16 reg) {
+    switch (reg) {
+    case r16_bc: return &r->bc;
+    case r16_de: return &r->de;
+    case r16_hl: return &r->hl;
+    case r16_sp: return &r->sp;
+    }
+    return NULL;
+}
+
+static inline bool check_cond(const struct sm83_register_file *r, enum cond cc) {
+    switch (cc) {
+    case cond_nz: return !(r->f & SM83_Z_MASK);
+    case cond_z: return r->f & SM83_Z_MASK;
+    case cond_nc: return !(r->f & SM83_C_MASK);
+    case cond_c: return r->f & SM83_C_MASK;
+    }
+    return false;
+}
+
+static inline void mathop(struct sm83_register_file *r, enum mathop op, uint8_t x) {
+    uint8_t carry = (r->f & SM83_C_MASK) ? 1 : 0;
+    uint8_t a = r->a;
+
+    switch (op) {
+    case op_add: carry = 0; // fallthrough
+    case op_adc:
+        r->a = a + x + carry;
+        r->f = ((a & 0xF) + (x & 0xF) + carry > 0xF) ? SM83_H_MASK : 0;
+        r->f |= (a + x + carry > 0xFF) ? SM83_C_MASK : 0;
+        break;
+    case op_sub:
+    case op_cp: carry = 0; // fallthrough
+    case op_sbc:
+        r->f = SM83_N_MASK;
+        r->f |= ((a & 0xF) < (x & 0xF) + carry) ? SM83_H_MASK : 0;
+        r->f |= (a < x + carry) ? SM83_C_MASK : 0;
+        if (op != op_cp) {
+            r->a = a - x - carry;
+        } else {
+            r->f |= (a == x) ? SM83_Z_MASK : 0;
+            return;
+        }
+        break;
+    case op_and:
+        r->a = a & x;
+        r->f = SM83_H_MASK;
+        break;
+    case op_xor:
+        r->a = a ^ x;
+        r->f = 0;
+        break;
+    case op_or:
+        r->a = a | x;
+        r->f = 0;
+        break;
+    }
+
+    r->f |= (r->a == 0) ? SM83_Z_MASK : 0;
+}
+
+// RLC/RRC/RL/RR/SLA/SRA/SWAP/SRL, op is bits 3-5 of the CB prefixed opcode.
+static inline uint8_t shift(struct sm83_register_file *r, unsigned op, uint8_t x) {
+    bool c = r->f & SM83_C_MASK;
+    uint8_t res;
+
+    switch (op) {
+    case 0: res = (x << 1) | (x >> 7); break;
+    case 1: res = (x >> 1) | (x << 7); break;
+    case 2: res = (x << 1) | (c ? 1 : 0); break;
+    case 3: res = (x >> 1) | (c ? (1 << 7) : 0); break;
+    case 4: res = x << 1; break;
+    case 5: res = (x >> 1) | (x & (1 << 7)); break;
+    case 6: res = (x << 4) | (x >> 4); break;
+    default: res = x >> 1; break;
+    }
+
+    if (op == 6) {
+        r->f = 0;
+    } else if (op % 2 == 0) {
+        r->f = (x & (1 << 7)) ? SM83_C_MASK : 0;
+    } else {
+        r->f = (x & 1) ? SM83_C_MASK : 0;
+    }
+    r->f |= (res == 0) ? SM83_Z_MASK : 0;
+
+    return res;
+}
+
+static inline size_t cb_prefixed(struct sm83_register_file *r, struct bus *bus, uint8_t op) {
+    enum r8 reg = op & 0b00000111;
+    unsigned idx = (op & 0b00111000) >> 3;
+    uint8_t val = get_r8(r, bus, reg);
+
+    switch (op & 0b11000000) {
+    case 0b00000000: val = shift(r, idx, val); break;
+    case 0b01000000:
+        r->f &= SM83_C_MASK;
+        r->f |= SM83_H_MASK;
+        r->f |= (val & (1 << idx)) ? 0 : SM83_Z_MASK;
+        return reg == r8_hl ? 3 : 2;
+    case 0b10000000: val &= ~(1 << idx); break;
+    case 0b11000000: val |= 1 << idx; break;
+    }
+
+    set_r8(r, bus, reg, val);
+    return reg == r8_hl ? 4 : 2;
+}
+
+static inline uint16_t add_sp(struct sm83_register_file *r, uint8_t x) {
+    r->f = ((r->sp & 0xF) + (x & 0xF) > 0xF) ? SM83_H_MASK : 0;
+    r->f |= ((r->sp & 0xFF) + x > 0xFF) ? SM83_C_MASK : 0;
+    return r->sp + (int8_t)x;
+}
+
+static inline void daa(struct sm83_register_file *r) {
+    bool n = r->f & SM83_N_MASK;
+    uint8_t flags = r->f & SM83_N_MASK;
+    uint8_t adjustment = 0;
+
+    if ((r->f & SM83_H_MASK) || (!n && (r->a & 0xF) > 0x9)) {
+        adjustment |= 0x06;
+    }
+    if ((r->f & SM83_C_MASK) || (!n && r->a > 0x99)) {
+        adjustment |= 0x60;
+        flags |= SM83_C_MASK;
+    }
+
+    r->a += n ? -adjustment : adjustment;
+    r->f = flags | ((r->a == 0) ? SM83_Z_MASK : 0);
+}
+
+// M-cycles taken by each opcode, conditional ones are listed with the condition not met.
+static const uint8_t sm83_op_cycles[256] = {
+    1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1, // 0x00
+    1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1, // 0x10
+    2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1, // 0x20
+    2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1, // 0x30
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x40
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x50
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x60
+    2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1, // 0x70
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x80
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x90
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0xA0
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0xB0
+    2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 0, 3, 6, 2, 4, // 0xC0
+    2, 3, 3, 1, 3, 4, 2, 4, 2, 4, 3, 1, 3, 1, 2, 4, // 0xD0
+    3, 3, 2, 1, 1, 4, 2, 4, 4, 1, 4, 1, 1, 1, 2, 4, // 0xE0
+    3, 3, 2, 1, 1, 4, 2, 4, 3, 2, 4, 1, 1, 1, 2, 4, // 0xF0
+};
+
+// Points the bus clock at the last m-cycle of an instruction starting at start, which is when loads
+// and stores make their access, as they do under sm83_m_cycle. Read-modify-writes, pushes and
+// calls make some of theirs a cycle or two earlier.
+static inline void sm83_clock(struct bus *bus, uint64_t start, struct sm83_insn insn) {
+    size_t cycles = sm83_op_cycles[insn.opcode];
+
+    if (insn.opcode == 0xCB) {
+        uint8_t op = insn.imm % 256;
+        cycles = op % 8 != 6 ? 2 : (op & 0xC0) == 0x40 ? 3 : 4; // only [hl] operands take longer
+    }
+    bus->clock = start + cycles - 1;
+}
+
+// Executes a decoded instruction. Like with sm83_m_cycle, pc is expected to point right after the
+// opcode, the next opcode is left for the caller to fetch. Returns the number of m-cycles it took.
+static inline size_t sm83_execute(struct sm83_register_file *r, struct bus *bus,
+                                  struct sm83_insn insn) {
+    uint8_t op = insn.opcode;
+    uint8_t imm8 = insn.imm % 256;
+    size_t cycles = sm83_op_cycles[op];
+
+    r->pc += insn.length - 1;
+
+    switch (op) {
+    case 0x00: break; // NOP
+
+    case 0x01: // LD r16, imm16
+    case 0x11:
+    case 0x21:
+    case 0x31:
+        *r16(r, op >> 4) = insn.imm;
+        break;
+
+    case 0x02: bus_write(bus, r->bc, r->a); break;   // LD [bc], a
+    case 0x12: bus_write(bus, r->de, r->a); break;   // LD [de], a
+    case 0x22: bus_write(bus, r->hl++, r->a); break; // LD [hl+], a
+    case 0x32: bus_write(bus, r->hl--, r->a); break; // LD [hl-], a
+
+    case 0x0A: r->a = bus_read(bus, r->bc); break;   // LD a, [bc]
+    case 0x1A: r->a = bus_read(bus, r->de); break;   // LD a, [de]
+    case 0x2A: r->a = bus_read(bus, r->hl++); break; // LD a, [hl+]
+    case 0x3A: r->a = bus_read(bus, r->hl--); break; // LD a, [hl-]
+
+    case 0x08: { // LD [imm16], sp
+        bus_write(bus, insn.imm, r->sp % 256);
+        bus_write(bus, insn.imm + 1, r->sp / 256);
+        break;
+    }
+
+    case 0x03: // INC r16
+    case 0x13:
+    case 0x23:
+    case 0x33:
+        (*r16(r, op >> 4))++;
+        break;
+
+    case 0x0B: // DEC r16
+    case 0x1B:
+    case 0x2B:
+    case 0x3B:
+        (*r16(r, op >> 4))--;
+        break;
+
+    case 0x09: // ADD hl, r16
+    case 0x19:
+    case 0x29:
+    case 0x39: {
+        uint16_t x = r->hl;
+        uint16_t y = *r16(r, op >> 4);
+        r->f &= SM83_Z_MASK;
+        r->f |= ((x & 0xFFF) + (y & 0xFFF) > 0xFFF) ? SM83_H_MASK : 0;
+        r->f |= ((uint32_t)x + y > 0xFFFF) ? SM83_C_MASK : 0;
+        r->hl = x + y;
+        break;
+    }
+
+    case 0x04: // INC r8
+    case 0x0C:
+    case 0x14:
+    case 0x1C:
+    case 0x24:
+    case 0x2C:
+    case 0x34:
+    case 0x3C: {
+        enum r8 reg = (op >> 3) & 0b111;
+        uint8_t val = get_r8(r, bus, reg) + 1;
+        r->f &= SM83_C_MASK;
+        r->f |= ((val & 0xF) == 0) ? SM83_H_MASK : 0;
+        r->f |= (val == 0) ? SM83_Z_MASK : 0;
+        set_r8(r, bus, reg, val);
+        break;
+    }
+
+    case 0x05: // DEC r8
+    case 0x0D:
+    case 0x15:
+    case 0x1D:
+    case 0x25:
+    case 0x2D:
+    case 0x35:
+    case 0x3D: {
+        enum r8 reg = (op >> 3) & 0b111;
+        uint8_t val = get_r8(r, bus, reg) - 1;
+        r->f &= SM83_C_MASK;
+        r->f |= SM83_N_MASK;
+        r->f |= ((val & 0xF) == 0xF) ? SM83_H_MASK : 0;
+        r->f |= (val == 0) ? SM83_Z_MASK : 0;
+        set_r8(r, bus, reg, val);
+        break;
+    }
+
+    case 0x06: // LD r8, imm8
+    case 0x0E:
+    case 0x16:
+    case 0x1E:
+    case 0x26:
+    case 0x2E:
+    case 0x36:
+    case 0x3E: {
+        enum r8 reg = (op >> 3) & 0b111;
+        set_r8(r, bus, reg, imm8);
+        break;
+    }
+
+    case 0x07: // RLCA
+        r->f = (r->a & (1 << 7)) ? SM83_C_MASK : 0;
+        r->a = (r->a << 1) | (r->a >> 7);
+        break;
+    case 0x0F: // RRCA
+        r->f = (r->a & 1) ? SM83_C_MASK : 0;
+        r->a = (r->a >> 1) | (r->a << 7);
+        break;
+    case 0x17: { // RLA
+        bool c = r->f & SM83_C_MASK;
+        r->f = (r->a & (1 << 7)) ? SM83_C_MASK : 0;
+        r->a = (r->a << 1) | (c ? 1 : 0);
+        break;
+    }
+    case 0x1F: { // RRA
+        bool c = r->f & SM83_C_MASK;
+        r->f = (r->a & 1) ? SM83_C_MASK : 0;
+        r->a = (r->a >> 1) | (c ? (1 << 7) : 0);
+        break;
+    }
+    case 0x27: daa(r); break; // DAA
+    case 0x2F: // CPL
+        r->a = ~r->a;
+        r->f |= SM83_N_MASK | SM83_H_MASK;
+        break;
+    case 0x37: // SCF
+        r->f &= SM83_Z_MASK;
+        r->f |= SM83_C_MASK;
+        break;
+    case 0x3F: // CCF
+        r->f &= SM83_Z_MASK | SM83_C_MASK;
+        r->f ^= SM83_C_MASK;
+        break;
+
+    case 0x18: r->pc += (int8_t)imm8; break; // JR imm8
+
+    case 0x20: // JR cond, imm8
+    case 0x28:
+    case 0x30:
+    case 0x38:
+        if (check_cond(r, (op >> 3) & 0b11)) {
+            r->pc += (int8_t)imm8;
+            cycles += 1;
+        }
+        break;
+
+    case 0x10: exit(1); // STOP (implement later)
+    case 0x76: exit(1); // HALT (implement later)
+    case 0xD9: exit(1); // RETI (implement later)
+    case 0xF3: exit(1); // DI (implement later)
+    case 0xFB: exit(1); // EI (implement later)
+
+    case 0xC6: // ADD/ADC/SUB/SBC/AND/XOR/OR/CP a, imm8
+    case 0xCE:
+    case 0xD6:
+    case 0xDE:
+    case 0xE6:
+    case 0xEE:
+    case 0xF6:
+    case 0xFE:
+        mathop(r, (op >> 3) & 0b111, imm8);
+        break;
+
+    case 0xC0: // RET cond
+    case 0xC8:
+    case 0xD0:
+    case 0xD8:
+        if (check_cond(r, (op >> 3) & 0b11)) {
+            r->pc = pop16(r, bus);
+            cycles += 3;
+        }
+        break;
+
+    case 0xC9: r->pc = pop16(r, bus); break; // RET
+
+    case 0xC2: // JP cond, imm16
+    case 0xCA:
+    case 0xD2:
+    case 0xDA:
+        if (check_cond(r, (op >> 3) & 0b11)) {
+            r->pc = insn.imm;
+            cycles += 1;
+        }
+        break;
+
+    case 0xC3: r->pc = insn.imm; break; // JP imm16
+    case 0xE9: r->pc = r->hl; break;    // JP hl
+
+    case 0xC4: // CALL cond, imm16
+    case 0xCC:
+    case 0xD4:
+    case 0xDC:
+        if (check_cond(r, (op >> 3) & 0b11)) {
+            push16(r, bus, r->pc);
+            r->pc = insn.imm;
+            cycles += 3;
+        }
+        break;
+
+    case 0xCD: // CALL imm16
+        push16(r, bus, r->pc);
+        r->pc = insn.imm;
+        break;
+
+    case 0xC7: // RST vec
+    case 0xCF:
+    case 0xD7:
+    case 0xDF:
+    case 0xE7:
+    case 0xEF:
+    case 0xF7:
+    case 0xFF:
+        push16(r, bus, r->pc);
+        r->pc = op & 0b00111000;
+        break;
+
+    case 0xC1: r->bc = pop16(r, bus); break;                             // POP BC
+    case 0xD1: r->de = pop16(r, bus); break;                             // POP DE
+    case 0xE1: r->hl = pop16(r, bus); break;                             // POP HL
+    case 0xF1: r->af = pop16(r, bus) & (0xFF00 | SM83_ALL_FLAGS); break; // POP AF
+
+    case 0xC5: push16(r, bus, r->bc); break;                             // PUSH BC
+    case 0xD5: push16(r, bus, r->de); break;                             // PUSH DE
+    case 0xE5: push16(r, bus, r->hl); break;                             // PUSH HL
+    case 0xF5: push16(r, bus, r->af & (0xFF00 | SM83_ALL_FLAGS)); break; // PUSH AF
+
+    case 0xE0: bus_write(bus, 0xFF00 + imm8, r->a); break; // LDH [imm8], a
+    case 0xF0: r->a = bus_read(bus, 0xFF00 + imm8); break; // LDH a, [imm8]
+    case 0xE2: bus_write(bus, 0xFF00 + r->c, r->a); break; // LDH [c], a
+    case 0xF2: r->a = bus_read(bus, 0xFF00 + r->c); break; // LDH a, [c]
+    case 0xEA: bus_write(bus, insn.imm, r->a); break;      // LD [imm16], a
+    case 0xFA: r->a = bus_read(bus, insn.imm); break;      // LD a, [imm16]
+
+    case 0xE8: r->sp = add_sp(r, imm8); break; // ADD sp, imm8
+    case 0xF8: r->hl = add_sp(r, imm8); break; // LD hl, sp + imm8
+    case 0xF9: r->sp = r->hl; break;           // LD sp, hl
+
+    case 0xCB: cycles += cb_prefixed(r, bus, imm8); break; // 0xCB is a prefix for 2 byte ops
+
+    // Invalid opcodes, pc doesn't change making an inf loop. Stepping back makes the caller fetch
+    // the same opcode again.
+    case 0xD3:
+    case 0xDB:
+    case 0xDD:
+    case 0xE3:
+    case 0xE4:
+    case 0xEB:
+    case 0xEC:
+    case 0xED:
+    case 0xF4:
+    case 0xFC:
+    case 0xFD: r->pc--; break;
+
+    default:
+        if (op < 0x80) { // LD r8, r8
+            enum r8 dest = (op >> 3) & 0b111;
+            enum r8 source = op & 0b111;
+            set_r8(r, bus, dest, get_r8(r, bus, source));
+        } else { // ADD/ADC/SUB/SBC/AND/XOR/OR/CP a, r8
+            enum r8 reg = op & 0b111;
+            mathop(r, (op >> 3) & 0b111, get_r8(r, bus, reg));
+        }
+        break;
+    }
+
+    return cycles;
+}
+
+#endif
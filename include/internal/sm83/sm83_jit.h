@@ -0,0 +1,27 @@
+#ifndef SM83_JIT_H
+#define SM83_JIT_H
+
+#include <stddef.h>
+
+#include "internal/sm83/sm83.h"
+
+// Recompiles straight-line runs of rom code (see sm83_block_decode) into x86-64 code. Register
+// only instructions are translated, anything touching memory or pc is handed back to the
+// interpreter one instruction at a time. Only available on x86-64 unix hosts.
+struct sm83_jit;
+
+// Allocates a JIT with an empty code buffer, which is never writable and executable at once.
+// Returns NULL if the host isn't supported or no executable memory could be mapped, callers are
+// expected to keep interpreting in that case.
+struct sm83_jit *sm83_jit_new(void);
+
+// Deallocates the JIT and unmaps its code.
+void sm83_jit_delete(struct sm83_jit *jit);
+
+// Drops all compiled code.
+void sm83_jit_flush(struct sm83_jit *jit);
+
+// Same as sm83_run, but rom code is executed as compiled code.
+size_t sm83_jit_run(struct sm83 *cpu, struct sm83_jit *jit, size_t cycles);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef SM83_LANES_H
+#define SM83_LANES_H
+
+#include <stddef.h>
+
+#include "internal/sm83/sm83.h"
+
+// Runs many cores in lockstep, one per vector lane, for workloads where they mostly execute the
+// same rom code. Registers are kept as structure-of-arrays so register only instructions run as
+// loops over every lane at once, which the compiler turns into vector code (AVX2, AVX-512, NEON,
+// whatever -march allows). Lanes that diverge (different pc or rom banks) are masked out and
+// catch up later, anything touching memory runs through sm83_step lane by lane.
+
+// Lanes per call to sm83_lanes_run, 32 fills a 256 bit vector with one 8 bit register of each.
+#ifndef SM83_LANES
+#define SM83_LANES 32
+#endif
+
+// Runs up to SM83_LANES cores, each on its own bus, until every one of them has executed at
+// least `cycles` machine cycles. Stores how many each one actually ran in done, returns the sum.
+size_t sm83_lanes_run(struct sm83 **cpus, size_t count, size_t cycles, size_t *done);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SM83_OPERANDS_H
+#define SM83_OPERANDS_H
+
+// Operand encodings, values match the bit fields of the opcodes they are decoded from.
+
+enum r8 { r8_b, r8_c, r8_d, r8_e, r8_h, r8_l, r8_hl, r8_a };
+enum r16 { r16_bc, r16_de, r16_hl, r16_sp };
+enum r16stk { r16stk_bc, r16stk_de, r16stk_hl, r16stk_af };
+enum r16mem { r16mem_bc, r16mem_de, r16mem_hli, r16mem_hld };
+enum cond { cond_nz, cond_z, cond_nc, cond_c };
+enum mathop { op_add, op_adc, op_sub, op_sbc, op_and, op_xor, op_or, op_cp };
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef SM83_PROFILE_H
+#define SM83_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "internal/sm83/sm83.h"
+
+// Counts what the guest spends its time on: executions, m-cycles and host time per opcode (the
+// 0xCB page separately) and per instruction address, plus m-cycles per call stack as tracked
+// through CALL/RST and RET. The hooks only exist in builds with SM83_PROFILE defined (make
+// PROFILE=1), anything else doesn't even check cpu->profile.
+//
+// While a profile is attached sm83_step, sm83_run and sm83_lanes_run execute everything through
+// sm83_m_cycle, ignoring the block cache and jit, so all of it gets counted. Host times include
+// the profiler's own overhead of a clock read per instruction.
+struct sm83_profile;
+
+#ifdef SM83_PROFILE
+#define SM83_PROFILE_ENABLED true
+#else
+#define SM83_PROFILE_ENABLED false
+#endif
+
+// Opcode slots, 0x000-0x0FF are plain opcodes and 0x100-0x1FF the ones after a 0xCB prefix.
+#define SM83_PROFILE_OPCODES 512
+
+// Calls nested deeper than this are counted towards the deepest tracked one.
+#define SM83_PROFILE_MAX_DEPTH 256
+
+// Allocates an empty profile, attach it with cpu->profile.
+struct sm83_profile *sm83_profile_new(void);
+
+// Deallocates the profile.
+void sm83_profile_delete(struct sm83_profile *profile);
+
+// Prints every executed opcode and the `sites` hottest instruction addresses, both sorted by
+// host time, as tab separated lines.
+void sm83_profile_report(const struct sm83_profile *profile, FILE *out, size_t sites);
+
+// Prints m-cycles per call stack in the collapsed format flamegraph.pl and friends read, one
+// "root;bank:addr;bank:addr m-cycles" line per stack.
+void sm83_profile_collapsed(const struct sm83_profile *profile, FILE *out);
+
+// Hooks called by the core, see the inline wrappers below.
+void sm83_profile_m_cycle(struct sm83_profile *profile, const struct sm83 *cpu);
+void sm83_profile_call(struct sm83_profile *profile, const struct sm83 *cpu);
+void sm83_profile_ret(struct sm83_profile *profile, const struct sm83 *cpu);
+
+// Before every m-cycle.
+static inline void sm83_profile_hook_m_cycle(const struct sm83 *cpu) {
+#ifdef SM83_PROFILE
+    if (cpu->profile != NULL) {
+        sm83_profile_m_cycle(cpu->profile, cpu);
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+// Right after a call pushed the return address and set pc to the callee.
+static inline void sm83_profile_hook_call(const struct sm83 *cpu) {
+#ifdef SM83_PROFILE
+    if (cpu->profile != NULL) {
+        sm83_profile_call(cpu->profile, cpu);
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+// Right before a return pops the return address.
+static inline void sm83_profile_hook_ret(const struct sm83 *cpu) {
+#ifdef SM83_PROFILE
+    if (cpu->profile != NULL) {
+        sm83_profile_ret(cpu->profile, cpu);
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+#endif
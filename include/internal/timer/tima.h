@@ -0,0 +1,46 @@
+#ifndef TIMA_H
+#define TIMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal/memory/bus.h"
+#include "internal/scheduler.h"
+
+#define TIMA_TAC_ENABLE (1 << 2)
+#define TIMA_TAC_CLOCK 0x03
+
+// DIV, TIMA, TMA and TAC. Nothing runs per cycle: the registers catch up on the time passed
+// whenever they're accessed, and the only event scheduled is TIMA's next overflow, for its
+// interrupt. TIMA is reloaded and the interrupt requested on the overflow itself rather than a
+// cycle later. Named after TIMA as timer_* is taken by POSIX timers.
+struct tima {
+    struct bus *bus;
+    struct scheduler *scheduler; // the timer's event is TIMA's next overflow
+
+    uint16_t counter; // t-cycles, 4 per m-cycle, DIV is the upper byte
+    uint8_t tima;
+    uint8_t tma;
+    uint8_t tac;
+};
+
+// Constructs a timer and maps its registers into the bus.
+struct tima *tima_new(struct bus *bus, struct scheduler *scheduler);
+
+// Constructs a copy of a timer for a forked bus.
+struct tima *tima_fork(const struct tima *timer, struct bus *bus, struct scheduler *scheduler);
+
+// Deallocates the timer, bus isn't deleted.
+void tima_delete(struct tima *timer);
+
+// Advances the timer by m-cycles, then schedules its next overflow. Meant to be called when
+// SCHEDULER_TIMER fires.
+void tima_tick(struct tima *timer, size_t cycles);
+
+// Brings the timer up to the bus clock.
+void tima_sync(struct tima *timer);
+
+// Reschedules the timer after its registers were changed directly, e.g. when loading a state.
+void tima_refresh(struct tima *timer);
+
+#endif
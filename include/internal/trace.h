@@ -0,0 +1,129 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Execution traces: one fixed-size record per instruction, written into a single producer single
+// consumer ring by the emulating thread and streamed to disk by a writer thread of the trace's
+// own. The hooks only exist in builds with CGBE_TRACE defined (make TRACE=1), anything else
+// doesn't even check bus->trace. While a trace is attached the core runs every instruction through
+// sm83_m_cycle (see sm83_hooked), which is where records start.
+//
+// On disk each record is XORed with the one before it and only its non-zero bytes are stored,
+// preceded by a bitmask of which ones those are. Consecutive instructions mostly differ in pc and
+// a register or two, so that's usually a fraction of the record. Records are stored in host byte
+// order, decode them on the same kind of machine that wrote them.
+
+#ifdef CGBE_TRACE
+#define CGBE_TRACE_ENABLED true
+#else
+#define CGBE_TRACE_ENABLED false
+#endif
+
+#define TRACE_MAGIC "CGBT"
+#define TRACE_VERSION 1
+
+// Accesses stored per record, anything after that is only counted. The longest instructions
+// (CALL, LD [imm16], sp) make 5 including the fetch of the next opcode.
+#define TRACE_MAX_ACCESSES 6
+
+// Records in the ring, must be a power of 2. The emulating thread waits for the writer when it's
+// full, so nothing is ever dropped.
+#define TRACE_RING_SIZE (1 << 16)
+
+// Records published to the writer at a time.
+#define TRACE_PUBLISH 256
+
+#define TRACE_ACCESS_WRITE 0x01
+
+struct trace_access {
+    uint16_t address;
+    uint8_t val;
+    uint8_t flags;
+};
+
+// One instruction, registers as they were before it ran.
+struct trace_record {
+    uint16_t pc; // address of the opcode
+    uint16_t bank;
+    uint8_t opcode;
+    uint8_t accesses; // bus accesses made, from the operands to the fetch of the next opcode
+    uint16_t af;
+    uint16_t bc;
+    uint16_t de;
+    uint16_t hl;
+    uint16_t sp;
+    struct trace_access access[TRACE_MAX_ACCESSES];
+};
+
+struct trace {
+    struct trace_record *ring;
+
+    // Records published by the emulating thread and written out by the writer, both only ever
+    // grow. Separate cache lines so neither side's stores slow down the other's loads.
+    alignas(64) atomic_size_t head;
+    alignas(64) atomic_size_t tail;
+
+    // Only touched by the emulating thread.
+    alignas(64) size_t next;      // index of current, published in batches of TRACE_PUBLISH
+    size_t cached_tail;           // the last look at tail
+    struct trace_record *current; // being filled, NULL before the first instruction
+
+    atomic_bool stop;
+    FILE *out;
+    pthread_t writer;
+};
+
+// Creates the trace file and starts its writer thread, attach it with bus->trace.
+struct trace *trace_new(const char *fname);
+
+// Writes out everything recorded so far, stops the writer and closes the file.
+void trace_delete(struct trace *trace);
+
+// Slow path of trace_next, publishes everything before next and waits for a free slot.
+void trace_sync(struct trace *trace);
+
+// Checks the header of a trace file, leaving it positioned at the first record.
+bool trace_read_header(FILE *in);
+
+// Reads the next record. record has to hold the previous record (zeroed for the first one), as
+// that's what it's encoded against. Returns false at the end of the file.
+bool trace_read(FILE *in, struct trace_record *record);
+
+// Finishes the current record and returns the next one, with no accesses and everything else
+// left for the caller to fill.
+static inline struct trace_record *trace_next(struct trace *trace) {
+    if (trace->current != NULL) {
+        trace->next++;
+    }
+    if (trace->next % TRACE_PUBLISH == 0 || trace->next - trace->cached_tail == TRACE_RING_SIZE) {
+        trace_sync(trace);
+    }
+
+    trace->current = &trace->ring[trace->next % TRACE_RING_SIZE];
+    trace->current->accesses = 0;
+
+    return trace->current;
+}
+
+// Records a bus access made by the current instruction.
+static inline void trace_access(struct trace *trace, uint16_t address, uint8_t val, uint8_t flags) {
+    struct trace_record *record = trace->current;
+
+    if (record == NULL) {
+        return;
+    }
+    if (record->accesses < TRACE_MAX_ACCESSES) {
+        record->access[record->accesses] = (struct trace_access){address, val, flags};
+    }
+    if (record->accesses < UINT8_MAX) {
+        record->accesses++;
+    }
+}
+
+#endif
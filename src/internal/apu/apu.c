@@ -0,0 +1,461 @@
+#include "internal/apu/apu.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLOCK_RATE (1 << 22) // t-cycles per second
+
+// Registers past the channels' ones, as offsets from 0xFF10.
+#define NR10 0x00
+#define NR32 0x0C
+#define NR43 0x12
+#define NR50 0x14
+#define NR51 0x15
+#define NR52 0x16
+
+#define NR52_ON (1 << 7)
+#define NRX4_TRIGGER (1 << 7)
+#define NRX4_LENGTH (1 << 6)
+
+#define SEQUENCER_STEP 8192 // t-cycles, the frame sequencer steps at 512Hz
+
+// Height of one level of one channel at full master volume, all four channels at their loudest
+// add up to a bit under INT16_MAX.
+#define AMP_SCALE 64
+
+// Bits read back as 1 whatever was written.
+static const uint8_t read_masks[APU_REGS] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F, 0xFF, 0x9F, 0xFF, 0xBF, 0xFF,
+    0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00, 0x70, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Square duty cycles, a bit per step, high when it's set.
+static const uint8_t duties[4] = {0x80, 0x81, 0xE1, 0x7E};
+
+// A channel's NRx0-NRx4, square 2 and noise have no NRx0.
+static uint8_t *reg(struct apu *apu, enum apu_channel_id ch, size_t i) {
+    return &apu->regs[5 * ch + i];
+}
+
+static uint16_t frequency(struct apu *apu, enum apu_channel_id ch) {
+    return *reg(apu, ch, 3) | (*reg(apu, ch, 4) & 0x07) << 8;
+}
+
+// T-cycles between two waveform steps.
+static uint32_t period(struct apu *apu, enum apu_channel_id ch) {
+    switch (ch) {
+    case APU_SQUARE1:
+    case APU_SQUARE2: return (2048 - frequency(apu, ch)) * 4;
+    case APU_WAVE: return (2048 - frequency(apu, ch)) * 2;
+    case APU_NOISE: break;
+    case APU_CHANNELS: assert(false);
+    }
+
+    uint8_t nr43 = apu->regs[NR43];
+    uint32_t divisor = nr43 % 8 != 0 ? nr43 % 8 * 16 : 8;
+    return divisor << (nr43 >> 4);
+}
+
+// The channel's output, 0-15.
+static uint8_t level(struct apu *apu, enum apu_channel_id ch) {
+    const struct apu_channel *c = &apu->channels[ch];
+
+    if (!c->on) {
+        return 0;
+    }
+
+    switch (ch) {
+    case APU_SQUARE1:
+    case APU_SQUARE2: return (duties[*reg(apu, ch, 1) >> 6] >> c->position) & 1 ? c->volume : 0;
+    case APU_WAVE: break;
+    case APU_NOISE: return apu->lfsr & 1 ? 0 : c->volume;
+    case APU_CHANNELS: assert(false);
+    }
+
+    uint8_t sample = apu->regs[APU_WAVE_RAM + c->position / 2] >> (c->position % 2 ? 0 : 4);
+    uint8_t shift = (apu->regs[NR32] >> 5) & 0x03;
+    return shift != 0 ? (sample & 0x0F) >> (shift - 1) : 0;
+}
+
+// Hands the channel's level changes at t-cycle t of the current frame to the output.
+static void emit(struct apu *apu, enum apu_channel_id ch, uint64_t t) {
+    struct apu_channel *c = &apu->channels[ch];
+
+    if (apu->output[0] == NULL) {
+        return;
+    }
+
+    uint8_t out = level(apu, ch);
+    for (size_t side = 0; side < 2; side++) {
+        unsigned shift = side == 0 ? 4 : 0; // left is the upper half of NR50 and NR51
+        bool panned = (apu->regs[NR51] >> (shift + ch)) & 1;
+        int32_t volume = ((apu->regs[NR50] >> shift) & 0x07) + 1;
+        int32_t amp = panned ? out * volume * AMP_SCALE : 0;
+
+        if (amp != c->amp[side]) {
+            blip_add_delta(apu->output[side], t, amp - c->amp[side]);
+            c->amp[side] = amp;
+        }
+    }
+}
+
+static void emit_all(struct apu *apu, uint64_t t) {
+    for (size_t ch = 0; ch < APU_CHANNELS; ch++) {
+        emit(apu, ch, t);
+    }
+}
+
+// Moves the waveform one step on.
+static void advance(struct apu *apu, enum apu_channel_id ch) {
+    struct apu_channel *c = &apu->channels[ch];
+
+    switch (ch) {
+    case APU_SQUARE1:
+    case APU_SQUARE2: c->position = (c->position + 1) % 8; break;
+    case APU_WAVE: c->position = (c->position + 1) % 32; break;
+    case APU_NOISE: {
+        uint16_t bit = (apu->lfsr ^ (apu->lfsr >> 1)) & 1;
+        apu->lfsr = (apu->lfsr >> 1) | bit << 14;
+        if (apu->regs[NR43] & 0x08) { // 7 bit mode
+            apu->lfsr = (apu->lfsr & ~0x40) | bit << 6;
+        }
+        break;
+    }
+    case APU_CHANNELS: assert(false);
+    }
+}
+
+// Whether the channel's level stays the same whatever step its waveform is at.
+static bool silent(struct apu *apu, enum apu_channel_id ch) {
+    switch (ch) {
+    case APU_SQUARE1:
+    case APU_SQUARE2:
+    case APU_NOISE: return apu->channels[ch].volume == 0;
+    case APU_WAVE: return (apu->regs[NR32] & 0x60) == 0;
+    case APU_CHANNELS: assert(false);
+    }
+    return false;
+}
+
+// Steps the channel's waveform through the first t-cycles of the current frame, handing every
+// edge to the output. Silent channels skip to where they end up, noise's lfsr is left as is then.
+static void run_channel(struct apu *apu, enum apu_channel_id ch, uint64_t cycles) {
+    struct apu_channel *c = &apu->channels[ch];
+    uint64_t p = period(apu, ch);
+    uint64_t t = c->timer;
+
+    if (!c->on || t >= cycles) {
+        c->timer -= c->on ? cycles : 0;
+        return;
+    }
+
+    if (silent(apu, ch)) {
+        uint64_t steps = (cycles - t - 1) / p + 1;
+        c->position = (c->position + steps) % (ch == APU_WAVE ? 32 : 8);
+        t += steps * p;
+    }
+    for (; t < cycles; t += p) {
+        advance(apu, ch);
+        emit(apu, ch, t);
+    }
+    c->timer = t - cycles;
+}
+
+// The frequency the sweep goes to next, past 2047 turns square 1 off.
+static uint16_t sweep_target(struct apu *apu) {
+    uint8_t nr10 = apu->regs[NR10];
+    uint16_t delta = apu->shadow >> (nr10 & 0x07);
+
+    return nr10 & 0x08 ? apu->shadow - delta : apu->shadow + delta;
+}
+
+static void clock_sweep(struct apu *apu) {
+    struct apu_channel *c = &apu->channels[APU_SQUARE1];
+    uint8_t pace = (apu->regs[NR10] >> 4) & 0x07;
+
+    if (--apu->sweep != 0) {
+        return;
+    }
+    apu->sweep = pace != 0 ? pace : 8;
+    if (!apu->sweeping || pace == 0) {
+        return;
+    }
+
+    uint16_t target = sweep_target(apu);
+    if (target > 2047) {
+        c->on = false;
+    } else if ((apu->regs[NR10] & 0x07) != 0) {
+        apu->shadow = target;
+        *reg(apu, APU_SQUARE1, 3) = target % 256;
+        *reg(apu, APU_SQUARE1, 4) = (*reg(apu, APU_SQUARE1, 4) & ~0x07) | target / 256;
+        c->on = sweep_target(apu) <= 2047;
+    }
+}
+
+static void clock_envelope(struct apu *apu, enum apu_channel_id ch) {
+    struct apu_channel *c = &apu->channels[ch];
+    uint8_t nrx2 = *reg(apu, ch, 2);
+
+    if (nrx2 % 8 == 0 || --c->envelope != 0) {
+        return;
+    }
+    c->envelope = nrx2 % 8;
+    if (nrx2 & 0x08) {
+        c->volume += c->volume < 15;
+    } else {
+        c->volume -= c->volume > 0;
+    }
+}
+
+// Lengths on even steps, the sweep on steps 2 and 6, envelopes on step 7.
+static void clock_sequencer(struct apu *apu) {
+    uint8_t step = apu->step;
+
+    apu->step = (step + 1) % 8;
+    if (step % 2 == 0) {
+        for (size_t ch = 0; ch < APU_CHANNELS; ch++) {
+            struct apu_channel *c = &apu->channels[ch];
+            if ((*reg(apu, ch, 4) & NRX4_LENGTH) && c->length != 0 && --c->length == 0) {
+                c->on = false;
+            }
+        }
+    }
+    if (step == 2 || step == 6) {
+        clock_sweep(apu);
+    }
+    if (step == 7) {
+        clock_envelope(apu, APU_SQUARE1);
+        clock_envelope(apu, APU_SQUARE2);
+        clock_envelope(apu, APU_NOISE);
+    }
+    emit_all(apu, 0);
+}
+
+// Runs for t-cycles, a frame sequencer step at most at a time. The output's frames end on every
+// step, so the channels' edges are only ever timed from the last one.
+static void run(struct apu *apu, uint64_t cycles) {
+    while (cycles > 0) {
+        uint64_t slice = SEQUENCER_STEP - apu->sequencer;
+        slice = cycles < slice ? cycles : slice;
+
+        if (apu->output[0] != NULL) {
+            // Nobody read the oldest samples in time, make room by dropping them.
+            if (blip_room(apu->output[0]) == 0) {
+                blip_read(apu->output[0], NULL, APU_BUFFER_SAMPLES / 4, 1);
+                blip_read(apu->output[1], NULL, APU_BUFFER_SAMPLES / 4, 1);
+            }
+
+            uint64_t room = blip_room(apu->output[0]);
+            slice = room < slice ? room : slice;
+            for (size_t ch = 0; ch < APU_CHANNELS; ch++) {
+                run_channel(apu, ch, slice);
+            }
+            blip_end_frame(apu->output[0], slice);
+            blip_end_frame(apu->output[1], slice);
+        }
+
+        apu->sequencer += slice;
+        cycles -= slice;
+        if (apu->sequencer == SEQUENCER_STEP) {
+            apu->sequencer = 0;
+            if (apu->regs[NR52] & NR52_ON) {
+                clock_sequencer(apu);
+            }
+        }
+    }
+}
+
+static void trigger(struct apu *apu, enum apu_channel_id ch) {
+    struct apu_channel *c = &apu->channels[ch];
+
+    c->on = c->dac;
+    if (c->length == 0) {
+        c->length = ch == APU_WAVE ? 256 : 64;
+    }
+    c->timer = period(apu, ch);
+    c->volume = *reg(apu, ch, 2) >> 4;
+    c->envelope = *reg(apu, ch, 2) % 8;
+
+    if (ch == APU_WAVE) {
+        c->position = 0;
+    }
+    if (ch == APU_NOISE) {
+        apu->lfsr = 0x7FFF;
+    }
+    if (ch == APU_SQUARE1) {
+        uint8_t pace = (apu->regs[NR10] >> 4) & 0x07;
+        uint8_t shift = apu->regs[NR10] & 0x07;
+
+        apu->shadow = frequency(apu, ch);
+        apu->sweep = pace != 0 ? pace : 8;
+        apu->sweeping = pace != 0 || shift != 0;
+        if (shift != 0 && sweep_target(apu) > 2047) {
+            c->on = false;
+        }
+    }
+}
+
+// Turning the apu off clears every register but wave ram, and keeps them cleared until it's back.
+static void power_off(struct apu *apu) {
+    memset(apu->regs, 0, NR52);
+    for (size_t ch = 0; ch < APU_CHANNELS; ch++) {
+        struct apu_channel *c = &apu->channels[ch];
+        *c = (struct apu_channel){.amp = {c->amp[0], c->amp[1]}};
+    }
+}
+
+static uint8_t reg_read(void *ctx, uint16_t address) {
+    struct apu *apu = ctx;
+    size_t r = address - 0xFF10;
+
+    apu_sync(apu);
+
+    if (r == NR52) {
+        uint8_t val = apu->regs[NR52] | read_masks[NR52];
+        for (size_t ch = 0; ch < APU_CHANNELS; ch++) {
+            val |= apu->channels[ch].on << ch;
+        }
+        return val;
+    }
+    return apu->regs[r] | read_masks[r];
+}
+
+static void reg_write(void *ctx, uint16_t address, uint8_t val) {
+    struct apu *apu = ctx;
+    size_t r = address - 0xFF10;
+
+    apu_sync(apu);
+
+    if (r >= APU_WAVE_RAM) {
+        apu->regs[r] = val;
+        emit(apu, APU_WAVE, 0);
+        return;
+    }
+    if (r == NR52) {
+        if (!(val & NR52_ON)) {
+            power_off(apu);
+        } else if (!(apu->regs[NR52] & NR52_ON)) {
+            apu->sequencer = 0;
+            apu->step = 0;
+        }
+        apu->regs[NR52] = val & NR52_ON;
+        emit_all(apu, 0);
+        return;
+    }
+    if (!(apu->regs[NR52] & NR52_ON) || r > NR52) {
+        return;
+    }
+
+    apu->regs[r] = val;
+    if (r == NR50 || r == NR51) {
+        emit_all(apu, 0);
+        return;
+    }
+
+    enum apu_channel_id ch = r / 5;
+    struct apu_channel *c = &apu->channels[ch];
+    switch (r % 5) {
+    case 0:
+        if (ch == APU_WAVE) {
+            c->dac = val & 0x80;
+            c->on &= c->dac;
+        }
+        break;
+    case 1: c->length = ch == APU_WAVE ? 256 - val : 64 - val % 64; break;
+    case 2:
+        if (ch != APU_WAVE) {
+            c->dac = (val & 0xF8) != 0;
+            c->on &= c->dac;
+        }
+        break;
+    case 4:
+        if (val & NRX4_TRIGGER) {
+            trigger(apu, ch);
+        }
+        break;
+    }
+    emit(apu, ch, 0);
+}
+
+static void attach(struct apu *apu) {
+    bus_map_io(apu->bus, 0x10, APU_REGS, (struct bus_handler){reg_read, reg_write, apu});
+}
+
+struct apu *apu_new(struct bus *bus) {
+    struct apu *apu = calloc(1, sizeof(struct apu));
+    assert(apu != NULL);
+
+    apu->bus = bus;
+    apu->synced = bus->clock;
+    apu->sweep = 8;
+    apu->lfsr = 0x7FFF;
+
+    // What the boot rom leaves, minus its chime.
+    apu->regs[NR50] = 0x77;
+    apu->regs[NR51] = 0xF3;
+    apu->regs[NR52] = NR52_ON;
+
+    attach(apu);
+
+    return apu;
+}
+
+struct apu *apu_fork(const struct apu *apu, struct bus *bus) {
+    struct apu *fork = malloc(sizeof(struct apu));
+    assert(fork != NULL);
+
+    *fork = *apu;
+    fork->bus = bus;
+    fork->output[0] = NULL;
+    fork->output[1] = NULL;
+
+    attach(fork);
+
+    return fork;
+}
+
+void apu_delete(struct apu *apu) {
+    if (apu == NULL) {
+        return;
+    }
+
+    blip_delete(apu->output[0]);
+    blip_delete(apu->output[1]);
+    free(apu);
+}
+
+void apu_set_rate(struct apu *apu, size_t rate) {
+    apu_sync(apu);
+
+    for (size_t side = 0; side < 2; side++) {
+        blip_delete(apu->output[side]);
+        apu->output[side] = rate != 0 ? blip_new(CLOCK_RATE, rate, APU_BUFFER_SAMPLES) : NULL;
+        for (size_t ch = 0; ch < APU_CHANNELS; ch++) {
+            apu->channels[ch].amp[side] = 0;
+        }
+    }
+    emit_all(apu, 0);
+}
+
+void apu_sync(struct apu *apu) {
+    uint64_t now = apu->bus->clock;
+
+    run(apu, 4 * (now - apu->synced));
+    apu->synced = now;
+}
+
+size_t apu_read_samples(struct apu *apu, int16_t *out, size_t count) {
+    if (apu->output[0] == NULL) {
+        return 0;
+    }
+
+    size_t n = blip_read(apu->output[0], out, count, 2);
+    blip_read(apu->output[1], out + 1, n, 2);
+    return n;
+}
+
+void apu_refresh(struct apu *apu) {
+    apu->synced = apu->bus->clock;
+    emit_all(apu, 0);
+}
@@ -0,0 +1,123 @@
+#include "internal/apu/blip.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PI 3.14159265358979323846
+
+// Cutoff of the step filter relative to the output's nyquist frequency, a little below it so the
+// transition band fits in BLIP_TAPS.
+#define CUTOFF 0.9
+
+// The dc blocker forgets 1 / 2^HIGH_PASS of the sum every sample, around 15Hz at 48kHz.
+#define HIGH_PASS 9
+
+// Windowed sinc, x in samples from its center.
+static double impulse(double x) {
+    double half = BLIP_TAPS / 2;
+
+    if (fabs(x) >= half) {
+        return 0;
+    }
+
+    double window = 0.42 + 0.5 * cos(PI * x / half) + 0.08 * cos(2 * PI * x / half);
+    double sinc = x == 0 ? 1 : sin(PI * CUTOFF * x) / (PI * CUTOFF * x);
+    return window * sinc;
+}
+
+// Samples the impulse at every phase, each phase scaled to sum to exactly 1 << 15 so a step
+// always ends up at its full height however it's rounded.
+static void make_kernel(struct blip *blip) {
+    for (size_t phase = 0; phase < BLIP_PHASES; phase++) {
+        double taps[BLIP_TAPS];
+        double total = 0;
+
+        for (size_t i = 0; i < BLIP_TAPS; i++) {
+            taps[i] = impulse(i - BLIP_TAPS / 2.0 - (double)phase / BLIP_PHASES);
+            total += taps[i];
+        }
+
+        int32_t error = 1 << 15;
+        size_t peak = 0;
+        for (size_t i = 0; i < BLIP_TAPS; i++) {
+            blip->kernel[phase][i] = lround(taps[i] / total * (1 << 15));
+            error -= blip->kernel[phase][i];
+            peak = taps[i] > taps[peak] ? i : peak;
+        }
+        blip->kernel[phase][peak] += error;
+    }
+}
+
+struct blip *blip_new(size_t clock_rate, size_t rate, size_t size) {
+    struct blip *blip = malloc(sizeof(struct blip));
+    assert(blip != NULL);
+
+    blip->factor = ((uint64_t)rate << BLIP_FRAC) / clock_rate;
+    blip->offset = 0;
+    blip->sum = 0;
+    blip->size = size;
+    blip->buf = calloc(size + BLIP_TAPS, sizeof(int32_t));
+    assert(blip->buf != NULL);
+    make_kernel(blip);
+
+    return blip;
+}
+
+void blip_delete(struct blip *blip) {
+    if (blip == NULL) {
+        return;
+    }
+
+    free(blip->buf);
+    free(blip);
+}
+
+void blip_add_delta(struct blip *blip, uint64_t t, int32_t delta) {
+    uint64_t pos = blip->offset + t * blip->factor;
+    size_t i = pos >> BLIP_FRAC;
+    size_t phase = (pos % (UINT64_C(1) << BLIP_FRAC)) * BLIP_PHASES >> BLIP_FRAC;
+    const int16_t *taps = blip->kernel[phase];
+
+    assert(i < blip->size);
+    for (size_t j = 0; j < BLIP_TAPS; j++) {
+        blip->buf[i + j] += delta * taps[j];
+    }
+}
+
+void blip_end_frame(struct blip *blip, uint64_t clocks) {
+    blip->offset += clocks * blip->factor;
+    assert(blip_available(blip) <= blip->size);
+}
+
+size_t blip_available(const struct blip *blip) {
+    return blip->offset >> BLIP_FRAC;
+}
+
+uint64_t blip_room(const struct blip *blip) {
+    uint64_t end = (uint64_t)blip->size << BLIP_FRAC;
+
+    return blip->offset < end ? (end - blip->offset - 1) / blip->factor : 0;
+}
+
+size_t blip_read(struct blip *blip, int16_t *out, size_t count, size_t stride) {
+    size_t n = count < blip_available(blip) ? count : blip_available(blip);
+
+    for (size_t i = 0; i < n; i++) {
+        blip->sum += blip->buf[i];
+
+        int32_t sample = blip->sum / (1 << 15);
+        sample = sample < INT16_MIN ? INT16_MIN : sample > INT16_MAX ? INT16_MAX : sample;
+        if (out != NULL) {
+            out[i * stride] = sample;
+        }
+        blip->sum -= blip->sum / (1 << HIGH_PASS);
+    }
+
+    memmove(blip->buf, blip->buf + n, (blip->size + BLIP_TAPS - n) * sizeof(int32_t));
+    memset(blip->buf + blip->size + BLIP_TAPS - n, 0, n * sizeof(int32_t));
+    blip->offset -= (uint64_t)n << BLIP_FRAC;
+
+    return n;
+}
@@ -0,0 +1,123 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, sysconf
+
+#include "internal/batch.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internal/cgbe.h"
+#include "internal/sm83/sm83_block.h"
+#include "internal/sm83/sm83_jit.h"
+
+struct worker {
+    // Next unstarted job of this worker's share, thieves take from it too. Each worker gets its
+    // own cache line so claiming a job doesn't bounce anyone else's.
+    alignas(64) atomic_size_t next;
+    size_t end;
+
+    size_t index;
+    struct batch_job *jobs;
+    struct worker *workers;
+    size_t count;
+    pthread_t thread;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+
+    // Code caches are per thread. They're keyed by (rom bank, pc) only, so they get flushed
+    // whenever the next job runs another rom. The rom they were filled from stays referenced,
+    // which keeps it mapped between jobs and its address from being reused by another rom.
+    struct sm83_jit *jit = sm83_jit_new();
+    struct sm83_block_cache *blocks = jit == NULL ? sm83_block_cache_new() : NULL;
+    struct rom *cached = NULL;
+
+    // Own share first, then everyone else's.
+    for (size_t i = 0; i < w->count; i++) {
+        struct worker *victim = &w->workers[(w->index + i) % w->count];
+        size_t job;
+
+        while ((job = atomic_fetch_add_explicit(&victim->next, 1, memory_order_relaxed)) <
+               victim->end) {
+            struct cgbe *gb = cgbe_new(w->jobs[job].rom);
+
+            if (gb->cart->rom != cached) {
+                if (jit != NULL) {
+                    sm83_jit_flush(jit);
+                } else {
+                    sm83_block_cache_flush(blocks);
+                }
+                rom_close(cached);
+                cached = rom_ref(gb->cart->rom);
+            }
+            gb->cpu->jit = jit;
+            gb->cpu->blocks = blocks;
+
+            w->jobs[job].done = cgbe_run(gb, w->jobs[job].cycles);
+            cgbe_delete(gb);
+        }
+    }
+
+    rom_close(cached);
+    if (jit != NULL) {
+        sm83_jit_delete(jit);
+    } else {
+        sm83_block_cache_delete(blocks);
+    }
+
+    return NULL;
+}
+
+struct batch_stats batch_run(struct batch_job *jobs, size_t count, size_t threads) {
+    assert(jobs != NULL || count == 0);
+
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? cores : 1;
+    }
+    if (threads > count) {
+        threads = count > 0 ? count : 1;
+    }
+
+    struct worker *workers = aligned_alloc(alignof(struct worker), threads * sizeof(struct worker));
+    assert(workers != NULL);
+
+    for (size_t i = 0; i < threads; i++) {
+        atomic_init(&workers[i].next, count * i / threads);
+        workers[i].end = count * (i + 1) / threads;
+        workers[i].index = i;
+        workers[i].jobs = jobs;
+        workers[i].workers = workers;
+        workers[i].count = threads;
+    }
+
+    double start = now();
+
+    for (size_t i = 0; i < threads; i++) {
+        int err = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        assert(err == 0);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    struct batch_stats stats = {.threads = threads, .cycles = 0, .seconds = now() - start};
+    for (size_t i = 0; i < count; i++) {
+        stats.cycles += jobs[i].done;
+    }
+
+    free(workers);
+
+    return stats;
+}
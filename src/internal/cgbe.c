@@ -0,0 +1,148 @@
+#include "internal/cgbe.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "internal/sm83/sm83_lanes.h"
+
+static void fire_events(struct cgbe *gb);
+
+// IF is read through the machine so that interrupts that came due while the cpu ran are flagged
+// by the time it looks.
+static uint8_t if_read(void *ctx, uint16_t address) {
+    struct cgbe *gb = ctx;
+
+    fire_events(gb);
+    return gb->bus->io[address - 0xFF00];
+}
+
+static void if_write(void *ctx, uint16_t address, uint8_t val) {
+    struct cgbe *gb = ctx;
+
+    fire_events(gb);
+    gb->bus->io[address - 0xFF00] = val;
+}
+
+static void attach(struct cgbe *gb) {
+    bus_map_io(gb->bus, BUS_IO_IF, 1, (struct bus_handler){if_read, if_write, gb});
+}
+
+struct cgbe *cgbe_new(const char *fname) {
+    struct cgbe *gb = malloc(sizeof(struct cgbe));
+    assert(gb != NULL);
+
+    gb->cart = cartridge_new(fname);
+    gb->bus = bus_new(gb->cart);
+    gb->cpu = sm83_new(gb->bus);
+    gb->scheduler = scheduler_new(&gb->bus->clock);
+    gb->ppu = ppu_new(gb->bus, gb->scheduler);
+    gb->timer = tima_new(gb->bus, gb->scheduler);
+    gb->apu = apu_new(gb->bus);
+    gb->joypad = joypad_new(gb->bus);
+    attach(gb);
+
+    // CGB register values after the boot rom.
+    gb->cpu->regs.af = 0x1180;
+    gb->cpu->regs.bc = 0x0000;
+    gb->cpu->regs.de = 0xFF56;
+    gb->cpu->regs.hl = 0x000D;
+    gb->cpu->regs.sp = 0xFFFE;
+    gb->cpu->regs.pc = 0x0100;
+    bus_write(gb->bus, 0xFF40, 0x91); // lcd on
+
+    return gb;
+}
+
+struct cgbe *cgbe_fork(struct cgbe *gb) {
+    struct cgbe *fork = malloc(sizeof(struct cgbe));
+    assert(fork != NULL);
+
+    fork->cart = cartridge_fork(gb->cart);
+    fork->bus = bus_fork(gb->bus, fork->cart);
+    fork->cpu = sm83_fork(gb->cpu, fork->bus);
+    fork->scheduler = scheduler_fork(gb->scheduler, &fork->bus->clock);
+    fork->ppu = ppu_fork(gb->ppu, fork->bus, fork->scheduler);
+    fork->timer = tima_fork(gb->timer, fork->bus, fork->scheduler);
+    fork->apu = apu_fork(gb->apu, fork->bus);
+    fork->joypad = joypad_fork(gb->joypad, fork->bus);
+    attach(fork);
+
+    return fork;
+}
+
+void cgbe_delete(struct cgbe *gb) {
+    joypad_delete(gb->joypad);
+    apu_delete(gb->apu);
+    tima_delete(gb->timer);
+    ppu_delete(gb->ppu);
+    scheduler_delete(gb->scheduler);
+    sm83_delete(gb->cpu);
+    bus_delete(gb->bus);
+    cartridge_delete(gb->cart);
+    free(gb);
+}
+
+// Hands the devices whose events are due the time they have to catch up on.
+static void fire_events(struct cgbe *gb) {
+    enum scheduler_event event;
+    size_t elapsed;
+
+    while (scheduler_pop(gb->scheduler, &event, &elapsed)) {
+        switch (event) {
+        case SCHEDULER_PPU: ppu_tick(gb->ppu, elapsed); break;
+        case SCHEDULER_TIMER: tima_tick(gb->timer, elapsed); break;
+        case SCHEDULER_EVENT_COUNT: break;
+        }
+    }
+}
+
+// Brings every device up to the clock, for whoever looks at them from outside the machine.
+static void sync_devices(struct cgbe *gb) {
+    fire_events(gb);
+    ppu_sync(gb->ppu);
+    tima_sync(gb->timer);
+    apu_sync(gb->apu);
+    cartridge_sync(gb->cart, gb->bus->clock);
+}
+
+size_t cgbe_run(struct cgbe *gb, size_t cycles) {
+    size_t done = 0;
+
+    while (done < cycles) {
+        fire_events(gb);
+
+        // An hblank dma that just ran halts the cpu, the devices carry on in the meantime.
+        size_t stall = bus_take_stall(gb->bus);
+        if (stall != 0) {
+            gb->bus->clock += stall;
+            done += stall;
+            continue;
+        }
+
+        size_t slice = scheduler_slice(gb->scheduler);
+        done += sm83_run(gb->cpu, slice < cycles - done ? slice : cycles - done);
+    }
+    sync_devices(gb);
+
+    return done;
+}
+
+size_t cgbe_run_lockstep(struct cgbe **gbs, size_t count, size_t cycles) {
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; i += SM83_LANES) {
+        size_t lanes = count - i < SM83_LANES ? count - i : SM83_LANES;
+        struct sm83 *cpus[SM83_LANES];
+        size_t done[SM83_LANES];
+
+        for (size_t j = 0; j < lanes; j++) {
+            cpus[j] = gbs[i + j]->cpu;
+        }
+        total += sm83_lanes_run(cpus, lanes, cycles, done);
+        for (size_t j = 0; j < lanes; j++) {
+            sync_devices(gbs[i + j]);
+        }
+    }
+
+    return total;
+}
@@ -0,0 +1,75 @@
+#include "internal/joypad/joypad.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// Buttons in the rows P1 currently selects, set when held.
+static uint8_t selected(const struct joypad *joypad) {
+    uint8_t rows = 0;
+
+    if (!(joypad->select & JOYPAD_SELECT_DIRECTIONS)) {
+        rows |= 0x0F;
+    }
+    if (!(joypad->select & JOYPAD_SELECT_ACTIONS)) {
+        rows |= 0xF0;
+    }
+    return joypad->buttons & rows;
+}
+
+static uint8_t reg_read(void *ctx, uint16_t address) {
+    const struct joypad *joypad = ctx;
+    uint8_t held = selected(joypad);
+
+    (void)address;
+    // Both rows share the low nibble, held buttons read as 0.
+    return 0xC0 | joypad->select | (~(held | held >> 4) & 0x0F);
+}
+
+static void reg_write(void *ctx, uint16_t address, uint8_t val) {
+    struct joypad *joypad = ctx;
+
+    (void)address;
+    joypad->select = val & (JOYPAD_SELECT_DIRECTIONS | JOYPAD_SELECT_ACTIONS);
+}
+
+static void attach(struct joypad *joypad) {
+    bus_map_io(joypad->bus, 0x00, 1, (struct bus_handler){reg_read, reg_write, joypad});
+}
+
+struct joypad *joypad_new(struct bus *bus) {
+    struct joypad *joypad = malloc(sizeof(struct joypad));
+    assert(joypad != NULL);
+
+    joypad->bus = bus;
+    joypad->select = JOYPAD_SELECT_DIRECTIONS | JOYPAD_SELECT_ACTIONS;
+    joypad->buttons = 0;
+
+    attach(joypad);
+
+    return joypad;
+}
+
+struct joypad *joypad_fork(const struct joypad *joypad, struct bus *bus) {
+    struct joypad *fork = malloc(sizeof(struct joypad));
+    assert(fork != NULL);
+
+    *fork = *joypad;
+    fork->bus = bus;
+
+    attach(fork);
+
+    return fork;
+}
+
+void joypad_delete(struct joypad *joypad) {
+    free(joypad);
+}
+
+void joypad_set(struct joypad *joypad, uint8_t buttons) {
+    uint8_t before = selected(joypad);
+
+    joypad->buttons = buttons;
+    if (selected(joypad) & ~before) {
+        bus_request_interrupt(joypad->bus, BUS_INTERRUPT_JOYPAD);
+    }
+}
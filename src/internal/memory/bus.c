@@ -2,30 +2,258 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
-struct bus *bus_new(struct cartridge *cart) {
+static_assert(BUS_PAGE_SIZE == RAM_PAGE_SIZE, "ram pages have to map onto bus pages");
+
+static uint8_t rom_read(void *ctx, uint16_t address) {
+    return cartridge_rom_read(((struct bus *)ctx)->cart, address);
+}
+
+// Rom writes talk to the mapper, the pages are only remapped (and cached code dropped) when that
+// switched banks. The clock catches up first in case this latches it.
+static void rom_write(void *ctx, uint16_t address, uint8_t val) {
+    struct bus *bus = ctx;
+
+    cartridge_sync(bus->cart, bus->clock);
+    if (cartridge_rom_write(bus->cart, address, val)) {
+        bus_map_cartridge(bus);
+    }
+}
+
+// Clock registers are only ever reached through here, never mapped.
+static uint8_t cart_ram_read(void *ctx, uint16_t address) {
+    struct bus *bus = ctx;
+
+    cartridge_sync(bus->cart, bus->clock);
+    return cartridge_ram_read(bus->cart, address);
+}
+
+// Only reached when the page isn't mapped writable, if the write made it writable (copied a
+// shared page) it gets remapped.
+static void cart_ram_write(void *ctx, uint16_t address, uint8_t val) {
+    struct bus *bus = ctx;
+
+    cartridge_sync(bus->cart, bus->clock);
+    cartridge_ram_write(bus->cart, address, val);
+    if (cartridge_ram_page_writable(bus->cart, address & ~(BUS_PAGE_SIZE - 1)) != NULL) {
+        bus_map_cartridge(bus);
+    }
+}
+
+// 0xC000-0xFDFF, wram is always mapped for reading, writes only get here while a page is shared
+// with a fork.
+static uint8_t wram_read(void *ctx, uint16_t address) {
+    return ram_read(((struct bus *)ctx)->wram, (address - 0xC000) % 0x2000);
+}
+
+static void wram_write(void *ctx, uint16_t address, uint8_t val) {
+    struct bus *bus = ctx;
+
+    ram_write(bus->wram, (address - 0xC000) % 0x2000, val);
+    bus_map_wram(bus);
+}
+
+// 0xFF00-0xFFFF, io registers, hram and ie share the last page.
+static uint8_t high_read(void *ctx, uint16_t address) {
+    struct bus *bus = ctx;
+
+    if (address == 0xFFFF) {
+        return bus->ie;
+    } else if (address >= 0xFF80) {
+        return bus->hram[address - 0xFF80];
+    }
+
+    const struct bus_handler *handler = &bus->io_handlers[address - 0xFF00];
+    if (handler->read != NULL) {
+        return handler->read(handler->ctx, address);
+    }
+    return bus->io[address - 0xFF00];
+}
+
+static void high_write(void *ctx, uint16_t address, uint8_t val) {
+    struct bus *bus = ctx;
+
+    if (address == 0xFFFF) {
+        bus->ie = val;
+        return;
+    } else if (address >= 0xFF80) {
+        bus->hram[address - 0xFF80] = val;
+        return;
+    }
+
+    const struct bus_handler *handler = &bus->io_handlers[address - 0xFF00];
+    if (handler->write != NULL) {
+        handler->write(handler->ctx, address, val);
+    } else {
+        bus->io[address - 0xFF00] = val;
+    }
+}
+
+static struct bus *bus_create(struct cartridge *cart, struct ram *wram) {
     struct bus *bus = malloc(sizeof(struct bus));
     assert(bus != NULL);
 
     bus->cart = cart;
+    bus->generation = 0;
+    bus->clock = 0;
+    bus->stall = 0;
+    bus->trace = NULL;
+    bus->wram = wram;
+
+    for (size_t i = 0; i < BUS_PAGE_COUNT; i++) {
+        bus->read_pages[i] = NULL;
+        bus->write_pages[i] = NULL;
+        bus->handlers[i] = (struct bus_handler){.read = NULL, .write = NULL, .ctx = NULL};
+    }
+    for (size_t i = 0; i < BUS_IO_COUNT; i++) {
+        bus->io_handlers[i] = (struct bus_handler){.read = NULL, .write = NULL, .ctx = NULL};
+    }
+
+    bus_map_handler(bus, 0x0000, 0x8000, (struct bus_handler){rom_read, rom_write, bus});
+    bus_map_handler(bus, 0xA000, 0x2000, (struct bus_handler){cart_ram_read, cart_ram_write, bus});
+    bus_map_cartridge(bus);
+
+    // 0xE000-0xFDFF echoes wram.
+    bus_map_handler(bus, 0xC000, 0x3E00, (struct bus_handler){wram_read, wram_write, bus});
+    bus_map_wram(bus);
+
+    bus_map_handler(bus, 0xFF00, BUS_PAGE_SIZE, (struct bus_handler){high_read, high_write, bus});
 
     return bus;
 }
 
-void bus_delete(struct bus *bus) { free(bus); }
+struct bus *bus_new(struct cartridge *cart) {
+    struct bus *bus = bus_create(cart, ram_new(0x2000));
 
-uint8_t bus_read(struct bus *bus, uint16_t address) {
-    if (0x0000 <= address && address <= 0x7FFF) {
-        return cartridge_rom_read(bus->cart, address);
-    } else {
-        exit(1);
+    memset(bus->hram, 0, sizeof(bus->hram));
+    memset(bus->io, 0, sizeof(bus->io));
+    bus->ie = 0;
+
+    return bus;
+}
+
+struct bus *bus_fork(struct bus *bus, struct cartridge *cart) {
+    struct bus *fork = bus_create(cart, ram_fork(bus->wram));
+
+    memcpy(fork->hram, bus->hram, sizeof(bus->hram));
+    memcpy(fork->io, bus->io, sizeof(bus->io));
+    fork->ie = bus->ie;
+    fork->clock = bus->clock;
+    fork->stall = bus->stall;
+
+    bus_map_wram(bus);
+    bus_map_cartridge(bus);
+
+    return fork;
+}
+
+void bus_delete(struct bus *bus) {
+    if (bus == NULL) {
+        return;
     }
+
+    ram_delete(bus->wram);
+    free(bus);
 }
 
-void bus_write(struct bus *bus, uint16_t address, uint8_t val) {
-    if (0x0000 <= address && address <= 0x7FFF) {
-        cartridge_rom_write(bus->cart, address, val);
-    } else {
-        exit(1);
+void bus_map_memory(struct bus *bus, uint16_t address, size_t size, uint8_t *mem, bool writable) {
+    assert(address % BUS_PAGE_SIZE == 0 && size % BUS_PAGE_SIZE == 0);
+    assert(address + size <= 0x10000);
+
+    for (size_t i = 0; i < size / BUS_PAGE_SIZE; i++) {
+        bus->read_pages[address / BUS_PAGE_SIZE + i] = mem + i * BUS_PAGE_SIZE;
+        bus->write_pages[address / BUS_PAGE_SIZE + i] = writable ? mem + i * BUS_PAGE_SIZE : NULL;
+    }
+    bus->generation++;
+}
+
+void bus_map_handler(struct bus *bus, uint16_t address, size_t size, struct bus_handler handler) {
+    assert(address % BUS_PAGE_SIZE == 0 && size % BUS_PAGE_SIZE == 0);
+    assert(address + size <= 0x10000);
+
+    for (size_t i = address / BUS_PAGE_SIZE; i < (address + size) / BUS_PAGE_SIZE; i++) {
+        bus->read_pages[i] = NULL;
+        bus->write_pages[i] = NULL;
+        bus->handlers[i] = handler;
+    }
+    bus->generation++;
+}
+
+void bus_map_ram(struct bus *bus, uint16_t address, size_t size, const struct ram *ram,
+                 size_t offset, bool writable) {
+    assert(address % BUS_PAGE_SIZE == 0 && size % BUS_PAGE_SIZE == 0);
+    assert(address + size <= 0x10000 && offset + size <= ram->size);
+
+    for (size_t i = 0; i < size; i += BUS_PAGE_SIZE) {
+        bus->read_pages[(address + i) / BUS_PAGE_SIZE] = ram_page(ram, offset + i);
+        bus->write_pages[(address + i) / BUS_PAGE_SIZE] =
+            writable ? ram_page_writable(ram, offset + i) : NULL;
+    }
+    bus->generation++;
+}
+
+void bus_map_io(struct bus *bus, uint8_t reg, size_t count, struct bus_handler handler) {
+    assert(reg + count <= BUS_IO_COUNT);
+
+    for (size_t i = reg; i < reg + count; i++) {
+        bus->io_handlers[i] = handler;
+    }
+}
+
+void bus_map_cartridge(struct bus *bus) {
+    if (bus->cart == NULL) {
+        return;
+    }
+
+    for (uint32_t address = 0x0000; address < 0x8000; address += BUS_PAGE_SIZE) {
+        bus->read_pages[address / BUS_PAGE_SIZE] = cartridge_rom_page(bus->cart, address);
+    }
+    for (uint32_t address = 0xA000; address < 0xC000; address += BUS_PAGE_SIZE) {
+        bus->read_pages[address / BUS_PAGE_SIZE] = cartridge_ram_page(bus->cart, address);
+        bus->write_pages[address / BUS_PAGE_SIZE] = cartridge_ram_page_writable(bus->cart, address);
+    }
+    bus->generation++;
+}
+
+void bus_map_wram(struct bus *bus) {
+    bus_map_ram(bus, 0xC000, 0x2000, bus->wram, 0, true);
+    bus_map_ram(bus, 0xE000, 0x1E00, bus->wram, 0, true);
+}
+
+void bus_dma_read(struct bus *bus, uint16_t src, uint8_t *dst, size_t size) {
+    while (size > 0) {
+        size_t n = BUS_PAGE_SIZE - src % BUS_PAGE_SIZE;
+        const uint8_t *page = bus->read_pages[src / BUS_PAGE_SIZE];
+
+        n = n < size ? n : size;
+        if (page != NULL) {
+            memcpy(dst, page + src % BUS_PAGE_SIZE, n);
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                dst[i] = bus_handler_read(bus, src + i);
+            }
+        }
+        src += n;
+        dst += n;
+        size -= n;
+    }
+}
+
+uint8_t bus_handler_read(struct bus *bus, uint16_t address) {
+    const struct bus_handler *handler = &bus->handlers[address / BUS_PAGE_SIZE];
+
+    if (handler->read == NULL) {
+        exit(1); // nothing mapped there yet
+    }
+    return handler->read(handler->ctx, address);
+}
+
+void bus_handler_write(struct bus *bus, uint16_t address, uint8_t val) {
+    const struct bus_handler *handler = &bus->handlers[address / BUS_PAGE_SIZE];
+
+    if (handler->write == NULL) {
+        exit(1); // nothing mapped there yet
     }
+    handler->write(handler->ctx, address, val);
 }
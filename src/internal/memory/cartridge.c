@@ -5,47 +5,139 @@
 
 static enum cartridge_mapper_type cartridge_mapper_type(uint8_t cart_type) {
     switch (cart_type) {
-    case 0x00: return CMT_ROM_ONLY;
+    case 0x00:
+    case 0x08:
+    case 0x09: return CMT_ROM_ONLY;
+    case 0x01:
+    case 0x02:
+    case 0x03: return CMT_MBC1;
+    case 0x05:
+    case 0x06: return CMT_MBC2;
+    case 0x0F:
+    case 0x10:
+    case 0x11:
+    case 0x12:
+    case 0x13: return CMT_MBC3;
+    case 0x19:
+    case 0x1A:
+    case 0x1B:
+    case 0x1C:
+    case 0x1D:
+    case 0x1E: return CMT_MBC5;
     default: return CMT_UNSUPPORTED;
     }
 }
 
+static size_t cartridge_ram_size(enum cartridge_mapper_type mapper, uint8_t ram_size) {
+    if (mapper == CMT_MBC2) {
+        return 512; // built in, 4 bits per byte
+    }
+
+    switch (ram_size) {
+    case 0x02: return 1 * CARTRIDGE_RAM_BANK_SIZE;
+    case 0x03: return 4 * CARTRIDGE_RAM_BANK_SIZE;
+    case 0x04: return 16 * CARTRIDGE_RAM_BANK_SIZE;
+    case 0x05: return 8 * CARTRIDGE_RAM_BANK_SIZE;
+    default: return 0;
+    }
+}
+
+static bool rtc_selected(const struct cartridge *cart) {
+    return cart->has_rtc && cart->mbc.ram_bank >= 0x08;
+}
+
+void cartridge_map_banks(struct cartridge *cart) {
+    const struct cartridge_mbc *mbc = &cart->mbc;
+    size_t rom_bank = mbc->rom_bank;
+    size_t ram_bank = mbc->ram_bank;
+
+    cart->bank_00_num = 0;
+
+    switch (cart->mapper) {
+    case CMT_ROM_ONLY: rom_bank = 1; break;
+    case CMT_MBC1:
+        // The upper two bits live in the ram bank register, in mode 1 they also apply to the
+        // first rom bank and to ram.
+        rom_bank = (rom_bank ? rom_bank : 1) | (ram_bank << 5);
+        if (mbc->mode == 1) {
+            cart->bank_00_num = (ram_bank << 5) % cart->rom_banks;
+        } else {
+            ram_bank = 0;
+        }
+        break;
+    case CMT_MBC2:
+    case CMT_MBC3: rom_bank = rom_bank ? rom_bank : 1; break;
+    case CMT_MBC5: break;
+    case CMT_UNSUPPORTED: exit(1);
+    }
+
+    cart->bank_01_nn_num = rom_bank % cart->rom_banks;
+    cart->bank_00 = cart->rom->data + cart->bank_00_num * CARTRIDGE_ROM_BANK_SIZE;
+    cart->bank_01_nn = cart->rom->data + cart->bank_01_nn_num * CARTRIDGE_ROM_BANK_SIZE;
+
+    cart->ram_mapped = false;
+    cart->ram_offset = 0;
+    if (mbc->ram_enabled && cart->ram_size >= CARTRIDGE_RAM_BANK_SIZE && !rtc_selected(cart)) {
+        size_t banks = cart->ram_size / CARTRIDGE_RAM_BANK_SIZE;
+        cart->ram_mapped = true;
+        cart->ram_offset = (ram_bank % banks) * CARTRIDGE_RAM_BANK_SIZE;
+    }
+}
+
 struct cartridge *cartridge_new(const char *fname) {
     assert(fname != NULL);
 
     struct cartridge *cart = malloc(sizeof(struct cartridge));
     assert(cart != NULL);
 
-    FILE *file = fopen(fname, "r");
-    assert(file != NULL);
-
-    fseek(file, 0, SEEK_END);
-    size_t file_size = ftell(file);
-    rewind(file);
+    cart->rom = rom_open(fname);
+    assert(cart->rom->size >= 2 * CARTRIDGE_ROM_BANK_SIZE);
+    assert(cart->rom->size % CARTRIDGE_ROM_BANK_SIZE == 0);
+    cart->rom_banks = cart->rom->size / CARTRIDGE_ROM_BANK_SIZE;
 
-    assert(file_size == 2 * CARTRIDGE_ROM_BANK_SIZE);
-
-    fread(cart->bank_00, CARTRIDGE_ROM_BANK_SIZE, sizeof(uint8_t), file);
-    fread(cart->bank_01_nn, CARTRIDGE_ROM_BANK_SIZE, sizeof(uint8_t), file);
-    cart->header = (void *)(cart->bank_00 + 0x0100);
-
-    fclose(file);
+    cart->header = (const void *)(cart->rom->data + 0x0100);
 
     cart->mapper = cartridge_mapper_type(cart->header->cartridge_type);
     assert(cart->mapper != CMT_UNSUPPORTED);
 
+    cart->has_rtc = cart->header->cartridge_type == 0x0F || cart->header->cartridge_type == 0x10;
+    cart->ram_size = cartridge_ram_size(cart->mapper, cart->header->ram_size);
+    cart->ram = ram_new(cart->ram_size);
+
+    // Plain rom+ram carts have no register to enable ram with.
+    cart->mbc = (struct cartridge_mbc){
+        .rom_bank = 1,
+        .ram_bank = 0,
+        .mode = 0,
+        .ram_enabled = cart->mapper == CMT_ROM_ONLY,
+    };
+    cart->rtc = (struct cartridge_rtc){0};
+    cartridge_map_banks(cart);
+
     return cart;
 }
 
+struct cartridge *cartridge_fork(const struct cartridge *cart) {
+    assert(cart != NULL);
+
+    struct cartridge *fork = malloc(sizeof(struct cartridge));
+    assert(fork != NULL);
+
+    *fork = *cart;
+    fork->rom = rom_ref(cart->rom);
+    fork->ram = ram_fork(cart->ram);
+
+    return fork;
+}
+
 void cartridge_delete(struct cartridge *cart) {
     if (cart == NULL) {
         return;
     }
 
-    switch (cart->mapper) {
-    case CMT_ROM_ONLY: free(cart); return;
-    case CMT_UNSUPPORTED: exit(1);
-    }
+    rom_close(cart->rom);
+    ram_delete(cart->ram);
+    free(cart);
 }
 
 void cartridge_header_print_info(const struct cartridge_header *cart, FILE *out) {
@@ -72,20 +164,193 @@ uint8_t cartridge_rom_read(struct cartridge *cart, uint16_t address) {
     assert(cart != NULL);
     assert(0x0000 <= address && address <= 0x7FFF);
 
-    switch (cart->mapper) {
-    case CMT_ROM_ONLY:
-        return address >= 0x4000 ? cart->bank_01_nn[address - 0x4000]
-                                 : cart->bank_00[address - 0x0000];
-    case CMT_UNSUPPORTED: exit(1);
+    return address >= 0x4000 ? cart->bank_01_nn[address - 0x4000] : cart->bank_00[address - 0x0000];
+}
+
+static void rtc_latch(struct cartridge_rtc *rtc, uint8_t val) {
+    if (rtc->latch == 0x00 && val == 0x01) {
+        for (size_t i = 0; i < RTC_REG_COUNT; i++) {
+            rtc->latched[i] = rtc->regs[i];
+        }
     }
+    rtc->latch = val;
 }
 
-void cartridge_rom_write(struct cartridge *cart, uint16_t address, uint8_t val) {
+bool cartridge_rom_write(struct cartridge *cart, uint16_t address, uint8_t val) {
     assert(cart != NULL);
     assert(0x0000 <= address && address <= 0x7FFF);
 
+    struct cartridge_mbc *mbc = &cart->mbc;
+
     switch (cart->mapper) {
-    case CMT_ROM_ONLY: return;
+    case CMT_ROM_ONLY: return false;
+    case CMT_MBC1:
+        switch (address >> 13) {
+        case 0: mbc->ram_enabled = (val & 0x0F) == 0x0A; break;
+        case 1: mbc->rom_bank = val & 0x1F; break;
+        case 2: mbc->ram_bank = val & 0x03; break;
+        case 3: mbc->mode = val & 0x01; break;
+        }
+        break;
+    case CMT_MBC2:
+        if (address >= 0x4000) {
+            return false;
+        }
+        // Bit 8 of the address picks the register.
+        if (address & 0x0100) {
+            mbc->rom_bank = val & 0x0F;
+        } else {
+            mbc->ram_enabled = (val & 0x0F) == 0x0A;
+        }
+        break;
+    case CMT_MBC3:
+        switch (address >> 13) {
+        case 0: mbc->ram_enabled = (val & 0x0F) == 0x0A; break;
+        case 1: mbc->rom_bank = val & 0x7F; break;
+        case 2: mbc->ram_bank = val & 0x0F; break;
+        case 3: rtc_latch(&cart->rtc, val); return false;
+        }
+        break;
+    case CMT_MBC5:
+        switch (address >> 12) {
+        case 0:
+        case 1: mbc->ram_enabled = (val & 0x0F) == 0x0A; break;
+        case 2: mbc->rom_bank = (mbc->rom_bank & 0x100) | val; break;
+        case 3: mbc->rom_bank = (mbc->rom_bank & 0xFF) | ((val & 0x01) << 8); break;
+        case 4:
+        case 5: mbc->ram_bank = val & 0x0F; break;
+        default: return false;
+        }
+        break;
     case CMT_UNSUPPORTED: exit(1);
     }
+
+    const uint8_t *bank_00 = cart->bank_00, *bank_01_nn = cart->bank_01_nn;
+    bool ram_mapped = cart->ram_mapped;
+    size_t ram_offset = cart->ram_offset;
+
+    cartridge_map_banks(cart);
+    return cart->bank_00 != bank_00 || cart->bank_01_nn != bank_01_nn ||
+           cart->ram_mapped != ram_mapped || cart->ram_offset != ram_offset;
+}
+
+uint8_t cartridge_ram_read(struct cartridge *cart, uint16_t address) {
+    assert(cart != NULL);
+    assert(0xA000 <= address && address <= 0xBFFF);
+
+    if (!cart->mbc.ram_enabled) {
+        return 0xFF;
+    }
+    if (rtc_selected(cart)) {
+        return cart->mbc.ram_bank <= 0x0C ? cart->rtc.latched[cart->mbc.ram_bank - 0x08] : 0xFF;
+    }
+    if (cart->mapper == CMT_MBC2) {
+        return ram_read(cart->ram, address % 512) | 0xF0;
+    }
+    if (!cart->ram_mapped) {
+        return 0xFF;
+    }
+    return ram_read(cart->ram, cart->ram_offset + address - 0xA000);
+}
+
+void cartridge_ram_write(struct cartridge *cart, uint16_t address, uint8_t val) {
+    assert(cart != NULL);
+    assert(0xA000 <= address && address <= 0xBFFF);
+
+    if (!cart->mbc.ram_enabled) {
+        return;
+    }
+    if (rtc_selected(cart)) {
+        if (cart->mbc.ram_bank <= 0x0C) {
+            cart->rtc.regs[cart->mbc.ram_bank - 0x08] = val;
+            if (cart->mbc.ram_bank == 0x08) {
+                cart->rtc.cycles = 0;
+            }
+        }
+        return;
+    }
+    if (cart->mapper == CMT_MBC2) {
+        ram_write(cart->ram, address % 512, val & 0x0F);
+        return;
+    }
+    if (cart->ram_mapped) {
+        ram_write(cart->ram, cart->ram_offset + address - 0xA000, val);
+    }
+}
+
+const uint8_t *cartridge_rom_page(const struct cartridge *cart, uint16_t address) {
+    assert(cart != NULL);
+    assert(address <= 0x7FFF);
+
+    return address >= 0x4000 ? &cart->bank_01_nn[address - 0x4000] : &cart->bank_00[address];
+}
+
+const uint8_t *cartridge_ram_page(const struct cartridge *cart, uint16_t address) {
+    assert(cart != NULL);
+    assert(0xA000 <= address && address <= 0xBFFF);
+
+    return cart->ram_mapped ? ram_page(cart->ram, cart->ram_offset + address - 0xA000) : NULL;
+}
+
+uint8_t *cartridge_ram_page_writable(const struct cartridge *cart, uint16_t address) {
+    assert(cart != NULL);
+    assert(0xA000 <= address && address <= 0xBFFF);
+
+    return cart->ram_mapped ? ram_page_writable(cart->ram, cart->ram_offset + address - 0xA000)
+                            : NULL;
+}
+
+uint16_t cartridge_rom_bank(const struct cartridge *cart, uint16_t address) {
+    assert(cart != NULL);
+    assert(address <= 0x7FFF);
+
+    return address >= 0x4000 ? cart->bank_01_nn_num : cart->bank_00_num;
+}
+
+static void rtc_second(struct cartridge_rtc *rtc) {
+    uint8_t *r = rtc->regs;
+
+    if (++r[RTC_S] != 60) {
+        r[RTC_S] &= 0x3F;
+        return;
+    }
+    r[RTC_S] = 0;
+    if (++r[RTC_M] != 60) {
+        r[RTC_M] &= 0x3F;
+        return;
+    }
+    r[RTC_M] = 0;
+    if (++r[RTC_H] != 24) {
+        r[RTC_H] &= 0x1F;
+        return;
+    }
+    r[RTC_H] = 0;
+
+    // 9 bit day counter, bit 7 of DH is the sticky overflow flag.
+    if (++r[RTC_DL] == 0) {
+        if (r[RTC_DH] & 0x01) {
+            r[RTC_DH] |= 0x80;
+        }
+        r[RTC_DH] ^= 0x01;
+    }
+}
+
+void cartridge_sync(struct cartridge *cart, uint64_t clock) {
+    assert(cart != NULL);
+
+    struct cartridge_rtc *rtc = &cart->rtc;
+    size_t cycles = clock - rtc->synced;
+
+    rtc->synced = clock;
+
+    // Bit 6 of DH halts the clock.
+    if (!cart->has_rtc || (rtc->regs[RTC_DH] & 0x40)) {
+        return;
+    }
+
+    rtc->cycles += cycles;
+    while (rtc->cycles >= CARTRIDGE_RTC_SECOND) {
+        rtc->cycles -= CARTRIDGE_RTC_SECOND;
+        rtc_second(rtc);
+    }
 }
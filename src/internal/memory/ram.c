@@ -0,0 +1,151 @@
+#include "internal/memory/ram.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal/hash.h"
+
+static struct ram *ram_alloc(size_t size) {
+    assert(size % RAM_PAGE_SIZE == 0);
+
+    struct ram *ram = malloc(sizeof(struct ram));
+    assert(ram != NULL);
+
+    ram->size = size;
+    ram->pages = NULL;
+    ram->hashed = NULL;
+    ram->hashes = NULL;
+    if (size != 0) {
+        ram->pages = malloc(size / RAM_PAGE_SIZE * sizeof(struct ram_page *));
+        assert(ram->pages != NULL);
+    }
+
+    return ram;
+}
+
+static struct ram_page *page_new(const uint8_t *data) {
+    struct ram_page *page = malloc(sizeof(struct ram_page));
+    assert(page != NULL);
+
+    atomic_init(&page->refs, 1);
+    if (data != NULL) {
+        memcpy(page->data, data, RAM_PAGE_SIZE);
+    } else {
+        memset(page->data, 0, RAM_PAGE_SIZE);
+    }
+
+    return page;
+}
+
+static void page_release(struct ram_page *page) {
+    // Whoever drops the last reference frees it, even if another fork copied it concurrently.
+    if (atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) == 1) {
+        free(page);
+    }
+}
+
+// Makes the page at index private to this ram, copying it if some fork still uses it.
+static struct ram_page *page_own(struct ram *ram, size_t index) {
+    struct ram_page *page = ram->pages[index];
+
+    if (atomic_load_explicit(&page->refs, memory_order_acquire) == 1) {
+        return page;
+    }
+
+    ram->pages[index] = page_new(page->data);
+    page_release(page);
+
+    return ram->pages[index];
+}
+
+struct ram *ram_new(size_t size) {
+    struct ram *ram = ram_alloc(size);
+
+    for (size_t i = 0; i < size / RAM_PAGE_SIZE; i++) {
+        ram->pages[i] = page_new(NULL);
+    }
+
+    return ram;
+}
+
+struct ram *ram_fork(const struct ram *ram) {
+    struct ram *fork = ram_alloc(ram->size);
+
+    for (size_t i = 0; i < ram->size / RAM_PAGE_SIZE; i++) {
+        atomic_fetch_add_explicit(&ram->pages[i]->refs, 1, memory_order_relaxed);
+        fork->pages[i] = ram->pages[i];
+    }
+
+    return fork;
+}
+
+void ram_delete(struct ram *ram) {
+    if (ram == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < ram->size / RAM_PAGE_SIZE; i++) {
+        page_release(ram->pages[i]);
+        if (ram->hashed != NULL) {
+            page_release(ram->hashed[i]);
+        }
+    }
+    free(ram->pages);
+    free(ram->hashed);
+    free(ram->hashes);
+    free(ram);
+}
+
+void ram_write(struct ram *ram, size_t offset, uint8_t val) {
+    assert(offset < ram->size);
+
+    page_own(ram, offset / RAM_PAGE_SIZE)->data[offset % RAM_PAGE_SIZE] = val;
+}
+
+void ram_save(const struct ram *ram, uint8_t *dst) {
+    for (size_t i = 0; i < ram->size / RAM_PAGE_SIZE; i++) {
+        memcpy(dst + i * RAM_PAGE_SIZE, ram->pages[i]->data, RAM_PAGE_SIZE);
+    }
+}
+
+void ram_load(struct ram *ram, const uint8_t *src) {
+    for (size_t i = 0; i < ram->size / RAM_PAGE_SIZE; i++) {
+        const uint8_t *data = src + i * RAM_PAGE_SIZE;
+
+        if (memcmp(ram->pages[i]->data, data, RAM_PAGE_SIZE) != 0) {
+            memcpy(page_own(ram, i)->data, data, RAM_PAGE_SIZE);
+        }
+    }
+}
+
+size_t ram_hash(struct ram *ram) {
+    size_t count = ram->size / RAM_PAGE_SIZE;
+    size_t hashed = 0;
+
+    if (ram->hashed == NULL && count != 0) {
+        ram->hashed = calloc(count, sizeof(struct ram_page *));
+        ram->hashes = malloc(count * sizeof(uint64_t));
+        assert(ram->hashed != NULL && ram->hashes != NULL);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct ram_page *page = ram->pages[i];
+
+        // A page that was hashed is shared with the reference held on it and can't have changed,
+        // any write would have replaced it with a copy.
+        if (page == ram->hashed[i]) {
+            continue;
+        }
+
+        atomic_fetch_add_explicit(&page->refs, 1, memory_order_relaxed);
+        if (ram->hashed[i] != NULL) {
+            page_release(ram->hashed[i]);
+        }
+        ram->hashed[i] = page;
+        ram->hashes[i] = hash_bytes(page->data, RAM_PAGE_SIZE);
+        hashed++;
+    }
+
+    return hashed;
+}
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L // open, fstat, mmap, pthread
+
+#include "internal/memory/rom.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct rom_mapping {
+    struct rom rom; // first, so a struct rom * is also a struct rom_mapping *
+    dev_t dev;
+    ino_t ino;
+    size_t refs;
+    struct rom_mapping *next;
+};
+
+// Every rom mapped by this process. Machines get created and deleted from many threads at once
+// (see batch_run), only the list and the refcounts are locked, never the rom data.
+static struct rom_mapping *mappings = NULL;
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct rom *rom_open(const char *fname) {
+    assert(fname != NULL);
+
+    int fd = open(fname, O_RDONLY);
+    assert(fd != -1);
+
+    struct stat st;
+    int err = fstat(fd, &st);
+    assert(err == 0);
+
+    pthread_mutex_lock(&mappings_lock);
+
+    for (struct rom_mapping *m = mappings; m != NULL; m = m->next) {
+        if (m->dev == st.st_dev && m->ino == st.st_ino) {
+            m->refs++;
+            pthread_mutex_unlock(&mappings_lock);
+            close(fd);
+            return &m->rom;
+        }
+    }
+
+    struct rom_mapping *m = malloc(sizeof(struct rom_mapping));
+    assert(m != NULL);
+
+    m->rom.size = st.st_size;
+    void *data = mmap(NULL, m->rom.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(data != MAP_FAILED);
+    m->rom.data = data;
+    close(fd);
+
+    m->dev = st.st_dev;
+    m->ino = st.st_ino;
+    m->refs = 1;
+    m->next = mappings;
+    mappings = m;
+
+    pthread_mutex_unlock(&mappings_lock);
+
+    return &m->rom;
+}
+
+struct rom *rom_ref(struct rom *rom) {
+    assert(rom != NULL);
+
+    pthread_mutex_lock(&mappings_lock);
+    ((struct rom_mapping *)rom)->refs++;
+    pthread_mutex_unlock(&mappings_lock);
+
+    return rom;
+}
+
+void rom_close(struct rom *rom) {
+    if (rom == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&mappings_lock);
+
+    struct rom_mapping **link = &mappings;
+    while (*link != (struct rom_mapping *)rom) {
+        assert(*link != NULL);
+        link = &(*link)->next;
+    }
+
+    struct rom_mapping *m = *link;
+    if (--m->refs != 0) {
+        pthread_mutex_unlock(&mappings_lock);
+        return;
+    }
+
+    *link = m->next;
+    pthread_mutex_unlock(&mappings_lock);
+
+    munmap((void *)m->rom.data, m->rom.size);
+    free(m);
+}
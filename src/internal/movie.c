@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L // open, fstat, mmap
+
+#include "internal/movie.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEADER_SIZE (4 + 1)
+
+// Decodes the varint at *p into val and moves *p past it. False if it runs past end or doesn't
+// fit 63 bits.
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *val) {
+    *val = 0;
+
+    for (unsigned shift = 0; *p < end && shift < 63; shift += 7) {
+        uint8_t byte = *(*p)++;
+
+        *val |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return *val < (UINT64_C(1) << 63);
+        }
+    }
+    return false;
+}
+
+// Walks every record up to the end marker, returns the movie's length or SIZE_MAX if it's cut
+// short or overflows.
+static size_t length(const uint8_t *p, const uint8_t *end) {
+    size_t frame = 0;
+
+    while (p < end) {
+        uint64_t gap;
+        if (!get_varint(&p, end, &gap) || p == end || gap > SIZE_MAX - 1 - frame) {
+            return SIZE_MAX;
+        }
+        frame += gap;
+
+        if (*p++ == 0) {
+            return frame;
+        }
+    }
+    return SIZE_MAX;
+}
+
+struct movie *movie_open(const char *fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct movie *movie = malloc(sizeof(struct movie));
+    assert(movie != NULL);
+
+    movie->data = data;
+    movie->size = st.st_size;
+    movie->frames = length(movie->data + HEADER_SIZE, movie->data + movie->size);
+
+    if (memcmp(movie->data, MOVIE_MAGIC, 4) != 0 || movie->data[4] != MOVIE_VERSION ||
+        movie->frames == SIZE_MAX) {
+        movie_close(movie);
+        return NULL;
+    }
+
+    // Records are only ever read front to back.
+    posix_madvise(data, movie->size, POSIX_MADV_SEQUENTIAL);
+
+    return movie;
+}
+
+void movie_close(struct movie *movie) {
+    if (movie == NULL) {
+        return;
+    }
+
+    munmap((void *)movie->data, movie->size);
+    free(movie);
+}
+
+void movie_start(const struct movie *movie, struct movie_cursor *cursor) {
+    cursor->next = movie->data + HEADER_SIZE;
+    cursor->buttons = 0;
+
+    // The movie was checked when it was opened, so the records can be trusted from here on.
+    get_varint(&cursor->next, movie->data + movie->size, &cursor->change);
+}
+
+uint8_t movie_buttons(const struct movie *movie, struct movie_cursor *cursor, size_t frame) {
+    assert(frame < movie->frames);
+
+    // A gap of 0 changes the buttons twice in one frame, only the last one counts.
+    while (cursor->change <= frame) {
+        uint64_t gap;
+
+        cursor->buttons ^= *cursor->next++;
+        get_varint(&cursor->next, movie->data + movie->size, &gap);
+        cursor->change += gap;
+    }
+    return cursor->buttons;
+}
+
+void movie_play(const struct movie *movie, struct cgbe *gb, uint64_t *hashes) {
+    struct movie_cursor cursor;
+    size_t done = 0;
+
+    movie_start(movie, &cursor);
+
+    for (size_t frame = 0; frame < movie->frames; frame++) {
+        joypad_set(gb->joypad, movie_buttons(movie, &cursor, frame));
+
+        // Frames end at fixed m-cycles from the start, however far the last run overshot.
+        size_t target = (frame + 1) * (size_t)PPU_FRAME_CYCLES;
+        if (done < target) {
+            done += cgbe_run(gb, target - done);
+        }
+        hashes[frame] = cgbe_state_hash(gb);
+    }
+}
@@ -0,0 +1,588 @@
+#include "internal/ppu/ppu.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define VRAM_BANK_SIZE 0x2000
+#define TILE_DATA_SIZE 0x1800 // 0x8000-0x97FF of each bank, the tile maps follow
+#define TILE_SIZE 16
+#define MAX_LINE_SPRITES 10
+
+// Line buffers have a tile's worth of room on either side, so partly visible tiles can be
+// written whole. Screen pixel x is at x + MARGIN.
+#define MARGIN 8
+#define LINE_SIZE (MARGIN + PPU_WIDTH + 2 * 8)
+
+#define STAT_LYC_INT (1 << 6)
+#define STAT_OAM_INT (1 << 5)
+#define STAT_VBLANK_INT (1 << 4)
+#define STAT_HBLANK_INT (1 << 3)
+#define STAT_WRITABLE (STAT_LYC_INT | STAT_OAM_INT | STAT_VBLANK_INT | STAT_HBLANK_INT)
+
+#define ATTR_PRIORITY (1 << 7)
+#define ATTR_Y_FLIP (1 << 6)
+#define ATTR_X_FLIP (1 << 5)
+#define ATTR_BANK (1 << 3)
+#define ATTR_PALETTE 0x07
+
+#define PALETTE_INCREMENT (1 << 7)
+
+// Spreads the bits of a tile row over 8 bytes, most significant bit in the lowest byte, which is
+// pixel order. One multiply moves every bit to the top of its own byte (no two partial products
+// meet in the bits that are kept), which does what pdep does without needing BMI2, and without
+// pdep's microcoded slowness on older AMD cores.
+static uint64_t spread(uint8_t bits) {
+    return ((bits * UINT64_C(0x8040201008040201)) >> 7) & UINT64_C(0x0101010101010101);
+}
+
+// Decodes a 2bpp tile row into 8 color numbers (0-3), one per byte, leftmost pixel in the lowest
+// byte.
+static uint64_t decode_row(uint8_t lo, uint8_t hi) {
+    return spread(lo) | spread(hi) << 1;
+}
+
+// Stores the 8 bytes of row, lowest first, whatever the host's byte order.
+static void store_row(uint8_t *dst, uint64_t row) {
+    for (size_t i = 0; i < 8; i++) {
+        dst[i] = row >> (8 * i);
+    }
+}
+
+static uint32_t rgb555_to_rgb888(uint16_t color) {
+    uint32_t r = color & 0x1F;
+    uint32_t g = (color >> 5) & 0x1F;
+    uint32_t b = (color >> 10) & 0x1F;
+
+    return (r << 3 | r >> 2) << 16 | (g << 3 | g >> 2) << 8 | (b << 3 | b >> 2);
+}
+
+static void update_color(struct ppu *ppu, size_t palettes, size_t index) {
+    const uint8_t *ram = ppu->palettes[palettes];
+
+    ppu->colors[palettes][index] = rgb555_to_rgb888(ram[2 * index] | ram[2 * index + 1] << 8);
+}
+
+enum ppu_mode ppu_mode(const struct ppu *ppu) {
+    if (!(ppu->lcdc & PPU_LCDC_ON)) {
+        return PPU_HBLANK;
+    } else if (ppu->ly >= PPU_HEIGHT) {
+        return PPU_VBLANK;
+    } else if (ppu->cycle < PPU_OAM_SCAN_CYCLES) {
+        return PPU_OAM_SCAN;
+    } else if (ppu->cycle < PPU_OAM_SCAN_CYCLES + PPU_DRAWING_CYCLES) {
+        return PPU_DRAWING;
+    }
+    return PPU_HBLANK;
+}
+
+// Requests the stat interrupt when any of the enabled conditions becomes true.
+static void update_stat(struct ppu *ppu) {
+    enum ppu_mode mode = ppu_mode(ppu);
+    bool line = (ppu->stat & STAT_LYC_INT && ppu->ly == ppu->lyc) ||
+                (ppu->stat & STAT_HBLANK_INT && mode == PPU_HBLANK) ||
+                (ppu->stat & STAT_VBLANK_INT && mode == PPU_VBLANK) ||
+                (ppu->stat & STAT_OAM_INT && mode == PPU_OAM_SCAN);
+
+    line = line && (ppu->lcdc & PPU_LCDC_ON);
+    if (line && !ppu->stat_line) {
+        bus_request_interrupt(ppu->bus, BUS_INTERRUPT_STAT);
+    }
+    ppu->stat_line = line;
+}
+
+// With the tile cache on, tile data writes go through vram_write so their tiles get marked dirty.
+static void map_vram(struct ppu *ppu) {
+    size_t bank = ppu->vbk * VRAM_BANK_SIZE;
+
+    bus_map_ram(ppu->bus, 0x8000, TILE_DATA_SIZE, ppu->vram, bank, ppu->tiles == NULL);
+    bus_map_ram(ppu->bus, 0x8000 + TILE_DATA_SIZE, VRAM_BANK_SIZE - TILE_DATA_SIZE, ppu->vram,
+                bank + TILE_DATA_SIZE, true);
+}
+
+static void mark_all_tiles(struct ppu *ppu) {
+    memset(ppu->tiles_dirty, 0xFF, sizeof(ppu->tiles_dirty));
+}
+
+// 0x8000-0x9FFF, vram is always mapped for reading, writes only get here while a page is shared
+// with a fork, or for tile data while the tile cache is on.
+static uint8_t vram_read(void *ctx, uint16_t address) {
+    struct ppu *ppu = ctx;
+
+    return ram_read(ppu->vram, ppu->vbk * VRAM_BANK_SIZE + address - 0x8000);
+}
+
+// Marks the tile at offset into the current vram bank dirty, if it's tile data.
+static void mark_tile(struct ppu *ppu, size_t offset) {
+    if (offset < TILE_DATA_SIZE) {
+        size_t tile = ppu->vbk * PPU_BANK_TILES + offset / TILE_SIZE;
+        ppu->tiles_dirty[tile / 64] |= UINT64_C(1) << (tile % 64);
+    }
+}
+
+static void vram_write(void *ctx, uint16_t address, uint8_t val) {
+    struct ppu *ppu = ctx;
+
+    // Lines due before the write get drawn with what was there.
+    ppu_sync(ppu);
+
+    size_t offset = ppu->vbk * VRAM_BANK_SIZE + address - 0x8000;
+    bool shared = ram_page_writable(ppu->vram, offset - offset % RAM_PAGE_SIZE) == NULL;
+
+    ram_write(ppu->vram, offset, val);
+    mark_tile(ppu, address - 0x8000);
+
+    // The write copied the page, which has to be mapped in place of the shared one.
+    if (shared) {
+        map_vram(ppu);
+    }
+}
+
+// Copies blocks of PPU_HDMA_BLOCK bytes from hdma_src into the current vram bank at hdma_dst,
+// memcpy at a time, and halts the cpu for as long as that takes.
+static void hdma_copy(struct ppu *ppu, size_t blocks) {
+    uint8_t buf[128 * PPU_HDMA_BLOCK];
+    bool shared = false;
+
+    bus_dma_read(ppu->bus, ppu->hdma_src, buf, blocks * PPU_HDMA_BLOCK);
+
+    for (size_t i = 0; i < blocks; i++) {
+        size_t offset = ppu->vbk * VRAM_BANK_SIZE + ppu->hdma_dst;
+        size_t page = offset - offset % RAM_PAGE_SIZE;
+        uint8_t *data = ram_page_writable(ppu->vram, page);
+
+        // Blocks never straddle pages, writing the first byte unshares the whole block's page.
+        if (data == NULL) {
+            ram_write(ppu->vram, offset, buf[i * PPU_HDMA_BLOCK]);
+            data = ram_page_writable(ppu->vram, page);
+            shared = true;
+        }
+        memcpy(data + offset % RAM_PAGE_SIZE, buf + i * PPU_HDMA_BLOCK, PPU_HDMA_BLOCK);
+        mark_tile(ppu, ppu->hdma_dst);
+
+        ppu->hdma_src += PPU_HDMA_BLOCK;
+        ppu->hdma_dst = (ppu->hdma_dst + PPU_HDMA_BLOCK) % VRAM_BANK_SIZE;
+    }
+
+    if (shared) {
+        map_vram(ppu);
+    }
+    bus_stall(ppu->bus, blocks * PPU_HDMA_BLOCK_CYCLES);
+}
+
+static uint8_t reg_read(void *ctx, uint16_t address) {
+    struct ppu *ppu = ctx;
+
+    ppu_sync(ppu);
+
+    switch (address) {
+    case 0xFF40: return ppu->lcdc;
+    case 0xFF41: return 0x80 | ppu->stat | (ppu->ly == ppu->lyc ? 0x04 : 0) | ppu_mode(ppu);
+    case 0xFF42: return ppu->scy;
+    case 0xFF43: return ppu->scx;
+    case 0xFF44: return ppu->ly;
+    case 0xFF45: return ppu->lyc;
+    case 0xFF4A: return ppu->wy;
+    case 0xFF4B: return ppu->wx;
+    case 0xFF46: return ppu->dma;
+    case 0xFF4F: return 0xFE | ppu->vbk;
+    case 0xFF55: return ppu->hdma5;
+    case 0xFF68: return 0x40 | ppu->bcps;
+    case 0xFF69: return ppu->palettes[0][ppu->bcps % 64];
+    case 0xFF6A: return 0x40 | ppu->ocps;
+    case 0xFF6B: return ppu->palettes[1][ppu->ocps % 64];
+    }
+    return 0xFF;
+}
+
+// Writes palette ram through an index register, which may then move on to the next byte.
+static void write_palette(struct ppu *ppu, size_t palettes, uint8_t *index, uint8_t val) {
+    size_t i = *index % 64;
+
+    ppu->palettes[palettes][i] = val;
+    update_color(ppu, palettes, i / 2);
+    if (*index & PALETTE_INCREMENT) {
+        *index = PALETTE_INCREMENT | (i + 1) % 64;
+    }
+}
+
+static void reg_write(void *ctx, uint16_t address, uint8_t val) {
+    struct ppu *ppu = ctx;
+
+    ppu_sync(ppu);
+
+    switch (address) {
+    case 0xFF40:
+        // Turning the lcd off or on restarts it at the top of the frame.
+        if ((ppu->lcdc ^ val) & PPU_LCDC_ON) {
+            ppu->ly = 0;
+            ppu->cycle = 0;
+            ppu->window_line = 0;
+        }
+        ppu->lcdc = val;
+        break;
+    case 0xFF41: ppu->stat = val & STAT_WRITABLE; break;
+    case 0xFF42: ppu->scy = val; break;
+    case 0xFF43: ppu->scx = val; break;
+    case 0xFF44: break; // LY is read only
+    case 0xFF45: ppu->lyc = val; break;
+    case 0xFF46:
+        ppu->dma = val;
+        bus_dma_read(ppu->bus, val << 8, ppu->oam, PPU_OAM_DMA_SIZE);
+        break;
+    case 0xFF4A: ppu->wy = val; break;
+    case 0xFF4B: ppu->wx = val; break;
+    case 0xFF4F:
+        ppu->vbk = val & 1;
+        map_vram(ppu);
+        break;
+    case 0xFF51: ppu->hdma_src = val << 8 | (ppu->hdma_src & 0x00F0); break;
+    case 0xFF52: ppu->hdma_src = (ppu->hdma_src & 0xFF00) | (val & 0xF0); break;
+    case 0xFF53: ppu->hdma_dst = (val & 0x1F) << 8 | (ppu->hdma_dst & 0x00F0); break;
+    case 0xFF54: ppu->hdma_dst = (ppu->hdma_dst & 0x1F00) | (val & 0xF0); break;
+    case 0xFF55:
+        if (!(ppu->hdma5 & PPU_HDMA_INACTIVE) && !(val & PPU_HDMA_INACTIVE)) {
+            ppu->hdma5 |= PPU_HDMA_INACTIVE; // stops the hblank dma
+        } else if (val & PPU_HDMA_INACTIVE) {
+            ppu->hdma5 = val & 0x7F;
+        } else {
+            hdma_copy(ppu, val % 128 + 1);
+            ppu->hdma5 = 0xFF;
+        }
+        break;
+    case 0xFF68: ppu->bcps = val & (PALETTE_INCREMENT | 0x3F); break;
+    case 0xFF69: write_palette(ppu, 0, &ppu->bcps, val); break;
+    case 0xFF6A: ppu->ocps = val & (PALETTE_INCREMENT | 0x3F); break;
+    case 0xFF6B: write_palette(ppu, 1, &ppu->ocps, val); break;
+    }
+
+    update_stat(ppu);
+    ppu_sync(ppu); // schedules the next event again, the write may have moved it
+}
+
+static void attach(struct ppu *ppu) {
+    struct bus_handler vram = {vram_read, vram_write, ppu};
+    struct bus_handler regs = {reg_read, reg_write, ppu};
+
+    bus_map_handler(ppu->bus, 0x8000, VRAM_BANK_SIZE, vram);
+    map_vram(ppu);
+    bus_map_memory(ppu->bus, 0xFE00, BUS_PAGE_SIZE, ppu->oam, true);
+
+    bus_map_io(ppu->bus, 0x40, 7, regs); // LCDC, STAT, SCY, SCX, LY, LYC, DMA
+    bus_map_io(ppu->bus, 0x4A, 2, regs); // WY, WX
+    bus_map_io(ppu->bus, 0x4F, 1, regs); // VBK
+    bus_map_io(ppu->bus, 0x51, 5, regs); // HDMA1-HDMA5
+    bus_map_io(ppu->bus, 0x68, 4, regs); // BCPS, BCPD, OCPS, OCPD
+}
+
+struct ppu *ppu_new(struct bus *bus, struct scheduler *scheduler) {
+    struct ppu *ppu = malloc(sizeof(struct ppu));
+    assert(ppu != NULL);
+
+    ppu->bus = bus;
+    ppu->scheduler = scheduler;
+    ppu->vram = ram_new(2 * VRAM_BANK_SIZE);
+    memset(ppu->oam, 0, sizeof(ppu->oam));
+    memset(ppu->palettes, 0xFF, sizeof(ppu->palettes)); // white
+
+    ppu->lcdc = 0;
+    ppu->stat = 0;
+    ppu->scy = 0;
+    ppu->scx = 0;
+    ppu->ly = 0;
+    ppu->lyc = 0;
+    ppu->wy = 0;
+    ppu->wx = 0;
+    ppu->vbk = 0;
+    ppu->bcps = 0;
+    ppu->ocps = 0;
+    ppu->dma = 0;
+    ppu->hdma_src = 0;
+    ppu->hdma_dst = 0;
+    ppu->hdma5 = 0xFF;
+
+    ppu->window_line = 0;
+    ppu->stat_line = false;
+    ppu->cycle = 0;
+    ppu->frames = 0;
+    ppu->framebuffer = NULL;
+    ppu->draw_every = 1;
+    ppu->tiles = NULL;
+    mark_all_tiles(ppu);
+
+    attach(ppu);
+    ppu_refresh(ppu);
+
+    return ppu;
+}
+
+struct ppu *ppu_fork(struct ppu *ppu, struct bus *bus, struct scheduler *scheduler) {
+    struct ppu *fork = malloc(sizeof(struct ppu));
+    assert(fork != NULL);
+
+    *fork = *ppu;
+    fork->bus = bus;
+    fork->scheduler = scheduler;
+    fork->vram = ram_fork(ppu->vram);
+    fork->framebuffer = NULL;
+    fork->tiles = NULL;
+    mark_all_tiles(fork);
+
+    attach(fork);
+    map_vram(ppu);
+
+    return fork;
+}
+
+void ppu_delete(struct ppu *ppu) {
+    if (ppu == NULL) {
+        return;
+    }
+
+    ram_delete(ppu->vram);
+    free(ppu->tiles);
+    free(ppu);
+}
+
+void ppu_refresh(struct ppu *ppu) {
+    for (size_t i = 0; i < 32; i++) {
+        update_color(ppu, 0, i);
+        update_color(ppu, 1, i);
+    }
+    mark_all_tiles(ppu);
+    map_vram(ppu);
+    scheduler_wake(ppu->scheduler, SCHEDULER_PPU);
+}
+
+void ppu_map_vram(struct ppu *ppu) {
+    map_vram(ppu);
+}
+
+static bool window_visible(const struct ppu *ppu) {
+    return (ppu->lcdc & PPU_LCDC_WINDOW_ON) && ppu->ly >= ppu->wy && ppu->wx <= 166;
+}
+
+// Number of a background tile among its vram bank's tiles.
+static size_t tile_number(const struct ppu *ppu, uint8_t tile) {
+    return ppu->lcdc & PPU_LCDC_TILES ? tile : 256 + (int8_t)tile;
+}
+
+// Reverses a decoded row's pixels, one per byte. Plain shifts and masks rather than a builtin,
+// compilers turn them into a single byte swap anyway.
+static uint64_t flip_row(uint64_t colors) {
+    colors = (colors & 0x00FF00FF00FF00FF) << 8 | (colors >> 8 & 0x00FF00FF00FF00FF);
+    colors = (colors & 0x0000FFFF0000FFFF) << 16 | (colors >> 16 & 0x0000FFFF0000FFFF);
+    return colors << 32 | colors >> 32;
+}
+
+// Returns row (0-7) of a tile, decoded as by decode_row, with tile numbering both banks' tiles in
+// vram order. Tiles marked dirty are decoded again first.
+static uint64_t tile_row(struct ppu *ppu, size_t tile, size_t row, bool x_flip) {
+    uint64_t bit = UINT64_C(1) << (tile % 64);
+
+    if (ppu->tiles_dirty[tile / 64] & bit) {
+        size_t address = tile / PPU_BANK_TILES * VRAM_BANK_SIZE + tile % PPU_BANK_TILES * TILE_SIZE;
+
+        for (size_t i = 0; i < 8; i++, address += 2) {
+            ppu->tiles[tile][i] =
+                decode_row(ram_read(ppu->vram, address), ram_read(ppu->vram, address + 1));
+        }
+        ppu->tiles_dirty[tile / 64] &= ~bit;
+    }
+
+    uint64_t colors = ppu->tiles[tile][row];
+    return x_flip ? flip_row(colors) : colors;
+}
+
+// Draws count tiles of one row of a tile map, starting at map column col, into the line buffers
+// from pos on. index gets each pixel's color within the background palettes, bg its color number
+// with the tile's priority bit on top, for sprites to decide who goes on top.
+static void draw_tiles(struct ppu *ppu, size_t map, uint8_t y, uint8_t col, size_t count,
+                       uint8_t *index, uint8_t *bg, size_t pos) {
+    size_t row_map = map + (y / 8) * 32;
+
+    for (size_t i = 0; i < count; i++, pos += 8) {
+        size_t entry = row_map + (col + i) % 32;
+        uint8_t tile = ram_read(ppu->vram, entry);
+        uint8_t attr = ram_read(ppu->vram, VRAM_BANK_SIZE + entry);
+        size_t row = attr & ATTR_Y_FLIP ? 7 - y % 8 : y % 8;
+        size_t number = tile_number(ppu, tile) + (attr & ATTR_BANK ? PPU_BANK_TILES : 0);
+        uint64_t colors = tile_row(ppu, number, row, attr & ATTR_X_FLIP);
+        uint64_t bytes = UINT64_C(0x0101010101010101);
+
+        // Every byte stays below 32, so adding to all 8 pixels at once can't carry across.
+        store_row(index + pos, colors + bytes * ((attr & ATTR_PALETTE) * 4));
+        store_row(bg + pos, colors | bytes * (attr & ATTR_PRIORITY));
+    }
+}
+
+static void draw_sprites(struct ppu *ppu, uint8_t *index, const uint8_t *bg) {
+    size_t height = ppu->lcdc & PPU_LCDC_OBJ_TALL ? 16 : 8;
+    bool taken[LINE_SIZE] = {false};
+    size_t count = 0;
+
+    // The first 10 sprites on the line in oam order are drawn, earlier ones on top (CGB rules).
+    for (size_t i = 0; i < 40 && count < MAX_LINE_SPRITES; i++) {
+        const uint8_t *sprite = &ppu->oam[4 * i];
+        size_t row = ppu->ly + 16 - sprite[0];
+
+        if (ppu->ly + 16 < sprite[0] || row >= height) {
+            continue;
+        }
+        count++;
+
+        uint8_t tile = height == 16 ? sprite[2] & 0xFE : sprite[2];
+        uint8_t attr = sprite[3];
+
+        if (attr & ATTR_Y_FLIP) {
+            row = height - 1 - row;
+        }
+
+        size_t number = tile + row / 8 + (attr & ATTR_BANK ? PPU_BANK_TILES : 0);
+        uint64_t colors = tile_row(ppu, number, row % 8, attr & ATTR_X_FLIP);
+
+        // sprite[1] is x + 8, which is also where it starts in the line buffers.
+        for (size_t px = 0; px < 8; px++, colors >>= 8) {
+            size_t pos = sprite[1] + px;
+            uint8_t color = colors & 0xFF;
+
+            if (color == 0 || pos < MARGIN || pos >= MARGIN + PPU_WIDTH || taken[pos]) {
+                continue;
+            }
+            taken[pos] = true;
+
+            bool behind = (ppu->lcdc & PPU_LCDC_BG_ON) && (bg[pos] & 0x03) != 0 &&
+                          ((bg[pos] & ATTR_PRIORITY) || (attr & ATTR_PRIORITY));
+            if (!behind) {
+                index[pos] = 32 + (attr & ATTR_PALETTE) * 4 + color;
+            }
+        }
+    }
+}
+
+// Looks every pixel's color up, 8 at a time with a gather where there's AVX2.
+static void draw_colors(const struct ppu *ppu, const uint8_t *index, uint32_t *dst) {
+    const uint32_t *colors = &ppu->colors[0][0];
+
+#if defined(__AVX2__)
+    for (size_t x = 0; x < PPU_WIDTH; x += 8) {
+        __m256i i = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(index + x)));
+        __m256i c = _mm256_i32gather_epi32((const int *)colors, i, 4);
+        _mm256_storeu_si256((__m256i *)(dst + x), c);
+    }
+#else
+    for (size_t x = 0; x < PPU_WIDTH; x++) {
+        dst[x] = colors[index[x]];
+    }
+#endif
+}
+
+static void draw_line(struct ppu *ppu) {
+    uint8_t index[LINE_SIZE];
+    uint8_t bg[LINE_SIZE];
+    uint8_t y = ppu->ly + ppu->scy;
+
+    // The tile cache only pays off once something gets drawn.
+    if (ppu->tiles == NULL) {
+        ppu->tiles = malloc(PPU_TILES * sizeof(*ppu->tiles));
+        assert(ppu->tiles != NULL);
+        mark_all_tiles(ppu);
+        map_vram(ppu);
+    }
+
+    size_t map = ppu->lcdc & PPU_LCDC_BG_MAP ? 0x1C00 : 0x1800;
+    draw_tiles(ppu, map, y, ppu->scx / 8, PPU_WIDTH / 8 + 1, index, bg, MARGIN - ppu->scx % 8);
+
+    if (window_visible(ppu)) {
+        size_t start = ppu->wx + MARGIN - 7;
+        size_t count = (PPU_WIDTH + MARGIN - start + 7) / 8;
+
+        map = ppu->lcdc & PPU_LCDC_WINDOW_MAP ? 0x1C00 : 0x1800;
+        draw_tiles(ppu, map, ppu->window_line, 0, count, index, bg, start);
+    }
+
+    if (ppu->lcdc & PPU_LCDC_OBJ_ON) {
+        draw_sprites(ppu, index, bg);
+    }
+
+    draw_colors(ppu, index + MARGIN, ppu->framebuffer + ppu->ly * PPU_WIDTH);
+}
+
+// Whether the current frame gets drawn, frames counts the vblanks before it.
+static bool drawing(const struct ppu *ppu) {
+    assert(ppu->draw_every > 0);
+    return ppu->framebuffer != NULL && ppu->frames % ppu->draw_every == 0;
+}
+
+size_t ppu_next_event(const struct ppu *ppu) {
+    if (!(ppu->lcdc & PPU_LCDC_ON)) {
+        return SIZE_MAX;
+    } else if (ppu->ly < PPU_HEIGHT && ppu->cycle < PPU_OAM_SCAN_CYCLES) {
+        return PPU_OAM_SCAN_CYCLES - ppu->cycle;
+    } else if (ppu->ly < PPU_HEIGHT && ppu->cycle < PPU_OAM_SCAN_CYCLES + PPU_DRAWING_CYCLES) {
+        return PPU_OAM_SCAN_CYCLES + PPU_DRAWING_CYCLES - ppu->cycle;
+    }
+    return PPU_LINE_CYCLES - ppu->cycle;
+}
+
+// M-cycles until the ppu has to run without anyone looking at it: every mode change while lines
+// are drawn, a STAT interrupt is enabled or an hblank dma runs, else only the vblank interrupt.
+// Register accesses catch it up in between.
+static size_t next_deadline(const struct ppu *ppu) {
+    if (!(ppu->lcdc & PPU_LCDC_ON) || drawing(ppu) || (ppu->stat & STAT_WRITABLE) ||
+        !(ppu->hdma5 & PPU_HDMA_INACTIVE)) {
+        return ppu_next_event(ppu);
+    }
+
+    size_t lines = ppu->ly < PPU_HEIGHT ? PPU_HEIGHT - ppu->ly : PPU_LINES - ppu->ly + PPU_HEIGHT;
+    return lines * PPU_LINE_CYCLES - ppu->cycle;
+}
+
+void ppu_tick(struct ppu *ppu, size_t cycles) {
+    while (ppu->lcdc & PPU_LCDC_ON) {
+        size_t step = ppu_next_event(ppu);
+
+        if (cycles < step) {
+            ppu->cycle += cycles;
+            break;
+        }
+        cycles -= step;
+        ppu->cycle += step;
+
+        if (ppu->cycle == PPU_LINE_CYCLES) {
+            ppu->cycle = 0;
+            ppu->ly++;
+            if (ppu->ly == PPU_HEIGHT) {
+                bus_request_interrupt(ppu->bus, BUS_INTERRUPT_VBLANK);
+                ppu->frames++;
+            } else if (ppu->ly == PPU_LINES) {
+                ppu->ly = 0;
+                ppu->window_line = 0;
+            }
+        } else if (ppu->cycle == PPU_OAM_SCAN_CYCLES + PPU_DRAWING_CYCLES) {
+            if (drawing(ppu)) {
+                draw_line(ppu);
+            }
+            if (window_visible(ppu)) {
+                ppu->window_line++;
+            }
+            if (!(ppu->hdma5 & PPU_HDMA_INACTIVE)) {
+                hdma_copy(ppu, 1);
+                ppu->hdma5 = ppu->hdma5 == 0 ? 0xFF : ppu->hdma5 - 1;
+            }
+        }
+
+        update_stat(ppu);
+    }
+
+    scheduler_schedule(ppu->scheduler, SCHEDULER_PPU, next_deadline(ppu));
+}
+
+void ppu_sync(struct ppu *ppu) {
+    ppu_tick(ppu, scheduler_sync(ppu->scheduler, SCHEDULER_PPU));
+}
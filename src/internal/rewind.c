@@ -0,0 +1,245 @@
+#include "internal/rewind.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Unchanged bytes that end a run of changed ones. Shorter gaps are cheaper to store as changed
+// bytes than as the two varints starting a new run.
+#define GAP 4
+
+// Longest varint, 7 bits per byte.
+#define VARINT_MAX 10
+
+static size_t put_varint(uint8_t *out, size_t val) {
+    size_t n = 0;
+
+    for (; val >= 0x80; val >>= 7) {
+        out[n++] = val | 0x80;
+    }
+    out[n++] = val;
+    return n;
+}
+
+static size_t get_varint(const uint8_t **p) {
+    size_t val = 0;
+
+    for (unsigned shift = 0;; shift += 7) {
+        uint8_t byte = *(*p)++;
+
+        val |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return val;
+        }
+    }
+}
+
+static bool same_word(const uint8_t *a, const uint8_t *b) {
+    uint64_t x, y;
+    memcpy(&x, a, 8);
+    memcpy(&y, b, 8);
+    return x == y;
+}
+
+// Runs are at least GAP bytes apart, each costs two varints on top of its bytes.
+static size_t encoded_max(size_t size) {
+    return size + (size / GAP + 1) * 2 * VARINT_MAX;
+}
+
+// Writes the XOR of cur and prev to out as runs: a varint count of unchanged bytes, a varint
+// count of changed ones, then the changed ones XORed with prev. Unchanged bytes at the end are
+// left out. Returns the bytes written, at most encoded_max(size).
+static size_t encode(const uint8_t *cur, const uint8_t *prev, size_t size, uint8_t *out) {
+    size_t i = 0, n = 0;
+
+    while (i < size) {
+        size_t start = i;
+        while (i + 8 <= size && same_word(cur + i, prev + i)) {
+            i += 8;
+        }
+        while (i < size && cur[i] == prev[i]) {
+            i++;
+        }
+        if (i == size) {
+            break;
+        }
+
+        size_t changed = i, unchanged = 0;
+        for (; i < size && unchanged < GAP; i++) {
+            unchanged = cur[i] == prev[i] ? unchanged + 1 : 0;
+        }
+        i -= unchanged;
+
+        n += put_varint(out + n, changed - start);
+        n += put_varint(out + n, i - changed);
+        for (size_t j = changed; j < i; j++) {
+            out[n++] = cur[j] ^ prev[j];
+        }
+    }
+    return n;
+}
+
+// XORs encoded runs into state.
+static void apply(const uint8_t *in, size_t size, uint8_t *state) {
+    const uint8_t *p = in;
+    size_t pos = 0;
+
+    while (p < in + size) {
+        pos += get_varint(&p);
+        size_t count = get_varint(&p);
+
+        for (size_t i = 0; i < count; i++) {
+            state[pos + i] ^= p[i];
+        }
+        p += count;
+        pos += count;
+    }
+}
+
+static struct rewind_frame *frame_at(const struct rewind *rw, size_t i) {
+    return &rw->frames[(rw->first + i) % rw->max_frames];
+}
+
+// Drops the oldest keyframe along with its deltas, which can't be decoded without it.
+static void drop_oldest(struct rewind *rw) {
+    do {
+        rw->first = (rw->first + 1) % rw->max_frames;
+        rw->count--;
+        if (rw->wrap != 0) {
+            rw->wrap--;
+        }
+    } while (rw->count != 0 && !frame_at(rw, 0)->key);
+
+    if (rw->count == 0) {
+        rw->head = 0;
+    }
+}
+
+// Returns where size bytes fit after the newest frame, dropping the oldest frames until they do,
+// or until there's room for one more frame. Whether buf has wrapped is tracked rather than told
+// from the offsets, empty frames (nothing changed) leave those ambiguous.
+static size_t reserve(struct rewind *rw, size_t size) {
+    assert(size <= rw->capacity);
+
+    for (;; drop_oldest(rw)) {
+        if (rw->count == 0) {
+            return 0;
+        }
+        if (rw->count == rw->max_frames) {
+            continue;
+        }
+
+        size_t tail = frame_at(rw, 0)->offset;
+
+        // Unwrapped frames run from tail to head, wrapped ones from tail to the end of buf and on
+        // from its start to head.
+        if (rw->wrap == 0) {
+            if (rw->head + size <= rw->capacity) {
+                return rw->head;
+            }
+            if (size <= tail) {
+                rw->wrap = rw->count;
+                return 0;
+            }
+        } else if (rw->head + size <= tail) {
+            return rw->head;
+        }
+    }
+}
+
+struct rewind *rewind_new(const struct cgbe *gb, size_t frames, size_t bytes) {
+    assert(frames != 0);
+
+    struct rewind *rw = malloc(sizeof(struct rewind));
+    assert(rw != NULL);
+
+    rw->state_size = cgbe_state_size(gb);
+    rw->last = malloc(rw->state_size);
+    rw->scratch = malloc(rw->state_size);
+    rw->encoded = malloc(encoded_max(rw->state_size));
+    rw->zeros = calloc(rw->state_size, 1);
+    rw->buf = malloc(bytes);
+    rw->capacity = bytes;
+    rw->frames = malloc(frames * sizeof(struct rewind_frame));
+    rw->max_frames = frames;
+    rw->first = 0;
+    rw->count = 0;
+    rw->head = 0;
+    rw->wrap = 0;
+    assert(rw->last != NULL && rw->scratch != NULL && rw->encoded != NULL && rw->zeros != NULL &&
+           rw->buf != NULL && rw->frames != NULL);
+
+    return rw;
+}
+
+void rewind_delete(struct rewind *rw) {
+    if (rw == NULL) {
+        return;
+    }
+
+    free(rw->last);
+    free(rw->scratch);
+    free(rw->encoded);
+    free(rw->zeros);
+    free(rw->buf);
+    free(rw->frames);
+    free(rw);
+}
+
+void rewind_push(struct rewind *rw, const struct cgbe *gb) {
+    cgbe_state_save(gb, rw->scratch, rw->state_size);
+
+    bool key = rw->count == 0;
+    for (size_t i = rw->count; i-- > 0 && !key;) {
+        if (frame_at(rw, i)->key) {
+            key = rw->count - i >= REWIND_KEYFRAME_INTERVAL;
+            break;
+        }
+    }
+
+    size_t size = encode(rw->scratch, key ? rw->zeros : rw->last, rw->state_size, rw->encoded);
+    size_t offset = reserve(rw, size);
+
+    // Making room dropped every frame, including the one the delta was taken against.
+    if (!key && rw->count == 0) {
+        key = true;
+        size = encode(rw->scratch, rw->zeros, rw->state_size, rw->encoded);
+        offset = reserve(rw, size);
+    }
+
+    memcpy(rw->buf + offset, rw->encoded, size);
+    *frame_at(rw, rw->count++) = (struct rewind_frame){offset, size, key};
+    rw->head = offset + size;
+
+    uint8_t *last = rw->last;
+    rw->last = rw->scratch;
+    rw->scratch = last;
+}
+
+void rewind_restore(struct rewind *rw, struct cgbe *gb, size_t back) {
+    assert(back < rw->count);
+
+    size_t index = rw->count - 1 - back;
+
+    // The newest frame is kept whole, everything else is decoded from its keyframe on.
+    if (back != 0) {
+        size_t key = index;
+        while (!frame_at(rw, key)->key) {
+            key--;
+        }
+
+        memset(rw->last, 0, rw->state_size);
+        for (size_t i = key; i <= index; i++) {
+            const struct rewind_frame *frame = frame_at(rw, i);
+            apply(rw->buf + frame->offset, frame->size, rw->last);
+        }
+        rw->count = index + 1;
+        rw->head = frame_at(rw, index)->offset + frame_at(rw, index)->size;
+        if (rw->wrap >= rw->count) {
+            rw->wrap = 0;
+        }
+    }
+
+    bool loaded = cgbe_state_load(gb, rw->last, rw->state_size);
+    assert(loaded);
+}
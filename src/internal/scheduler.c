@@ -0,0 +1,84 @@
+#include "internal/scheduler.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// There are only ever a handful of events, scanning them all on a change is cheaper than keeping
+// a heap or a timing wheel in order, and finding the earliest one stays a single load.
+static void set_deadline(struct scheduler *sched, enum scheduler_event event, uint64_t deadline) {
+    sched->events[event].deadline = deadline;
+
+    sched->next = SCHEDULER_NEVER;
+    for (size_t i = 0; i < SCHEDULER_EVENT_COUNT; i++) {
+        if (sched->events[i].deadline < sched->next) {
+            sched->next = sched->events[i].deadline;
+        }
+    }
+}
+
+struct scheduler *scheduler_new(const uint64_t *clock) {
+    struct scheduler *sched = malloc(sizeof(struct scheduler));
+    assert(sched != NULL);
+
+    sched->clock = clock;
+    sched->next = SCHEDULER_NEVER;
+    for (size_t i = 0; i < SCHEDULER_EVENT_COUNT; i++) {
+        sched->events[i] = (struct scheduler_entry){SCHEDULER_NEVER, *clock};
+    }
+
+    return sched;
+}
+
+struct scheduler *scheduler_fork(const struct scheduler *sched, const uint64_t *clock) {
+    struct scheduler *fork = malloc(sizeof(struct scheduler));
+    assert(fork != NULL);
+
+    *fork = *sched;
+    fork->clock = clock;
+
+    return fork;
+}
+
+void scheduler_delete(struct scheduler *sched) {
+    free(sched);
+}
+
+void scheduler_schedule(struct scheduler *sched, enum scheduler_event event, size_t cycles) {
+    uint64_t synced = sched->events[event].synced;
+
+    set_deadline(sched, event, cycles == SIZE_MAX ? SCHEDULER_NEVER : synced + cycles);
+}
+
+void scheduler_wake(struct scheduler *sched, enum scheduler_event event) {
+    sched->events[event].synced = scheduler_now(sched);
+    set_deadline(sched, event, scheduler_now(sched));
+}
+
+size_t scheduler_sync(struct scheduler *sched, enum scheduler_event event) {
+    uint64_t now = scheduler_now(sched);
+    size_t elapsed = now - sched->events[event].synced;
+
+    sched->events[event].synced = now;
+    return elapsed;
+}
+
+bool scheduler_pop(struct scheduler *sched, enum scheduler_event *event, size_t *elapsed) {
+    if (sched->next > scheduler_now(sched)) {
+        return false;
+    }
+
+    // Ties go to the first event in enum order.
+    size_t i = 0;
+    while (sched->events[i].deadline != sched->next) {
+        i++;
+    }
+
+    struct scheduler_entry *entry = &sched->events[i];
+
+    *event = i;
+    *elapsed = entry->deadline - entry->synced;
+    entry->synced = entry->deadline;
+    set_deadline(sched, i, SCHEDULER_NEVER);
+
+    return true;
+}
@@ -6,6 +6,9 @@ struct sm83 *sm83_new(struct bus *bus) {
     struct sm83 *cpu = malloc(sizeof(struct sm83));
 
     cpu->bus = bus;
+    cpu->blocks = NULL;
+    cpu->jit = NULL;
+    cpu->profile = NULL;
 
     cpu->regs.af = 0;
     cpu->regs.bc = 0;
@@ -13,6 +16,7 @@ struct sm83 *sm83_new(struct bus *bus) {
     cpu->regs.hl = 0;
     cpu->regs.pc = 0;
     cpu->regs.sp = 0;
+    cpu->lazy.op = SM83_LAZY_NONE;
 
     // Make first op NOP so we just fetch the next one on the first m-cycle.
     cpu->opcode = 0x00;
@@ -21,4 +25,16 @@ struct sm83 *sm83_new(struct bus *bus) {
     return cpu;
 }
 
+struct sm83 *sm83_fork(const struct sm83 *cpu, struct bus *bus) {
+    struct sm83 *fork = malloc(sizeof(struct sm83));
+
+    *fork = *cpu;
+    fork->bus = bus;
+    fork->blocks = NULL;
+    fork->jit = NULL;
+    fork->profile = NULL;
+
+    return fork;
+}
+
 void sm83_delete(struct sm83 *cpu) { free(cpu); }
@@ -0,0 +1,190 @@
+#include "internal/sm83/sm83_block.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define SM83_BLOCK_CACHE_SIZE 1024 // must be a power of 2
+
+struct sm83_block {
+    bool valid;
+    uint16_t bank;
+    uint16_t pc; // address of the first opcode
+    uint8_t count;
+    struct sm83_insn insns[SM83_BLOCK_MAX_INSNS];
+};
+
+struct sm83_block_cache {
+    struct sm83_block blocks[SM83_BLOCK_CACHE_SIZE];
+};
+
+struct sm83_block_cache *sm83_block_cache_new(void) {
+    struct sm83_block_cache *cache = malloc(sizeof(struct sm83_block_cache));
+    assert(cache != NULL);
+
+    sm83_block_cache_flush(cache);
+
+    return cache;
+}
+
+void sm83_block_cache_delete(struct sm83_block_cache *cache) { free(cache); }
+
+void sm83_block_cache_flush(struct sm83_block_cache *cache) {
+    for (size_t i = 0; i < SM83_BLOCK_CACHE_SIZE; i++) {
+        cache->blocks[i].valid = false;
+    }
+}
+
+// Anything that may change pc in a way we can't follow at decode time.
+static bool ends_block(uint8_t opcode) {
+    switch (opcode) {
+    case 0x18: // JR
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+    case 0xC2: // JP
+    case 0xC3:
+    case 0xCA:
+    case 0xD2:
+    case 0xDA:
+    case 0xE9:
+    case 0xC4: // CALL
+    case 0xCC:
+    case 0xCD:
+    case 0xD4:
+    case 0xDC:
+    case 0xC0: // RET, RETI
+    case 0xC8:
+    case 0xC9:
+    case 0xD0:
+    case 0xD8:
+    case 0xD9:
+    case 0xC7: // RST
+    case 0xCF:
+    case 0xD7:
+    case 0xDF:
+    case 0xE7:
+    case 0xEF:
+    case 0xF7:
+    case 0xFF:
+    case 0x10: // STOP, HALT, DI, EI
+    case 0x76:
+    case 0xF3:
+    case 0xFB:
+    case 0xD3: // Invalid
+    case 0xDB:
+    case 0xDD:
+    case 0xE3:
+    case 0xE4:
+    case 0xEB:
+    case 0xEC:
+    case 0xED:
+    case 0xF4:
+    case 0xFC:
+    case 0xFD:
+        return true;
+    default: return false;
+    }
+}
+
+size_t sm83_block_decode(struct bus *bus, uint16_t pc, struct sm83_insn *insns) {
+    uint32_t address = pc;
+    uint32_t region_end = pc < 0x4000 ? 0x4000 : 0x8000;
+    size_t count = 0;
+
+    while (count < SM83_BLOCK_MAX_INSNS) {
+        uint8_t opcode = bus_read(bus, address);
+        if (address + sm83_op_length[opcode] > region_end) {
+            break;
+        }
+
+        insns[count++] = sm83_decode(bus, opcode, address + 1);
+        address += sm83_op_length[opcode];
+
+        if (ends_block(opcode)) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+// Returns NULL if not even the first instruction fits in the bank.
+static struct sm83_block *translate(struct sm83_block *block, struct bus *bus, uint16_t bank,
+                                    uint16_t pc) {
+    block->count = sm83_block_decode(bus, pc, block->insns);
+    block->valid = block->count != 0;
+    if (!block->valid) {
+        return NULL;
+    }
+
+    block->bank = bank;
+    block->pc = pc;
+
+    return block;
+}
+
+static struct sm83_block *lookup(struct sm83_block_cache *cache, struct bus *bus, uint16_t pc) {
+    if (pc > 0x7FFF) {
+        return NULL;
+    }
+
+    uint16_t bank = cartridge_rom_bank(bus->cart, pc);
+    struct sm83_block *block = &cache->blocks[(pc ^ (bank << 5)) & (SM83_BLOCK_CACHE_SIZE - 1)];
+
+    if (block->valid && block->pc == pc && block->bank == bank) {
+        return block;
+    }
+    return translate(block, bus, bank, pc);
+}
+
+size_t sm83_block_run(struct sm83 *cpu, struct sm83_block_cache *cache, size_t cycles) {
+    struct bus *bus = cpu->bus;
+    uint64_t start = bus->clock;
+    size_t done = 0;
+
+    while (cpu->m_cycle != 0 && done < cycles) {
+        sm83_m_cycle(cpu);
+        bus->clock++;
+        done++;
+    }
+    sm83_sync_flags(cpu);
+
+    struct sm83_register_file regs = cpu->regs;
+    uint8_t opcode = cpu->opcode;
+
+    while (done < cycles) {
+        struct sm83_block *block = lookup(cache, bus, regs.pc - 1);
+
+        if (block == NULL) {
+            struct sm83_insn insn = sm83_decode(bus, opcode, regs.pc);
+
+            sm83_clock(bus, start + done, insn);
+            done += sm83_execute(&regs, bus, insn);
+            done += bus_take_stall(bus);
+            opcode = bus_read(bus, regs.pc++);
+            continue;
+        }
+
+        // A write may switch banks under the block, or start a transfer that halts the cpu, in
+        // which case we leave it right away.
+        size_t generation = bus->generation;
+        size_t i = 0;
+        for (;;) {
+            sm83_clock(bus, start + done, block->insns[i]);
+            done += sm83_execute(&regs, bus, block->insns[i++]);
+            if (i == block->count || bus->generation != generation || bus->stall != 0) {
+                break;
+            }
+            regs.pc++; // the next opcode is already decoded, skip its fetch
+        }
+        done += bus_take_stall(bus);
+        opcode = bus_read(bus, regs.pc++);
+    }
+
+    cpu->regs = regs;
+    cpu->opcode = opcode;
+    bus->clock = start + done;
+
+    return done;
+}
@@ -0,0 +1,516 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include "internal/sm83/sm83_jit.h"
+#include "internal/sm83/sm83_block.h"
+#include "internal/sm83/sm83_exec.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+
+#include <string.h>
+#include <sys/mman.h>
+
+#define SM83_JIT_BUFFER_SIZE (4 << 20)
+#define SM83_JIT_MAX_BLOCK_SIZE 4096 // bytes of host code, way more than 32 instructions can take
+#define SM83_JIT_CACHE_SIZE 4096     // must be a power of 2
+
+// What compiled code runs on, passed in rdi.
+//
+// Host register mapping while inside compiled code:
+//   rbx - the context
+//   r12 - a
+//   r13 - m-cycles taken so far
+//   r14 - f, only kept up to date where something reads it (see flags_live)
+//   r15 - lahf_to_f
+// Everything else stays in the context. r12/r14 are spilled around calls into the interpreter.
+struct jit_context {
+    struct sm83_register_file regs;
+    struct bus *bus;
+    size_t generation;
+    uint64_t clock; // bus clock when the block was entered
+    bool exit;      // set when the interpreter changed the memory map or halted the cpu
+};
+
+struct jit_block {
+    bool valid;
+    uint16_t bank;
+    uint16_t pc; // address of the first opcode
+    size_t (*code)(struct jit_context *ctx);
+};
+
+struct sm83_jit {
+    uint8_t *buffer;
+    size_t used;
+
+    // Host flags as loaded by lahf (SF:ZF:0:AF:0:PF:1:CF) to SM83 flags.
+    uint8_t lahf_to_f[256];
+
+    struct jit_block blocks[SM83_JIT_CACHE_SIZE];
+};
+
+#define CTX(field) ((uint8_t)offsetof(struct jit_context, field))
+
+static const uint8_t r8_offset[8] = {
+    CTX(regs.b), CTX(regs.c), CTX(regs.d), CTX(regs.e), CTX(regs.h), CTX(regs.l), 0, CTX(regs.a),
+};
+
+static const uint8_t r16_offset[4] = {CTX(regs.bc), CTX(regs.de), CTX(regs.hl), CTX(regs.sp)};
+
+// Second opcode byte of `op r/m8, r8`, indexed by enum mathop.
+static const uint8_t x86_mathop[8] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+
+struct emitter {
+    uint8_t *p;
+};
+
+static void emit_bytes(struct emitter *e, const uint8_t *bytes, size_t n) {
+    memcpy(e->p, bytes, n);
+    e->p += n;
+}
+
+#define EMIT(e, ...)                                                                               \
+    emit_bytes(e, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void emit16(struct emitter *e, uint16_t val) { EMIT(e, val % 256, val / 256); }
+
+static void emit32(struct emitter *e, uint32_t val) {
+    emit16(e, val % 65536);
+    emit16(e, val / 65536);
+}
+
+static void emit64(struct emitter *e, uint64_t val) {
+    emit32(e, val % ((uint64_t)1 << 32));
+    emit32(e, val >> 32);
+}
+
+// Runs one instruction the compiled code couldn't handle, taken m-cycles into the block.
+static size_t interpret(struct jit_context *ctx, uint32_t packed, size_t taken) {
+    struct sm83_insn insn = {
+        .opcode = packed % 256,
+        .length = (packed >> 8) % 256,
+        .imm = packed >> 16,
+    };
+
+    sm83_clock(ctx->bus, ctx->clock + taken, insn);
+    size_t cycles = sm83_execute(&ctx->regs, ctx->bus, insn);
+
+    ctx->exit = ctx->bus->generation != ctx->generation || ctx->bus->stall != 0;
+
+    return cycles;
+}
+
+static bool native(uint8_t op) {
+    enum r8 dst = (op >> 3) & 0b111;
+    enum r8 src = op & 0b111;
+
+    switch (op & 0b11000000) {
+    case 0b00000000:
+        switch (op & 0b00000111) {
+        case 0b001: return !(op & 0b1000); // LD r16, imm16
+        case 0b011: return true;           // INC/DEC r16
+        case 0b100:                        // INC r8
+        case 0b101:                        // DEC r8
+        case 0b110: return dst != r8_hl;   // LD r8, imm8
+        default: return op == 0x00;        // NOP
+        }
+    case 0b01000000: return dst != r8_hl && src != r8_hl; // LD r8, r8
+    case 0b10000000: return src != r8_hl;                 // ALU a, r8
+    default: return (op & 0b11000111) == 0b11000110;      // ALU a, imm8
+    }
+}
+
+static bool defines_flags(uint8_t op) { return op >= 0x80 && native(op); }
+
+static bool reads_flags(uint8_t op) {
+    if (!native(op)) {
+        return true;
+    }
+    if (op < 0x80) {
+        return false;
+    }
+
+    enum mathop mop = (op >> 3) & 0b111;
+    return mop == op_adc || mop == op_sbc;
+}
+
+// Whether f is read after each instruction before being fully overwritten, compiled code only
+// materializes flags where they are.
+static void flags_live(const struct sm83_insn *insns, size_t count, bool *live) {
+    bool l = true; // whatever runs after the block
+
+    for (size_t i = count; i-- > 0;) {
+        live[i] = l;
+        if (defines_flags(insns[i].opcode)) {
+            l = false;
+        }
+        if (reads_flags(insns[i].opcode)) {
+            l = true;
+        }
+    }
+}
+
+// mov ecx, src
+static void emit_load_cl(struct emitter *e, enum r8 src) {
+    if (src == r8_a) {
+        EMIT(e, 0x44, 0x89, 0xE1); // mov ecx, r12d
+    } else {
+        EMIT(e, 0x0F, 0xB6, 0x4B, r8_offset[src]); // movzx ecx, byte [rbx + src]
+    }
+}
+
+// Turns the host flags left by the last instruction into f.
+static void emit_flags(struct emitter *e, uint8_t from_host, uint8_t keep, uint8_t set) {
+    EMIT(e, 0x9F);                         // lahf
+    EMIT(e, 0x0F, 0xB6, 0xC4);             // movzx eax, ah
+    EMIT(e, 0x41, 0x0F, 0xB6, 0x04, 0x07); // movzx eax, byte [r15 + rax]
+    if (from_host != (SM83_Z_MASK | SM83_H_MASK | SM83_C_MASK)) {
+        EMIT(e, 0x83, 0xE0, from_host); // and eax, from_host
+    }
+    if (keep != 0) {
+        EMIT(e, 0x41, 0x83, 0xE6, keep); // and r14d, keep
+        EMIT(e, 0x41, 0x09, 0xC6);       // or r14d, eax
+    } else {
+        EMIT(e, 0x41, 0x89, 0xC6); // mov r14d, eax
+    }
+    if (set != 0) {
+        EMIT(e, 0x41, 0x83, 0xCE, set); // or r14d, set
+    }
+}
+
+static void emit_mathop(struct emitter *e, enum mathop op, bool flags) {
+    if (op == op_adc || op == op_sbc) {
+        EMIT(e, 0x41, 0x0F, 0xBA, 0xE6, 4); // bt r14d, 4
+    }
+    EMIT(e, 0x41, x86_mathop[op], 0xCC); // op r12b, cl
+
+    if (!flags) {
+        return;
+    }
+
+    switch (op) {
+    case op_add:
+    case op_adc: emit_flags(e, SM83_Z_MASK | SM83_H_MASK | SM83_C_MASK, 0, 0); break;
+    case op_sub:
+    case op_sbc:
+    case op_cp: emit_flags(e, SM83_Z_MASK | SM83_H_MASK | SM83_C_MASK, 0, SM83_N_MASK); break;
+    case op_and: emit_flags(e, SM83_Z_MASK, 0, SM83_H_MASK); break;
+    case op_xor:
+    case op_or: emit_flags(e, SM83_Z_MASK, 0, 0); break;
+    }
+}
+
+static void emit_native(struct emitter *e, struct sm83_insn insn, bool flags) {
+    uint8_t op = insn.opcode;
+    enum r8 dst = (op >> 3) & 0b111;
+    enum r8 src = op & 0b111;
+    uint8_t r16 = r16_offset[(op >> 4) & 0b11];
+
+    if (op == 0x00) {
+        return;
+    }
+
+    if (op >= 0x80) {
+        if (op >= 0xC0) {
+            EMIT(e, 0xB9); // mov ecx, imm8
+            emit32(e, insn.imm);
+        } else {
+            emit_load_cl(e, src);
+        }
+        emit_mathop(e, (op >> 3) & 0b111, flags);
+        return;
+    }
+
+    if (op >= 0x40) { // LD r8, r8
+        emit_load_cl(e, src);
+        if (dst == r8_a) {
+            EMIT(e, 0x41, 0x89, 0xCC); // mov r12d, ecx
+        } else {
+            EMIT(e, 0x88, 0x4B, r8_offset[dst]); // mov byte [rbx + dst], cl
+        }
+        return;
+    }
+
+    switch (op & 0b00001111) {
+    case 0x1: // LD r16, imm16
+        EMIT(e, 0x66, 0xC7, 0x43, r16); // mov word [rbx + r16], imm16
+        emit16(e, insn.imm);
+        return;
+    case 0x3: EMIT(e, 0x66, 0xFF, 0x43, r16); return; // inc word [rbx + r16]
+    case 0xB: EMIT(e, 0x66, 0xFF, 0x4B, r16); return; // dec word [rbx + r16]
+    }
+
+    switch (op & 0b00000111) {
+    case 0b100: // INC r8
+    case 0b101: // DEC r8
+        if (dst == r8_a) {
+            EMIT(e, 0x41, 0xFE, (op & 1) ? 0xCC : 0xC4); // inc/dec r12b
+        } else {
+            EMIT(e, 0xFE, (op & 1) ? 0x4B : 0x43, r8_offset[dst]); // inc/dec byte [rbx + dst]
+        }
+        if (flags) {
+            emit_flags(e, SM83_Z_MASK | SM83_H_MASK, SM83_C_MASK, (op & 1) ? SM83_N_MASK : 0);
+        }
+        return;
+    case 0b110: // LD r8, imm8
+        if (dst == r8_a) {
+            EMIT(e, 0x41, 0xBC); // mov r12d, imm8
+            emit32(e, insn.imm);
+        } else {
+            EMIT(e, 0xC6, 0x43, r8_offset[dst], insn.imm); // mov byte [rbx + dst], imm8
+        }
+        return;
+    }
+}
+
+static void emit_set_pc(struct emitter *e, uint16_t pc) {
+    EMIT(e, 0x66, 0xC7, 0x43, CTX(regs.pc)); // mov word [rbx + pc], pc
+    emit16(e, pc);
+}
+
+static void emit_add_cycles(struct emitter *e, uint32_t cycles) {
+    if (cycles != 0) {
+        EMIT(e, 0x49, 0x81, 0xC5); // add r13, cycles
+        emit32(e, cycles);
+    }
+}
+
+static void emit_spill(struct emitter *e) {
+    EMIT(e, 0x44, 0x88, 0x63, CTX(regs.a)); // mov byte [rbx + a], r12b
+    EMIT(e, 0x44, 0x88, 0x73, CTX(regs.f)); // mov byte [rbx + f], r14b
+}
+
+static void emit_reload(struct emitter *e) {
+    EMIT(e, 0x44, 0x0F, 0xB6, 0x63, CTX(regs.a)); // movzx r12d, byte [rbx + a]
+    EMIT(e, 0x44, 0x0F, 0xB6, 0x73, CTX(regs.f)); // movzx r14d, byte [rbx + f]
+}
+
+static void emit_interpret(struct emitter *e, struct sm83_insn insn, uint16_t pc) {
+    emit_spill(e);
+    emit_set_pc(e, pc + 1);
+    EMIT(e, 0x48, 0x89, 0xDF); // mov rdi, rbx
+    EMIT(e, 0xBE);             // mov esi, insn
+    emit32(e, insn.opcode | (insn.length << 8) | ((uint32_t)insn.imm << 16));
+    EMIT(e, 0x4C, 0x89, 0xEA); // mov rdx, r13
+    EMIT(e, 0x48, 0xB8);       // mov rax, interpret
+    emit64(e, (uintptr_t)interpret);
+    EMIT(e, 0xFF, 0xD0);       // call rax
+    EMIT(e, 0x49, 0x01, 0xC5); // add r13, rax
+    emit_reload(e);
+}
+
+// Compiles a block, returns NULL if there's nothing to compile.
+static uint8_t *compile(struct sm83_jit *jit, struct bus *bus, uint16_t pc) {
+    struct sm83_insn insns[SM83_BLOCK_MAX_INSNS];
+    bool live[SM83_BLOCK_MAX_INSNS];
+    uint8_t *exits[SM83_BLOCK_MAX_INSNS];
+    size_t exit_count = 0;
+
+    size_t count = sm83_block_decode(bus, pc, insns);
+    if (count == 0) {
+        return NULL;
+    }
+    flags_live(insns, count, live);
+
+    if (jit->used + SM83_JIT_MAX_BLOCK_SIZE > SM83_JIT_BUFFER_SIZE) {
+        sm83_jit_flush(jit);
+    }
+    struct emitter e = {.p = jit->buffer + jit->used};
+    uint8_t *code = e.p;
+
+    EMIT(&e, 0x53);             // push rbx
+    EMIT(&e, 0x41, 0x54);       // push r12
+    EMIT(&e, 0x41, 0x55);       // push r13
+    EMIT(&e, 0x41, 0x56);       // push r14
+    EMIT(&e, 0x41, 0x57);       // push r15
+    EMIT(&e, 0x48, 0x89, 0xFB); // mov rbx, rdi
+    EMIT(&e, 0x45, 0x31, 0xED); // xor r13d, r13d
+    EMIT(&e, 0x49, 0xBF);       // mov r15, lahf_to_f
+    emit64(&e, (uintptr_t)jit->lahf_to_f);
+    emit_reload(&e);
+
+    uint32_t cycles = 0; // taken by native instructions and not yet added to r13
+    bool last_native = false;
+
+    for (size_t i = 0; i < count; i++) {
+        last_native = native(insns[i].opcode);
+
+        if (last_native) {
+            emit_native(&e, insns[i], live[i]);
+            cycles += sm83_op_cycles[insns[i].opcode];
+        } else {
+            emit_add_cycles(&e, cycles);
+            cycles = 0;
+            emit_interpret(&e, insns[i], pc);
+
+            if (i + 1 < count) {
+                EMIT(&e, 0x80, 0x7B, CTX(exit), 0); // cmp byte [rbx + exit], 0
+                EMIT(&e, 0x0F, 0x85);               // jne exit
+                exits[exit_count++] = e.p;
+                emit32(&e, 0);
+            }
+        }
+
+        pc += insns[i].length;
+    }
+
+    // The interpreter already left pc pointing at the next opcode.
+    if (last_native) {
+        emit_add_cycles(&e, cycles);
+        emit_set_pc(&e, pc);
+    }
+
+    for (size_t i = 0; i < exit_count; i++) {
+        uint32_t rel = e.p - (exits[i] + 4);
+        memcpy(exits[i], &rel, sizeof(rel));
+    }
+
+    emit_spill(&e);
+    EMIT(&e, 0x4C, 0x89, 0xE8); // mov rax, r13
+    EMIT(&e, 0x41, 0x5F);       // pop r15
+    EMIT(&e, 0x41, 0x5E);       // pop r14
+    EMIT(&e, 0x41, 0x5D);       // pop r13
+    EMIT(&e, 0x41, 0x5C);       // pop r12
+    EMIT(&e, 0x5B);             // pop rbx
+    EMIT(&e, 0xC3);             // ret
+
+    assert((size_t)(e.p - code) <= SM83_JIT_MAX_BLOCK_SIZE);
+    jit->used = e.p - jit->buffer;
+
+    return code;
+}
+
+// Switches the code buffer between writable and executable, it's never both at once.
+static void protect(struct sm83_jit *jit, int prot) {
+    // Worked in sm83_jit_new, so failing now means the process lost the right to.
+    if (mprotect(jit->buffer, SM83_JIT_BUFFER_SIZE, prot) != 0) {
+        exit(1);
+    }
+}
+
+static struct jit_block *lookup(struct sm83_jit *jit, struct bus *bus, uint16_t pc) {
+    if (pc > 0x7FFF) {
+        return NULL;
+    }
+
+    uint16_t bank = cartridge_rom_bank(bus->cart, pc);
+    struct jit_block *block = &jit->blocks[(pc ^ (bank << 5)) & (SM83_JIT_CACHE_SIZE - 1)];
+
+    if (block->valid && block->pc == pc && block->bank == bank) {
+        return block;
+    }
+
+    protect(jit, PROT_READ | PROT_WRITE);
+    uint8_t *code = compile(jit, bus, pc);
+    protect(jit, PROT_READ | PROT_EXEC);
+    if (code == NULL) {
+        block->valid = false;
+        return NULL;
+    }
+
+    // ISO C has no conversion from object to function pointers.
+    memcpy(&block->code, &code, sizeof(block->code));
+    block->valid = true;
+    block->bank = bank;
+    block->pc = pc;
+
+    return block;
+}
+
+struct sm83_jit *sm83_jit_new(void) {
+    struct sm83_jit *jit = malloc(sizeof(struct sm83_jit));
+    assert(jit != NULL);
+
+    // Hardened kernels refuse memory that's writable and executable at once, the buffer starts
+    // out executable and is only made writable while compiling into it. Some refuse executable
+    // anonymous memory outright, which shows up here rather than on the first compile.
+    jit->buffer = mmap(NULL, SM83_JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->buffer == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    if (mprotect(jit->buffer, SM83_JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        munmap(jit->buffer, SM83_JIT_BUFFER_SIZE);
+        free(jit);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < 256; i++) {
+        jit->lahf_to_f[i] = ((i & (1 << 6)) ? SM83_Z_MASK : 0) |
+                            ((i & (1 << 4)) ? SM83_H_MASK : 0) | ((i & 1) ? SM83_C_MASK : 0);
+    }
+
+    sm83_jit_flush(jit);
+
+    return jit;
+}
+
+void sm83_jit_delete(struct sm83_jit *jit) {
+    munmap(jit->buffer, SM83_JIT_BUFFER_SIZE);
+    free(jit);
+}
+
+void sm83_jit_flush(struct sm83_jit *jit) {
+    jit->used = 0;
+    for (size_t i = 0; i < SM83_JIT_CACHE_SIZE; i++) {
+        jit->blocks[i].valid = false;
+    }
+}
+
+size_t sm83_jit_run(struct sm83 *cpu, struct sm83_jit *jit, size_t cycles) {
+    struct bus *bus = cpu->bus;
+    uint64_t start = bus->clock;
+    size_t done = 0;
+
+    while (cpu->m_cycle != 0 && done < cycles) {
+        sm83_m_cycle(cpu);
+        bus->clock++;
+        done++;
+    }
+    sm83_sync_flags(cpu);
+
+    struct jit_context ctx = {.regs = cpu->regs, .bus = bus};
+    uint8_t opcode = cpu->opcode;
+
+    while (done < cycles) {
+        struct jit_block *block = lookup(jit, bus, ctx.regs.pc - 1);
+
+        if (block == NULL) {
+            struct sm83_insn insn = sm83_decode(bus, opcode, ctx.regs.pc);
+
+            sm83_clock(bus, start + done, insn);
+            done += sm83_execute(&ctx.regs, bus, insn);
+        } else {
+            ctx.generation = bus->generation;
+            ctx.clock = start + done;
+            done += block->code(&ctx);
+        }
+        done += bus_take_stall(bus);
+        opcode = bus_read(bus, ctx.regs.pc++);
+    }
+
+    cpu->regs = ctx.regs;
+    cpu->opcode = opcode;
+    bus->clock = start + done;
+
+    return done;
+}
+
+#else
+
+struct sm83_jit *sm83_jit_new(void) { return NULL; }
+
+void sm83_jit_delete(struct sm83_jit *jit) { (void)jit; }
+
+void sm83_jit_flush(struct sm83_jit *jit) { (void)jit; }
+
+size_t sm83_jit_run(struct sm83 *cpu, struct sm83_jit *jit, size_t cycles) {
+    (void)cpu;
+    (void)jit;
+    (void)cycles;
+    abort(); // there's no way to get a jit on this host
+}
+
+#endif
@@ -0,0 +1,371 @@
+#include "internal/sm83/sm83_lanes.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "internal/sm83/sm83_exec.h"
+
+#define N SM83_LANES
+
+// Registers of every lane. r is indexed by enum r8, r[r8_hl] is unused.
+struct lanes {
+    uint8_t r[8][N];
+    uint8_t f[N];
+    uint16_t pc[N]; // past the already fetched opcode, like in struct sm83
+    uint16_t sp[N];
+    uint8_t opcode[N];
+
+    // Rom mapped at 0x0000 and 0x4000. Lanes only run together when these match, which means they
+    // see the same code and the operands can be read once for all of them.
+    uintptr_t banks[2][N];
+
+    uint64_t done[N];  // m-cycles run, UINT64_MAX for unused lanes
+    uint64_t start[N]; // each bus' clock when the run started
+    struct sm83 *cpus[N];
+};
+
+static void load_lane(struct lanes *l, size_t i) {
+    const struct sm83 *cpu = l->cpus[i];
+
+    l->r[r8_b][i] = cpu->regs.b;
+    l->r[r8_c][i] = cpu->regs.c;
+    l->r[r8_d][i] = cpu->regs.d;
+    l->r[r8_e][i] = cpu->regs.e;
+    l->r[r8_h][i] = cpu->regs.h;
+    l->r[r8_l][i] = cpu->regs.l;
+    l->r[r8_hl][i] = 0;
+    l->r[r8_a][i] = cpu->regs.a;
+    l->f[i] = cpu->regs.f;
+    l->pc[i] = cpu->regs.pc;
+    l->sp[i] = cpu->regs.sp;
+    l->opcode[i] = cpu->opcode;
+    l->banks[0][i] = (uintptr_t)cpu->bus->read_pages[0x00];
+    l->banks[1][i] = (uintptr_t)cpu->bus->read_pages[0x40];
+}
+
+static void store_lane(const struct lanes *l, size_t i) {
+    struct sm83 *cpu = l->cpus[i];
+
+    cpu->regs.b = l->r[r8_b][i];
+    cpu->regs.c = l->r[r8_c][i];
+    cpu->regs.d = l->r[r8_d][i];
+    cpu->regs.e = l->r[r8_e][i];
+    cpu->regs.h = l->r[r8_h][i];
+    cpu->regs.l = l->r[r8_l][i];
+    cpu->regs.a = l->r[r8_a][i];
+    cpu->regs.f = l->f[i];
+    cpu->regs.pc = l->pc[i];
+    cpu->regs.sp = l->sp[i];
+    cpu->opcode = l->opcode[i];
+}
+
+// Runs the lane's next instruction on its own core.
+static void step_lane(struct lanes *l, size_t i) {
+    store_lane(l, i);
+    l->cpus[i]->bus->clock = l->start[i] + l->done[i];
+    l->done[i] += sm83_step(l->cpus[i]);
+    load_lane(l, i);
+}
+
+// Kernels over every lane, m is 0xFF for lanes taking part and 0x00 for the others.
+
+static void blend(uint8_t *dst, const uint8_t *src, const uint8_t *m) {
+    for (size_t i = 0; i < N; i++) {
+        dst[i] = (dst[i] & ~m[i]) | (src[i] & m[i]);
+    }
+}
+
+static uint8_t zero(uint8_t r) { return r == 0 ? SM83_Z_MASK : 0; }
+
+static void alu(struct lanes *l, enum mathop op, const uint8_t *y, const uint8_t *m) {
+    const uint8_t *a = l->r[r8_a];
+    uint8_t r[N], f[N];
+
+    switch (op) {
+    case op_add:
+        for (size_t i = 0; i < N; i++) {
+            r[i] = a[i] + y[i];
+            f[i] = zero(r[i]) | (((a[i] ^ y[i] ^ r[i]) & 0x10) << 1) | (r[i] < a[i] ? 0x10 : 0);
+        }
+        break;
+    case op_adc:
+        for (size_t i = 0; i < N; i++) {
+            uint8_t c = (l->f[i] >> 4) & 1;
+            r[i] = a[i] + y[i] + c;
+            f[i] = zero(r[i]) | (((a[i] ^ y[i] ^ r[i]) & 0x10) << 1) |
+                   (r[i] < a[i] || (c && r[i] == a[i]) ? 0x10 : 0);
+        }
+        break;
+    case op_sub:
+    case op_cp:
+        for (size_t i = 0; i < N; i++) {
+            r[i] = a[i] - y[i];
+            f[i] = zero(r[i]) | SM83_N_MASK | (((a[i] ^ y[i] ^ r[i]) & 0x10) << 1) |
+                   (y[i] > a[i] ? 0x10 : 0);
+        }
+        break;
+    case op_sbc:
+        for (size_t i = 0; i < N; i++) {
+            uint8_t c = (l->f[i] >> 4) & 1;
+            r[i] = a[i] - y[i] - c;
+            f[i] = zero(r[i]) | SM83_N_MASK | (((a[i] ^ y[i] ^ r[i]) & 0x10) << 1) |
+                   (y[i] > a[i] || (c && y[i] == a[i]) ? 0x10 : 0);
+        }
+        break;
+    case op_and:
+        for (size_t i = 0; i < N; i++) {
+            r[i] = a[i] & y[i];
+            f[i] = zero(r[i]) | SM83_H_MASK;
+        }
+        break;
+    case op_xor:
+        for (size_t i = 0; i < N; i++) {
+            r[i] = a[i] ^ y[i];
+            f[i] = zero(r[i]);
+        }
+        break;
+    case op_or:
+        for (size_t i = 0; i < N; i++) {
+            r[i] = a[i] | y[i];
+            f[i] = zero(r[i]);
+        }
+        break;
+    }
+
+    if (op != op_cp) {
+        blend(l->r[r8_a], r, m);
+    }
+    blend(l->f, f, m);
+}
+
+static void inc_dec(struct lanes *l, enum r8 reg, bool dec, const uint8_t *m) {
+    const uint8_t *x = l->r[reg];
+    uint8_t r[N], f[N];
+
+    for (size_t i = 0; i < N; i++) {
+        r[i] = dec ? x[i] - 1 : x[i] + 1;
+        f[i] = zero(r[i]) | (dec ? SM83_N_MASK : 0) |
+               ((r[i] & 0x0F) == (dec ? 0x0F : 0x00) ? SM83_H_MASK : 0) | (l->f[i] & SM83_C_MASK);
+    }
+
+    blend(l->r[reg], r, m);
+    blend(l->f, f, m);
+}
+
+static void broadcast(uint8_t *dst, uint8_t val) {
+    for (size_t i = 0; i < N; i++) {
+        dst[i] = val;
+    }
+}
+
+static bool lane_cond(uint8_t f, enum cond cc) {
+    switch (cc) {
+    case cond_nz: return !(f & SM83_Z_MASK);
+    case cond_z: return f & SM83_Z_MASK;
+    case cond_nc: return !(f & SM83_C_MASK);
+    case cond_c: return f & SM83_C_MASK;
+    }
+    return false;
+}
+
+// Executes one instruction on every lane in m if it's register only or an unconditional jump.
+// pc is the address of the opcode. Returns its length in m-cycles and sets next to the address of
+// the following opcode, or returns 0 without touching anything if it's neither.
+static size_t step_lanes(struct lanes *l, struct sm83_insn insn, uint16_t pc, const uint8_t *m,
+                         uint16_t *next) {
+    uint8_t op = insn.opcode;
+    uint8_t imm[N];
+
+    *next = pc + insn.length;
+
+    if (op == 0x00) {
+        return 1; // nop
+    } else if (op >= 0x40 && op < 0x80 && op != 0x76 && (op & 0b111) != r8_hl &&
+               ((op >> 3) & 0b111) != r8_hl) {
+        blend(l->r[(op >> 3) & 0b111], l->r[op & 0b111], m); // ld r8, r8
+        return 1;
+    } else if (op >= 0x80 && op < 0xC0 && (op & 0b111) != r8_hl) {
+        alu(l, (op >> 3) & 0b111, l->r[op & 0b111], m); // op a, r8
+        return 1;
+    } else if ((op & 0b11000111) == 0b11000110) {
+        broadcast(imm, insn.imm); // op a, imm8
+        alu(l, (op >> 3) & 0b111, imm, m);
+        return 2;
+    } else if ((op & 0b11000111) == 0b00000110 && ((op >> 3) & 0b111) != r8_hl) {
+        broadcast(imm, insn.imm); // ld r8, imm8
+        blend(l->r[(op >> 3) & 0b111], imm, m);
+        return 2;
+    } else if ((op & 0b11000110) == 0b00000100 && ((op >> 3) & 0b111) != r8_hl) {
+        inc_dec(l, (op >> 3) & 0b111, op & 1, m); // inc/dec r8
+        return 1;
+    } else if (op == 0x18) {
+        *next += (int8_t)insn.imm; // jr imm8
+        return 3;
+    } else if (op == 0xC3) {
+        *next = insn.imm; // jp imm16
+        return 4;
+    }
+
+    return 0;
+}
+
+// Runs the leader's code on every lane in m for as long as it's register only code and jumps,
+// which keeps every lane in m at the same pc. Stops at anything else, at conditional jumps the
+// lanes don't agree on (those get taken lane by lane), at any taken jump while lanes outside m
+// are waiting and once a lane could reach the cycle budget. Returns false if not even the first
+// instruction could be run that way.
+static bool run_lanes(struct lanes *l, const uint8_t *m, size_t lead, uint64_t cycles) {
+    struct bus *bus = l->cpus[lead]->bus;
+    uint16_t pc = l->pc[lead] - 1; // of the current opcode, always in rom while in here
+    uint8_t opcode = l->opcode[lead];
+    uint64_t most = 0; // m-cycles run by the lane in m furthest ahead
+    uint64_t ran = 0;
+    bool others = false; // lanes outside m still running
+
+    for (size_t i = 0; i < N; i++) {
+        most = m[i] && l->done[i] > most ? l->done[i] : most;
+        others |= !m[i] && l->done[i] < cycles;
+    }
+
+    for (;;) {
+        // Banks match, so every lane reads the same operands out of rom.
+        struct sm83_insn insn = sm83_decode(bus, opcode, pc + 1);
+        uint16_t next;
+        size_t c = step_lanes(l, insn, pc, m, &next);
+
+        if (c == 0 && (insn.opcode & 0b11100111) == 0b00100000) {
+            // jr cc, imm8
+            uint16_t fall = pc + 2, target = fall + (int8_t)insn.imm;
+            uint8_t taken[N], any = 0x00, all = 0xFF;
+
+            for (size_t i = 0; i < N; i++) {
+                taken[i] = lane_cond(l->f[i], (insn.opcode >> 3) & 0b11) ? 0xFF : 0x00;
+                any |= taken[i] & m[i];
+                all &= taken[i] | ~m[i];
+            }
+
+            if (any != all) {
+                for (size_t i = 0; i < N; i++) {
+                    if (m[i]) {
+                        uint16_t to = taken[i] ? target : fall;
+                        l->done[i] += ran + (taken[i] ? 3 : 2);
+                        l->opcode[i] = bus_read(l->cpus[i]->bus, to);
+                        l->pc[i] = to + 1;
+                    }
+                }
+                return true;
+            }
+            c = any ? 3 : 2;
+            next = any ? target : fall;
+        }
+        if (c == 0) {
+            break;
+        }
+
+        ran += c;
+        // Stopping at jumps while other lanes wait lets them join in again at loop heads.
+        bool jumped = next != pc + insn.length;
+        pc = next;
+        if (pc >= 0x8000 || most + ran >= cycles || (jumped && others)) {
+            break;
+        }
+        opcode = bus_read(bus, pc);
+    }
+
+    if (ran == 0) {
+        return false;
+    }
+
+    // Outside of rom each lane fetches its own opcode.
+    uint8_t fetched = pc < 0x8000 ? bus_read(bus, pc) : 0;
+    for (size_t i = 0; i < N; i++) {
+        l->done[i] += m[i] ? ran : 0;
+        l->pc[i] = m[i] ? pc + 1 : l->pc[i];
+        l->opcode[i] = m[i] ? fetched : l->opcode[i];
+    }
+    if (pc >= 0x8000) {
+        for (size_t i = 0; i < N; i++) {
+            if (m[i]) {
+                l->opcode[i] = bus_read(l->cpus[i]->bus, pc);
+            }
+        }
+    }
+
+    return true;
+}
+
+size_t sm83_lanes_run(struct sm83 **cpus, size_t count, size_t cycles, size_t *done) {
+    assert(count <= N);
+
+    // Hooked cores have to run through sm83_m_cycle, so they all run one after another.
+    for (size_t i = 0; i < count; i++) {
+        if (sm83_hooked(cpus[i])) {
+            size_t total = 0;
+
+            for (size_t j = 0; j < count; j++) {
+                done[j] = sm83_run(cpus[j], cycles);
+                total += done[j];
+            }
+            return total;
+        }
+    }
+
+    struct lanes l = {0};
+
+    for (size_t i = 0; i < N; i++) {
+        l.cpus[i] = i < count ? cpus[i] : NULL;
+        l.done[i] = UINT64_MAX;
+    }
+    for (size_t i = 0; i < count; i++) {
+        // Lanes only ever stop at instruction boundaries, with flags synced.
+        l.start[i] = cpus[i]->bus->clock;
+        l.done[i] = cpus[i]->m_cycle != 0 ? sm83_step(cpus[i]) : 0;
+        sm83_sync_flags(cpus[i]);
+        load_lane(&l, i);
+    }
+
+    for (;;) {
+        // The lane furthest behind leads, which keeps the lanes close in time and lets the ones
+        // that diverged find each other again at the same pc.
+        size_t lead = N;
+        for (size_t i = 0; i < count; i++) {
+            if (l.done[i] < cycles && (lead == N || l.done[i] < l.done[lead])) {
+                lead = i;
+            }
+        }
+        if (lead == N) {
+            break;
+        }
+
+        uint8_t m[N];
+        for (size_t i = 0; i < N; i++) {
+            bool same = l.pc[i] == l.pc[lead] && l.opcode[i] == l.opcode[lead] &&
+                        l.banks[0][i] == l.banks[0][lead] && l.banks[1][i] == l.banks[1][lead];
+            m[i] = same && l.done[i] < cycles ? 0xFF : 0x00;
+        }
+
+        // Outside of rom every lane has code of its own.
+        if ((uint16_t)(l.pc[lead] - 1) >= 0x8000) {
+            step_lane(&l, lead);
+            continue;
+        }
+
+        if (!run_lanes(&l, m, lead, cycles)) {
+            for (size_t i = 0; i < count; i++) {
+                if (m[i]) {
+                    step_lane(&l, i);
+                }
+            }
+        }
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        store_lane(&l, i);
+        cpus[i]->bus->clock = l.start[i] + l.done[i];
+        done[i] = l.done[i];
+        total += done[i];
+    }
+
+    return total;
+}
@@ -1,74 +1,151 @@
 #include "internal/memory/bus.h"
 #include "internal/sm83/sm83.h"
+#include "internal/sm83/sm83_operands.h"
+#include "internal/sm83/sm83_profile.h"
 
 #include <assert.h>
 #include <stdlib.h>
 
-enum r8 { r8_b, r8_c, r8_d, r8_e, r8_h, r8_l, r8_hl, r8_a };
-enum r16 { r16_bc, r16_de, r16_hl, r16_sp };
-enum r16stk { r16stk_bc, r16stk_de, r16stk_hl, r16stk_af };
-enum r16mem { r16mem_bc, r16mem_de, r16mem_hli, r16mem_hld };
-enum cond { cond_nz, cond_z, cond_nc, cond_c };
+#ifdef CGBE_TRACE
+// Starts the trace record of the instruction that was just fetched.
+static void trace_insn(struct sm83 *cpu) {
+    struct trace_record *record = trace_next(cpu->bus->trace);
+    uint16_t pc = cpu->regs.pc - 1;
+
+    sm83_sync_flags(cpu);
+
+    record->pc = pc;
+    record->bank = 0;
+    if (pc < 0x8000 && cpu->bus->cart != NULL) {
+        record->bank = cartridge_rom_bank(cpu->bus->cart, pc);
+    }
+    record->opcode = cpu->opcode;
+    record->af = cpu->regs.af;
+    record->bc = cpu->regs.bc;
+    record->de = cpu->regs.de;
+    record->hl = cpu->regs.hl;
+    record->sp = cpu->regs.sp;
+}
+#endif
 
 static void prefetch(struct sm83 *cpu) {
     cpu->opcode = bus_read(cpu->bus, cpu->regs.pc++);
     cpu->m_cycle = 0;
+
+#ifdef CGBE_TRACE
+    if (cpu->bus->trace != NULL) {
+        trace_insn(cpu);
+    }
+#endif
 }
 
-static void add_a(struct sm83 *cpu, uint16_t x) {
-    cpu->regs.f = ((cpu->regs.a & 0xF) + (x & 0xF) > 0xF) ? SM83_H_MASK : 0;
-    cpu->regs.f |= (cpu->regs.a + x > 0xFF) ? SM83_C_MASK : 0;
+void sm83_sync_flags(struct sm83 *cpu) {
+    const struct sm83_lazy_flags *l = &cpu->lazy;
+    uint8_t f = 0;
 
-    cpu->regs.a += x;
+    switch (l->op) {
+    case SM83_LAZY_NONE: return;
+    case SM83_LAZY_ADD:
+        f |= ((l->x & 0xF) + (l->y & 0xF) + l->carry > 0xF) ? SM83_H_MASK : 0;
+        f |= (l->x + l->y + l->carry > 0xFF) ? SM83_C_MASK : 0;
+        f |= ((uint8_t)(l->x + l->y + l->carry) == 0) ? SM83_Z_MASK : 0;
+        break;
+    case SM83_LAZY_SUB:
+        f = SM83_N_MASK;
+        f |= ((l->x & 0xF) < (l->y & 0xF) + l->carry) ? SM83_H_MASK : 0;
+        f |= (l->x < l->y + l->carry) ? SM83_C_MASK : 0;
+        f |= ((uint8_t)(l->x - l->y - l->carry) == 0) ? SM83_Z_MASK : 0;
+        break;
+    case SM83_LAZY_INC:
+        f |= ((l->x & 0xF) == 0) ? SM83_H_MASK : 0;
+        f |= l->carry ? SM83_C_MASK : 0;
+        f |= (l->x == 0) ? SM83_Z_MASK : 0;
+        break;
+    case SM83_LAZY_DEC:
+        f = SM83_N_MASK;
+        f |= ((l->x & 0xF) == 0xF) ? SM83_H_MASK : 0;
+        f |= l->carry ? SM83_C_MASK : 0;
+        f |= (l->x == 0) ? SM83_Z_MASK : 0;
+        break;
+    case SM83_LAZY_SHIFT:
+        f |= l->carry ? SM83_C_MASK : 0;
+        f |= (l->x == 0) ? SM83_Z_MASK : 0;
+        break;
+    }
 
-    cpu->regs.f |= (cpu->regs.a == 0) ? SM83_Z_MASK : 0;
+    cpu->regs.f = f;
+    cpu->lazy.op = SM83_LAZY_NONE;
 }
 
-static void adc_a(struct sm83 *cpu, uint16_t x) {
-    if (cpu->regs.f & SM83_C_MASK) {
-        x++;
+// Just C, without syncing the rest.
+static uint8_t carry_flag(const struct sm83 *cpu) {
+    const struct sm83_lazy_flags *l = &cpu->lazy;
+
+    switch (l->op) {
+    case SM83_LAZY_NONE: return (cpu->regs.f & SM83_C_MASK) ? 1 : 0;
+    case SM83_LAZY_ADD: return l->x + l->y + l->carry > 0xFF;
+    case SM83_LAZY_SUB: return l->x < l->y + l->carry;
+    case SM83_LAZY_INC:
+    case SM83_LAZY_DEC:
+    case SM83_LAZY_SHIFT: return l->carry;
     }
-    add_a(cpu, x);
+    return 0;
 }
 
-static void sub_a(struct sm83 *cpu, uint16_t x) {
-    cpu->regs.f = ((cpu->regs.a & 0xF) < (x & 0xF)) ? SM83_H_MASK : 0;
-    cpu->regs.f |= (cpu->regs.a < x) ? SM83_C_MASK : 0;
+static void set_lazy(struct sm83 *cpu, enum sm83_lazy_op op, uint8_t x, uint8_t y, uint8_t carry) {
+    cpu->lazy.op = op;
+    cpu->lazy.x = x;
+    cpu->lazy.y = y;
+    cpu->lazy.carry = carry;
+}
 
-    cpu->regs.a -= x;
+// For ops that overwrite every flag.
+static void set_flags(struct sm83 *cpu, uint8_t f) {
+    cpu->regs.f = f;
+    cpu->lazy.op = SM83_LAZY_NONE;
+}
 
-    cpu->regs.f |= (cpu->regs.a == 0) ? SM83_Z_MASK : 0;
+// Carry is added separately so the half carry isn't lost when x is 0xFF.
+static void add_a(struct sm83 *cpu, uint8_t x, uint8_t carry) {
+    set_lazy(cpu, SM83_LAZY_ADD, cpu->regs.a, x, carry);
+    cpu->regs.a += x + carry;
 }
 
-static void sbc_a(struct sm83 *cpu, uint16_t x) {
-    if (cpu->regs.f & SM83_C_MASK) {
-        x++;
-    }
-    sub_a(cpu, x);
+static void adc_a(struct sm83 *cpu, uint8_t x) { add_a(cpu, x, carry_flag(cpu)); }
+
+static void sub_a(struct sm83 *cpu, uint8_t x, uint8_t carry) {
+    set_lazy(cpu, SM83_LAZY_SUB, cpu->regs.a, x, carry);
+    cpu->regs.a -= x + carry;
 }
 
+static void sbc_a(struct sm83 *cpu, uint8_t x) { sub_a(cpu, x, carry_flag(cpu)); }
+
 static void and_a(struct sm83 *cpu, uint8_t x) {
     cpu->regs.a &= x;
-
-    cpu->regs.f = SM83_H_MASK;
-    cpu->regs.f |= (cpu->regs.a == 0) ? SM83_Z_MASK : 0;
+    set_flags(cpu, SM83_H_MASK | ((cpu->regs.a == 0) ? SM83_Z_MASK : 0));
 }
 
 static void xor_a(struct sm83 *cpu, uint8_t x) {
     cpu->regs.a ^= x;
-    cpu->regs.f |= (cpu->regs.a == 0) ? SM83_Z_MASK : 0;
+    set_flags(cpu, (cpu->regs.a == 0) ? SM83_Z_MASK : 0);
 }
 
 static void or_a(struct sm83 *cpu, uint8_t x) {
     cpu->regs.a |= x;
-    cpu->regs.f |= (cpu->regs.a == 0) ? SM83_Z_MASK : 0;
+    set_flags(cpu, (cpu->regs.a == 0) ? SM83_Z_MASK : 0);
 }
 
-static void cp_a(struct sm83 *cpu, uint8_t x) {
-    cpu->regs.f = SM83_N_MASK;
-    cpu->regs.f |= (cpu->regs.a == x) ? SM83_Z_MASK : 0;
-    cpu->regs.f |= (cpu->regs.a < x) ? SM83_C_MASK : 0;
-    cpu->regs.f |= (cpu->regs.a & 0xF) < (x & 0xF) ? SM83_H_MASK : 0;
+static void cp_a(struct sm83 *cpu, uint8_t x) { set_lazy(cpu, SM83_LAZY_SUB, cpu->regs.a, x, 0); }
+
+// Condition codes read the flags, so they get synced first.
+static bool check_cond(struct sm83 *cpu, enum cond cc) {
+    sm83_sync_flags(cpu);
+
+    bool z = cpu->regs.f & SM83_Z_MASK;
+    bool c = cpu->regs.f & SM83_C_MASK;
+
+    return (cc == cond_z && z) || (cc == cond_nz && !z) || (cc == cond_c && c) ||
+           (cc == cond_nc && !c);
 }
 
 // returns true if reg is r8_hl
@@ -171,8 +248,8 @@ static void ld_imm16_sp(struct sm83 *cpu) {
     switch (cpu->m_cycle++) {
     case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
     case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.pc++); break;
-    case 2: bus_write(cpu->bus, cpu->tmp.hilo++, cpu->regs.pc % 256); break;
-    case 3: bus_write(cpu->bus, cpu->tmp.hilo, cpu->regs.pc / 256); break;
+    case 2: bus_write(cpu->bus, cpu->tmp.hilo++, cpu->regs.sp % 256); break;
+    case 3: bus_write(cpu->bus, cpu->tmp.hilo, cpu->regs.sp / 256); break;
     case 4: prefetch(cpu); break;
     }
 }
@@ -230,6 +307,7 @@ static void add_hl_r16(struct sm83 *cpu, enum r16 reg) {
         case r16_sp: y = cpu->regs.sp; break;
         }
 
+        sm83_sync_flags(cpu);
         cpu->regs.f &= SM83_Z_MASK;
         cpu->regs.f |= ((x & 0xFFF) + (y & 0xFFF) > 0xFFF) ? SM83_H_MASK : 0;
         cpu->regs.f |= ((uint32_t)x + y > 0xFFFF) ? SM83_C_MASK : 0;
@@ -249,9 +327,7 @@ static void inc_r8(struct sm83 *cpu, enum r8 reg) {
     case 0:
         bool one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
 
-        cpu->regs.f &= SM83_C_MASK;
-        cpu->regs.f |= ((cpu->tmp.lo ^ (cpu->tmp.lo + 1)) & (1 << 4)) ? SM83_H_MASK : 0;
-        cpu->regs.f |= ((uint8_t)(cpu->tmp.lo++) == 0) ? SM83_Z_MASK : 0;
+        set_lazy(cpu, SM83_LAZY_INC, ++cpu->tmp.lo, 0, carry_flag(cpu));
 
         if (one_more) {
             break;
@@ -272,9 +348,7 @@ static void dec_r8(struct sm83 *cpu, enum r8 reg) {
     case 0:
         bool one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
 
-        cpu->regs.f &= SM83_C_MASK;
-        cpu->regs.f |= ((cpu->tmp.lo ^ (cpu->tmp.lo - 1)) & (1 << 4)) ? SM83_H_MASK : 0;
-        cpu->regs.f |= ((uint8_t)(cpu->tmp.lo--) == 0) ? SM83_Z_MASK : 0;
+        set_lazy(cpu, SM83_LAZY_DEC, --cpu->tmp.lo, 0, carry_flag(cpu));
 
         if (one_more) {
             break;
@@ -291,7 +365,7 @@ static void dec_r8(struct sm83 *cpu, enum r8 reg) {
 static void ld_r8_imm8(struct sm83 *cpu, enum r8 reg) {
     assert(cpu->m_cycle < 2 || (reg == r8_hl && cpu->m_cycle < 3));
 
-    switch (cpu->m_cycle) {
+    switch (cpu->m_cycle++) {
     case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
     case 1:
         if (load_to_r8(cpu, reg, cpu->tmp.lo)) {
@@ -305,8 +379,8 @@ static void ld_r8_imm8(struct sm83 *cpu, enum r8 reg) {
 static void rlca(struct sm83 *cpu) {
     assert(cpu->m_cycle < 1);
 
-    cpu->regs.f = (cpu->regs.a & (1 << 7)) ? SM83_C_MASK : 0;
-    cpu->regs.a = (cpu->regs.a << 1) | (cpu->regs.f ? 1 : 0);
+    set_flags(cpu, (cpu->regs.a & (1 << 7)) ? SM83_C_MASK : 0);
+    cpu->regs.a = (cpu->regs.a << 1) | (cpu->regs.a >> 7);
     prefetch(cpu);
 }
 
@@ -314,8 +388,8 @@ static void rlca(struct sm83 *cpu) {
 static void rrca(struct sm83 *cpu) {
     assert(cpu->m_cycle < 1);
 
-    cpu->regs.f = (cpu->regs.a & 1) ? SM83_C_MASK : 0;
-    cpu->regs.a = (cpu->regs.a >> 1) | (cpu->regs.f ? (1 << 7) : 0);
+    set_flags(cpu, (cpu->regs.a & 1) ? SM83_C_MASK : 0);
+    cpu->regs.a = (cpu->regs.a >> 1) | (cpu->regs.a << 7);
     prefetch(cpu);
 }
 
@@ -323,8 +397,8 @@ static void rrca(struct sm83 *cpu) {
 static void rla(struct sm83 *cpu) {
     assert(cpu->m_cycle < 1);
 
-    bool c = cpu->regs.f & SM83_C_MASK;
-    cpu->regs.f = (cpu->regs.a & (1 << 7)) ? SM83_C_MASK : 0;
+    bool c = carry_flag(cpu);
+    set_flags(cpu, (cpu->regs.a & (1 << 7)) ? SM83_C_MASK : 0);
     cpu->regs.a = (cpu->regs.a << 1) | (c ? 1 : 0);
     prefetch(cpu);
 }
@@ -333,9 +407,9 @@ static void rla(struct sm83 *cpu) {
 static void rra(struct sm83 *cpu) {
     assert(cpu->m_cycle < 1);
 
-    bool c = cpu->regs.f & SM83_C_MASK;
-    cpu->regs.f = (cpu->regs.a & 1) ? SM83_C_MASK : 0;
-    cpu->regs.a = (cpu->regs.a << 1) | (c ? (1 << 7) : 0);
+    bool c = carry_flag(cpu);
+    set_flags(cpu, (cpu->regs.a & 1) ? SM83_C_MASK : 0);
+    cpu->regs.a = (cpu->regs.a >> 1) | (c ? (1 << 7) : 0);
     prefetch(cpu);
 }
 
@@ -346,6 +420,8 @@ static void daa(struct sm83 *cpu) {
     // Based on code from here: https://ehaskins.com/2018-01-30%20Z80%20DAA/
     // And notes from here: https://rgbds.gbdev.io/docs/v0.9.1/gbz80.7#DAA
 
+    sm83_sync_flags(cpu);
+
     bool H_flag = cpu->regs.f & SM83_H_MASK;
     bool N_flag = cpu->regs.f & SM83_N_MASK;
     bool C_flag = cpu->regs.f & SM83_C_MASK;
@@ -379,6 +455,7 @@ static void daa(struct sm83 *cpu) {
 static void cpl(struct sm83 *cpu) {
     assert(cpu->m_cycle < 1);
 
+    sm83_sync_flags(cpu);
     cpu->regs.a = ~cpu->regs.a;
     cpu->regs.f |= SM83_N_MASK | SM83_H_MASK;
     prefetch(cpu);
@@ -388,6 +465,7 @@ static void cpl(struct sm83 *cpu) {
 static void scf(struct sm83 *cpu) {
     assert(cpu->m_cycle < 1);
 
+    sm83_sync_flags(cpu);
     cpu->regs.f &= SM83_Z_MASK;
     cpu->regs.f |= SM83_C_MASK;
     prefetch(cpu);
@@ -397,6 +475,7 @@ static void scf(struct sm83 *cpu) {
 static void ccf(struct sm83 *cpu) {
     assert(cpu->m_cycle < 1);
 
+    sm83_sync_flags(cpu);
     cpu->regs.f &= SM83_Z_MASK | SM83_C_MASK;
     cpu->regs.f ^= SM83_C_MASK;
     prefetch(cpu);
@@ -407,19 +486,15 @@ static void jr_imm8(struct sm83 *cpu) {
     assert(cpu->m_cycle < 3);
 
     switch (cpu->m_cycle++) {
-    case 0: cpu->regs.pc += (int8_t)bus_read(cpu->bus, cpu->regs.pc++); break;
-    // case 1:
+    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
+    case 1: cpu->regs.pc += (int8_t)cpu->tmp.lo; break;
     case 2: prefetch(cpu); break;
     }
 }
 
 // JR cond, imm8 | Opcode: 0x001xx000 | M-cycles: 2/3 | Flags: ----
 static void jr_cond_imm8(struct sm83 *cpu, enum cond cc) {
-    bool z = cpu->regs.f & SM83_Z_MASK;
-    bool c = cpu->regs.f & SM83_C_MASK;
-
-    bool cond = (cc == cond_z && z) || (cc == cond_nz && !z) || (cc == cond_c && c) ||
-                (cc == cond_nc && !c);
+    bool cond = check_cond(cpu, cc);
 
     assert(cpu->m_cycle < 2 || (cond && cpu->m_cycle < 3));
 
@@ -451,8 +526,6 @@ static void ld_r8_r8(struct sm83 *cpu, enum r8 dest, enum r8 source) {
     }
 }
 
-enum mathop { op_add, op_adc, op_sub, op_sbc, op_and, op_xor, op_or, op_cp };
-
 // ADD/ADC/SUB/SBC/AND/XOR/OR/CP a, r8
 // Opcode: 0x10oooxxx | M-cycles: 1/2
 static void mathop_a_r8(struct sm83 *cpu, enum mathop op, enum r8 reg) {
@@ -464,9 +537,9 @@ static void mathop_a_r8(struct sm83 *cpu, enum mathop op, enum r8 reg) {
         bool one_more = load_from_r8(cpu, &tmp, reg);
 
         switch (op) {
-        case op_add: add_a(cpu, tmp); break;
+        case op_add: add_a(cpu, tmp, 0); break;
         case op_adc: adc_a(cpu, tmp); break;
-        case op_sub: sub_a(cpu, tmp); break;
+        case op_sub: sub_a(cpu, tmp, 0); break;
         case op_sbc: sbc_a(cpu, tmp); break;
         case op_and: and_a(cpu, tmp); break;
         case op_xor: xor_a(cpu, tmp); break;
@@ -491,9 +564,9 @@ static void mathop_a_imm8(struct sm83 *cpu, enum mathop op) {
         uint8_t arg = bus_read(cpu->bus, cpu->regs.pc++);
 
         switch (op) {
-        case op_add: add_a(cpu, arg); break;
+        case op_add: add_a(cpu, arg, 0); break;
         case op_adc: adc_a(cpu, arg); break;
-        case op_sub: sub_a(cpu, arg); break;
+        case op_sub: sub_a(cpu, arg, 0); break;
         case op_sbc: sbc_a(cpu, arg); break;
         case op_and: and_a(cpu, arg); break;
         case op_xor: xor_a(cpu, arg); break;
@@ -508,11 +581,7 @@ static void mathop_a_imm8(struct sm83 *cpu, enum mathop op) {
 
 // RET cond | Opcode: 0x110xx000 | M-cycles: 2/5 | Flags: ----
 static void ret_cond(struct sm83 *cpu, enum cond cc) {
-    bool z = cpu->regs.f & SM83_Z_MASK;
-    bool c = cpu->regs.f & SM83_C_MASK;
-
-    bool cond = (cc == cond_z && z) || (cc == cond_nz && !z) || (cc == cond_c && c) ||
-                (cc == cond_nc && !c);
+    bool cond = check_cond(cpu, cc);
 
     assert(cpu->m_cycle < 2 || (cond && cpu->m_cycle < 5));
 
@@ -520,6 +589,7 @@ static void ret_cond(struct sm83 *cpu, enum cond cc) {
     // case 0:
     case 1:
         if (cond) {
+            sm83_profile_hook_ret(cpu);
             cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.sp++);
         } else {
             prefetch(cpu);
@@ -539,7 +609,10 @@ static void ret(struct sm83 *cpu) {
     assert(cpu->m_cycle < 4);
 
     switch (cpu->m_cycle++) {
-    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.sp++); break;
+    case 0:
+        sm83_profile_hook_ret(cpu);
+        cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.sp++);
+        break;
     case 1:
         cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.sp++);
         cpu->regs.pc = cpu->tmp.hilo;
@@ -551,19 +624,15 @@ static void ret(struct sm83 *cpu) {
 
 // JP cond, imm16 | Opcode: 0x110cc010 | M-cycles: 3/4 | Flags: ----
 static void jp_cond_imm16(struct sm83 *cpu, enum cond cc) {
-    bool z = cpu->regs.f & SM83_Z_MASK;
-    bool c = cpu->regs.f & SM83_C_MASK;
-
-    bool cond = (cc == cond_z && z) || (cc == cond_nz && !z) || (cc == cond_c && c) ||
-                (cc == cond_nc && !c);
+    bool cond = check_cond(cpu, cc);
 
     assert(cpu->m_cycle < 3 || (cond && cpu->m_cycle < 4));
 
     switch (cpu->m_cycle++) {
-    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.sp++); break;
-    case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.sp++); break;
+    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
+    case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.pc++); break;
     case 2:
-        if (cc) {
+        if (cond) {
             cpu->regs.pc = cpu->tmp.hilo;
             break;
         }
@@ -576,8 +645,8 @@ static void jp_imm16(struct sm83 *cpu) {
     assert(cpu->m_cycle < 4);
 
     switch (cpu->m_cycle++) {
-    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.sp++); break;
-    case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.sp++); break;
+    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
+    case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.pc++); break;
     case 2: cpu->regs.pc = cpu->tmp.hilo; break;
     case 3: prefetch(cpu); break;
     }
@@ -592,24 +661,24 @@ static void jp_hl(struct sm83 *cpu) {
 
 // CALL cond, imm16 | Opcode: 0x110cc100 | M-cycles: 3/6 | Flags: ----
 static void call_cond_imm16(struct sm83 *cpu, enum cond cc) {
-    bool z = cpu->regs.f & SM83_Z_MASK;
-    bool c = cpu->regs.f & SM83_C_MASK;
-
-    bool cond = (cc == cond_z && z) || (cc == cond_nz && !z) || (cc == cond_c && c) ||
-                (cc == cond_nc && !c);
+    bool cond = check_cond(cpu, cc);
 
     assert(cpu->m_cycle < 3 || (cond && cpu->m_cycle < 6));
 
     switch (cpu->m_cycle++) {
-    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.sp++); break;
-    case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.sp++); break;
+    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
+    case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.pc++); break;
     case 2:
-        if (!cc) {
+        if (!cond) {
             prefetch(cpu);
         }
         break;
     case 3: bus_write(cpu->bus, --cpu->regs.sp, cpu->regs.pc / 256); break;
-    case 4: bus_write(cpu->bus, --cpu->regs.sp, cpu->regs.pc % 256); break;
+    case 4:
+        bus_write(cpu->bus, --cpu->regs.sp, cpu->regs.pc % 256);
+        cpu->regs.pc = cpu->tmp.hilo;
+        sm83_profile_hook_call(cpu);
+        break;
     case 5: prefetch(cpu); break;
     }
 }
@@ -619,11 +688,15 @@ static void call_imm16(struct sm83 *cpu) {
     assert(cpu->m_cycle < 6);
 
     switch (cpu->m_cycle++) {
-    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.sp++); break;
-    case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.sp++); break;
+    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
+    case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.pc++); break;
     // case 2:
     case 3: bus_write(cpu->bus, --cpu->regs.sp, cpu->regs.pc / 256); break;
-    case 4: bus_write(cpu->bus, --cpu->regs.sp, cpu->regs.pc % 256); break;
+    case 4:
+        bus_write(cpu->bus, --cpu->regs.sp, cpu->regs.pc % 256);
+        cpu->regs.pc = cpu->tmp.hilo;
+        sm83_profile_hook_call(cpu);
+        break;
     case 5: prefetch(cpu); break;
     }
 }
@@ -638,6 +711,7 @@ static void rst(struct sm83 *cpu, uint16_t vec) {
     case 2:
         bus_write(cpu->bus, --cpu->regs.sp, cpu->regs.pc % 256);
         cpu->regs.pc = vec;
+        sm83_profile_hook_call(cpu);
         break;
     case 3: prefetch(cpu); break;
     }
@@ -652,7 +726,10 @@ static void pop(struct sm83 *cpu, enum r16stk r) {
     case 1: cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.sp++); break;
     case 2:
         switch (r) {
-        case r16stk_af: cpu->regs.af = cpu->tmp.hilo & SM83_ALL_FLAGS; break;
+        case r16stk_af:
+            cpu->regs.a = cpu->tmp.hi;
+            set_flags(cpu, cpu->tmp.lo & SM83_ALL_FLAGS);
+            break;
         case r16stk_bc: cpu->regs.bc = cpu->tmp.hilo; break;
         case r16stk_de: cpu->regs.de = cpu->tmp.hilo; break;
         case r16stk_hl: cpu->regs.hl = cpu->tmp.hilo; break;
@@ -669,7 +746,10 @@ static void push(struct sm83 *cpu, enum r16stk r) {
     switch (cpu->m_cycle++) {
     case 0:
         switch (r) {
-        case r16stk_af: cpu->tmp.hilo = cpu->regs.af & SM83_ALL_FLAGS; break;
+        case r16stk_af:
+            sm83_sync_flags(cpu);
+            cpu->tmp.hilo = cpu->regs.af & (0xFF00 | SM83_ALL_FLAGS);
+            break;
         case r16stk_bc: cpu->tmp.hilo = cpu->regs.bc; break;
         case r16stk_de: cpu->tmp.hilo = cpu->regs.de; break;
         case r16stk_hl: cpu->tmp.hilo = cpu->regs.hl; break;
@@ -747,6 +827,50 @@ static void ld_a_imm16(struct sm83 *cpu) {
     }
 }
 
+// ADD sp, imm8 | Opcode: 0b11101000 | M-cycles: 4 | Flags: 00HC
+static void add_sp_imm8(struct sm83 *cpu) {
+    assert(cpu->m_cycle < 4);
+
+    switch (cpu->m_cycle++) {
+    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
+    // case 1:
+    case 2:
+        set_flags(cpu, ((cpu->regs.sp & 0xF) + (cpu->tmp.lo & 0xF) > 0xF) ? SM83_H_MASK : 0);
+        cpu->regs.f |= ((cpu->regs.sp & 0xFF) + cpu->tmp.lo > 0xFF) ? SM83_C_MASK : 0;
+        cpu->regs.sp += (int8_t)cpu->tmp.lo;
+        break;
+    case 3: prefetch(cpu); break;
+    }
+}
+
+// LD hl, sp + imm8 | Opcode: 0b11111000 | M-cycles: 3 | Flags: 00HC
+static void ld_hl_sp_imm8(struct sm83 *cpu) {
+    assert(cpu->m_cycle < 3);
+
+    switch (cpu->m_cycle++) {
+    case 0: cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++); break;
+    case 1:
+        set_flags(cpu, ((cpu->regs.sp & 0xF) + (cpu->tmp.lo & 0xF) > 0xF) ? SM83_H_MASK : 0);
+        cpu->regs.f |= ((cpu->regs.sp & 0xFF) + cpu->tmp.lo > 0xFF) ? SM83_C_MASK : 0;
+        cpu->regs.hl = cpu->regs.sp + (int8_t)cpu->tmp.lo;
+        break;
+    case 2: prefetch(cpu); break;
+    }
+}
+
+// LD sp, hl | Opcode: 0b11111001 | M-cycles: 2 | Flags: ----
+static void ld_sp_hl(struct sm83 *cpu) {
+    assert(cpu->m_cycle < 2);
+
+    switch (cpu->m_cycle++) {
+    // case 0:
+    case 1:
+        cpu->regs.sp = cpu->regs.hl;
+        prefetch(cpu);
+        break;
+    }
+}
+
 // RLC r8 | M-cycles: 2/4 | Flags: Z00C
 static void rlc(struct sm83 *cpu, enum r8 reg) {
     assert(cpu->m_cycle < 4);
@@ -755,9 +879,8 @@ static void rlc(struct sm83 *cpu, enum r8 reg) {
     switch (cpu->m_cycle++) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
-        cpu->regs.f = (cpu->tmp.lo & (1 << 7)) ? SM83_C_MASK : 0;
-        cpu->tmp.lo = (cpu->tmp.lo << 1) | (cpu->regs.f ? 1 : 0);
-        cpu->regs.f |= (cpu->tmp.lo == 0) ? SM83_Z_MASK : 0;
+        cpu->tmp.lo = (cpu->tmp.lo << 1) | (cpu->tmp.lo >> 7);
+        set_lazy(cpu, SM83_LAZY_SHIFT, cpu->tmp.lo, 0, cpu->tmp.lo & 1);
         if (one_more) break;
     case 2:
         one_more = load_to_r8(cpu, reg, cpu->tmp.lo);
@@ -774,9 +897,8 @@ static void rrc(struct sm83 *cpu, enum r8 reg) {
     switch (cpu->m_cycle++) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
-        cpu->regs.f = (cpu->tmp.lo & 1) ? SM83_C_MASK : 0;
-        cpu->tmp.lo = (cpu->tmp.lo >> 1) | (cpu->regs.f ? (1 << 7) : 0);
-        cpu->regs.f |= (cpu->tmp.lo == 0) ? SM83_Z_MASK : 0;
+        cpu->tmp.lo = (cpu->tmp.lo >> 1) | (cpu->tmp.lo << 7);
+        set_lazy(cpu, SM83_LAZY_SHIFT, cpu->tmp.lo, 0, cpu->tmp.lo >> 7);
         if (one_more) break;
     case 2:
         one_more = load_to_r8(cpu, reg, cpu->tmp.lo);
@@ -793,10 +915,9 @@ static void rl(struct sm83 *cpu, enum r8 reg) {
     switch (cpu->m_cycle++) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
-        bool c = cpu->regs.f & SM83_C_MASK;
-        cpu->regs.f = (cpu->tmp.lo & (1 << 7)) ? SM83_C_MASK : 0;
-        cpu->tmp.lo = (cpu->tmp.lo << 1) | (c ? 1 : 0);
-        cpu->regs.f |= (cpu->tmp.lo == 0) ? SM83_Z_MASK : 0;
+        uint8_t c = cpu->tmp.lo >> 7;
+        cpu->tmp.lo = (cpu->tmp.lo << 1) | carry_flag(cpu);
+        set_lazy(cpu, SM83_LAZY_SHIFT, cpu->tmp.lo, 0, c);
         if (one_more) break;
     case 2:
         one_more = load_to_r8(cpu, reg, cpu->tmp.lo);
@@ -813,10 +934,9 @@ static void rr(struct sm83 *cpu, enum r8 reg) {
     switch (cpu->m_cycle++) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
-        bool c = cpu->regs.f & SM83_C_MASK;
-        cpu->regs.f = (cpu->tmp.lo & 1) ? SM83_C_MASK : 0;
-        cpu->tmp.lo = (cpu->tmp.lo << 1) | (c ? (1 << 7) : 0);
-        cpu->regs.f |= (cpu->tmp.lo == 0) ? SM83_Z_MASK : 0;
+        uint8_t c = cpu->tmp.lo & 1;
+        cpu->tmp.lo = (cpu->tmp.lo >> 1) | (carry_flag(cpu) << 7);
+        set_lazy(cpu, SM83_LAZY_SHIFT, cpu->tmp.lo, 0, c);
         if (one_more) break;
     case 2:
         one_more = load_to_r8(cpu, reg, cpu->tmp.lo);
@@ -833,9 +953,8 @@ static void sla(struct sm83 *cpu, enum r8 reg) {
     switch (cpu->m_cycle++) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
-        cpu->regs.f = (cpu->tmp.lo & (1 << 7)) ? SM83_C_MASK : 0;
+        set_lazy(cpu, SM83_LAZY_SHIFT, cpu->tmp.lo << 1, 0, cpu->tmp.lo >> 7);
         cpu->tmp.lo <<= 1;
-        cpu->regs.f |= (cpu->tmp.lo == 0) ? SM83_Z_MASK : 0;
         if (one_more) break;
     case 2:
         one_more = load_to_r8(cpu, reg, cpu->tmp.lo);
@@ -852,9 +971,9 @@ static void sra(struct sm83 *cpu, enum r8 reg) {
     switch (cpu->m_cycle++) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
-        cpu->regs.f = (cpu->tmp.lo & 1) ? SM83_C_MASK : 0;
-        cpu->tmp.lo = (cpu->tmp.lo >> 1) | (cpu->tmp.lo & (1 << 7));
-        cpu->regs.f |= (cpu->tmp.lo == 0) ? SM83_Z_MASK : 0;
+        set_lazy(cpu, SM83_LAZY_SHIFT, (cpu->tmp.lo >> 1) | (cpu->tmp.lo & (1 << 7)), 0,
+                 cpu->tmp.lo & 1);
+        cpu->tmp.lo = cpu->lazy.x;
         if (one_more) break;
     case 2:
         one_more = load_to_r8(cpu, reg, cpu->tmp.lo);
@@ -872,7 +991,7 @@ static void swap(struct sm83 *cpu, enum r8 reg) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
         cpu->tmp.lo = (cpu->tmp.lo << 4) | (cpu->tmp.lo >> 4);
-        cpu->regs.f &= SM83_Z_MASK;
+        set_lazy(cpu, SM83_LAZY_SHIFT, cpu->tmp.lo, 0, 0);
         if (one_more) break;
     case 2:
         one_more = load_to_r8(cpu, reg, cpu->tmp.lo);
@@ -889,9 +1008,8 @@ static void srl(struct sm83 *cpu, enum r8 reg) {
     switch (cpu->m_cycle++) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
-        cpu->regs.f = (cpu->tmp.lo & 1) ? SM83_C_MASK : 0;
+        set_lazy(cpu, SM83_LAZY_SHIFT, cpu->tmp.lo >> 1, 0, cpu->tmp.lo & 1);
         cpu->tmp.lo >>= 1;
-        cpu->regs.f |= (cpu->tmp.lo == 0) ? SM83_Z_MASK : 0;
         if (one_more) break;
     case 2:
         one_more = load_to_r8(cpu, reg, cpu->tmp.lo);
@@ -908,9 +1026,10 @@ static void bit(struct sm83 *cpu, enum r8 reg, uint8_t idx) {
     switch (cpu->m_cycle++) {
     case 1:
         one_more = load_from_r8(cpu, &cpu->tmp.lo, reg);
+        sm83_sync_flags(cpu);
         cpu->regs.f &= SM83_C_MASK;
         cpu->regs.f |= SM83_H_MASK;
-        cpu->regs.f |= (cpu->tmp.lo & (1 << idx)) ? SM83_Z_MASK : 0;
+        cpu->regs.f |= (cpu->tmp.lo & (1 << idx)) ? 0 : SM83_Z_MASK;
         if (one_more) break;
     case 2: prefetch(cpu); break;
     }
@@ -950,320 +1069,686 @@ static void set(struct sm83 *cpu, enum r8 reg, uint8_t idx) {
     }
 }
 
+// Every table entry below is a thunk with its operands baked in as constants, so once the
+// handler is inlined there's no decoding left to do at run time, just one indirect call.
+#define CB_OP(code, call)                                                                          \
+    static void cb_op_##code(struct sm83 *cpu) { call; }
+
+CB_OP(0x00, rlc(cpu, r8_b))  // RLC b
+CB_OP(0x01, rlc(cpu, r8_c))  // RLC c
+CB_OP(0x02, rlc(cpu, r8_d))  // RLC d
+CB_OP(0x03, rlc(cpu, r8_e))  // RLC e
+CB_OP(0x04, rlc(cpu, r8_h))  // RLC h
+CB_OP(0x05, rlc(cpu, r8_l))  // RLC l
+CB_OP(0x06, rlc(cpu, r8_hl)) // RLC [hl]
+CB_OP(0x07, rlc(cpu, r8_a))  // RLC a
+
+CB_OP(0x08, rrc(cpu, r8_b))  // RRC b
+CB_OP(0x09, rrc(cpu, r8_c))  // RRC c
+CB_OP(0x0A, rrc(cpu, r8_d))  // RRC d
+CB_OP(0x0B, rrc(cpu, r8_e))  // RRC e
+CB_OP(0x0C, rrc(cpu, r8_h))  // RRC h
+CB_OP(0x0D, rrc(cpu, r8_l))  // RRC l
+CB_OP(0x0E, rrc(cpu, r8_hl)) // RRC [hl]
+CB_OP(0x0F, rrc(cpu, r8_a))  // RRC a
+
+CB_OP(0x10, rl(cpu, r8_b))  // RL b
+CB_OP(0x11, rl(cpu, r8_c))  // RL c
+CB_OP(0x12, rl(cpu, r8_d))  // RL d
+CB_OP(0x13, rl(cpu, r8_e))  // RL e
+CB_OP(0x14, rl(cpu, r8_h))  // RL h
+CB_OP(0x15, rl(cpu, r8_l))  // RL l
+CB_OP(0x16, rl(cpu, r8_hl)) // RL [hl]
+CB_OP(0x17, rl(cpu, r8_a))  // RL a
+
+CB_OP(0x18, rr(cpu, r8_b))  // RR b
+CB_OP(0x19, rr(cpu, r8_c))  // RR c
+CB_OP(0x1A, rr(cpu, r8_d))  // RR d
+CB_OP(0x1B, rr(cpu, r8_e))  // RR e
+CB_OP(0x1C, rr(cpu, r8_h))  // RR h
+CB_OP(0x1D, rr(cpu, r8_l))  // RR l
+CB_OP(0x1E, rr(cpu, r8_hl)) // RR [hl]
+CB_OP(0x1F, rr(cpu, r8_a))  // RR a
+
+CB_OP(0x20, sla(cpu, r8_b))  // SLA b
+CB_OP(0x21, sla(cpu, r8_c))  // SLA c
+CB_OP(0x22, sla(cpu, r8_d))  // SLA d
+CB_OP(0x23, sla(cpu, r8_e))  // SLA e
+CB_OP(0x24, sla(cpu, r8_h))  // SLA h
+CB_OP(0x25, sla(cpu, r8_l))  // SLA l
+CB_OP(0x26, sla(cpu, r8_hl)) // SLA [hl]
+CB_OP(0x27, sla(cpu, r8_a))  // SLA a
+
+CB_OP(0x28, sra(cpu, r8_b))  // SRA b
+CB_OP(0x29, sra(cpu, r8_c))  // SRA c
+CB_OP(0x2A, sra(cpu, r8_d))  // SRA d
+CB_OP(0x2B, sra(cpu, r8_e))  // SRA e
+CB_OP(0x2C, sra(cpu, r8_h))  // SRA h
+CB_OP(0x2D, sra(cpu, r8_l))  // SRA l
+CB_OP(0x2E, sra(cpu, r8_hl)) // SRA [hl]
+CB_OP(0x2F, sra(cpu, r8_a))  // SRA a
+
+CB_OP(0x30, swap(cpu, r8_b))  // SWAP b
+CB_OP(0x31, swap(cpu, r8_c))  // SWAP c
+CB_OP(0x32, swap(cpu, r8_d))  // SWAP d
+CB_OP(0x33, swap(cpu, r8_e))  // SWAP e
+CB_OP(0x34, swap(cpu, r8_h))  // SWAP h
+CB_OP(0x35, swap(cpu, r8_l))  // SWAP l
+CB_OP(0x36, swap(cpu, r8_hl)) // SWAP [hl]
+CB_OP(0x37, swap(cpu, r8_a))  // SWAP a
+
+CB_OP(0x38, srl(cpu, r8_b))  // SRL b
+CB_OP(0x39, srl(cpu, r8_c))  // SRL c
+CB_OP(0x3A, srl(cpu, r8_d))  // SRL d
+CB_OP(0x3B, srl(cpu, r8_e))  // SRL e
+CB_OP(0x3C, srl(cpu, r8_h))  // SRL h
+CB_OP(0x3D, srl(cpu, r8_l))  // SRL l
+CB_OP(0x3E, srl(cpu, r8_hl)) // SRL [hl]
+CB_OP(0x3F, srl(cpu, r8_a))  // SRL a
+
+CB_OP(0x40, bit(cpu, r8_b, 0))  // BIT 0, b
+CB_OP(0x41, bit(cpu, r8_c, 0))  // BIT 0, c
+CB_OP(0x42, bit(cpu, r8_d, 0))  // BIT 0, d
+CB_OP(0x43, bit(cpu, r8_e, 0))  // BIT 0, e
+CB_OP(0x44, bit(cpu, r8_h, 0))  // BIT 0, h
+CB_OP(0x45, bit(cpu, r8_l, 0))  // BIT 0, l
+CB_OP(0x46, bit(cpu, r8_hl, 0)) // BIT 0, [hl]
+CB_OP(0x47, bit(cpu, r8_a, 0))  // BIT 0, a
+
+CB_OP(0x48, bit(cpu, r8_b, 1))  // BIT 1, b
+CB_OP(0x49, bit(cpu, r8_c, 1))  // BIT 1, c
+CB_OP(0x4A, bit(cpu, r8_d, 1))  // BIT 1, d
+CB_OP(0x4B, bit(cpu, r8_e, 1))  // BIT 1, e
+CB_OP(0x4C, bit(cpu, r8_h, 1))  // BIT 1, h
+CB_OP(0x4D, bit(cpu, r8_l, 1))  // BIT 1, l
+CB_OP(0x4E, bit(cpu, r8_hl, 1)) // BIT 1, [hl]
+CB_OP(0x4F, bit(cpu, r8_a, 1))  // BIT 1, a
+
+CB_OP(0x50, bit(cpu, r8_b, 2))  // BIT 2, b
+CB_OP(0x51, bit(cpu, r8_c, 2))  // BIT 2, c
+CB_OP(0x52, bit(cpu, r8_d, 2))  // BIT 2, d
+CB_OP(0x53, bit(cpu, r8_e, 2))  // BIT 2, e
+CB_OP(0x54, bit(cpu, r8_h, 2))  // BIT 2, h
+CB_OP(0x55, bit(cpu, r8_l, 2))  // BIT 2, l
+CB_OP(0x56, bit(cpu, r8_hl, 2)) // BIT 2, [hl]
+CB_OP(0x57, bit(cpu, r8_a, 2))  // BIT 2, a
+
+CB_OP(0x58, bit(cpu, r8_b, 3))  // BIT 3, b
+CB_OP(0x59, bit(cpu, r8_c, 3))  // BIT 3, c
+CB_OP(0x5A, bit(cpu, r8_d, 3))  // BIT 3, d
+CB_OP(0x5B, bit(cpu, r8_e, 3))  // BIT 3, e
+CB_OP(0x5C, bit(cpu, r8_h, 3))  // BIT 3, h
+CB_OP(0x5D, bit(cpu, r8_l, 3))  // BIT 3, l
+CB_OP(0x5E, bit(cpu, r8_hl, 3)) // BIT 3, [hl]
+CB_OP(0x5F, bit(cpu, r8_a, 3))  // BIT 3, a
+
+CB_OP(0x60, bit(cpu, r8_b, 4))  // BIT 4, b
+CB_OP(0x61, bit(cpu, r8_c, 4))  // BIT 4, c
+CB_OP(0x62, bit(cpu, r8_d, 4))  // BIT 4, d
+CB_OP(0x63, bit(cpu, r8_e, 4))  // BIT 4, e
+CB_OP(0x64, bit(cpu, r8_h, 4))  // BIT 4, h
+CB_OP(0x65, bit(cpu, r8_l, 4))  // BIT 4, l
+CB_OP(0x66, bit(cpu, r8_hl, 4)) // BIT 4, [hl]
+CB_OP(0x67, bit(cpu, r8_a, 4))  // BIT 4, a
+
+CB_OP(0x68, bit(cpu, r8_b, 5))  // BIT 5, b
+CB_OP(0x69, bit(cpu, r8_c, 5))  // BIT 5, c
+CB_OP(0x6A, bit(cpu, r8_d, 5))  // BIT 5, d
+CB_OP(0x6B, bit(cpu, r8_e, 5))  // BIT 5, e
+CB_OP(0x6C, bit(cpu, r8_h, 5))  // BIT 5, h
+CB_OP(0x6D, bit(cpu, r8_l, 5))  // BIT 5, l
+CB_OP(0x6E, bit(cpu, r8_hl, 5)) // BIT 5, [hl]
+CB_OP(0x6F, bit(cpu, r8_a, 5))  // BIT 5, a
+
+CB_OP(0x70, bit(cpu, r8_b, 6))  // BIT 6, b
+CB_OP(0x71, bit(cpu, r8_c, 6))  // BIT 6, c
+CB_OP(0x72, bit(cpu, r8_d, 6))  // BIT 6, d
+CB_OP(0x73, bit(cpu, r8_e, 6))  // BIT 6, e
+CB_OP(0x74, bit(cpu, r8_h, 6))  // BIT 6, h
+CB_OP(0x75, bit(cpu, r8_l, 6))  // BIT 6, l
+CB_OP(0x76, bit(cpu, r8_hl, 6)) // BIT 6, [hl]
+CB_OP(0x77, bit(cpu, r8_a, 6))  // BIT 6, a
+
+CB_OP(0x78, bit(cpu, r8_b, 7))  // BIT 7, b
+CB_OP(0x79, bit(cpu, r8_c, 7))  // BIT 7, c
+CB_OP(0x7A, bit(cpu, r8_d, 7))  // BIT 7, d
+CB_OP(0x7B, bit(cpu, r8_e, 7))  // BIT 7, e
+CB_OP(0x7C, bit(cpu, r8_h, 7))  // BIT 7, h
+CB_OP(0x7D, bit(cpu, r8_l, 7))  // BIT 7, l
+CB_OP(0x7E, bit(cpu, r8_hl, 7)) // BIT 7, [hl]
+CB_OP(0x7F, bit(cpu, r8_a, 7))  // BIT 7, a
+
+CB_OP(0x80, res(cpu, r8_b, 0))  // RES 0, b
+CB_OP(0x81, res(cpu, r8_c, 0))  // RES 0, c
+CB_OP(0x82, res(cpu, r8_d, 0))  // RES 0, d
+CB_OP(0x83, res(cpu, r8_e, 0))  // RES 0, e
+CB_OP(0x84, res(cpu, r8_h, 0))  // RES 0, h
+CB_OP(0x85, res(cpu, r8_l, 0))  // RES 0, l
+CB_OP(0x86, res(cpu, r8_hl, 0)) // RES 0, [hl]
+CB_OP(0x87, res(cpu, r8_a, 0))  // RES 0, a
+
+CB_OP(0x88, res(cpu, r8_b, 1))  // RES 1, b
+CB_OP(0x89, res(cpu, r8_c, 1))  // RES 1, c
+CB_OP(0x8A, res(cpu, r8_d, 1))  // RES 1, d
+CB_OP(0x8B, res(cpu, r8_e, 1))  // RES 1, e
+CB_OP(0x8C, res(cpu, r8_h, 1))  // RES 1, h
+CB_OP(0x8D, res(cpu, r8_l, 1))  // RES 1, l
+CB_OP(0x8E, res(cpu, r8_hl, 1)) // RES 1, [hl]
+CB_OP(0x8F, res(cpu, r8_a, 1))  // RES 1, a
+
+CB_OP(0x90, res(cpu, r8_b, 2))  // RES 2, b
+CB_OP(0x91, res(cpu, r8_c, 2))  // RES 2, c
+CB_OP(0x92, res(cpu, r8_d, 2))  // RES 2, d
+CB_OP(0x93, res(cpu, r8_e, 2))  // RES 2, e
+CB_OP(0x94, res(cpu, r8_h, 2))  // RES 2, h
+CB_OP(0x95, res(cpu, r8_l, 2))  // RES 2, l
+CB_OP(0x96, res(cpu, r8_hl, 2)) // RES 2, [hl]
+CB_OP(0x97, res(cpu, r8_a, 2))  // RES 2, a
+
+CB_OP(0x98, res(cpu, r8_b, 3))  // RES 3, b
+CB_OP(0x99, res(cpu, r8_c, 3))  // RES 3, c
+CB_OP(0x9A, res(cpu, r8_d, 3))  // RES 3, d
+CB_OP(0x9B, res(cpu, r8_e, 3))  // RES 3, e
+CB_OP(0x9C, res(cpu, r8_h, 3))  // RES 3, h
+CB_OP(0x9D, res(cpu, r8_l, 3))  // RES 3, l
+CB_OP(0x9E, res(cpu, r8_hl, 3)) // RES 3, [hl]
+CB_OP(0x9F, res(cpu, r8_a, 3))  // RES 3, a
+
+CB_OP(0xA0, res(cpu, r8_b, 4))  // RES 4, b
+CB_OP(0xA1, res(cpu, r8_c, 4))  // RES 4, c
+CB_OP(0xA2, res(cpu, r8_d, 4))  // RES 4, d
+CB_OP(0xA3, res(cpu, r8_e, 4))  // RES 4, e
+CB_OP(0xA4, res(cpu, r8_h, 4))  // RES 4, h
+CB_OP(0xA5, res(cpu, r8_l, 4))  // RES 4, l
+CB_OP(0xA6, res(cpu, r8_hl, 4)) // RES 4, [hl]
+CB_OP(0xA7, res(cpu, r8_a, 4))  // RES 4, a
+
+CB_OP(0xA8, res(cpu, r8_b, 5))  // RES 5, b
+CB_OP(0xA9, res(cpu, r8_c, 5))  // RES 5, c
+CB_OP(0xAA, res(cpu, r8_d, 5))  // RES 5, d
+CB_OP(0xAB, res(cpu, r8_e, 5))  // RES 5, e
+CB_OP(0xAC, res(cpu, r8_h, 5))  // RES 5, h
+CB_OP(0xAD, res(cpu, r8_l, 5))  // RES 5, l
+CB_OP(0xAE, res(cpu, r8_hl, 5)) // RES 5, [hl]
+CB_OP(0xAF, res(cpu, r8_a, 5))  // RES 5, a
+
+CB_OP(0xB0, res(cpu, r8_b, 6))  // RES 6, b
+CB_OP(0xB1, res(cpu, r8_c, 6))  // RES 6, c
+CB_OP(0xB2, res(cpu, r8_d, 6))  // RES 6, d
+CB_OP(0xB3, res(cpu, r8_e, 6))  // RES 6, e
+CB_OP(0xB4, res(cpu, r8_h, 6))  // RES 6, h
+CB_OP(0xB5, res(cpu, r8_l, 6))  // RES 6, l
+CB_OP(0xB6, res(cpu, r8_hl, 6)) // RES 6, [hl]
+CB_OP(0xB7, res(cpu, r8_a, 6))  // RES 6, a
+
+CB_OP(0xB8, res(cpu, r8_b, 7))  // RES 7, b
+CB_OP(0xB9, res(cpu, r8_c, 7))  // RES 7, c
+CB_OP(0xBA, res(cpu, r8_d, 7))  // RES 7, d
+CB_OP(0xBB, res(cpu, r8_e, 7))  // RES 7, e
+CB_OP(0xBC, res(cpu, r8_h, 7))  // RES 7, h
+CB_OP(0xBD, res(cpu, r8_l, 7))  // RES 7, l
+CB_OP(0xBE, res(cpu, r8_hl, 7)) // RES 7, [hl]
+CB_OP(0xBF, res(cpu, r8_a, 7))  // RES 7, a
+
+CB_OP(0xC0, set(cpu, r8_b, 0))  // SET 0, b
+CB_OP(0xC1, set(cpu, r8_c, 0))  // SET 0, c
+CB_OP(0xC2, set(cpu, r8_d, 0))  // SET 0, d
+CB_OP(0xC3, set(cpu, r8_e, 0))  // SET 0, e
+CB_OP(0xC4, set(cpu, r8_h, 0))  // SET 0, h
+CB_OP(0xC5, set(cpu, r8_l, 0))  // SET 0, l
+CB_OP(0xC6, set(cpu, r8_hl, 0)) // SET 0, [hl]
+CB_OP(0xC7, set(cpu, r8_a, 0))  // SET 0, a
+
+CB_OP(0xC8, set(cpu, r8_b, 1))  // SET 1, b
+CB_OP(0xC9, set(cpu, r8_c, 1))  // SET 1, c
+CB_OP(0xCA, set(cpu, r8_d, 1))  // SET 1, d
+CB_OP(0xCB, set(cpu, r8_e, 1))  // SET 1, e
+CB_OP(0xCC, set(cpu, r8_h, 1))  // SET 1, h
+CB_OP(0xCD, set(cpu, r8_l, 1))  // SET 1, l
+CB_OP(0xCE, set(cpu, r8_hl, 1)) // SET 1, [hl]
+CB_OP(0xCF, set(cpu, r8_a, 1))  // SET 1, a
+
+CB_OP(0xD0, set(cpu, r8_b, 2))  // SET 2, b
+CB_OP(0xD1, set(cpu, r8_c, 2))  // SET 2, c
+CB_OP(0xD2, set(cpu, r8_d, 2))  // SET 2, d
+CB_OP(0xD3, set(cpu, r8_e, 2))  // SET 2, e
+CB_OP(0xD4, set(cpu, r8_h, 2))  // SET 2, h
+CB_OP(0xD5, set(cpu, r8_l, 2))  // SET 2, l
+CB_OP(0xD6, set(cpu, r8_hl, 2)) // SET 2, [hl]
+CB_OP(0xD7, set(cpu, r8_a, 2))  // SET 2, a
+
+CB_OP(0xD8, set(cpu, r8_b, 3))  // SET 3, b
+CB_OP(0xD9, set(cpu, r8_c, 3))  // SET 3, c
+CB_OP(0xDA, set(cpu, r8_d, 3))  // SET 3, d
+CB_OP(0xDB, set(cpu, r8_e, 3))  // SET 3, e
+CB_OP(0xDC, set(cpu, r8_h, 3))  // SET 3, h
+CB_OP(0xDD, set(cpu, r8_l, 3))  // SET 3, l
+CB_OP(0xDE, set(cpu, r8_hl, 3)) // SET 3, [hl]
+CB_OP(0xDF, set(cpu, r8_a, 3))  // SET 3, a
+
+CB_OP(0xE0, set(cpu, r8_b, 4))  // SET 4, b
+CB_OP(0xE1, set(cpu, r8_c, 4))  // SET 4, c
+CB_OP(0xE2, set(cpu, r8_d, 4))  // SET 4, d
+CB_OP(0xE3, set(cpu, r8_e, 4))  // SET 4, e
+CB_OP(0xE4, set(cpu, r8_h, 4))  // SET 4, h
+CB_OP(0xE5, set(cpu, r8_l, 4))  // SET 4, l
+CB_OP(0xE6, set(cpu, r8_hl, 4)) // SET 4, [hl]
+CB_OP(0xE7, set(cpu, r8_a, 4))  // SET 4, a
+
+CB_OP(0xE8, set(cpu, r8_b, 5))  // SET 5, b
+CB_OP(0xE9, set(cpu, r8_c, 5))  // SET 5, c
+CB_OP(0xEA, set(cpu, r8_d, 5))  // SET 5, d
+CB_OP(0xEB, set(cpu, r8_e, 5))  // SET 5, e
+CB_OP(0xEC, set(cpu, r8_h, 5))  // SET 5, h
+CB_OP(0xED, set(cpu, r8_l, 5))  // SET 5, l
+CB_OP(0xEE, set(cpu, r8_hl, 5)) // SET 5, [hl]
+CB_OP(0xEF, set(cpu, r8_a, 5))  // SET 5, a
+
+CB_OP(0xF0, set(cpu, r8_b, 6))  // SET 6, b
+CB_OP(0xF1, set(cpu, r8_c, 6))  // SET 6, c
+CB_OP(0xF2, set(cpu, r8_d, 6))  // SET 6, d
+CB_OP(0xF3, set(cpu, r8_e, 6))  // SET 6, e
+CB_OP(0xF4, set(cpu, r8_h, 6))  // SET 6, h
+CB_OP(0xF5, set(cpu, r8_l, 6))  // SET 6, l
+CB_OP(0xF6, set(cpu, r8_hl, 6)) // SET 6, [hl]
+CB_OP(0xF7, set(cpu, r8_a, 6))  // SET 6, a
+
+CB_OP(0xF8, set(cpu, r8_b, 7))  // SET 7, b
+CB_OP(0xF9, set(cpu, r8_c, 7))  // SET 7, c
+CB_OP(0xFA, set(cpu, r8_d, 7))  // SET 7, d
+CB_OP(0xFB, set(cpu, r8_e, 7))  // SET 7, e
+CB_OP(0xFC, set(cpu, r8_h, 7))  // SET 7, h
+CB_OP(0xFD, set(cpu, r8_l, 7))  // SET 7, l
+CB_OP(0xFE, set(cpu, r8_hl, 7)) // SET 7, [hl]
+CB_OP(0xFF, set(cpu, r8_a, 7))  // SET 7, a
+
+#undef CB_OP
+
+static void (*const cb_ops[256])(struct sm83 *cpu) = {
+    cb_op_0x00, cb_op_0x01, cb_op_0x02, cb_op_0x03, cb_op_0x04, cb_op_0x05, cb_op_0x06, cb_op_0x07,
+    cb_op_0x08, cb_op_0x09, cb_op_0x0A, cb_op_0x0B, cb_op_0x0C, cb_op_0x0D, cb_op_0x0E, cb_op_0x0F,
+    cb_op_0x10, cb_op_0x11, cb_op_0x12, cb_op_0x13, cb_op_0x14, cb_op_0x15, cb_op_0x16, cb_op_0x17,
+    cb_op_0x18, cb_op_0x19, cb_op_0x1A, cb_op_0x1B, cb_op_0x1C, cb_op_0x1D, cb_op_0x1E, cb_op_0x1F,
+    cb_op_0x20, cb_op_0x21, cb_op_0x22, cb_op_0x23, cb_op_0x24, cb_op_0x25, cb_op_0x26, cb_op_0x27,
+    cb_op_0x28, cb_op_0x29, cb_op_0x2A, cb_op_0x2B, cb_op_0x2C, cb_op_0x2D, cb_op_0x2E, cb_op_0x2F,
+    cb_op_0x30, cb_op_0x31, cb_op_0x32, cb_op_0x33, cb_op_0x34, cb_op_0x35, cb_op_0x36, cb_op_0x37,
+    cb_op_0x38, cb_op_0x39, cb_op_0x3A, cb_op_0x3B, cb_op_0x3C, cb_op_0x3D, cb_op_0x3E, cb_op_0x3F,
+    cb_op_0x40, cb_op_0x41, cb_op_0x42, cb_op_0x43, cb_op_0x44, cb_op_0x45, cb_op_0x46, cb_op_0x47,
+    cb_op_0x48, cb_op_0x49, cb_op_0x4A, cb_op_0x4B, cb_op_0x4C, cb_op_0x4D, cb_op_0x4E, cb_op_0x4F,
+    cb_op_0x50, cb_op_0x51, cb_op_0x52, cb_op_0x53, cb_op_0x54, cb_op_0x55, cb_op_0x56, cb_op_0x57,
+    cb_op_0x58, cb_op_0x59, cb_op_0x5A, cb_op_0x5B, cb_op_0x5C, cb_op_0x5D, cb_op_0x5E, cb_op_0x5F,
+    cb_op_0x60, cb_op_0x61, cb_op_0x62, cb_op_0x63, cb_op_0x64, cb_op_0x65, cb_op_0x66, cb_op_0x67,
+    cb_op_0x68, cb_op_0x69, cb_op_0x6A, cb_op_0x6B, cb_op_0x6C, cb_op_0x6D, cb_op_0x6E, cb_op_0x6F,
+    cb_op_0x70, cb_op_0x71, cb_op_0x72, cb_op_0x73, cb_op_0x74, cb_op_0x75, cb_op_0x76, cb_op_0x77,
+    cb_op_0x78, cb_op_0x79, cb_op_0x7A, cb_op_0x7B, cb_op_0x7C, cb_op_0x7D, cb_op_0x7E, cb_op_0x7F,
+    cb_op_0x80, cb_op_0x81, cb_op_0x82, cb_op_0x83, cb_op_0x84, cb_op_0x85, cb_op_0x86, cb_op_0x87,
+    cb_op_0x88, cb_op_0x89, cb_op_0x8A, cb_op_0x8B, cb_op_0x8C, cb_op_0x8D, cb_op_0x8E, cb_op_0x8F,
+    cb_op_0x90, cb_op_0x91, cb_op_0x92, cb_op_0x93, cb_op_0x94, cb_op_0x95, cb_op_0x96, cb_op_0x97,
+    cb_op_0x98, cb_op_0x99, cb_op_0x9A, cb_op_0x9B, cb_op_0x9C, cb_op_0x9D, cb_op_0x9E, cb_op_0x9F,
+    cb_op_0xA0, cb_op_0xA1, cb_op_0xA2, cb_op_0xA3, cb_op_0xA4, cb_op_0xA5, cb_op_0xA6, cb_op_0xA7,
+    cb_op_0xA8, cb_op_0xA9, cb_op_0xAA, cb_op_0xAB, cb_op_0xAC, cb_op_0xAD, cb_op_0xAE, cb_op_0xAF,
+    cb_op_0xB0, cb_op_0xB1, cb_op_0xB2, cb_op_0xB3, cb_op_0xB4, cb_op_0xB5, cb_op_0xB6, cb_op_0xB7,
+    cb_op_0xB8, cb_op_0xB9, cb_op_0xBA, cb_op_0xBB, cb_op_0xBC, cb_op_0xBD, cb_op_0xBE, cb_op_0xBF,
+    cb_op_0xC0, cb_op_0xC1, cb_op_0xC2, cb_op_0xC3, cb_op_0xC4, cb_op_0xC5, cb_op_0xC6, cb_op_0xC7,
+    cb_op_0xC8, cb_op_0xC9, cb_op_0xCA, cb_op_0xCB, cb_op_0xCC, cb_op_0xCD, cb_op_0xCE, cb_op_0xCF,
+    cb_op_0xD0, cb_op_0xD1, cb_op_0xD2, cb_op_0xD3, cb_op_0xD4, cb_op_0xD5, cb_op_0xD6, cb_op_0xD7,
+    cb_op_0xD8, cb_op_0xD9, cb_op_0xDA, cb_op_0xDB, cb_op_0xDC, cb_op_0xDD, cb_op_0xDE, cb_op_0xDF,
+    cb_op_0xE0, cb_op_0xE1, cb_op_0xE2, cb_op_0xE3, cb_op_0xE4, cb_op_0xE5, cb_op_0xE6, cb_op_0xE7,
+    cb_op_0xE8, cb_op_0xE9, cb_op_0xEA, cb_op_0xEB, cb_op_0xEC, cb_op_0xED, cb_op_0xEE, cb_op_0xEF,
+    cb_op_0xF0, cb_op_0xF1, cb_op_0xF2, cb_op_0xF3, cb_op_0xF4, cb_op_0xF5, cb_op_0xF6, cb_op_0xF7,
+    cb_op_0xF8, cb_op_0xF9, cb_op_0xFA, cb_op_0xFB, cb_op_0xFC, cb_op_0xFD, cb_op_0xFE, cb_op_0xFF,
+};
+
+// CB prefixed opcode lives in tmp.hi, so the ops are free to use tmp.lo.
 static void cb_prefix(struct sm83 *cpu) {
     if (cpu->m_cycle == 0) {
-        cpu->tmp.lo = bus_read(cpu->bus, cpu->regs.pc++);
+        cpu->tmp.hi = bus_read(cpu->bus, cpu->regs.pc++);
         cpu->m_cycle++;
         return;
     }
 
-    switch (cpu->tmp.lo & 0b11000000) {
-    case 0b00000000:
-        switch (cpu->tmp.lo & 0b0011100) {
-        case 0b00000000: rlc(cpu, cpu->tmp.lo & 0x00000111); break;
-        case 0b00001000: rrc(cpu, cpu->tmp.lo & 0x00000111); break;
-        case 0b00010000: rl(cpu, cpu->tmp.lo & 0x00000111); break;
-        case 0b00011000: rr(cpu, cpu->tmp.lo & 0x00000111); break;
-        case 0b00100000: sla(cpu, cpu->tmp.lo & 0x00000111); break;
-        case 0b00101000: sra(cpu, cpu->tmp.lo & 0x00000111); break;
-        case 0b00110000: swap(cpu, cpu->tmp.lo & 0x00000111); break;
-        case 0b00111000: srl(cpu, cpu->tmp.lo & 0x00000111); break;
-        }
-        break;
-    case 0b01000000: bit(cpu, cpu->tmp.lo & 0b00000111, cpu->tmp.lo & 0b00111000); break;
-    case 0b10000000: res(cpu, cpu->tmp.lo & 0b00000111, cpu->tmp.lo & 0b00111000); break;
-    case 0b11000000: set(cpu, cpu->tmp.lo & 0b00000111, cpu->tmp.lo & 0b00111000); break;
-    }
-}
+    cb_ops[cpu->tmp.hi](cpu);
+}
+
+// Invalid opcodes, pc doesn't change making an inf loop
+static void invalid(struct sm83 *cpu) { (void)cpu; }
+
+static void unimplemented(struct sm83 *cpu) {
+    (void)cpu;
+    exit(1);
+}
+
+#define OP(code, call)                                                                             \
+    static void op_##code(struct sm83 *cpu) { call; }
+
+OP(0x00, nop(cpu)) // NOP
+
+OP(0x01, ld_r16_imm16(cpu, r16_bc)) // LD bc, imm16
+OP(0x11, ld_r16_imm16(cpu, r16_de)) // LD de, imm16
+OP(0x21, ld_r16_imm16(cpu, r16_hl)) // LD hl, imm16
+OP(0x31, ld_r16_imm16(cpu, r16_sp)) // LD sp, imm16
+
+OP(0x02, ld_r16mem_a(cpu, r16mem_bc))  // LD [bc], a
+OP(0x12, ld_r16mem_a(cpu, r16mem_de))  // LD [de], a
+OP(0x22, ld_r16mem_a(cpu, r16mem_hli)) // LD [hl+], a
+OP(0x32, ld_r16mem_a(cpu, r16mem_hld)) // LD [hl-], a
+
+OP(0x0A, ld_a_r16mem(cpu, r16mem_bc))  // LD a, [bc]
+OP(0x1A, ld_a_r16mem(cpu, r16mem_de))  // LD a, [de]
+OP(0x2A, ld_a_r16mem(cpu, r16mem_hli)) // LD a, [hl+]
+OP(0x3A, ld_a_r16mem(cpu, r16mem_hld)) // LD a, [hl-]
+
+OP(0x08, ld_imm16_sp(cpu)) // LD [imm16], sp
+
+OP(0x03, inc_r16(cpu, r16_bc)) // INC bc
+OP(0x13, inc_r16(cpu, r16_de)) // INC de
+OP(0x23, inc_r16(cpu, r16_hl)) // INC hl
+OP(0x33, inc_r16(cpu, r16_sp)) // INC sp
+
+OP(0x0B, dec_r16(cpu, r16_bc)) // DEC bc
+OP(0x1B, dec_r16(cpu, r16_de)) // DEC de
+OP(0x2B, dec_r16(cpu, r16_hl)) // DEC hl
+OP(0x3B, dec_r16(cpu, r16_sp)) // DEC sp
+
+OP(0x09, add_hl_r16(cpu, r16_bc)) // ADD hl, bc
+OP(0x19, add_hl_r16(cpu, r16_de)) // ADD hl, de
+OP(0x29, add_hl_r16(cpu, r16_hl)) // ADD hl, hl
+OP(0x39, add_hl_r16(cpu, r16_sp)) // ADD hl, sp
+
+OP(0x04, inc_r8(cpu, r8_b))  // INC b
+OP(0x0C, inc_r8(cpu, r8_c))  // INC c
+OP(0x14, inc_r8(cpu, r8_d))  // INC d
+OP(0x1C, inc_r8(cpu, r8_e))  // INC e
+OP(0x24, inc_r8(cpu, r8_h))  // INC h
+OP(0x2C, inc_r8(cpu, r8_l))  // INC l
+OP(0x34, inc_r8(cpu, r8_hl)) // INC [hl]
+OP(0x3C, inc_r8(cpu, r8_a))  // INC a
+
+OP(0x05, dec_r8(cpu, r8_b))  // DEC b
+OP(0x0D, dec_r8(cpu, r8_c))  // DEC c
+OP(0x15, dec_r8(cpu, r8_d))  // DEC d
+OP(0x1D, dec_r8(cpu, r8_e))  // DEC e
+OP(0x25, dec_r8(cpu, r8_h))  // DEC h
+OP(0x2D, dec_r8(cpu, r8_l))  // DEC l
+OP(0x35, dec_r8(cpu, r8_hl)) // DEC [hl]
+OP(0x3D, dec_r8(cpu, r8_a))  // DEC a
+
+OP(0x06, ld_r8_imm8(cpu, r8_b))  // LD b, imm8
+OP(0x0E, ld_r8_imm8(cpu, r8_c))  // LD c, imm8
+OP(0x16, ld_r8_imm8(cpu, r8_d))  // LD d, imm8
+OP(0x1E, ld_r8_imm8(cpu, r8_e))  // LD e, imm8
+OP(0x26, ld_r8_imm8(cpu, r8_h))  // LD h, imm8
+OP(0x2E, ld_r8_imm8(cpu, r8_l))  // LD l, imm8
+OP(0x36, ld_r8_imm8(cpu, r8_hl)) // LD [hl], imm8
+OP(0x3E, ld_r8_imm8(cpu, r8_a))  // LD a, imm8
+
+OP(0x07, rlca(cpu)) // RLCA
+OP(0x0F, rrca(cpu)) // RRCA
+OP(0x17, rla(cpu))  // RLA
+OP(0x1F, rra(cpu))  // RRA
+OP(0x27, daa(cpu))  // DAA
+OP(0x2F, cpl(cpu))  // CPL
+OP(0x37, scf(cpu))  // SCF
+OP(0x3F, ccf(cpu))  // CCF
+
+OP(0x18, jr_imm8(cpu))               // JR imm8
+OP(0x20, jr_cond_imm8(cpu, cond_nz)) // JR nz, imm8
+OP(0x28, jr_cond_imm8(cpu, cond_z))  // JR z, imm8
+OP(0x30, jr_cond_imm8(cpu, cond_nc)) // JR nc, imm8
+OP(0x38, jr_cond_imm8(cpu, cond_c))  // JR c, imm8
+
+OP(0x40, ld_r8_r8(cpu, r8_b, r8_b))  // LD b, b
+OP(0x41, ld_r8_r8(cpu, r8_b, r8_c))  // LD b, c
+OP(0x42, ld_r8_r8(cpu, r8_b, r8_d))  // LD b, d
+OP(0x43, ld_r8_r8(cpu, r8_b, r8_e))  // LD b, e
+OP(0x44, ld_r8_r8(cpu, r8_b, r8_h))  // LD b, h
+OP(0x45, ld_r8_r8(cpu, r8_b, r8_l))  // LD b, l
+OP(0x46, ld_r8_r8(cpu, r8_b, r8_hl)) // LD b, [hl]
+OP(0x47, ld_r8_r8(cpu, r8_b, r8_a))  // LD b, a
+
+OP(0x48, ld_r8_r8(cpu, r8_c, r8_b))  // LD c, b
+OP(0x49, ld_r8_r8(cpu, r8_c, r8_c))  // LD c, c
+OP(0x4A, ld_r8_r8(cpu, r8_c, r8_d))  // LD c, d
+OP(0x4B, ld_r8_r8(cpu, r8_c, r8_e))  // LD c, e
+OP(0x4C, ld_r8_r8(cpu, r8_c, r8_h))  // LD c, h
+OP(0x4D, ld_r8_r8(cpu, r8_c, r8_l))  // LD c, l
+OP(0x4E, ld_r8_r8(cpu, r8_c, r8_hl)) // LD c, [hl]
+OP(0x4F, ld_r8_r8(cpu, r8_c, r8_a))  // LD c, a
+
+OP(0x50, ld_r8_r8(cpu, r8_d, r8_b))  // LD d, b
+OP(0x51, ld_r8_r8(cpu, r8_d, r8_c))  // LD d, c
+OP(0x52, ld_r8_r8(cpu, r8_d, r8_d))  // LD d, d
+OP(0x53, ld_r8_r8(cpu, r8_d, r8_e))  // LD d, e
+OP(0x54, ld_r8_r8(cpu, r8_d, r8_h))  // LD d, h
+OP(0x55, ld_r8_r8(cpu, r8_d, r8_l))  // LD d, l
+OP(0x56, ld_r8_r8(cpu, r8_d, r8_hl)) // LD d, [hl]
+OP(0x57, ld_r8_r8(cpu, r8_d, r8_a))  // LD d, a
+
+OP(0x58, ld_r8_r8(cpu, r8_e, r8_b))  // LD e, b
+OP(0x59, ld_r8_r8(cpu, r8_e, r8_c))  // LD e, c
+OP(0x5A, ld_r8_r8(cpu, r8_e, r8_d))  // LD e, d
+OP(0x5B, ld_r8_r8(cpu, r8_e, r8_e))  // LD e, e
+OP(0x5C, ld_r8_r8(cpu, r8_e, r8_h))  // LD e, h
+OP(0x5D, ld_r8_r8(cpu, r8_e, r8_l))  // LD e, l
+OP(0x5E, ld_r8_r8(cpu, r8_e, r8_hl)) // LD e, [hl]
+OP(0x5F, ld_r8_r8(cpu, r8_e, r8_a))  // LD e, a
+
+OP(0x60, ld_r8_r8(cpu, r8_h, r8_b))  // LD h, b
+OP(0x61, ld_r8_r8(cpu, r8_h, r8_c))  // LD h, c
+OP(0x62, ld_r8_r8(cpu, r8_h, r8_d))  // LD h, d
+OP(0x63, ld_r8_r8(cpu, r8_h, r8_e))  // LD h, e
+OP(0x64, ld_r8_r8(cpu, r8_h, r8_h))  // LD h, h
+OP(0x65, ld_r8_r8(cpu, r8_h, r8_l))  // LD h, l
+OP(0x66, ld_r8_r8(cpu, r8_h, r8_hl)) // LD h, [hl]
+OP(0x67, ld_r8_r8(cpu, r8_h, r8_a))  // LD h, a
+
+OP(0x68, ld_r8_r8(cpu, r8_l, r8_b))  // LD l, b
+OP(0x69, ld_r8_r8(cpu, r8_l, r8_c))  // LD l, c
+OP(0x6A, ld_r8_r8(cpu, r8_l, r8_d))  // LD l, d
+OP(0x6B, ld_r8_r8(cpu, r8_l, r8_e))  // LD l, e
+OP(0x6C, ld_r8_r8(cpu, r8_l, r8_h))  // LD l, h
+OP(0x6D, ld_r8_r8(cpu, r8_l, r8_l))  // LD l, l
+OP(0x6E, ld_r8_r8(cpu, r8_l, r8_hl)) // LD l, [hl]
+OP(0x6F, ld_r8_r8(cpu, r8_l, r8_a))  // LD l, a
+
+OP(0x70, ld_r8_r8(cpu, r8_hl, r8_b)) // LD [hl], b
+OP(0x71, ld_r8_r8(cpu, r8_hl, r8_c)) // LD [hl], c
+OP(0x72, ld_r8_r8(cpu, r8_hl, r8_d)) // LD [hl], d
+OP(0x73, ld_r8_r8(cpu, r8_hl, r8_e)) // LD [hl], e
+OP(0x74, ld_r8_r8(cpu, r8_hl, r8_h)) // LD [hl], h
+OP(0x75, ld_r8_r8(cpu, r8_hl, r8_l)) // LD [hl], l
+
+OP(0x77, ld_r8_r8(cpu, r8_hl, r8_a)) // LD [hl], a
+
+OP(0x78, ld_r8_r8(cpu, r8_a, r8_b))  // LD a, b
+OP(0x79, ld_r8_r8(cpu, r8_a, r8_c))  // LD a, c
+OP(0x7A, ld_r8_r8(cpu, r8_a, r8_d))  // LD a, d
+OP(0x7B, ld_r8_r8(cpu, r8_a, r8_e))  // LD a, e
+OP(0x7C, ld_r8_r8(cpu, r8_a, r8_h))  // LD a, h
+OP(0x7D, ld_r8_r8(cpu, r8_a, r8_l))  // LD a, l
+OP(0x7E, ld_r8_r8(cpu, r8_a, r8_hl)) // LD a, [hl]
+OP(0x7F, ld_r8_r8(cpu, r8_a, r8_a))  // LD a, a
+
+OP(0x80, mathop_a_r8(cpu, op_add, r8_b))  // ADD a, b
+OP(0x81, mathop_a_r8(cpu, op_add, r8_c))  // ADD a, c
+OP(0x82, mathop_a_r8(cpu, op_add, r8_d))  // ADD a, d
+OP(0x83, mathop_a_r8(cpu, op_add, r8_e))  // ADD a, e
+OP(0x84, mathop_a_r8(cpu, op_add, r8_h))  // ADD a, h
+OP(0x85, mathop_a_r8(cpu, op_add, r8_l))  // ADD a, l
+OP(0x86, mathop_a_r8(cpu, op_add, r8_hl)) // ADD a, [hl]
+OP(0x87, mathop_a_r8(cpu, op_add, r8_a))  // ADD a, a
+
+OP(0x88, mathop_a_r8(cpu, op_adc, r8_b))  // ADC a, b
+OP(0x89, mathop_a_r8(cpu, op_adc, r8_c))  // ADC a, c
+OP(0x8A, mathop_a_r8(cpu, op_adc, r8_d))  // ADC a, d
+OP(0x8B, mathop_a_r8(cpu, op_adc, r8_e))  // ADC a, e
+OP(0x8C, mathop_a_r8(cpu, op_adc, r8_h))  // ADC a, h
+OP(0x8D, mathop_a_r8(cpu, op_adc, r8_l))  // ADC a, l
+OP(0x8E, mathop_a_r8(cpu, op_adc, r8_hl)) // ADC a, [hl]
+OP(0x8F, mathop_a_r8(cpu, op_adc, r8_a))  // ADC a, a
+
+OP(0x90, mathop_a_r8(cpu, op_sub, r8_b))  // SUB a, b
+OP(0x91, mathop_a_r8(cpu, op_sub, r8_c))  // SUB a, c
+OP(0x92, mathop_a_r8(cpu, op_sub, r8_d))  // SUB a, d
+OP(0x93, mathop_a_r8(cpu, op_sub, r8_e))  // SUB a, e
+OP(0x94, mathop_a_r8(cpu, op_sub, r8_h))  // SUB a, h
+OP(0x95, mathop_a_r8(cpu, op_sub, r8_l))  // SUB a, l
+OP(0x96, mathop_a_r8(cpu, op_sub, r8_hl)) // SUB a, [hl]
+OP(0x97, mathop_a_r8(cpu, op_sub, r8_a))  // SUB a, a
+
+OP(0x98, mathop_a_r8(cpu, op_sbc, r8_b))  // SBC a, b
+OP(0x99, mathop_a_r8(cpu, op_sbc, r8_c))  // SBC a, c
+OP(0x9A, mathop_a_r8(cpu, op_sbc, r8_d))  // SBC a, d
+OP(0x9B, mathop_a_r8(cpu, op_sbc, r8_e))  // SBC a, e
+OP(0x9C, mathop_a_r8(cpu, op_sbc, r8_h))  // SBC a, h
+OP(0x9D, mathop_a_r8(cpu, op_sbc, r8_l))  // SBC a, l
+OP(0x9E, mathop_a_r8(cpu, op_sbc, r8_hl)) // SBC a, [hl]
+OP(0x9F, mathop_a_r8(cpu, op_sbc, r8_a))  // SBC a, a
+
+OP(0xA0, mathop_a_r8(cpu, op_and, r8_b))  // AND a, b
+OP(0xA1, mathop_a_r8(cpu, op_and, r8_c))  // AND a, c
+OP(0xA2, mathop_a_r8(cpu, op_and, r8_d))  // AND a, d
+OP(0xA3, mathop_a_r8(cpu, op_and, r8_e))  // AND a, e
+OP(0xA4, mathop_a_r8(cpu, op_and, r8_h))  // AND a, h
+OP(0xA5, mathop_a_r8(cpu, op_and, r8_l))  // AND a, l
+OP(0xA6, mathop_a_r8(cpu, op_and, r8_hl)) // AND a, [hl]
+OP(0xA7, mathop_a_r8(cpu, op_and, r8_a))  // AND a, a
+
+OP(0xA8, mathop_a_r8(cpu, op_xor, r8_b))  // XOR a, b
+OP(0xA9, mathop_a_r8(cpu, op_xor, r8_c))  // XOR a, c
+OP(0xAA, mathop_a_r8(cpu, op_xor, r8_d))  // XOR a, d
+OP(0xAB, mathop_a_r8(cpu, op_xor, r8_e))  // XOR a, e
+OP(0xAC, mathop_a_r8(cpu, op_xor, r8_h))  // XOR a, h
+OP(0xAD, mathop_a_r8(cpu, op_xor, r8_l))  // XOR a, l
+OP(0xAE, mathop_a_r8(cpu, op_xor, r8_hl)) // XOR a, [hl]
+OP(0xAF, mathop_a_r8(cpu, op_xor, r8_a))  // XOR a, a
+
+OP(0xB0, mathop_a_r8(cpu, op_or, r8_b))  // OR a, b
+OP(0xB1, mathop_a_r8(cpu, op_or, r8_c))  // OR a, c
+OP(0xB2, mathop_a_r8(cpu, op_or, r8_d))  // OR a, d
+OP(0xB3, mathop_a_r8(cpu, op_or, r8_e))  // OR a, e
+OP(0xB4, mathop_a_r8(cpu, op_or, r8_h))  // OR a, h
+OP(0xB5, mathop_a_r8(cpu, op_or, r8_l))  // OR a, l
+OP(0xB6, mathop_a_r8(cpu, op_or, r8_hl)) // OR a, [hl]
+OP(0xB7, mathop_a_r8(cpu, op_or, r8_a))  // OR a, a
+
+OP(0xB8, mathop_a_r8(cpu, op_cp, r8_b))  // CP a, b
+OP(0xB9, mathop_a_r8(cpu, op_cp, r8_c))  // CP a, c
+OP(0xBA, mathop_a_r8(cpu, op_cp, r8_d))  // CP a, d
+OP(0xBB, mathop_a_r8(cpu, op_cp, r8_e))  // CP a, e
+OP(0xBC, mathop_a_r8(cpu, op_cp, r8_h))  // CP a, h
+OP(0xBD, mathop_a_r8(cpu, op_cp, r8_l))  // CP a, l
+OP(0xBE, mathop_a_r8(cpu, op_cp, r8_hl)) // CP a, [hl]
+OP(0xBF, mathop_a_r8(cpu, op_cp, r8_a))  // CP a, a
+
+OP(0xC6, mathop_a_imm8(cpu, op_add)) // ADD a, imm8
+OP(0xCE, mathop_a_imm8(cpu, op_adc)) // ADC a, imm8
+OP(0xD6, mathop_a_imm8(cpu, op_sub)) // SUB a, imm8
+OP(0xDE, mathop_a_imm8(cpu, op_sbc)) // SBC a, imm8
+OP(0xE6, mathop_a_imm8(cpu, op_and)) // AND a, imm8
+OP(0xEE, mathop_a_imm8(cpu, op_xor)) // XOR a, imm8
+OP(0xF6, mathop_a_imm8(cpu, op_or))  // OR a, imm8
+OP(0xFE, mathop_a_imm8(cpu, op_cp))  // CP a, imm8
+
+OP(0xC0, ret_cond(cpu, cond_nz)) // RET NZ
+OP(0xC8, ret_cond(cpu, cond_z))  // RET Z
+OP(0xC9, ret(cpu))               // RET
+OP(0xD0, ret_cond(cpu, cond_nc)) // RET NC
+OP(0xD8, ret_cond(cpu, cond_c))  // RET C
+OP(0xD9, unimplemented(cpu))     // RETI (implement later)
+
+OP(0xC2, jp_cond_imm16(cpu, cond_nz)) // JP nz, imm16
+OP(0xCA, jp_cond_imm16(cpu, cond_z))  // JP z, imm16
+OP(0xD2, jp_cond_imm16(cpu, cond_nc)) // JP nc, imm16
+OP(0xDA, jp_cond_imm16(cpu, cond_c))  // JP c, imm16
+
+OP(0xC3, jp_imm16(cpu)) // JP imm16
+OP(0xE9, jp_hl(cpu))    // JP hl
+
+OP(0xC4, call_cond_imm16(cpu, cond_nz)) // CALL nz, imm16
+OP(0xCC, call_cond_imm16(cpu, cond_z))  // CALL z, imm16
+OP(0xD4, call_cond_imm16(cpu, cond_nc)) // CALL nc, imm16
+OP(0xDC, call_cond_imm16(cpu, cond_c))  // CALL c, imm16
+
+OP(0xCD, call_imm16(cpu)) // CALL imm16
+
+OP(0xC7, rst(cpu, 0x00)) // RST 00h
+OP(0xCF, rst(cpu, 0x08)) // RST 08h
+OP(0xD7, rst(cpu, 0x10)) // RST 10h
+OP(0xDF, rst(cpu, 0x18)) // RST 18h
+OP(0xE7, rst(cpu, 0x20)) // RST 20h
+OP(0xEF, rst(cpu, 0x28)) // RST 28h
+OP(0xF7, rst(cpu, 0x30)) // RST 30h
+OP(0xFF, rst(cpu, 0x38)) // RST 38h
+
+OP(0xC1, pop(cpu, r16stk_bc)) // POP BC
+OP(0xD1, pop(cpu, r16stk_de)) // POP DE
+OP(0xE1, pop(cpu, r16stk_hl)) // POP HL
+OP(0xF1, pop(cpu, r16stk_af)) // POP AF
+
+OP(0xC5, push(cpu, r16stk_bc)) // PUSH BC
+OP(0xD5, push(cpu, r16stk_de)) // PUSH DE
+OP(0xE5, push(cpu, r16stk_hl)) // PUSH HL
+OP(0xF5, push(cpu, r16stk_af)) // PUSH AF
+
+OP(0xE0, ldh_imm8_a(cpu)) // LDH [0xFF00 + imm8], a
+OP(0xF0, ldh_a_imm8(cpu)) // LDH a, [0xFF00 + imm8]
+
+OP(0xE2, ldh_c_a(cpu)) // LDH [0xFF00 + c], a
+OP(0xF2, ldh_a_c(cpu)) // LDH a, [0xFF00 + c]
+
+OP(0xEA, ld_imm16_a(cpu)) // LD [imm16], a
+OP(0xFA, ld_a_imm16(cpu)) // LD a, [imm16]
+
+OP(0xE8, add_sp_imm8(cpu))   // ADD sp, imm8
+OP(0xF8, ld_hl_sp_imm8(cpu)) // LD hl, sp + imm8
+OP(0xF9, ld_sp_hl(cpu))      // LD sp, hl
+
+OP(0xCB, cb_prefix(cpu)) // 0xCB is a prefix for 2 byte ops
+
+OP(0x10, unimplemented(cpu)) // STOP (implement later)
+OP(0x76, unimplemented(cpu)) // HALT (implement later)
+OP(0xF3, unimplemented(cpu)) // DI (implement later)
+OP(0xFB, unimplemented(cpu)) // EI (implement later)
+
+#undef OP
+
+static void (*const ops[256])(struct sm83 *cpu) = {
+    op_0x00, op_0x01, op_0x02, op_0x03, op_0x04, op_0x05, op_0x06, op_0x07,
+    op_0x08, op_0x09, op_0x0A, op_0x0B, op_0x0C, op_0x0D, op_0x0E, op_0x0F,
+    op_0x10, op_0x11, op_0x12, op_0x13, op_0x14, op_0x15, op_0x16, op_0x17,
+    op_0x18, op_0x19, op_0x1A, op_0x1B, op_0x1C, op_0x1D, op_0x1E, op_0x1F,
+    op_0x20, op_0x21, op_0x22, op_0x23, op_0x24, op_0x25, op_0x26, op_0x27,
+    op_0x28, op_0x29, op_0x2A, op_0x2B, op_0x2C, op_0x2D, op_0x2E, op_0x2F,
+    op_0x30, op_0x31, op_0x32, op_0x33, op_0x34, op_0x35, op_0x36, op_0x37,
+    op_0x38, op_0x39, op_0x3A, op_0x3B, op_0x3C, op_0x3D, op_0x3E, op_0x3F,
+    op_0x40, op_0x41, op_0x42, op_0x43, op_0x44, op_0x45, op_0x46, op_0x47,
+    op_0x48, op_0x49, op_0x4A, op_0x4B, op_0x4C, op_0x4D, op_0x4E, op_0x4F,
+    op_0x50, op_0x51, op_0x52, op_0x53, op_0x54, op_0x55, op_0x56, op_0x57,
+    op_0x58, op_0x59, op_0x5A, op_0x5B, op_0x5C, op_0x5D, op_0x5E, op_0x5F,
+    op_0x60, op_0x61, op_0x62, op_0x63, op_0x64, op_0x65, op_0x66, op_0x67,
+    op_0x68, op_0x69, op_0x6A, op_0x6B, op_0x6C, op_0x6D, op_0x6E, op_0x6F,
+    op_0x70, op_0x71, op_0x72, op_0x73, op_0x74, op_0x75, op_0x76, op_0x77,
+    op_0x78, op_0x79, op_0x7A, op_0x7B, op_0x7C, op_0x7D, op_0x7E, op_0x7F,
+    op_0x80, op_0x81, op_0x82, op_0x83, op_0x84, op_0x85, op_0x86, op_0x87,
+    op_0x88, op_0x89, op_0x8A, op_0x8B, op_0x8C, op_0x8D, op_0x8E, op_0x8F,
+    op_0x90, op_0x91, op_0x92, op_0x93, op_0x94, op_0x95, op_0x96, op_0x97,
+    op_0x98, op_0x99, op_0x9A, op_0x9B, op_0x9C, op_0x9D, op_0x9E, op_0x9F,
+    op_0xA0, op_0xA1, op_0xA2, op_0xA3, op_0xA4, op_0xA5, op_0xA6, op_0xA7,
+    op_0xA8, op_0xA9, op_0xAA, op_0xAB, op_0xAC, op_0xAD, op_0xAE, op_0xAF,
+    op_0xB0, op_0xB1, op_0xB2, op_0xB3, op_0xB4, op_0xB5, op_0xB6, op_0xB7,
+    op_0xB8, op_0xB9, op_0xBA, op_0xBB, op_0xBC, op_0xBD, op_0xBE, op_0xBF,
+    op_0xC0, op_0xC1, op_0xC2, op_0xC3, op_0xC4, op_0xC5, op_0xC6, op_0xC7,
+    op_0xC8, op_0xC9, op_0xCA, op_0xCB, op_0xCC, op_0xCD, op_0xCE, op_0xCF,
+    op_0xD0, op_0xD1, op_0xD2, invalid, op_0xD4, op_0xD5, op_0xD6, op_0xD7,
+    op_0xD8, op_0xD9, op_0xDA, invalid, op_0xDC, invalid, op_0xDE, op_0xDF,
+    op_0xE0, op_0xE1, op_0xE2, invalid, invalid, op_0xE5, op_0xE6, op_0xE7,
+    op_0xE8, op_0xE9, op_0xEA, invalid, invalid, invalid, op_0xEE, op_0xEF,
+    op_0xF0, op_0xF1, op_0xF2, op_0xF3, invalid, op_0xF5, op_0xF6, op_0xF7,
+    op_0xF8, op_0xF9, op_0xFA, op_0xFB, invalid, invalid, op_0xFE, op_0xFF,
+};
 
 void sm83_m_cycle(struct sm83 *cpu) {
-    switch (cpu->opcode) {
-    case 0x00: nop(cpu); break; // NOP
-
-    case 0x01: ld_r16_imm16(cpu, r16_bc); break; // LD bc, imm16
-    case 0x11: ld_r16_imm16(cpu, r16_de); break; // LD de, imm16
-    case 0x21: ld_r16_imm16(cpu, r16_hl); break; // LD hl, imm16
-    case 0x31: ld_r16_imm16(cpu, r16_sp); break; // LD sp, imm16
-
-    case 0x02: ld_r16mem_a(cpu, r16mem_bc); break;  // LD [bc], a
-    case 0x12: ld_r16mem_a(cpu, r16mem_de); break;  // LD [de], a
-    case 0x22: ld_r16mem_a(cpu, r16mem_hli); break; // LD [hl+], a
-    case 0x32: ld_r16mem_a(cpu, r16mem_hld); break; // LD [hl-], a
-
-    case 0x0A: ld_a_r16mem(cpu, r16mem_bc); break;  // LD a, [bc]
-    case 0x1A: ld_a_r16mem(cpu, r16mem_de); break;  // LD a, [de]
-    case 0x2A: ld_a_r16mem(cpu, r16mem_hli); break; // LD a, [hl+]
-    case 0x3A: ld_a_r16mem(cpu, r16mem_hld); break; // LD a, [hl-]
-
-    case 0x08: ld_imm16_sp(cpu); break; // LD [imm16], sp
-
-    case 0x03: inc_r16(cpu, r16_bc); break; // INC bc
-    case 0x13: inc_r16(cpu, r16_de); break; // INC de
-    case 0x23: inc_r16(cpu, r16_hl); break; // INC hl
-    case 0x33: inc_r16(cpu, r16_sp); break; // INC sp
-
-    case 0x0B: dec_r16(cpu, r16_bc); break; // DEC bc
-    case 0x1B: dec_r16(cpu, r16_de); break; // DEC de
-    case 0x2B: dec_r16(cpu, r16_hl); break; // DEC hl
-    case 0x3B: dec_r16(cpu, r16_sp); break; // DEC sp
-
-    case 0x09: add_hl_r16(cpu, r16_bc); break; // ADD hl, bc
-    case 0x19: add_hl_r16(cpu, r16_de); break; // ADD hl, de
-    case 0x29: add_hl_r16(cpu, r16_hl); break; // ADD hl, hl
-    case 0x39: add_hl_r16(cpu, r16_sp); break; // ADD hl, sp
-
-    case 0x04: inc_r8(cpu, r8_b); break;  // INC b
-    case 0x0C: inc_r8(cpu, r8_c); break;  // INC c
-    case 0x14: inc_r8(cpu, r8_d); break;  // INC d
-    case 0x1C: inc_r8(cpu, r8_e); break;  // INC e
-    case 0x24: inc_r8(cpu, r8_h); break;  // INC h
-    case 0x2C: inc_r8(cpu, r8_l); break;  // INC l
-    case 0x34: inc_r8(cpu, r8_hl); break; // INC [hl]
-    case 0x3C: inc_r8(cpu, r8_a); break;  // INC a
-
-    case 0x05: dec_r8(cpu, r8_b); break;  // DEC b
-    case 0x0D: dec_r8(cpu, r8_c); break;  // DEC c
-    case 0x15: dec_r8(cpu, r8_d); break;  // DEC d
-    case 0x1D: dec_r8(cpu, r8_e); break;  // DEC e
-    case 0x25: dec_r8(cpu, r8_h); break;  // DEC h
-    case 0x2D: dec_r8(cpu, r8_l); break;  // DEC l
-    case 0x35: dec_r8(cpu, r8_hl); break; // DEC [hl]
-    case 0x3D: dec_r8(cpu, r8_a); break;  // DEC a
-
-    case 0x06: ld_r8_imm8(cpu, r8_b); break;  // LD b, imm8
-    case 0x0E: ld_r8_imm8(cpu, r8_c); break;  // LD c, imm8
-    case 0x16: ld_r8_imm8(cpu, r8_d); break;  // LD d, imm8
-    case 0x1E: ld_r8_imm8(cpu, r8_e); break;  // LD e, imm8
-    case 0x26: ld_r8_imm8(cpu, r8_h); break;  // LD h, imm8
-    case 0x2E: ld_r8_imm8(cpu, r8_l); break;  // LD l, imm8
-    case 0x36: ld_r8_imm8(cpu, r8_hl); break; // LD [hl], imm8
-    case 0x3E: ld_r8_imm8(cpu, r8_a); break;  // LD a, imm8
-
-    case 0x07: rlca(cpu); break; // RLCA
-    case 0x0F: rrca(cpu); break; // RRCA
-    case 0x17: rla(cpu); break;  // RLA
-    case 0x1F: rra(cpu); break;  // RRA
-    case 0x27: daa(cpu); break;  // DAA
-    case 0x2F: cpl(cpu); break;  // CPL
-    case 0x37: scf(cpu); break;  // SCF
-    case 0x3F: ccf(cpu); break;  // CCF
-
-    case 0x18: jr_imm8(cpu); break;               // JR imm8
-    case 0x20: jr_cond_imm8(cpu, cond_nz); break; // JR nz, imm8
-    case 0x28: jr_cond_imm8(cpu, cond_z); break;  // JR z, imm8
-    case 0x30: jr_cond_imm8(cpu, cond_nc); break; // JR nc, imm8
-    case 0x38: jr_cond_imm8(cpu, cond_c); break;  // JR c, imm8
-
-    case 0x40: ld_r8_r8(cpu, r8_b, r8_b); break;  // LD b, b
-    case 0x41: ld_r8_r8(cpu, r8_b, r8_c); break;  // LD b, c
-    case 0x42: ld_r8_r8(cpu, r8_b, r8_d); break;  // LD b, d
-    case 0x43: ld_r8_r8(cpu, r8_b, r8_e); break;  // LD b, e
-    case 0x44: ld_r8_r8(cpu, r8_b, r8_h); break;  // LD b, h
-    case 0x45: ld_r8_r8(cpu, r8_b, r8_l); break;  // LD b, l
-    case 0x46: ld_r8_r8(cpu, r8_b, r8_hl); break; // LD b, [hl]
-    case 0x47: ld_r8_r8(cpu, r8_b, r8_a); break;  // LD b, a
-
-    case 0x48: ld_r8_r8(cpu, r8_c, r8_b); break;  // LD c, b
-    case 0x49: ld_r8_r8(cpu, r8_c, r8_c); break;  // LD c, c
-    case 0x4A: ld_r8_r8(cpu, r8_c, r8_d); break;  // LD c, d
-    case 0x4B: ld_r8_r8(cpu, r8_c, r8_e); break;  // LD c, e
-    case 0x4C: ld_r8_r8(cpu, r8_c, r8_h); break;  // LD c, h
-    case 0x4D: ld_r8_r8(cpu, r8_c, r8_l); break;  // LD c, l
-    case 0x4E: ld_r8_r8(cpu, r8_c, r8_hl); break; // LD c, [hl]
-    case 0x4F: ld_r8_r8(cpu, r8_c, r8_a); break;  // LD c, a
-
-    case 0x50: ld_r8_r8(cpu, r8_d, r8_b); break;  // LD d, b
-    case 0x51: ld_r8_r8(cpu, r8_d, r8_c); break;  // LD d, c
-    case 0x52: ld_r8_r8(cpu, r8_d, r8_d); break;  // LD d, d
-    case 0x53: ld_r8_r8(cpu, r8_d, r8_e); break;  // LD d, e
-    case 0x54: ld_r8_r8(cpu, r8_d, r8_h); break;  // LD d, h
-    case 0x55: ld_r8_r8(cpu, r8_d, r8_l); break;  // LD d, l
-    case 0x56: ld_r8_r8(cpu, r8_d, r8_hl); break; // LD d, [hl]
-    case 0x57: ld_r8_r8(cpu, r8_d, r8_a); break;  // LD d, a
-
-    case 0x58: ld_r8_r8(cpu, r8_e, r8_b); break;  // LD e, b
-    case 0x59: ld_r8_r8(cpu, r8_e, r8_c); break;  // LD e, c
-    case 0x5A: ld_r8_r8(cpu, r8_e, r8_d); break;  // LD e, d
-    case 0x5B: ld_r8_r8(cpu, r8_e, r8_e); break;  // LD e, e
-    case 0x5C: ld_r8_r8(cpu, r8_e, r8_h); break;  // LD e, h
-    case 0x5D: ld_r8_r8(cpu, r8_e, r8_l); break;  // LD e, l
-    case 0x5E: ld_r8_r8(cpu, r8_e, r8_hl); break; // LD e, [hl]
-    case 0x5F: ld_r8_r8(cpu, r8_e, r8_a); break;  // LD e, a
-
-    case 0x60: ld_r8_r8(cpu, r8_h, r8_b); break;  // LD h, b
-    case 0x61: ld_r8_r8(cpu, r8_h, r8_c); break;  // LD h, c
-    case 0x62: ld_r8_r8(cpu, r8_h, r8_d); break;  // LD h, d
-    case 0x63: ld_r8_r8(cpu, r8_h, r8_e); break;  // LD h, e
-    case 0x64: ld_r8_r8(cpu, r8_h, r8_h); break;  // LD h, h
-    case 0x65: ld_r8_r8(cpu, r8_h, r8_l); break;  // LD h, l
-    case 0x66: ld_r8_r8(cpu, r8_h, r8_hl); break; // LD h, [hl]
-    case 0x67: ld_r8_r8(cpu, r8_h, r8_a); break;  // LD h, a
-
-    case 0x68: ld_r8_r8(cpu, r8_l, r8_b); break;  // LD l, b
-    case 0x69: ld_r8_r8(cpu, r8_l, r8_c); break;  // LD l, c
-    case 0x6A: ld_r8_r8(cpu, r8_l, r8_d); break;  // LD l, d
-    case 0x6B: ld_r8_r8(cpu, r8_l, r8_e); break;  // LD l, e
-    case 0x6C: ld_r8_r8(cpu, r8_l, r8_h); break;  // LD l, h
-    case 0x6D: ld_r8_r8(cpu, r8_l, r8_l); break;  // LD l, l
-    case 0x6E: ld_r8_r8(cpu, r8_l, r8_hl); break; // LD l, [hl]
-    case 0x6F: ld_r8_r8(cpu, r8_l, r8_a); break;  // LD l, a
-
-    case 0x70: ld_r8_r8(cpu, r8_hl, r8_b); break; // LD [hl], b
-    case 0x71: ld_r8_r8(cpu, r8_hl, r8_c); break; // LD [hl], c
-    case 0x72: ld_r8_r8(cpu, r8_hl, r8_d); break; // LD [hl], d
-    case 0x73: ld_r8_r8(cpu, r8_hl, r8_e); break; // LD [hl], e
-    case 0x74: ld_r8_r8(cpu, r8_hl, r8_h); break; // LD [hl], h
-    case 0x75: ld_r8_r8(cpu, r8_hl, r8_l); break; // LD [hl], l
-
-    case 0x77: ld_r8_r8(cpu, r8_hl, r8_a); break; // LD [hl], a
-
-    case 0x78: ld_r8_r8(cpu, r8_a, r8_b); break;  // LD a, b
-    case 0x79: ld_r8_r8(cpu, r8_a, r8_c); break;  // LD a, c
-    case 0x7A: ld_r8_r8(cpu, r8_a, r8_d); break;  // LD a, d
-    case 0x7B: ld_r8_r8(cpu, r8_a, r8_e); break;  // LD a, e
-    case 0x7C: ld_r8_r8(cpu, r8_a, r8_h); break;  // LD a, h
-    case 0x7D: ld_r8_r8(cpu, r8_a, r8_l); break;  // LD a, l
-    case 0x7E: ld_r8_r8(cpu, r8_a, r8_hl); break; // LD a, [hl]
-    case 0x7F: ld_r8_r8(cpu, r8_a, r8_a); break;  // LD a, a
-
-    case 0x80: mathop_a_r8(cpu, op_add, r8_b); break;  // ADD a, b
-    case 0x81: mathop_a_r8(cpu, op_add, r8_c); break;  // ADD a, c
-    case 0x82: mathop_a_r8(cpu, op_add, r8_d); break;  // ADD a, d
-    case 0x83: mathop_a_r8(cpu, op_add, r8_e); break;  // ADD a, e
-    case 0x84: mathop_a_r8(cpu, op_add, r8_h); break;  // ADD a, h
-    case 0x85: mathop_a_r8(cpu, op_add, r8_l); break;  // ADD a, l
-    case 0x86: mathop_a_r8(cpu, op_add, r8_hl); break; // ADD a, [hl]
-    case 0x87: mathop_a_r8(cpu, op_add, r8_a); break;  // ADD a, a
-
-    case 0x88: mathop_a_r8(cpu, op_adc, r8_b); break;  // ADC a, b
-    case 0x89: mathop_a_r8(cpu, op_adc, r8_c); break;  // ADC a, c
-    case 0x8A: mathop_a_r8(cpu, op_adc, r8_d); break;  // ADC a, d
-    case 0x8B: mathop_a_r8(cpu, op_adc, r8_e); break;  // ADC a, e
-    case 0x8C: mathop_a_r8(cpu, op_adc, r8_h); break;  // ADC a, h
-    case 0x8D: mathop_a_r8(cpu, op_adc, r8_l); break;  // ADC a, l
-    case 0x8E: mathop_a_r8(cpu, op_adc, r8_hl); break; // ADC a, [hl]
-    case 0x8F: mathop_a_r8(cpu, op_adc, r8_a); break;  // ADC a, a
-
-    case 0x90: mathop_a_r8(cpu, op_sub, r8_b); break;  // SUB a, b
-    case 0x91: mathop_a_r8(cpu, op_sub, r8_c); break;  // SUB a, c
-    case 0x92: mathop_a_r8(cpu, op_sub, r8_d); break;  // SUB a, d
-    case 0x93: mathop_a_r8(cpu, op_sub, r8_e); break;  // SUB a, e
-    case 0x94: mathop_a_r8(cpu, op_sub, r8_h); break;  // SUB a, h
-    case 0x95: mathop_a_r8(cpu, op_sub, r8_l); break;  // SUB a, l
-    case 0x96: mathop_a_r8(cpu, op_sub, r8_hl); break; // SUB a, [hl]
-    case 0x97: mathop_a_r8(cpu, op_sub, r8_a); break;  // SUB a, a
-
-    case 0x98: mathop_a_r8(cpu, op_sbc, r8_b); break;  // SBC a, b
-    case 0x99: mathop_a_r8(cpu, op_sbc, r8_c); break;  // SBC a, c
-    case 0x9A: mathop_a_r8(cpu, op_sbc, r8_d); break;  // SBC a, d
-    case 0x9B: mathop_a_r8(cpu, op_sbc, r8_e); break;  // SBC a, e
-    case 0x9C: mathop_a_r8(cpu, op_sbc, r8_h); break;  // SBC a, h
-    case 0x9D: mathop_a_r8(cpu, op_sbc, r8_l); break;  // SBC a, l
-    case 0x9E: mathop_a_r8(cpu, op_sbc, r8_hl); break; // SBC a, [hl]
-    case 0x9F: mathop_a_r8(cpu, op_sbc, r8_a); break;  // SBC a, a
-
-    case 0xA0: mathop_a_r8(cpu, op_and, r8_b); break;  // AND a, b
-    case 0xA1: mathop_a_r8(cpu, op_and, r8_c); break;  // AND a, c
-    case 0xA2: mathop_a_r8(cpu, op_and, r8_d); break;  // AND a, d
-    case 0xA3: mathop_a_r8(cpu, op_and, r8_e); break;  // AND a, e
-    case 0xA4: mathop_a_r8(cpu, op_and, r8_h); break;  // AND a, h
-    case 0xA5: mathop_a_r8(cpu, op_and, r8_l); break;  // AND a, l
-    case 0xA6: mathop_a_r8(cpu, op_and, r8_hl); break; // AND a, [hl]
-    case 0xA7: mathop_a_r8(cpu, op_and, r8_a); break;  // AND a, a
-
-    case 0xA8: mathop_a_r8(cpu, op_xor, r8_b); break;  // XOR a, b
-    case 0xA9: mathop_a_r8(cpu, op_xor, r8_c); break;  // XOR a, c
-    case 0xAA: mathop_a_r8(cpu, op_xor, r8_d); break;  // XOR a, d
-    case 0xAB: mathop_a_r8(cpu, op_xor, r8_e); break;  // XOR a, e
-    case 0xAC: mathop_a_r8(cpu, op_xor, r8_h); break;  // XOR a, h
-    case 0xAD: mathop_a_r8(cpu, op_xor, r8_l); break;  // XOR a, l
-    case 0xAE: mathop_a_r8(cpu, op_xor, r8_hl); break; // XOR a, [hl]
-    case 0xAF: mathop_a_r8(cpu, op_xor, r8_a); break;  // XOR a, a
-
-    case 0xB0: mathop_a_r8(cpu, op_or, r8_b); break;  // OR a, b
-    case 0xB1: mathop_a_r8(cpu, op_or, r8_c); break;  // OR a, c
-    case 0xB2: mathop_a_r8(cpu, op_or, r8_d); break;  // OR a, d
-    case 0xB3: mathop_a_r8(cpu, op_or, r8_e); break;  // OR a, e
-    case 0xB4: mathop_a_r8(cpu, op_or, r8_h); break;  // OR a, h
-    case 0xB5: mathop_a_r8(cpu, op_or, r8_l); break;  // OR a, l
-    case 0xB6: mathop_a_r8(cpu, op_or, r8_hl); break; // OR a, [hl]
-    case 0xB7: mathop_a_r8(cpu, op_or, r8_a); break;  // OR a, a
-
-    case 0xB8: mathop_a_r8(cpu, op_cp, r8_b); break;  // CP a, b
-    case 0xB9: mathop_a_r8(cpu, op_cp, r8_c); break;  // CP a, c
-    case 0xBA: mathop_a_r8(cpu, op_cp, r8_d); break;  // CP a, d
-    case 0xBB: mathop_a_r8(cpu, op_cp, r8_e); break;  // CP a, e
-    case 0xBC: mathop_a_r8(cpu, op_cp, r8_h); break;  // CP a, h
-    case 0xBD: mathop_a_r8(cpu, op_cp, r8_l); break;  // CP a, l
-    case 0xBE: mathop_a_r8(cpu, op_cp, r8_hl); break; // CP a, [hl]
-    case 0xBF: mathop_a_r8(cpu, op_cp, r8_a); break;  // CP a, a
-
-    case 0xC6: mathop_a_imm8(cpu, op_add); break; // ADD a, imm8
-    case 0xCE: mathop_a_imm8(cpu, op_adc); break; // ADC a, imm8
-    case 0xD6: mathop_a_imm8(cpu, op_sub); break; // SUB a, imm8
-    case 0xDE: mathop_a_imm8(cpu, op_sbc); break; // SBC a, imm8
-    case 0xE6: mathop_a_imm8(cpu, op_and); break; // AND a, imm8
-    case 0xEE: mathop_a_imm8(cpu, op_xor); break; // XOR a, imm8
-    case 0xF6: mathop_a_imm8(cpu, op_or); break;  // OR a, imm8
-    case 0xFE: mathop_a_imm8(cpu, op_cp); break;  // CP a, imm8
-
-    case 0xC0: ret_cond(cpu, cond_nz); break; // RET NZ
-    case 0xC8: ret_cond(cpu, cond_z); break;  // RET Z
-    case 0xC9: ret(cpu); break;               // RET
-    case 0xD0: ret_cond(cpu, cond_nc); break; // RET NC
-    case 0xD8: ret_cond(cpu, cond_c); break;  // RET C
-    case 0xD9: exit(1);                       // RETI (implement later)
-
-    case 0xC2: jp_cond_imm16(cpu, cond_nz); break; // JP nz, imm16
-    case 0xCA: jp_cond_imm16(cpu, cond_z); break;  // JP z, imm16
-    case 0xD2: jp_cond_imm16(cpu, cond_nc); break; // JP nc, imm16
-    case 0xDA: jp_cond_imm16(cpu, cond_c); break;  // JP c, imm16
-
-    case 0xC3: jp_imm16(cpu); break; // JP imm16
-    case 0xE9: jp_hl(cpu); break;    // JP hl
-
-    case 0xC4: call_cond_imm16(cpu, cond_nz); break; // CALL nz, imm16
-    case 0xCC: call_cond_imm16(cpu, cond_z); break;  // CALL z, imm16
-    case 0xD4: call_cond_imm16(cpu, cond_nc); break; // CALL nc, imm16
-    case 0xDC: call_cond_imm16(cpu, cond_c); break;  // CALL c, imm16
-
-    case 0xCD: call_imm16(cpu); break; // CALL imm16
-
-    case 0xC7: rst(cpu, 0x00); // RST 00h
-    case 0xCF: rst(cpu, 0x08); // RST 08h
-    case 0xD7: rst(cpu, 0x10); // RST 10h
-    case 0xDF: rst(cpu, 0x18); // RST 18h
-    case 0xE7: rst(cpu, 0x20); // RST 20h
-    case 0xEF: rst(cpu, 0x28); // RST 28h
-    case 0xF7: rst(cpu, 0x30); // RST 30h
-    case 0xFF: rst(cpu, 0x38); // RST 38h
-
-    case 0xC1: pop(cpu, r16stk_bc); break; // POP BC
-    case 0xD1: pop(cpu, r16stk_de); break; // POP DE
-    case 0xE1: pop(cpu, r16stk_hl); break; // POP HL
-    case 0xF1: pop(cpu, r16stk_af); break; // POP AF
-
-    case 0xC5: push(cpu, r16stk_bc); break; // PUSH BC
-    case 0xD5: push(cpu, r16stk_de); break; // PUSH DE
-    case 0xE5: push(cpu, r16stk_hl); break; // PUSH HL
-    case 0xF5: push(cpu, r16stk_af); break; // PUSH AF
-
-    case 0xE0: ldh_imm8_a(cpu); break; // LDH [0xFF00 + imm8], a
-    case 0xF0: ldh_a_imm8(cpu); break; // LDH a, [0xFF00 + imm8]
-
-    case 0xE2: ldh_c_a(cpu); break; // LDH [0xFF00 + c], a
-    case 0xF2: ldh_a_c(cpu); break; // LDH a, [0xFF00 + c]
-
-    case 0xEA: ld_imm16_a(cpu); break; // LD [imm16], a
-    case 0xFA: ld_a_imm16(cpu); break; // LD a, [imm16]
-
-    case 0xCB: cb_prefix(cpu); // 0xCB is a prefix for 2 byte ops
-
-    case 0x10: exit(1); // STOP (implement later)
-    case 0x76: exit(1); // HALT (implement later)
-    case 0xF3: exit(1); // DI (implement later)
-    case 0xFB: exit(1); // EI (implement later)
-
-    default: break; // Invalid opcodes, pc doesn't change making an inf loop
-    }
+    sm83_profile_hook_m_cycle(cpu);
+    ops[cpu->opcode](cpu);
 }
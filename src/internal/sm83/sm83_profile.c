@@ -0,0 +1,316 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include "internal/sm83/sm83_profile.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Instruction addresses are keyed by bank << 16 | address, the bank being the rom bank for rom
+// addresses and 0 for everything else.
+
+#define ROOT_SP 0x10000 // above any real stack pointer, so the root frame never returns
+
+struct stats {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t ns;
+};
+
+struct site {
+    bool used;
+    uint32_t key;
+    struct stats stats;
+};
+
+// Node of the call tree, one per distinct call stack.
+struct frame {
+    uint32_t key; // callee
+    uint32_t parent;
+    uint32_t child; // first callee, 0 if none (the root is never anyone's callee)
+    uint32_t sibling;
+    uint64_t cycles; // spent in this stack itself, not in its callees
+};
+
+struct sm83_profile {
+    struct stats ops[SM83_PROFILE_OPCODES];
+
+    // Open addressing, capacity is a power of 2 and at most half full.
+    struct site *sites;
+    size_t site_count;
+    size_t site_capacity;
+
+    struct frame *frames; // frames[0] is the root
+    size_t frame_count;
+    size_t frame_capacity;
+
+    // Calls currently in progress, stack[0] is the root.
+    struct {
+        uint32_t frame;
+        uint32_t sp; // where the return address is
+    } stack[SM83_PROFILE_MAX_DEPTH];
+    size_t depth;
+
+    // Instruction in flight, booked once the next one starts.
+    bool busy;
+    uint16_t op;
+    size_t site;
+    uint64_t cycles;
+    uint64_t start;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t key_of(const struct sm83 *cpu, uint16_t address) {
+    uint32_t bank = 0;
+
+    if (address < 0x8000 && cpu->bus->cart != NULL) {
+        bank = cartridge_rom_bank(cpu->bus->cart, address);
+    }
+    return bank << 16 | address;
+}
+
+static size_t site_slot(const struct site *sites, size_t capacity, uint32_t key) {
+    size_t i = (key * 0x9E3779B1u) & (capacity - 1);
+
+    while (sites[i].used && sites[i].key != key) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return i;
+}
+
+static void grow_sites(struct sm83_profile *profile) {
+    size_t capacity = profile->site_capacity * 2;
+    struct site *sites = calloc(capacity, sizeof(struct site));
+    assert(sites != NULL);
+
+    for (size_t i = 0; i < profile->site_capacity; i++) {
+        if (profile->sites[i].used) {
+            sites[site_slot(sites, capacity, profile->sites[i].key)] = profile->sites[i];
+        }
+    }
+
+    free(profile->sites);
+    profile->sites = sites;
+    profile->site_capacity = capacity;
+}
+
+static size_t find_site(struct sm83_profile *profile, uint32_t key) {
+    if (2 * (profile->site_count + 1) > profile->site_capacity) {
+        grow_sites(profile);
+    }
+
+    size_t i = site_slot(profile->sites, profile->site_capacity, key);
+
+    if (!profile->sites[i].used) {
+        profile->sites[i] = (struct site){.used = true, .key = key, .stats = {0, 0, 0}};
+        profile->site_count++;
+    }
+    return i;
+}
+
+static uint32_t find_child(struct sm83_profile *profile, uint32_t parent, uint32_t key) {
+    for (uint32_t i = profile->frames[parent].child; i != 0; i = profile->frames[i].sibling) {
+        if (profile->frames[i].key == key) {
+            return i;
+        }
+    }
+
+    if (profile->frame_count == profile->frame_capacity) {
+        profile->frame_capacity *= 2;
+        profile->frames = realloc(profile->frames, profile->frame_capacity * sizeof(struct frame));
+        assert(profile->frames != NULL);
+    }
+
+    uint32_t i = profile->frame_count++;
+    profile->frames[i] = (struct frame){
+        .key = key,
+        .parent = parent,
+        .child = 0,
+        .sibling = profile->frames[parent].child,
+        .cycles = 0,
+    };
+    profile->frames[parent].child = i;
+
+    return i;
+}
+
+struct sm83_profile *sm83_profile_new(void) {
+    struct sm83_profile *profile = malloc(sizeof(struct sm83_profile));
+    assert(profile != NULL);
+
+    for (size_t i = 0; i < SM83_PROFILE_OPCODES; i++) {
+        profile->ops[i] = (struct stats){0, 0, 0};
+    }
+
+    profile->site_count = 0;
+    profile->site_capacity = 1024;
+    profile->sites = calloc(profile->site_capacity, sizeof(struct site));
+    assert(profile->sites != NULL);
+
+    profile->frame_count = 1;
+    profile->frame_capacity = 256;
+    profile->frames = malloc(profile->frame_capacity * sizeof(struct frame));
+    assert(profile->frames != NULL);
+    profile->frames[0] = (struct frame){.key = 0, .parent = 0, .child = 0, .sibling = 0};
+
+    profile->stack[0].frame = 0;
+    profile->stack[0].sp = ROOT_SP;
+    profile->depth = 0;
+
+    profile->busy = false;
+
+    return profile;
+}
+
+void sm83_profile_delete(struct sm83_profile *profile) {
+    if (profile == NULL) {
+        return;
+    }
+
+    free(profile->sites);
+    free(profile->frames);
+    free(profile);
+}
+
+static void add(struct stats *stats, uint64_t cycles, uint64_t ns) {
+    stats->count++;
+    stats->cycles += cycles;
+    stats->ns += ns;
+}
+
+void sm83_profile_m_cycle(struct sm83_profile *profile, const struct sm83 *cpu) {
+    if (cpu->m_cycle == 0) {
+        uint64_t start = now_ns();
+
+        if (profile->busy) {
+            add(&profile->ops[profile->op], profile->cycles, start - profile->start);
+            add(&profile->sites[profile->site].stats, profile->cycles, start - profile->start);
+        }
+
+        // The opcode was prefetched, pc is already past it.
+        profile->busy = true;
+        profile->op = cpu->opcode;
+        profile->site = find_site(profile, key_of(cpu, cpu->regs.pc - 1));
+        profile->cycles = 0;
+        profile->start = start;
+    } else if (cpu->m_cycle == 1 && profile->op == 0xCB) {
+        profile->op = 0x100 | cpu->tmp.hi; // fetched by the prefix's first m-cycle
+    }
+
+    profile->cycles++;
+    profile->frames[profile->stack[profile->depth].frame].cycles++;
+}
+
+void sm83_profile_call(struct sm83_profile *profile, const struct sm83 *cpu) {
+    if (profile->depth + 1 == SM83_PROFILE_MAX_DEPTH) {
+        return;
+    }
+
+    uint32_t frame = find_child(profile, profile->stack[profile->depth].frame,
+                                key_of(cpu, cpu->regs.pc));
+
+    profile->depth++;
+    profile->stack[profile->depth].frame = frame;
+    profile->stack[profile->depth].sp = cpu->regs.sp;
+}
+
+// Calls whose return address is at or below sp are over, including ones that never returned
+// because the code dropped their return address some other way.
+void sm83_profile_ret(struct sm83_profile *profile, const struct sm83 *cpu) {
+    while (profile->depth > 0 && profile->stack[profile->depth].sp <= cpu->regs.sp) {
+        profile->depth--;
+    }
+}
+
+struct entry {
+    uint32_t key;
+    struct stats stats;
+};
+
+static int by_ns(const void *a, const void *b) {
+    const struct entry *x = a;
+    const struct entry *y = b;
+
+    if (x->stats.ns != y->stats.ns) {
+        return x->stats.ns < y->stats.ns ? 1 : -1;
+    }
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total != 0 ? 100.0 * part / total : 0;
+}
+
+void sm83_profile_report(const struct sm83_profile *profile, FILE *out, size_t sites) {
+    struct entry *entries = malloc(
+        (profile->site_count > SM83_PROFILE_OPCODES ? profile->site_count : SM83_PROFILE_OPCODES) *
+        sizeof(struct entry));
+    assert(entries != NULL);
+    size_t count = 0;
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < SM83_PROFILE_OPCODES; i++) {
+        if (profile->ops[i].count != 0) {
+            entries[count++] = (struct entry){.key = i, .stats = profile->ops[i]};
+            total += profile->ops[i].ns;
+        }
+    }
+    qsort(entries, count, sizeof(struct entry), by_ns);
+
+    fprintf(out, "# opcode\tcount\tm-cycles\tns\tns/insn\t%%time\n");
+    for (size_t i = 0; i < count; i++) {
+        const struct stats *s = &entries[i].stats;
+
+        fprintf(out, entries[i].key >= 0x100 ? "CB %02X" : "%02X", entries[i].key % 0x100);
+        fprintf(out, "\t%llu\t%llu\t%llu\t%.2f\t%.2f\n", (unsigned long long)s->count,
+                (unsigned long long)s->cycles, (unsigned long long)s->ns,
+                (double)s->ns / s->count, percent(s->ns, total));
+    }
+
+    count = 0;
+    for (size_t i = 0; i < profile->site_capacity; i++) {
+        if (profile->sites[i].used && profile->sites[i].stats.count != 0) {
+            entries[count++] = (struct entry){profile->sites[i].key, profile->sites[i].stats};
+        }
+    }
+    qsort(entries, count, sizeof(struct entry), by_ns);
+
+    fprintf(out, "# bank:address\tcount\tm-cycles\tns\tns/insn\t%%time\n");
+    for (size_t i = 0; i < count && i < sites; i++) {
+        const struct stats *s = &entries[i].stats;
+
+        fprintf(out, "%02X:%04X\t%llu\t%llu\t%llu\t%.2f\t%.2f\n", entries[i].key >> 16,
+                entries[i].key & 0xFFFF, (unsigned long long)s->count,
+                (unsigned long long)s->cycles, (unsigned long long)s->ns,
+                (double)s->ns / s->count, percent(s->ns, total));
+    }
+
+    free(entries);
+}
+
+void sm83_profile_collapsed(const struct sm83_profile *profile, FILE *out) {
+    uint32_t path[SM83_PROFILE_MAX_DEPTH];
+
+    for (size_t i = 0; i < profile->frame_count; i++) {
+        if (profile->frames[i].cycles == 0) {
+            continue;
+        }
+
+        size_t depth = 0;
+        for (uint32_t f = i; f != 0; f = profile->frames[f].parent) {
+            path[depth++] = profile->frames[f].key;
+        }
+
+        fprintf(out, "root");
+        while (depth > 0) {
+            depth--;
+            fprintf(out, ";%02X:%04X", path[depth] >> 16, path[depth] & 0xFFFF);
+        }
+        fprintf(out, " %llu\n", (unsigned long long)profile->frames[i].cycles);
+    }
+}
@@ -0,0 +1,100 @@
+#include "internal/sm83/sm83.h"
+#include "internal/sm83/sm83_block.h"
+#include "internal/sm83/sm83_exec.h"
+#include "internal/sm83/sm83_jit.h"
+
+// Profiling and tracing hook into sm83_m_cycle, so while either is attached everything goes
+// through it.
+static size_t run_m_cycles(struct sm83 *cpu, size_t cycles) {
+    size_t done = 0;
+
+    while (done < cycles || cpu->m_cycle != 0) {
+        sm83_m_cycle(cpu);
+        cpu->bus->clock++;
+        done++;
+
+        if (cpu->m_cycle == 0) {
+            size_t stall = bus_take_stall(cpu->bus);
+            cpu->bus->clock += stall;
+            done += stall;
+        }
+    }
+    sm83_sync_flags(cpu);
+
+    return done;
+}
+
+size_t sm83_step(struct sm83 *cpu) {
+    if (sm83_hooked(cpu)) {
+        return run_m_cycles(cpu, 1);
+    }
+
+    struct bus *bus = cpu->bus;
+    uint64_t start = bus->clock;
+    size_t cycles = 0;
+
+    // Stepping from the middle of an instruction just finishes it.
+    while (cpu->m_cycle != 0) {
+        sm83_m_cycle(cpu);
+        bus->clock++;
+        cycles++;
+    }
+    sm83_sync_flags(cpu);
+    if (cycles != 0) {
+        cycles += bus_take_stall(bus);
+        bus->clock = start + cycles;
+        return cycles;
+    }
+
+    struct sm83_register_file regs = cpu->regs;
+    struct sm83_insn insn = sm83_decode(bus, cpu->opcode, regs.pc);
+
+    sm83_clock(bus, start, insn);
+    cycles = sm83_execute(&regs, bus, insn) + bus_take_stall(bus);
+    cpu->opcode = bus_read(bus, regs.pc++);
+    cpu->regs = regs;
+    bus->clock = start + cycles;
+
+    return cycles;
+}
+
+size_t sm83_run(struct sm83 *cpu, size_t cycles) {
+    if (sm83_hooked(cpu)) {
+        return run_m_cycles(cpu, cycles);
+    }
+    if (cpu->jit != NULL) {
+        return sm83_jit_run(cpu, cpu->jit, cycles);
+    }
+    if (cpu->blocks != NULL) {
+        return sm83_block_run(cpu, cpu->blocks, cycles);
+    }
+
+    struct bus *bus = cpu->bus;
+    uint64_t start = bus->clock;
+    size_t done = 0;
+
+    while (cpu->m_cycle != 0 && done < cycles) {
+        sm83_m_cycle(cpu);
+        bus->clock++;
+        done++;
+    }
+    sm83_sync_flags(cpu);
+
+    struct sm83_register_file regs = cpu->regs;
+    uint8_t opcode = cpu->opcode;
+
+    while (done < cycles) {
+        struct sm83_insn insn = sm83_decode(bus, opcode, regs.pc);
+
+        sm83_clock(bus, start + done, insn);
+        done += sm83_execute(&regs, bus, insn);
+        done += bus_take_stall(bus);
+        opcode = bus_read(bus, regs.pc++);
+    }
+
+    cpu->regs = regs;
+    cpu->opcode = opcode;
+    bus->clock = start + done;
+
+    return done;
+}
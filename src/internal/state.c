@@ -0,0 +1,340 @@
+#include "internal/cgbe.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal/hash.h"
+
+// A state is a fixed header followed by every piece of the machine in a fixed order. Scalars are
+// little endian, memories are copied as is, so saving is mostly a handful of memcpys. Loading
+// only unshares the ram pages that actually change. The apu's waveform positions are left out:
+// the cpu can't see them and headless runs don't keep them up, so states don't depend on whether
+// audio was on.
+
+#define STATE_MAGIC "CGBS"
+
+#define STATE_HEADER_SIZE (4 + 4 + 4 + 4 + 2 + 1)
+#define STATE_CPU_SIZE (6 * 2 + 1 + 2 + 1 + 4)
+#define STATE_CART_SIZE (2 + 1 + 1 + 1 + 2 * RTC_REG_COUNT + 1 + 4)
+#define STATE_PPU_SIZE (11 + 1 + 2 + 2 + 1 + 1 + 1 + 4 + 4 + 2 * 64 + BUS_PAGE_SIZE)
+#define STATE_TIMER_SIZE (2 + 1 + 1 + 1)
+#define STATE_APU_SIZE (APU_REGS + APU_CHANNELS * (1 + 1 + 2 + 1 + 1) + 2 + 1 + 1 + 2 + 1)
+#define STATE_JOYPAD_SIZE (1 + 1)
+
+struct writer {
+    uint8_t *p;
+    bool hashes; // rams go in as their page hashes (see ram_hash) rather than their contents
+};
+
+struct reader {
+    const uint8_t *p;
+};
+
+static void put(struct writer *w, const void *src, size_t n) {
+    memcpy(w->p, src, n);
+    w->p += n;
+}
+
+static void put_ram(struct writer *w, const struct ram *ram) {
+    if (w->hashes) {
+        // Rams without pages have no hash array to copy from.
+        if (ram->size != 0) {
+            put(w, ram->hashes, ram->size / RAM_PAGE_SIZE * sizeof(uint64_t));
+        }
+        return;
+    }
+    ram_save(ram, w->p);
+    w->p += ram->size;
+}
+
+static void put8(struct writer *w, uint8_t val) { *w->p++ = val; }
+
+static void put16(struct writer *w, uint16_t val) {
+    put8(w, val % 256);
+    put8(w, val / 256);
+}
+
+static void put32(struct writer *w, uint32_t val) {
+    put16(w, val % 65536);
+    put16(w, val / 65536);
+}
+
+static void get(struct reader *r, void *dst, size_t n) {
+    memcpy(dst, r->p, n);
+    r->p += n;
+}
+
+static void get_ram(struct reader *r, struct ram *ram) {
+    ram_load(ram, r->p);
+    r->p += ram->size;
+}
+
+static uint8_t get8(struct reader *r) { return *r->p++; }
+
+static uint16_t get16(struct reader *r) {
+    uint16_t lo = get8(r);
+    return lo | (get8(r) << 8);
+}
+
+static uint32_t get32(struct reader *r) {
+    uint32_t lo = get16(r);
+    return lo | ((uint32_t)get16(r) << 16);
+}
+
+size_t cgbe_state_size(const struct cgbe *gb) {
+    const struct bus *bus = gb->bus;
+
+    return STATE_HEADER_SIZE + STATE_CPU_SIZE + STATE_CART_SIZE + 1 + sizeof(bus->hram) +
+           sizeof(bus->io) + bus->wram->size + STATE_PPU_SIZE + gb->ppu->vram->size +
+           STATE_TIMER_SIZE + STATE_APU_SIZE + STATE_JOYPAD_SIZE + gb->cart->ram_size;
+}
+
+// Writes the state, or with hashes a stand-in for it that has every ram's page hashes in place of
+// its contents. Returns the bytes written.
+static size_t save(const struct cgbe *gb, uint8_t *buf, bool hashes) {
+    const struct sm83 *cpu = gb->cpu;
+    const struct cartridge *cart = gb->cart;
+    const struct bus *bus = gb->bus;
+    const struct ppu *ppu = gb->ppu;
+    const struct tima *timer = gb->timer;
+    const struct apu *apu = gb->apu;
+    const struct joypad *joypad = gb->joypad;
+    struct writer w = {.p = buf, .hashes = hashes};
+
+    put(&w, STATE_MAGIC, 4);
+    put32(&w, CGBE_STATE_VERSION);
+    put32(&w, cgbe_state_size(gb));
+    put32(&w, cart->rom->size);
+    put16(&w, cart->header->global_checksum);
+    put8(&w, cart->mapper);
+
+    put16(&w, cpu->regs.af);
+    put16(&w, cpu->regs.bc);
+    put16(&w, cpu->regs.de);
+    put16(&w, cpu->regs.hl);
+    put16(&w, cpu->regs.pc);
+    put16(&w, cpu->regs.sp);
+    put8(&w, cpu->opcode);
+    put16(&w, cpu->tmp.hilo);
+    put8(&w, cpu->m_cycle);
+    put8(&w, cpu->lazy.op);
+    put8(&w, cpu->lazy.x);
+    put8(&w, cpu->lazy.y);
+    put8(&w, cpu->lazy.carry);
+
+    put16(&w, cart->mbc.rom_bank);
+    put8(&w, cart->mbc.ram_bank);
+    put8(&w, cart->mbc.mode);
+    put8(&w, cart->mbc.ram_enabled);
+    put(&w, cart->rtc.regs, RTC_REG_COUNT);
+    put(&w, cart->rtc.latched, RTC_REG_COUNT);
+    put8(&w, cart->rtc.latch);
+    put32(&w, cart->rtc.cycles);
+
+    put8(&w, bus->ie);
+    put(&w, bus->hram, sizeof(bus->hram));
+    put(&w, bus->io, sizeof(bus->io));
+    put_ram(&w, bus->wram);
+
+    put8(&w, ppu->lcdc);
+    put8(&w, ppu->stat);
+    put8(&w, ppu->scy);
+    put8(&w, ppu->scx);
+    put8(&w, ppu->ly);
+    put8(&w, ppu->lyc);
+    put8(&w, ppu->wy);
+    put8(&w, ppu->wx);
+    put8(&w, ppu->vbk);
+    put8(&w, ppu->bcps);
+    put8(&w, ppu->ocps);
+    put8(&w, ppu->dma);
+    put16(&w, ppu->hdma_src);
+    put16(&w, ppu->hdma_dst);
+    put8(&w, ppu->hdma5);
+    put8(&w, ppu->window_line);
+    put8(&w, ppu->stat_line);
+    put32(&w, ppu->cycle);
+    put32(&w, ppu->frames);
+    put(&w, ppu->palettes, sizeof(ppu->palettes));
+    put(&w, ppu->oam, sizeof(ppu->oam));
+    put_ram(&w, ppu->vram);
+
+    put16(&w, timer->counter);
+    put8(&w, timer->tima);
+    put8(&w, timer->tma);
+    put8(&w, timer->tac);
+
+    put(&w, apu->regs, APU_REGS);
+    for (size_t i = 0; i < APU_CHANNELS; i++) {
+        const struct apu_channel *c = &apu->channels[i];
+        put8(&w, c->on);
+        put8(&w, c->dac);
+        put16(&w, c->length);
+        put8(&w, c->volume);
+        put8(&w, c->envelope);
+    }
+    put16(&w, apu->shadow);
+    put8(&w, apu->sweep);
+    put8(&w, apu->sweeping);
+    put16(&w, apu->sequencer);
+    put8(&w, apu->step);
+
+    put8(&w, joypad->select);
+    put8(&w, joypad->buttons);
+
+    put_ram(&w, cart->ram);
+
+    return w.p - buf;
+}
+
+size_t cgbe_state_save(const struct cgbe *gb, uint8_t *buf, size_t size) {
+    assert(size >= cgbe_state_size(gb));
+
+    size_t written = save(gb, buf, false);
+    assert(written == cgbe_state_size(gb));
+    return written;
+}
+
+bool cgbe_state_load(struct cgbe *gb, const uint8_t *buf, size_t size) {
+    struct sm83 *cpu = gb->cpu;
+    struct cartridge *cart = gb->cart;
+    struct bus *bus = gb->bus;
+    struct ppu *ppu = gb->ppu;
+    struct tima *timer = gb->timer;
+    struct apu *apu = gb->apu;
+    struct joypad *joypad = gb->joypad;
+    struct reader r = {.p = buf};
+
+    if (size < STATE_HEADER_SIZE || memcmp(buf, STATE_MAGIC, 4) != 0) {
+        return false;
+    }
+    r.p += 4;
+    if (get32(&r) != CGBE_STATE_VERSION || get32(&r) != cgbe_state_size(gb) ||
+        size < cgbe_state_size(gb)) {
+        return false;
+    }
+    if (get32(&r) != cart->rom->size || get16(&r) != cart->header->global_checksum ||
+        get8(&r) != cart->mapper) {
+        return false;
+    }
+
+    cpu->regs.af = get16(&r);
+    cpu->regs.bc = get16(&r);
+    cpu->regs.de = get16(&r);
+    cpu->regs.hl = get16(&r);
+    cpu->regs.pc = get16(&r);
+    cpu->regs.sp = get16(&r);
+    cpu->opcode = get8(&r);
+    cpu->tmp.hilo = get16(&r);
+    cpu->m_cycle = get8(&r);
+    cpu->lazy.op = get8(&r);
+    cpu->lazy.x = get8(&r);
+    cpu->lazy.y = get8(&r);
+    cpu->lazy.carry = get8(&r);
+
+    cart->mbc.rom_bank = get16(&r);
+    cart->mbc.ram_bank = get8(&r);
+    cart->mbc.mode = get8(&r);
+    cart->mbc.ram_enabled = get8(&r);
+    get(&r, cart->rtc.regs, RTC_REG_COUNT);
+    get(&r, cart->rtc.latched, RTC_REG_COUNT);
+    cart->rtc.latch = get8(&r);
+    cart->rtc.cycles = get32(&r);
+
+    bus->ie = get8(&r);
+    get(&r, bus->hram, sizeof(bus->hram));
+    get(&r, bus->io, sizeof(bus->io));
+    get_ram(&r, bus->wram);
+
+    ppu->lcdc = get8(&r);
+    ppu->stat = get8(&r);
+    ppu->scy = get8(&r);
+    ppu->scx = get8(&r);
+    ppu->ly = get8(&r);
+    ppu->lyc = get8(&r);
+    ppu->wy = get8(&r);
+    ppu->wx = get8(&r);
+    ppu->vbk = get8(&r);
+    ppu->bcps = get8(&r);
+    ppu->ocps = get8(&r);
+    ppu->dma = get8(&r);
+    ppu->hdma_src = get16(&r);
+    ppu->hdma_dst = get16(&r);
+    ppu->hdma5 = get8(&r);
+    ppu->window_line = get8(&r);
+    ppu->stat_line = get8(&r);
+    ppu->cycle = get32(&r);
+    ppu->frames = get32(&r);
+    get(&r, ppu->palettes, sizeof(ppu->palettes));
+    get(&r, ppu->oam, sizeof(ppu->oam));
+    get_ram(&r, ppu->vram);
+
+    timer->counter = get16(&r);
+    timer->tima = get8(&r);
+    timer->tma = get8(&r);
+    timer->tac = get8(&r);
+
+    get(&r, apu->regs, APU_REGS);
+    for (size_t i = 0; i < APU_CHANNELS; i++) {
+        struct apu_channel *c = &apu->channels[i];
+        c->on = get8(&r);
+        c->dac = get8(&r);
+        c->length = get16(&r);
+        c->volume = get8(&r);
+        c->envelope = get8(&r);
+    }
+    apu->shadow = get16(&r);
+    apu->sweep = get8(&r);
+    apu->sweeping = get8(&r);
+    apu->sequencer = get16(&r);
+    apu->step = get8(&r);
+
+    joypad->select = get8(&r);
+    joypad->buttons = get8(&r);
+
+    get_ram(&r, cart->ram);
+
+    cart->rtc.synced = bus->clock;
+    cartridge_map_banks(cart);
+    bus_map_cartridge(bus);
+    bus_map_wram(bus);
+    ppu_refresh(ppu);
+    tima_refresh(timer);
+    apu_refresh(apu);
+
+    return true;
+}
+
+// Bytes a ram's page hashes, 8 for every page, take up less than its contents.
+static size_t hash_savings(const struct ram *ram) {
+    return ram->size - ram->size / RAM_PAGE_SIZE * sizeof(uint64_t);
+}
+
+uint64_t cgbe_state_hash(struct cgbe *gb) {
+    struct bus *bus = gb->bus;
+
+    // Only pages written to since the last call get hashed again. Hashing shares the pages it
+    // hashes, so anything mapped writable has to be mapped again.
+    if (ram_hash(bus->wram) != 0) {
+        bus_map_wram(bus);
+    }
+    if (ram_hash(gb->ppu->vram) != 0) {
+        ppu_map_vram(gb->ppu);
+    }
+    if (ram_hash(gb->cart->ram) != 0) {
+        bus_map_cartridge(bus);
+    }
+
+    size_t size = cgbe_state_size(gb) - hash_savings(bus->wram) - hash_savings(gb->ppu->vram) -
+                  hash_savings(gb->cart->ram);
+    uint8_t *buf = malloc(size);
+    assert(buf != NULL);
+
+    size_t written = save(gb, buf, true);
+    assert(written == size);
+    uint64_t h = hash_bytes(buf, size);
+
+    free(buf);
+    return h;
+}
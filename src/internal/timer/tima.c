@@ -0,0 +1,139 @@
+#include "internal/timer/tima.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// TIMA counts falling edges of one counter bit, picked by TAC's clock select.
+static const uint8_t clock_bits[4] = {9, 3, 5, 7};
+
+static bool enabled(const struct tima *timer) {
+    return timer->tac & TIMA_TAC_ENABLE;
+}
+
+// Falling edges of the selected bit come once every period t-cycles.
+static uint32_t period(const struct tima *timer) {
+    return UINT32_C(2) << clock_bits[timer->tac & TIMA_TAC_CLOCK];
+}
+
+// The input TIMA counts the falling edges of.
+static bool signal(const struct tima *timer) {
+    return enabled(timer) && (timer->counter & period(timer) / 2);
+}
+
+// Increments TIMA count times, each overflow reloads it from TMA and requests the interrupt.
+static void increment(struct tima *timer, uint64_t count) {
+    uint64_t until = 256 - timer->tima;
+
+    if (count < until) {
+        timer->tima += count;
+        return;
+    }
+    timer->tima = timer->tma + (count - until) % (256 - timer->tma);
+    bus_request_interrupt(timer->bus, BUS_INTERRUPT_TIMER);
+}
+
+// M-cycles until TIMA next overflows, SIZE_MAX while it's stopped.
+static size_t next_overflow(const struct tima *timer) {
+    if (!enabled(timer)) {
+        return SIZE_MAX;
+    }
+
+    uint64_t p = period(timer);
+    uint64_t t_cycles = p - timer->counter % p + (255 - timer->tima) * p;
+    return t_cycles / 4;
+}
+
+static uint8_t reg_read(void *ctx, uint16_t address) {
+    struct tima *timer = ctx;
+
+    tima_sync(timer);
+
+    switch (address) {
+    case 0xFF04: return timer->counter >> 8;
+    case 0xFF05: return timer->tima;
+    case 0xFF06: return timer->tma;
+    case 0xFF07: return 0xF8 | timer->tac;
+    }
+    return 0xFF;
+}
+
+static void reg_write(void *ctx, uint16_t address, uint8_t val) {
+    struct tima *timer = ctx;
+
+    tima_sync(timer);
+
+    bool before = signal(timer);
+
+    switch (address) {
+    case 0xFF04: timer->counter = 0; break;
+    case 0xFF05: timer->tima = val; break;
+    case 0xFF06: timer->tma = val; break;
+    case 0xFF07: timer->tac = val & (TIMA_TAC_ENABLE | TIMA_TAC_CLOCK); break;
+    }
+
+    // Resetting DIV or changing TAC can pull the input low, which counts as an edge.
+    if (before && !signal(timer)) {
+        increment(timer, 1);
+    }
+    tima_tick(timer, 0); // schedules the next overflow again
+}
+
+static void attach(struct tima *timer) {
+    bus_map_io(timer->bus, 0x04, 4, (struct bus_handler){reg_read, reg_write, timer});
+}
+
+struct tima *tima_new(struct bus *bus, struct scheduler *scheduler) {
+    struct tima *timer = malloc(sizeof(struct tima));
+    assert(timer != NULL);
+
+    timer->bus = bus;
+    timer->scheduler = scheduler;
+    timer->counter = 0;
+    timer->tima = 0;
+    timer->tma = 0;
+    timer->tac = 0;
+
+    attach(timer);
+    tima_refresh(timer);
+
+    return timer;
+}
+
+struct tima *tima_fork(const struct tima *timer, struct bus *bus, struct scheduler *scheduler) {
+    struct tima *fork = malloc(sizeof(struct tima));
+    assert(fork != NULL);
+
+    *fork = *timer;
+    fork->bus = bus;
+    fork->scheduler = scheduler;
+
+    attach(fork);
+
+    return fork;
+}
+
+void tima_delete(struct tima *timer) {
+    free(timer);
+}
+
+void tima_tick(struct tima *timer, size_t cycles) {
+    uint64_t t_cycles = 4 * (uint64_t)cycles;
+
+    if (enabled(timer)) {
+        unsigned shift = clock_bits[timer->tac & TIMA_TAC_CLOCK] + 1;
+        uint64_t from = timer->counter;
+
+        increment(timer, ((from + t_cycles) >> shift) - (from >> shift));
+    }
+    timer->counter += t_cycles;
+
+    scheduler_schedule(timer->scheduler, SCHEDULER_TIMER, next_overflow(timer));
+}
+
+void tima_sync(struct tima *timer) {
+    tima_tick(timer, scheduler_sync(timer->scheduler, SCHEDULER_TIMER));
+}
+
+void tima_refresh(struct tima *timer) {
+    scheduler_wake(timer->scheduler, SCHEDULER_TIMER);
+}
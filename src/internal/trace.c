@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 200809L // nanosleep
+
+#include "internal/trace.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MASK_BYTES ((sizeof(struct trace_record) + 7) / 8)
+
+// Encoded records are gathered here and written with one fwrite per chunk.
+#define CHUNK_SIZE (64 * 1024)
+
+// The writer hands ring slots back at least this often, so a full ring frees up quickly.
+#define RELEASE_EVERY 4096
+
+static_assert(sizeof(struct trace_record) <= 64, "the record mask has to fit a uint64_t");
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "ring size must be a power of 2");
+
+// Records are XORed a word at a time, bit 8 * w + i of the mask stands for byte i (counting from
+// the least significant) of word w. Works the same whatever the host's byte order.
+static void to_words(const struct trace_record *record, uint64_t *words) {
+    words[MASK_BYTES - 1] = 0;
+    memcpy(words, record, sizeof(struct trace_record));
+}
+
+// Stores the mask of bytes that differ from prev and the XOR of those bytes, then copies record
+// to prev. Returns the encoded size.
+static size_t encode(const struct trace_record *record, struct trace_record *prev, uint8_t *out) {
+    struct trace_record copy = *record;
+    uint64_t r[MASK_BYTES];
+    uint64_t p[MASK_BYTES];
+    uint64_t mask = 0;
+    size_t n = MASK_BYTES;
+
+    // Slots past the accesses made are whatever an older record left there.
+    for (size_t i = copy.accesses; i < TRACE_MAX_ACCESSES; i++) {
+        copy.access[i] = (struct trace_access){0, 0, 0};
+    }
+    to_words(&copy, r);
+    to_words(prev, p);
+
+    for (size_t w = 0; w < MASK_BYTES; w++) {
+        uint64_t x = r[w] ^ p[w];
+
+        for (size_t i = 0; x != 0; i++, x >>= 8) {
+            uint8_t byte = x;
+
+            // Branchless, zero bytes get stored and then overwritten by the next one.
+            out[n] = byte;
+            n += byte != 0;
+            mask |= (uint64_t)(byte != 0) << (8 * w + i);
+        }
+    }
+    for (size_t i = 0; i < MASK_BYTES; i++) {
+        out[i] = mask >> (8 * i);
+    }
+
+    *prev = copy;
+    return n;
+}
+
+static void flush_chunk(struct trace *trace, const uint8_t *chunk, size_t size) {
+    if (size != 0 && fwrite(chunk, 1, size, trace->out) != size) {
+        perror("trace");
+        exit(1);
+    }
+}
+
+static void *writer_main(void *arg) {
+    struct trace *trace = arg;
+    struct trace_record prev = {0};
+    uint8_t *chunk = malloc(CHUNK_SIZE);
+    assert(chunk != NULL);
+    size_t used = 0;
+    size_t tail = 0;
+
+    for (;;) {
+        // stop is only set after the last head, so seeing it means head is final.
+        bool stop = atomic_load(&trace->stop);
+        size_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+
+        if (tail == head) {
+            if (stop) {
+                break;
+            }
+            nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000}, NULL);
+            continue;
+        }
+
+        while (tail != head) {
+            if (CHUNK_SIZE - used < sizeof(struct trace_record) + MASK_BYTES) {
+                flush_chunk(trace, chunk, used);
+                used = 0;
+            }
+            used += encode(&trace->ring[tail % TRACE_RING_SIZE], &prev, chunk + used);
+            tail++;
+
+            if (tail % RELEASE_EVERY == 0) {
+                atomic_store_explicit(&trace->tail, tail, memory_order_release);
+            }
+        }
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);
+    }
+
+    flush_chunk(trace, chunk, used);
+    free(chunk);
+
+    return NULL;
+}
+
+static void put32(FILE *out, uint32_t val) {
+    uint8_t bytes[4] = {val, val >> 8, val >> 16, val >> 24};
+    fwrite(bytes, 1, 4, out);
+}
+
+static uint32_t get32(FILE *in) {
+    uint8_t bytes[4] = {0};
+
+    if (fread(bytes, 1, 4, in) != 4) {
+        return 0;
+    }
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+struct trace *trace_new(const char *fname) {
+    struct trace *trace = aligned_alloc(alignof(struct trace), sizeof(struct trace));
+    assert(trace != NULL);
+
+    trace->out = fopen(fname, "wb");
+    if (trace->out == NULL) {
+        perror(fname);
+        exit(1);
+    }
+    fwrite(TRACE_MAGIC, 1, 4, trace->out);
+    put32(trace->out, TRACE_VERSION);
+    put32(trace->out, sizeof(struct trace_record));
+
+    trace->ring = malloc(TRACE_RING_SIZE * sizeof(struct trace_record));
+    assert(trace->ring != NULL);
+
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    trace->next = 0;
+    trace->cached_tail = 0;
+    trace->current = NULL;
+    atomic_init(&trace->stop, false);
+
+    int err = pthread_create(&trace->writer, NULL, writer_main, trace);
+    assert(err == 0);
+
+    return trace;
+}
+
+void trace_delete(struct trace *trace) {
+    if (trace == NULL) {
+        return;
+    }
+
+    if (trace->current != NULL) {
+        trace->next++;
+    }
+    atomic_store_explicit(&trace->head, trace->next, memory_order_release);
+    atomic_store(&trace->stop, true);
+    pthread_join(trace->writer, NULL);
+
+    if (fclose(trace->out) != 0) {
+        perror("trace");
+        exit(1);
+    }
+    free(trace->ring);
+    free(trace);
+}
+
+void trace_sync(struct trace *trace) {
+    atomic_store_explicit(&trace->head, trace->next, memory_order_release);
+
+    while (trace->next - trace->cached_tail == TRACE_RING_SIZE) {
+        trace->cached_tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+        if (trace->next - trace->cached_tail == TRACE_RING_SIZE) {
+            sched_yield();
+        }
+    }
+}
+
+bool trace_read_header(FILE *in) {
+    char magic[4];
+
+    if (fread(magic, 1, 4, in) != 4 || memcmp(magic, TRACE_MAGIC, 4) != 0) {
+        return false;
+    }
+    return get32(in) == TRACE_VERSION && get32(in) == sizeof(struct trace_record);
+}
+
+bool trace_read(FILE *in, struct trace_record *record) {
+    uint8_t bytes[MASK_BYTES];
+    uint64_t words[MASK_BYTES];
+    uint64_t mask = 0;
+
+    if (fread(bytes, 1, MASK_BYTES, in) != MASK_BYTES) {
+        return false;
+    }
+    for (size_t i = 0; i < MASK_BYTES; i++) {
+        mask |= (uint64_t)bytes[i] << (8 * i);
+    }
+
+    to_words(record, words);
+    for (size_t i = 0; i < 8 * MASK_BYTES; i++) {
+        if (mask & ((uint64_t)1 << i)) {
+            int c = fgetc(in);
+            if (c == EOF) {
+                return false;
+            }
+            words[i / 8] ^= (uint64_t)c << (8 * (i % 8));
+        }
+    }
+    memcpy(record, words, sizeof(struct trace_record));
+
+    return true;
+}
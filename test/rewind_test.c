@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L // mkstemp
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internal/rewind.h"
+
+// Checks that every frame in a rewind ring restores to exactly the state that was pushed, as
+// cgbe_state_save sees it, while the ring wraps and evicts. The rom increments its way through
+// cart ram, wram and vram, so frames differ by however long the machine ran in between. Frames
+// pushed without running (restore(0) then push, as run-ahead does) are empty deltas, which the
+// ring has to keep apart from the frames around them.
+
+#define FRAMES 256 // ring size, in frames
+#define STEPS 4000
+#define MAX_FRAME_CYCLES 3000
+
+// Enables cart ram, then forever increments every byte of A000-BFFF, C000-DEFF and 8000-9FFF.
+static const uint8_t code[] = {
+    0x3E, 0x0A, 0xEA, 0x00, 0x00,                   // ld a, 0x0A; ld [0x0000], a
+    0x21, 0x00, 0xA0,                               // ld hl, 0xA000
+    0x34, 0x23, 0x7C, 0xFE, 0xC0, 0x20, 0xF9,       // inc [hl]; inc hl; cp 0xC0 on h; jr nz
+    0x21, 0x00, 0xC0,                               // ld hl, 0xC000
+    0x34, 0x23, 0x7C, 0xFE, 0xDF, 0x20, 0xF9,       // same up to 0xDF00
+    0x21, 0x00, 0x80,                               // ld hl, 0x8000
+    0x34, 0x23, 0x7C, 0xFE, 0xA0, 0x20, 0xF9, 0x18, // same up to 0xA000
+    0xE0,                                           // jr back to the first ld hl
+};
+
+// States pushed, refs[pushed % FRAMES] is the next one's.
+static uint8_t *refs[FRAMES];
+static size_t pushed;
+
+static uint32_t seed = 1;
+
+// xorshift32, so every host runs the same frames.
+static uint32_t random32(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// Writes the rom to a temporary file named after the mkstemp template in path.
+static void write_rom(char *path) {
+    uint8_t *rom = calloc(2, CARTRIDGE_ROM_BANK_SIZE);
+    assert(rom != NULL);
+
+    rom[0x0100] = 0xC3; // jp 0x0150
+    rom[0x0101] = 0x50;
+    rom[0x0102] = 0x01;
+    rom[0x0147] = 0x03; // MBC1+RAM+BATTERY
+    rom[0x0149] = 0x02; // 8 KiB
+    memcpy(&rom[0x0150], code, sizeof(code));
+
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    ssize_t written = write(fd, rom, 2 * CARTRIDGE_ROM_BANK_SIZE);
+    assert(written == 2 * CARTRIDGE_ROM_BANK_SIZE);
+    close(fd);
+    free(rom);
+}
+
+static void push(struct rewind *rw, struct cgbe *gb) {
+    rewind_push(rw, gb);
+    cgbe_state_save(gb, refs[pushed % FRAMES], rw->state_size);
+    pushed++;
+}
+
+// Restores the frame back frames before the newest, returns whether it's the state pushed then.
+static bool restore(struct rewind *rw, struct cgbe *gb, size_t back, uint8_t *buf) {
+    rewind_restore(rw, gb, back);
+    pushed -= back;
+    cgbe_state_save(gb, buf, rw->state_size);
+    return memcmp(buf, refs[(pushed - 1) % FRAMES], rw->state_size) == 0;
+}
+
+// Walks back through every frame in the ring, oldest last, returns how many were wrong.
+static size_t check_all(struct rewind *rw, struct cgbe *gb, uint8_t *buf) {
+    size_t wrong = !restore(rw, gb, 0, buf);
+
+    while (rw->count > 1) {
+        wrong += !restore(rw, gb, 1, buf);
+    }
+    return wrong;
+}
+
+// Bytes a keyframe of the machine's current state takes.
+static size_t keyframe_size(struct cgbe *gb) {
+    struct rewind *rw = rewind_new(gb, 1, 2 * cgbe_state_size(gb));
+
+    rewind_push(rw, gb);
+    size_t size = rw->frames[0].size;
+    rewind_delete(rw);
+    return size;
+}
+
+// With room for exactly two keyframes, the third wraps to the start of buf and ends right where
+// the oldest frame starts. An empty frame pushed then mustn't make the ring look unwrapped, or the
+// next frame is written over the oldest keyframe.
+static size_t check_exact_wrap(struct cgbe *gb, uint8_t *buf) {
+    struct rewind *rw = rewind_new(gb, FRAMES, 2 * keyframe_size(gb));
+
+    pushed = 0;
+    for (size_t i = 0; i < 2 * REWIND_KEYFRAME_INTERVAL + 1; i++) {
+        push(rw, gb);
+    }
+    rewind_restore(rw, gb, 0);
+    push(rw, gb);
+    cgbe_run(gb, 100);
+    push(rw, gb);
+
+    size_t wrong = check_all(rw, gb, buf);
+    rewind_delete(rw);
+    return wrong;
+}
+
+// Frames of random lengths in a ring a few states big, with restores in between.
+static size_t check_random(struct cgbe *gb, uint8_t *buf) {
+    struct rewind *rw = rewind_new(gb, FRAMES, 3 * cgbe_state_size(gb));
+    size_t wrong = 0;
+
+    pushed = 0;
+    push(rw, gb);
+    for (size_t i = 0; i < STEPS; i++) {
+        switch (random32() % 8) {
+        case 0: rewind_restore(rw, gb, 0); break;
+        case 1: wrong += !restore(rw, gb, random32() % rw->count, buf); break;
+        default: cgbe_run(gb, random32() % MAX_FRAME_CYCLES); break;
+        }
+        push(rw, gb);
+    }
+
+    wrong += check_all(rw, gb, buf);
+    rewind_delete(rw);
+    return wrong;
+}
+
+int main(void) {
+    char path[] = "/tmp/cgbe-rewind-test-XXXXXX";
+    write_rom(path);
+    struct cgbe *gb = cgbe_new(path);
+    unlink(path);
+
+    size_t size = cgbe_state_size(gb);
+    uint8_t *buf = malloc(size);
+    assert(buf != NULL);
+    for (size_t i = 0; i < FRAMES; i++) {
+        refs[i] = malloc(size);
+        assert(refs[i] != NULL);
+    }
+
+    // Dirty every page first, so keyframes aren't mostly zeros.
+    cgbe_run(gb, 1 << 17);
+
+    size_t exact = check_exact_wrap(gb, buf);
+    size_t random = check_random(gb, buf);
+    printf("%s: %zu wrong frames after an exact wrap, %zu after random frames\n",
+           exact + random == 0 ? "ok" : "FAILED", exact, random);
+
+    for (size_t i = 0; i < FRAMES; i++) {
+        free(refs[i]);
+    }
+    free(buf);
+    cgbe_delete(gb);
+    return exact + random == 0 ? 0 : 1;
+}
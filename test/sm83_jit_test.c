@@ -0,0 +1,303 @@
+#define _POSIX_C_SOURCE 200809L // mkstemp
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internal/memory/bus.h"
+#include "internal/sm83/sm83.h"
+#include "internal/sm83/sm83_jit.h"
+
+// Checks sm83_jit_run against sm83_step on a generated MBC1 rom: flag heavy ALU runs, CB ops on
+// registers and wram, conditional branches, stores to io registers and hram, and calls into
+// routines in the other rom banks after switching to them. The jitted core runs a block at a
+// time, after every block the stepped core is brought up to the same clock and both have to
+// agree on their registers, the clock and memory.
+
+#define BANKS 4
+#define ROUTINES 16 // per switchable bank
+#define ROUTINE_SIZE 0x100
+#define CODE_END 0x3F00 // bank 0 code stays below this
+#define CYCLES (1 << 20)
+#define STACK 0xDFF0
+
+struct side {
+    struct cartridge *cart;
+    struct bus *bus;
+    struct sm83 *cpu;
+};
+
+struct writer {
+    uint8_t *rom;
+    size_t pos;
+};
+
+static uint32_t seed = 1;
+
+// xorshift32, so every host generates the same rom.
+static uint32_t random32(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// Single byte instructions that only touch registers, skipping those that involve (hl) or sp.
+static bool alu1(uint8_t op) {
+    uint8_t x = op >> 6, y = op >> 3 & 0x07, z = op & 0x07;
+
+    switch (x) {
+    case 0: return ((z == 4 || z == 5) && y != 6) || z == 7 || (op & 0x0F) == 0x09 ||
+                   (z == 3 && op < 0x30);
+    case 1: return y != 6 && z != 6;
+    case 2: return z != 6;
+    default: return false;
+    }
+}
+
+static uint8_t random_alu1(void) {
+    for (;;) {
+        uint8_t op = random32();
+
+        if (alu1(op)) {
+            return op;
+        }
+    }
+}
+
+static void emit(struct writer *w, uint8_t byte) { w->rom[w->pos++] = byte; }
+
+static void emit16(struct writer *w, uint16_t val) {
+    emit(w, val % 256);
+    emit(w, val / 256);
+}
+
+// Register only ALU ops, some of them with an immediate operand.
+static void emit_alu(struct writer *w, size_t count) {
+    static const uint8_t imm_ops[] = {0x06, 0x0E, 0x16, 0x1E, 0x26, 0x2E, 0x3E, 0xC6,
+                                      0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE};
+
+    for (size_t i = 0; i < count; i++) {
+        if (random32() % 4 == 0) {
+            emit(w, imm_ops[random32() % sizeof(imm_ops)]);
+            emit(w, random32());
+        } else {
+            emit(w, random_alu1());
+        }
+    }
+}
+
+// CB ops of every kind, with hl pointing into wram for the (hl) ones. Only BIT may use h or l,
+// anything else could move hl out of wram.
+static void emit_cb(struct writer *w, size_t count) {
+    emit(w, 0x21); // ld hl, imm16
+    emit16(w, 0xC000 + random32() % 0x1000);
+    for (size_t i = 0; i < count; i++) {
+        uint8_t op = random32();
+
+        while ((op >> 6) != 1 && ((op & 0x07) == 4 || (op & 0x07) == 5)) {
+            op = random32();
+        }
+        emit(w, 0xCB);
+        emit(w, op);
+    }
+}
+
+// A compare and a conditional jump over some ALU ops.
+static void emit_branch(struct writer *w) {
+    static const uint8_t jumps[] = {0x20, 0x28, 0x30, 0x38};
+    size_t count = 1 + random32() % 12;
+
+    emit(w, 0xFE); // cp imm8
+    emit(w, random32());
+    emit(w, jumps[random32() % sizeof(jumps)]);
+    emit(w, count);
+    for (size_t i = 0; i < count; i++) {
+        emit(w, random_alu1());
+    }
+}
+
+// Stores to io registers nobody claimed and to hram, through every addressing mode.
+static void emit_io(struct writer *w) {
+    static const uint8_t regs[] = {0x01, 0x02, 0x42, 0x43, 0x4C, 0x80, 0x9A, 0xC3, 0xFE};
+    uint8_t reg = regs[random32() % sizeof(regs)];
+
+    emit(w, 0x3E); // ld a, imm8
+    emit(w, random32());
+    switch (random32() % 3) {
+    case 0:
+        emit(w, 0xE0); // ldh [imm8], a
+        emit(w, reg);
+        break;
+    case 1:
+        emit(w, 0x0E); // ld c, imm8
+        emit(w, reg);
+        emit(w, 0xE2); // ld [c], a
+        break;
+    case 2:
+        emit(w, 0xEA); // ld [imm16], a
+        emit16(w, 0xFF00 + reg);
+        break;
+    }
+    emit(w, 0xF0); // ldh a, [imm8]
+    emit(w, reg);
+}
+
+// Stores to wram, then a push and pop through the stack.
+static void emit_store(struct writer *w) {
+    static const uint8_t stores[] = {0x77, 0x22, 0x32, 0x34, 0x35, 0x70, 0x71, 0x72};
+
+    emit(w, 0x21); // ld hl, imm16
+    emit16(w, 0xC000 + random32() % 0x1000);
+    for (size_t i = 0, count = 1 + random32() % 4; i < count; i++) {
+        emit(w, stores[random32() % sizeof(stores)]);
+    }
+    emit(w, 0xC5 + random32() % 4 * 0x10); // push bc/de/hl/af
+    emit(w, 0xC1 + random32() % 3 * 0x10); // pop bc/de/hl
+}
+
+// Switches to a bank and calls one of its routines.
+static void emit_call(struct writer *w) {
+    emit(w, 0x3E); // ld a, imm8
+    emit(w, 1 + random32() % (BANKS - 1));
+    emit(w, 0xEA); // ld [0x2000], a
+    emit16(w, 0x2000);
+    emit(w, 0xCD); // call imm16
+    emit16(w, 0x4000 + random32() % ROUTINES * ROUTINE_SIZE);
+}
+
+static void emit_segment(struct writer *w, bool calls) {
+    switch (random32() % (calls ? 6 : 5)) {
+    case 0: emit_alu(w, 4 + random32() % 20); break;
+    case 1: emit_cb(w, 1 + random32() % 12); break;
+    case 2: emit_branch(w); break;
+    case 3: emit_io(w); break;
+    case 4: emit_store(w); break;
+    case 5: emit_call(w); break;
+    }
+}
+
+// Writes the rom to a temporary file named after the mkstemp template in path.
+static void write_rom(char *path) {
+    uint8_t *rom = calloc(BANKS, CARTRIDGE_ROM_BANK_SIZE);
+    assert(rom != NULL);
+
+    struct writer w = {.rom = rom, .pos = 0x0100};
+    emit(&w, 0xC3); // jp 0x0150
+    emit16(&w, 0x0150);
+    rom[0x0147] = 0x01; // MBC1
+    rom[0x0148] = 0x01; // 4 banks
+
+    w.pos = 0x0150;
+    emit(&w, 0x31); // ld sp, imm16
+    emit16(&w, STACK);
+    while (w.pos < CODE_END - 64) {
+        emit_segment(&w, true);
+    }
+    emit(&w, 0xC3); // jp 0x0153
+    emit16(&w, 0x0153);
+
+    for (size_t bank = 1; bank < BANKS; bank++) {
+        for (size_t i = 0; i < ROUTINES; i++) {
+            size_t start = bank * CARTRIDGE_ROM_BANK_SIZE + i * ROUTINE_SIZE;
+
+            w.pos = start;
+            for (size_t j = 0; j < 3; j++) {
+                emit_segment(&w, false);
+            }
+            emit(&w, 0xC9); // ret
+            assert(w.pos - start <= ROUTINE_SIZE);
+        }
+    }
+
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    ssize_t written = write(fd, rom, BANKS * CARTRIDGE_ROM_BANK_SIZE);
+    assert(written == BANKS * CARTRIDGE_ROM_BANK_SIZE);
+    close(fd);
+    free(rom);
+}
+
+static void side_init(struct side *side, const char *path) {
+    side->cart = cartridge_new(path);
+    side->bus = bus_new(side->cart);
+    side->cpu = sm83_new(side->bus);
+    side->cpu->opcode = bus_read(side->bus, 0x0100);
+    side->cpu->regs.pc = 0x0101;
+}
+
+static void side_delete(struct side *side) {
+    sm83_delete(side->cpu);
+    bus_delete(side->bus);
+    cartridge_delete(side->cart);
+}
+
+static bool same_memory(const struct side *a, const struct side *b) {
+    static uint8_t wram_a[0x2000], wram_b[0x2000];
+
+    ram_save(a->bus->wram, wram_a);
+    ram_save(b->bus->wram, wram_b);
+    return memcmp(wram_a, wram_b, sizeof(wram_a)) == 0 &&
+           memcmp(a->bus->hram, b->bus->hram, sizeof(a->bus->hram)) == 0 &&
+           memcmp(a->bus->io, b->bus->io, sizeof(a->bus->io)) == 0 && a->bus->ie == b->bus->ie;
+}
+
+static void print_cpu(const char *name, const struct side *side) {
+    const struct sm83_register_file *r = &side->cpu->regs;
+
+    printf("  %-4s clock=%llu bank=%u af=%04X bc=%04X de=%04X hl=%04X sp=%04X pc=%04X\n", name,
+           (unsigned long long)side->bus->clock, cartridge_rom_bank(side->cart, 0x4000), r->af,
+           r->bc, r->de, r->hl, r->sp, r->pc);
+}
+
+int main(void) {
+    struct sm83_jit *jit = sm83_jit_new();
+    if (jit == NULL) {
+        printf("skipped: the jit isn't supported on this host\n");
+        return 0;
+    }
+
+    char path[] = "/tmp/cgbe-jit-test-XXXXXX";
+    write_rom(path);
+
+    struct side j, s;
+    side_init(&j, path);
+    side_init(&s, path);
+    unlink(path);
+
+    size_t blocks = 0, switches = 0;
+    uint16_t bank = cartridge_rom_bank(j.cart, 0x4000);
+    bool agree = true;
+
+    while (agree && j.bus->clock < CYCLES) {
+        struct sm83_register_file before = j.cpu->regs;
+
+        sm83_jit_run(j.cpu, jit, 1);
+        while (s.bus->clock < j.bus->clock) {
+            sm83_step(s.cpu);
+        }
+        blocks++;
+
+        if (cartridge_rom_bank(j.cart, 0x4000) != bank) {
+            bank = cartridge_rom_bank(j.cart, 0x4000);
+            switches++;
+        }
+
+        agree = j.bus->clock == s.bus->clock && j.cpu->opcode == s.cpu->opcode &&
+                memcmp(&j.cpu->regs, &s.cpu->regs, sizeof(j.cpu->regs)) == 0 && same_memory(&j, &s);
+        if (!agree) {
+            printf("block %zu from pc=%04X disagrees\n", blocks, (uint16_t)(before.pc - 1));
+            print_cpu("jit", &j);
+            print_cpu("step", &s);
+        }
+    }
+
+    printf("%s: %zu blocks, %zu bank switches\n", agree ? "ok" : "FAILED", blocks, switches);
+
+    side_delete(&j);
+    side_delete(&s);
+    sm83_jit_delete(jit);
+    return agree ? 0 : 1;
+}
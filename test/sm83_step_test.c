@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal/memory/bus.h"
+#include "internal/sm83/sm83.h"
+
+// Checks sm83_step against sm83_m_cycle: a core and a fork of it start from the same random
+// registers and memory, one is driven a machine cycle at a time and the other an instruction at a
+// time, and both have to end up with the same registers, take the same number of m-cycles and
+// write the same bytes to the same addresses in the same order. Every opcode and every CB opcode
+// is run from TRIALS random starting points, along with the instructions that follow it.
+
+#define TRIALS 64
+#define FOLLOWING 3 // instructions run after the one under test, if they can be
+#define MAX_WRITES 16
+#define MAX_M_CYCLES 6
+
+struct side {
+    struct bus *bus;
+    struct sm83 *cpu;
+    uint8_t mem[0x10000];
+    uint16_t addresses[MAX_WRITES];
+    uint8_t vals[MAX_WRITES];
+    size_t writes;
+};
+
+// Opcodes the core doesn't implement yet and exits on. The ones that don't exist are tested like
+// any other, both cores have to loop on them in place: same pc, same opcode fetched again, one
+// m-cycle each.
+static const uint8_t skipped[] = {0x10, 0x76, 0xD9, 0xF3, 0xFB};
+
+static uint32_t seed = 1;
+
+// xorshift32, so every host runs the same cases.
+static uint32_t random32(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static bool is_skipped(uint8_t opcode) {
+    return memchr(skipped, opcode, sizeof(skipped)) != NULL;
+}
+
+static uint8_t mem_read(void *ctx, uint16_t address) { return ((struct side *)ctx)->mem[address]; }
+
+static void mem_write(void *ctx, uint16_t address, uint8_t val) {
+    struct side *side = ctx;
+
+    side->mem[address] = val;
+    if (side->writes < MAX_WRITES) {
+        side->addresses[side->writes] = address;
+        side->vals[side->writes] = val;
+    }
+    side->writes++;
+}
+
+// All of memory goes through the handler, so every write gets recorded.
+static void side_init(struct side *side) {
+    side->bus = bus_new(NULL);
+    side->writes = 0;
+    bus_map_handler(side->bus, 0x0000, 0x10000, (struct bus_handler){mem_read, mem_write, side});
+}
+
+static bool same_writes(const struct side *a, const struct side *b) {
+    size_t n = a->writes < MAX_WRITES ? a->writes : MAX_WRITES;
+
+    return a->writes == b->writes && memcmp(a->addresses, b->addresses, n * 2) == 0 &&
+           memcmp(a->vals, b->vals, n) == 0;
+}
+
+static void print_cpu(const char *name, const struct sm83 *cpu) {
+    const struct sm83_register_file *r = &cpu->regs;
+
+    printf("  %-7s af=%04X bc=%04X de=%04X hl=%04X sp=%04X pc=%04X opcode=%02X\n", name, r->af,
+           r->bc, r->de, r->hl, r->sp, r->pc, cpu->opcode);
+}
+
+// Runs one trial of opcode (prefixed by 0xCB with cb), returns whether both cores agreed.
+static bool trial(struct side *m, struct side *s, uint8_t opcode, bool cb) {
+    for (size_t i = 0; i < 0x10000; i++) {
+        m->mem[i] = random32();
+    }
+
+    uint16_t pc = random32();
+    m->mem[pc] = cb ? 0xCB : opcode;
+    if (cb) {
+        m->mem[(uint16_t)(pc + 1)] = opcode;
+    }
+    memcpy(s->mem, m->mem, sizeof(m->mem));
+    m->writes = s->writes = 0;
+
+    m->cpu->regs = (struct sm83_register_file){
+        .af = random32() & 0xFFF0,
+        .bc = random32(),
+        .de = random32(),
+        .hl = random32(),
+        .sp = random32(),
+        .pc = pc + 1,
+    };
+    m->cpu->opcode = m->mem[pc];
+    m->cpu->lazy.op = SM83_LAZY_NONE;
+    m->cpu->m_cycle = 0;
+    s->cpu->regs = m->cpu->regs;
+    s->cpu->opcode = m->cpu->opcode;
+    s->cpu->lazy = m->cpu->lazy;
+    s->cpu->m_cycle = 0;
+
+    for (size_t insn = 0; insn <= FOLLOWING; insn++) {
+        uint8_t current = s->cpu->opcode;
+        size_t stepped = sm83_step(s->cpu);
+        size_t cycles = 0;
+
+        do {
+            sm83_m_cycle(m->cpu);
+            cycles++;
+        } while (m->cpu->m_cycle != 0 && cycles < MAX_M_CYCLES);
+        sm83_sync_flags(m->cpu);
+
+        if (cycles != stepped || m->cpu->opcode != s->cpu->opcode ||
+            memcmp(&m->cpu->regs, &s->cpu->regs, sizeof(m->cpu->regs)) != 0 ||
+            !same_writes(m, s)) {
+            printf("%s%02X, instruction %zu (%02X): m-cycles %zu, step %zu, writes %zu and %zu\n",
+                   cb ? "CB " : "", opcode, insn, current, cycles, stepped, m->writes, s->writes);
+            print_cpu("m-cycle", m->cpu);
+            print_cpu("step", s->cpu);
+            return false;
+        }
+        if (is_skipped(s->cpu->opcode)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+int main(void) {
+    struct side *m = malloc(sizeof(struct side)), *s = malloc(sizeof(struct side));
+    size_t failures = 0;
+
+    side_init(m);
+    side_init(s);
+    m->cpu = sm83_new(m->bus);
+    s->cpu = sm83_fork(m->cpu, s->bus);
+
+    for (size_t op = 0; op < 256; op++) {
+        for (size_t i = 0; i < TRIALS && !is_skipped(op); i++) {
+            if (!trial(m, s, op, false)) {
+                failures++;
+                break;
+            }
+        }
+        for (size_t i = 0; i < TRIALS; i++) {
+            if (!trial(m, s, op, true)) {
+                failures++;
+                break;
+            }
+        }
+    }
+
+    printf("%s: %zu opcodes disagree\n", failures == 0 ? "ok" : "FAILED", failures);
+
+    sm83_delete(m->cpu);
+    sm83_delete(s->cpu);
+    bus_delete(m->bus);
+    bus_delete(s->bus);
+    free(m);
+    free(s);
+    return failures == 0 ? 0 : 1;
+}